@@ -1143,8 +1143,8 @@ static void load_symbols(struct elfhdr *hdr, int fd)
     s->disas_symtab.elf64 = syms;
     s->lookup_symbol = (lookup_symbol_t)lookup_symbolxx;
 #endif
-    s->next = syminfos;
-    syminfos = s;
+    s->filename = NULL;
+    syminfo_register(s, ELF_CLASS);
 }
 
 int load_elf_binary(struct linux_binprm * bprm, struct target_pt_regs * regs,
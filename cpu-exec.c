@@ -21,7 +21,12 @@
 #include "disas/disas.h"
 #include "tcg.h"
 #include "qemu/atomic.h"
+#include "qemu/timer.h"
 #include "sysemu/qtest.h"
+#include "exec/helper-proto.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "qemu/main-loop.h"
+#endif
 
 void cpu_loop_exit(CPUState *cpu)
 {
@@ -111,58 +116,102 @@ static void cpu_exec_nocache(CPUArchState *env, int max_cycles,
     tb_free(tb);
 }
 
+/* Key of a TB in tb_ctx.htable, see tb_cmp().  */
+struct tb_desc {
+    target_ulong pc;
+    target_ulong cs_base;
+    CPUArchState *env;
+    tb_page_addr_t phys_page1;
+    uint64_t flags;
+};
+
+static bool tb_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const struct tb_desc *desc = d;
+
+    if (tb->pc == desc->pc &&
+        tb->page_addr[0] == desc->phys_page1 &&
+        tb->cs_base == desc->cs_base &&
+        tb->flags == desc->flags) {
+        /* check next page if needed */
+        if (tb->page_addr[1] == -1) {
+            return true;
+        } else {
+            tb_page_addr_t phys_page2;
+            target_ulong virt_page2;
+
+            virt_page2 = (desc->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+            phys_page2 = get_page_addr_code(desc->env, virt_page2);
+            if (tb->page_addr[1] == phys_page2) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static TranslationBlock *tb_find_physical(CPUArchState *env,
+                                          target_ulong pc,
+                                          target_ulong cs_base,
+                                          uint64_t flags)
+{
+    tb_page_addr_t phys_pc;
+    struct tb_desc desc;
+    uint32_t h;
+
+    desc.env = env;
+    desc.pc = pc;
+    desc.cs_base = cs_base;
+    desc.flags = flags;
+
+    phys_pc = get_page_addr_code(env, pc);
+    desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    h = tb_hash_func(phys_pc, pc, flags, cs_base);
+    return qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
+}
+
 static TranslationBlock *tb_find_slow(CPUArchState *env,
                                       target_ulong pc,
                                       target_ulong cs_base,
                                       uint64_t flags)
 {
     CPUState *cpu = ENV_GET_CPU(env);
-    TranslationBlock *tb, **ptb1;
-    unsigned int h;
-    tb_page_addr_t phys_pc, phys_page1;
-    target_ulong virt_page2;
+    TranslationBlock *tb;
+#ifdef CONFIG_PROFILER
+    int64_t ti = profile_getclock();
+#endif
 
     tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
 
     /* find translated block using physical mappings */
-    phys_pc = get_page_addr_code(env, pc);
-    phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_phys_hash_func(phys_pc);
-    ptb1 = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    for(;;) {
-        tb = *ptb1;
-        if (!tb)
-            goto not_found;
-        if (tb->pc == pc &&
-            tb->page_addr[0] == phys_page1 &&
-            tb->cs_base == cs_base &&
-            tb->flags == flags) {
-            /* check next page if needed */
-            if (tb->page_addr[1] != -1) {
-                tb_page_addr_t phys_page2;
-
-                virt_page2 = (pc & TARGET_PAGE_MASK) +
-                    TARGET_PAGE_SIZE;
-                phys_page2 = get_page_addr_code(env, virt_page2);
-                if (tb->page_addr[1] == phys_page2)
-                    goto found;
-            } else {
-                goto found;
-            }
+    tb = tb_find_physical(env, pc, cs_base, flags);
+#ifdef CONFIG_PROFILER
+    tcg_ctx.tb_lookup_count++;
+    tcg_ctx.tb_lookup_time += profile_getclock() - ti;
+#endif
+    if (!tb) {
+#if !defined(CONFIG_USER_ONLY)
+        /* translating may fill the TLB, which needs the iothread lock:
+           it must be taken before tb_lock */
+        bool iothread_locked = qemu_tcg_lock_iothread();
+#endif
+
+        tb_lock();
+        /* another vCPU thread may have translated it meanwhile */
+        tb = tb_find_physical(env, pc, cs_base, flags);
+        if (!tb) {
+            /* if no translated code available, then translate it now */
+            tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
         }
-        ptb1 = &tb->phys_hash_next;
-    }
- not_found:
-   /* if no translated code available, then translate it now */
-    tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
-
- found:
-    /* Move the last found TB to the head of the list */
-    if (likely(*ptb1)) {
-        *ptb1 = tb->phys_hash_next;
-        tb->phys_hash_next = tcg_ctx.tb_ctx.tb_phys_hash[h];
-        tcg_ctx.tb_ctx.tb_phys_hash[h] = tb;
+        tb_unlock();
+#if !defined(CONFIG_USER_ONLY)
+        if (iothread_locked) {
+            qemu_mutex_unlock_iothread();
+        }
+#endif
     }
+
     /* we add the TB in the virtual pc hash table */
     cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
     return tb;
@@ -187,6 +236,127 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
     return tb;
 }
 
+/* Superblocks.  With tb_hot_threshold, the TBs are first translated
+ * cold, and only run from cpu_exec: it counts how many times each one
+ * runs, and by which goto_tb slot each one exits.  A TB that gets hot is
+ * translated again with CF_SUPERBLOCK, and replaces the cold one.  The
+ * frontend then goes on translating across the direct jumps forward in
+ * the page, and across the conditional branches that the cold TBs mostly
+ * left the same way, the other way becoming a side exit.  The optimizer
+ * and the register allocator see the whole superblock: the constants,
+ * the flags computed but overwritten and the globals kept in registers
+ * are no longer lost at each jump.  Only the superblocks are chained.
+ */
+
+/* follow a conditional branch taken at least 7 times out of 8, out of
+   this many exits of the cold TB */
+#define TB_TRACE_MIN_EXITS 16
+
+/* Called while translating the superblock "tb": return the goto_tb slot
+   whose target to follow at its conditional branch number "n", which
+   ends the cold TB at "block_pc", or -1 to end the superblock there.
+   The choices are recorded in tb->trace, for the retranslations of
+   cpu_restore_state ("search_pc") to make the same.  */
+int tb_trace_branch(CPUArchState *env, TranslationBlock *tb, int n,
+                    target_ulong block_pc, bool search_pc)
+{
+    TranslationBlock *cold;
+    uint32_t total;
+    int slot;
+
+    if (n >= TB_TRACE_MAX_BRANCHES) {
+        return -1;
+    }
+    if (search_pc) {
+        return ((tb->trace >> (n * 2)) & 3) - 1;
+    }
+
+    cold = tb_find_physical(env, block_pc, tb->cs_base, tb->flags);
+    if (!cold || (cold->cflags & CF_SUPERBLOCK)) {
+        return -1;
+    }
+    total = cold->exit_count[0] + cold->exit_count[1];
+    slot = cold->exit_count[1] > cold->exit_count[0];
+    if (total < TB_TRACE_MIN_EXITS ||
+        cold->exit_count[slot] < total - total / 8) {
+        return -1;
+    }
+    tb->trace |= (uint32_t)(slot + 1) << (n * 2);
+    return slot;
+}
+
+/* Count a run of the cold TB "tb" from cpu_exec, and return the
+   superblock to run instead once it is hot.  The counters are not
+   atomic: with -tcg-threads multi, they are approximate.  */
+static TranslationBlock *tb_count_run(CPUArchState *env, TranslationBlock *tb)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *hot;
+    int flush_count;
+#if !defined(CONFIG_USER_ONLY)
+    bool iothread_locked;
+#endif
+
+    if (++tb->exec_count < tb_hot_threshold) {
+        return tb;
+    }
+
+#if !defined(CONFIG_USER_ONLY)
+    /* see tb_find_slow */
+    iothread_locked = qemu_tcg_lock_iothread();
+#endif
+    tb_lock();
+    flush_count = tcg_ctx.tb_ctx.tb_flush_count;
+    /* another vCPU thread may have done it meanwhile */
+    hot = tb_find_physical(env, tb->pc, tb->cs_base, tb->flags);
+    if (!hot || !(hot->cflags & CF_SUPERBLOCK)) {
+        hot = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, CF_SUPERBLOCK);
+        /* The cold TB stays in the translation buffer, and is still found
+           by tb_find_pc for the vCPUs that may be running it, unless
+           translating flushed or evicted it first.  */
+        if (tcg_ctx.tb_ctx.tb_flush_count == flush_count && hot != tb) {
+            tb_phys_invalidate(tb, -1);
+        }
+    }
+    tb_unlock();
+#if !defined(CONFIG_USER_ONLY)
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
+#endif
+
+    cpu->tb_jmp_cache[tb_jmp_cache_hash_func(hot->pc)] = hot;
+    return hot;
+}
+
+/* Called by the code generated for goto_ptr: return the host code of
+   the TB to run next if tb_find_fast would find it, or else the
+   epilogue, which goes back to cpu_exec and its slow path.  Lookups
+   done here never translate, so they never raise exceptions.  */
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    /* the runs of the cold TBs are counted by cpu_exec */
+    if (unlikely(tb_hot_threshold) && !(tb->cflags & CF_SUPERBLOCK)) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    if (qemu_loglevel_mask(CPU_LOG_EXEC)) {
+        qemu_log("Trace %p [" TARGET_FMT_lx "] %s\n",
+                 tb->tc_ptr, tb->pc, lookup_symbol(tb->pc));
+    }
+    return tb->tc_ptr;
+}
+
 static CPUDebugExcpHandler *debug_excp_handler;
 
 void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler)
@@ -227,8 +397,6 @@ int cpu_exec(CPUArchState *env)
     TranslationBlock *tb;
     uint8_t *tc_ptr;
     uintptr_t next_tb;
-    /* This must be volatile so it is not trashed by longjmp() */
-    volatile bool have_tb_lock = false;
 
     if (cpu->halted) {
         if (!cpu_has_work(cpu)) {
@@ -251,6 +419,10 @@ int cpu_exec(CPUArchState *env)
     if (unlikely(exit_request)) {
         cpu->exit_request = 1;
     }
+#if !defined(CONFIG_USER_ONLY)
+    /* a sample requested while this vCPU didn't run */
+    cpu->profile_request = 0;
+#endif
 
 #if defined(TARGET_I386)
     /* put eflags in CPU temporary format */
@@ -306,8 +478,13 @@ int cpu_exec(CPUArchState *env)
                     ret = cpu->exception_index;
                     break;
 #else
+                    bool iothread_locked = qemu_tcg_lock_iothread();
+
                     cc->do_interrupt(cpu);
                     cpu->exception_index = -1;
+                    if (iothread_locked) {
+                        qemu_mutex_unlock_iothread();
+                    }
 #endif
                 }
             }
@@ -316,6 +493,11 @@ int cpu_exec(CPUArchState *env)
             for(;;) {
                 interrupt_request = cpu->interrupt_request;
                 if (unlikely(interrupt_request)) {
+#if !defined(CONFIG_USER_ONLY)
+                    /* the interrupt controllers are devices */
+                    bool iothread_locked = qemu_tcg_lock_iothread();
+#endif
+
                     if (unlikely(cpu->singlestep_enabled & SSTEP_NOIRQ)) {
                         /* Mask out external interrupts for this step. */
                         interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -598,15 +780,32 @@ int cpu_exec(CPUArchState *env)
                            the program flow was changed */
                         next_tb = 0;
                     }
+#if !defined(CONFIG_USER_ONLY)
+                    if (iothread_locked) {
+                        qemu_mutex_unlock_iothread();
+                    }
+#endif
                 }
                 if (unlikely(cpu->exit_request)) {
                     cpu->exit_request = 0;
                     cpu->exception_index = EXCP_INTERRUPT;
                     cpu_loop_exit(cpu);
                 }
-                spin_lock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = true;
                 tb = tb_find_fast(env);
+                if (unlikely(tb_hot_threshold)) {
+                    if (next_tb != 0 &&
+                        (next_tb & TB_EXIT_MASK) <= TB_EXIT_IDX1) {
+                        TranslationBlock *last_tb;
+
+                        last_tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
+                        if (!(last_tb->cflags & CF_SUPERBLOCK)) {
+                            last_tb->exit_count[next_tb & TB_EXIT_MASK]++;
+                        }
+                    }
+                    if (!(tb->cflags & CF_SUPERBLOCK)) {
+                        tb = tb_count_run(env, tb);
+                    }
+                }
 
 #if defined(TARGET_ARM)
                 /* When we reach exit(), make a copy of the
@@ -631,13 +830,22 @@ int cpu_exec(CPUArchState *env)
                 }
                 /* see if we can patch the calling TB. When the TB
                    spans two pages, we cannot safely do a direct
-                   jump. */
+                   jump.  With tb_hot_threshold, only the superblocks
+                   are chained, so that the cold TBs are counted. */
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
-                                next_tb & TB_EXIT_MASK, tb);
+                    TranslationBlock *last_tb;
+
+                    last_tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
+                    tb_lock();
+                    /* another thread may have invalidated either TB */
+                    if (last_tb->page_addr[0] != -1 &&
+                        tb->page_addr[0] != -1 &&
+                        (!tb_hot_threshold ||
+                         (last_tb->cflags & tb->cflags & CF_SUPERBLOCK))) {
+                        tb_add_jump(last_tb, next_tb & TB_EXIT_MASK, tb);
+                    }
+                    tb_unlock();
                 }
-                have_tb_lock = false;
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
 
                 /* cpu_interrupt might be called while translating the
                    TB, but before it is linked into a potentially
@@ -660,6 +868,12 @@ int cpu_exec(CPUArchState *env)
                          */
                         tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
                         next_tb = 0;
+#if !defined(CONFIG_USER_ONLY)
+                        if (unlikely(cpu->profile_request)) {
+                            cpu->profile_request = 0;
+                            cpu_profile_sample(cpu, tb->pc);
+                        }
+#endif
                         break;
                     case TB_EXIT_ICOUNT_EXPIRED:
                     {
@@ -708,10 +922,13 @@ int cpu_exec(CPUArchState *env)
 #ifdef TARGET_I386
             x86_cpu = X86_CPU(cpu);
 #endif
-            if (have_tb_lock) {
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = false;
+            tb_lock_reset();
+#if !defined(CONFIG_USER_ONLY)
+            tcg_atomic_unlock();
+            if (parallel_cpus && qemu_mutex_iothread_locked()) {
+                qemu_mutex_unlock_iothread();
             }
+#endif
         }
     } /* for(;;) */
 
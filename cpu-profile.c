@@ -0,0 +1,247 @@
+/*
+ * Sampling profiler of the guest code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+/* guest-profile-start arms a timer of the host clock that asks each vCPU,
+ * "frequency" times per second, where its guest code is.  Unlike the
+ * profile plugins, nothing is added to the generated code:
+ *
+ * 1. The timer only sets cpu->profile_request and cpu->tcg_exit_req.  The
+ *    vCPU leaves the generated code at the start of the next TB, where
+ *    cpu_tb_exec already synchronized its state with that TB, and
+ *    cpu_exec records the PC of the TB with cpu_profile_sample.  A sample
+ *    costs one exit to cpu_exec, and goes to the TB that follows the code
+ *    that ran when the timer fired.
+ * 2. Each vCPU has its own histogram of the PCs, an open addressing hash
+ *    table that only its thread writes.  The monitor reads it without
+ *    locks: a bucket is published by its count, after its PC.
+ * 3. The halted vCPUs are counted as idle by the timer itself.
+ * 4. query-guest-profile merges the PCs of each guest symbol, and returns
+ *    "cpuN;symbol" stacks with their number of samples, the folded
+ *    stacks that flamegraph.pl reads.
+ */
+
+#include "config.h"
+#include "cpu.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "qapi/qmp/qerror.h"
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
+#include "qmp-commands.h"
+#include "sysemu/sysemu.h"
+
+#define PROFILE_BUCKETS     8192    /* per vCPU, a power of 2 */
+#define PROFILE_PROBES      16
+
+#define PROFILE_DEFAULT_FREQUENCY   997
+#define PROFILE_MAX_FREQUENCY       10000
+
+typedef struct CPUProfileBucket {
+    uint64_t pc;
+    uint32_t count;             /* 0 for a free bucket */
+} CPUProfileBucket;
+
+typedef struct CPUProfile {
+    CPUProfileBucket buckets[PROFILE_BUCKETS];
+    uint32_t nb_lost;           /* the samples that found no bucket */
+    uint32_t nb_idle;           /* written by the timer */
+} CPUProfile;
+
+static QEMUTimer *profile_timer;
+static int64_t profile_frequency;
+static bool profile_running;
+
+static void cpu_profile_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    if (runstate_is_running()) {
+        CPU_FOREACH(cpu) {
+            if (!cpu->profile) {
+                /* hotplugged since guest-profile-start */
+                continue;
+            }
+            if (cpu->halted) {
+                cpu->profile->nb_idle++;
+            } else {
+                cpu->profile_request = 1;
+                smp_wmb();
+                cpu->tcg_exit_req = 1;
+            }
+        }
+    }
+    timer_mod(profile_timer, qemu_clock_get_ns(QEMU_CLOCK_HOST) +
+              get_ticks_per_sec() / profile_frequency);
+}
+
+/* Called by cpu_exec, in the thread of "cpu", when it left the generated
+   code for a sample.  */
+void cpu_profile_sample(CPUState *cpu, target_ulong pc)
+{
+    CPUProfile *p = cpu->profile;
+    uint32_t h = ((uint64_t)pc * 0x9e3779b97f4a7c15ull) >> 32;
+    int i;
+
+    if (!p) {
+        return;
+    }
+    for (i = 0; i < PROFILE_PROBES; i++) {
+        CPUProfileBucket *b = &p->buckets[(h + i) & (PROFILE_BUCKETS - 1)];
+        uint32_t count = b->count;
+
+        if (count == 0) {
+            b->pc = pc;
+            smp_wmb();
+            atomic_set(&b->count, 1);
+            return;
+        }
+        if (b->pc == pc) {
+            atomic_set(&b->count, count + 1);
+            return;
+        }
+    }
+    atomic_set(&p->nb_lost, p->nb_lost + 1);
+}
+
+void qmp_guest_profile_start(bool has_frequency, int64_t frequency,
+                             Error **errp)
+{
+    CPUState *cpu;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "The guest profiler needs the TCG accelerator");
+        return;
+    }
+    if (!has_frequency) {
+        frequency = PROFILE_DEFAULT_FREQUENCY;
+    }
+    if (frequency <= 0 || frequency > PROFILE_MAX_FREQUENCY) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "frequency",
+                  "a number of samples per second, up to 10000");
+        return;
+    }
+
+    /* Start a new profile.  A sample requested by the previous one may
+       still be recorded meanwhile: it only counts once more.  */
+    CPU_FOREACH(cpu) {
+        cpu->profile_request = 0;
+        if (!cpu->profile) {
+            cpu->profile = g_new0(CPUProfile, 1);
+        } else {
+            memset(cpu->profile, 0, sizeof(CPUProfile));
+        }
+    }
+    if (!profile_timer) {
+        profile_timer = timer_new_ns(QEMU_CLOCK_HOST, cpu_profile_tick, NULL);
+    }
+    profile_frequency = frequency;
+    profile_running = true;
+    timer_mod(profile_timer, qemu_clock_get_ns(QEMU_CLOCK_HOST) +
+              get_ticks_per_sec() / profile_frequency);
+}
+
+void qmp_guest_profile_stop(Error **errp)
+{
+    if (profile_timer) {
+        timer_del(profile_timer);
+    }
+    profile_running = false;
+}
+
+static void cpu_profile_add(GHashTable *stacks, char *stack, uint32_t count)
+{
+    uint64_t *total = g_hash_table_lookup(stacks, stack);
+
+    if (!total) {
+        total = g_new0(uint64_t, 1);
+        g_hash_table_insert(stacks, stack, total);
+    } else {
+        g_free(stack);
+    }
+    *total += count;
+}
+
+static gint cpu_profile_compare(gconstpointer a, gconstpointer b)
+{
+    const GuestProfileStack *sa = a, *sb = b;
+
+    return sa->count < sb->count ? 1 : sa->count > sb->count ? -1 :
+           strcmp(sa->stack, sb->stack);
+}
+
+GuestProfile *qmp_query_guest_profile(Error **errp)
+{
+    GuestProfile *info = g_new0(GuestProfile, 1);
+    GHashTable *stacks;
+    GHashTableIter iter;
+    gpointer key, value;
+    GList *list = NULL, *l;
+    GuestProfileStackList **tail = &info->stacks;
+    CPUState *cpu;
+    int i;
+
+    stacks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    CPU_FOREACH(cpu) {
+        CPUProfile *p = cpu->profile;
+
+        if (!p) {
+            continue;
+        }
+        for (i = 0; i < PROFILE_BUCKETS; i++) {
+            uint32_t count = atomic_read(&p->buckets[i].count);
+            target_ulong pc;
+            const char *symbol;
+            char *stack;
+
+            if (count == 0) {
+                continue;
+            }
+            smp_rmb();
+            pc = p->buckets[i].pc;
+            symbol = lookup_symbol(pc);
+            if (*symbol) {
+                stack = g_strdup_printf("cpu%d;%s", cpu->cpu_index, symbol);
+            } else {
+                stack = g_strdup_printf("cpu%d;0x" TARGET_FMT_lx,
+                                        cpu->cpu_index, pc);
+            }
+            cpu_profile_add(stacks, stack, count);
+            info->samples += count;
+        }
+        if (p->nb_idle) {
+            cpu_profile_add(stacks, g_strdup_printf("cpu%d;[idle]",
+                                                    cpu->cpu_index),
+                            p->nb_idle);
+            info->samples += p->nb_idle;
+        }
+        info->lost += atomic_read(&p->nb_lost);
+    }
+
+    g_hash_table_iter_init(&iter, stacks);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        GuestProfileStack *s = g_new0(GuestProfileStack, 1);
+
+        s->stack = g_strdup(key);
+        s->count = *(uint64_t *)value;
+        list = g_list_prepend(list, s);
+    }
+    g_hash_table_destroy(stacks);
+
+    /* the most sampled first */
+    list = g_list_sort(list, cpu_profile_compare);
+    for (l = list; l; l = l->next) {
+        *tail = g_new0(GuestProfileStackList, 1);
+        (*tail)->value = l->data;
+        tail = &(*tail)->next;
+    }
+    g_list_free(list);
+
+    info->running = profile_running;
+    info->frequency = profile_frequency;
+    return info;
+}
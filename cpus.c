@@ -39,7 +39,9 @@
 #include "qemu/main-loop.h"
 #include "qemu/bitmap.h"
 #include "qemu/seqlock.h"
+#include "qemu/tls.h"
 #include "qapi-event.h"
+#include "tcg.h"
 
 #ifndef _WIN32
 #include "qemu/compatfd.h"
@@ -444,6 +446,35 @@ static const VMStateDescription vmstate_timers = {
     }
 };
 
+/* -tcg-threads: "single", the default, runs all the vCPUs in one host
+   thread, "multi" gives each of them its own thread.  Called before the
+   vCPUs are created.  */
+void qemu_tcg_configure(const char *mode)
+{
+    if (!mode || !strcmp(mode, "single")) {
+        return;
+    }
+    if (strcmp(mode, "multi")) {
+        fprintf(stderr, "-tcg-threads: unknown mode '%s'\n", mode);
+        exit(1);
+    }
+    if (!tcg_enabled()) {
+        fprintf(stderr, "-tcg-threads multi needs the TCG accelerator\n");
+        exit(1);
+    }
+    if (use_icount) {
+        fprintf(stderr, "-tcg-threads multi is not compatible with -icount\n");
+        exit(1);
+    }
+#if !defined(TCG_GUEST_DEFAULT_MO) || !TCG_TARGET_HAS_mb
+    fprintf(stderr, "-tcg-threads multi is not supported for this guest "
+            "on this host\n");
+    exit(1);
+#else
+    parallel_cpus = true;
+#endif
+}
+
 void configure_icount(const char *option)
 {
     seqlock_init(&timers_state.vm_clock_seqlock, NULL);
@@ -712,6 +743,7 @@ static void qemu_tcg_init_cpu_signals(void)
 static QemuMutex qemu_global_mutex;
 static QemuCond qemu_io_proceeded_cond;
 static bool iothread_requesting_mutex;
+static DEFINE_TLS(bool, iothread_locked);
 
 static QemuThread io_thread;
 
@@ -724,6 +756,11 @@ static QemuCond qemu_cpu_cond;
 static QemuCond qemu_pause_cond;
 static QemuCond qemu_work_cond;
 
+/* -tcg-threads multi: exclusive sections (see qemu_tcg_start_exclusive) */
+static QemuCond exclusive_cond;
+static QemuCond exclusive_resume;
+static int pending_cpus;
+
 void qemu_init_cpu_loop(void)
 {
     qemu_init_sigbus();
@@ -731,6 +768,8 @@ void qemu_init_cpu_loop(void)
     qemu_cond_init(&qemu_pause_cond);
     qemu_cond_init(&qemu_work_cond);
     qemu_cond_init(&qemu_io_proceeded_cond);
+    qemu_cond_init(&exclusive_cond);
+    qemu_cond_init(&exclusive_resume);
     qemu_mutex_init(&qemu_global_mutex);
 
     qemu_thread_get_self(&io_thread);
@@ -930,6 +969,9 @@ static void *qemu_dummy_cpu_thread_fn(void *arg)
 }
 
 static void tcg_exec_all(void);
+static int tcg_cpu_exec(CPUArchState *env);
+static void tcg_cpu_exec_start(CPUState *cpu);
+static void tcg_cpu_exec_end(CPUState *cpu);
 
 static void *qemu_tcg_cpu_thread_fn(void *arg)
 {
@@ -971,6 +1013,49 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     return NULL;
 }
 
+/* -tcg-threads multi: one thread per vCPU.  The iothread lock is only
+ * held out of cpu_exec, see docs/multi-thread-tcg.txt.
+ */
+static void *qemu_tcg_mt_cpu_thread_fn(void *arg)
+{
+    CPUState *cpu = arg;
+    CPUArchState *env = cpu->env_ptr;
+    int r;
+
+    qemu_mutex_lock_iothread();
+    qemu_thread_get_self(cpu->thread);
+    cpu->thread_id = qemu_get_thread_id();
+    cpu->created = true;
+    current_cpu = cpu;
+    qemu_cond_signal(&qemu_cpu_cond);
+
+    /* wait for initial kick-off after machine start */
+    while (cpu->stopped) {
+        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+        qemu_wait_io_event_common(cpu);
+    }
+
+    while (1) {
+        if (cpu_can_run(cpu)) {
+            tcg_cpu_exec_start(cpu);
+            qemu_mutex_unlock_iothread();
+            r = tcg_cpu_exec(env);
+            qemu_mutex_lock_iothread();
+            tcg_cpu_exec_end(cpu);
+            if (r == EXCP_DEBUG) {
+                cpu_handle_guest_debug(cpu);
+            }
+            tb_run_deferred_work(env);
+        }
+        while (cpu_thread_is_idle(cpu)) {
+            qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+        }
+        qemu_wait_io_event_common(cpu);
+    }
+
+    return NULL;
+}
+
 static void qemu_cpu_kick_thread(CPUState *cpu)
 {
 #ifndef _WIN32
@@ -1013,7 +1098,10 @@ static void qemu_cpu_kick_thread(CPUState *cpu)
 void qemu_cpu_kick(CPUState *cpu)
 {
     qemu_cond_broadcast(cpu->halt_cond);
-    if (!tcg_enabled() && !cpu->thread_kicked) {
+    if (parallel_cpus) {
+        /* the vCPU polls tcg_exit_req at the start of each TB */
+        cpu_exit(cpu);
+    } else if (!tcg_enabled() && !cpu->thread_kicked) {
         qemu_cpu_kick_thread(cpu);
         cpu->thread_kicked = true;
     }
@@ -1045,7 +1133,8 @@ static bool qemu_in_vcpu_thread(void)
 
 void qemu_mutex_lock_iothread(void)
 {
-    if (!tcg_enabled()) {
+    if (!tcg_enabled() || parallel_cpus) {
+        /* no vCPU thread holds the lock while running guest code */
         qemu_mutex_lock(&qemu_global_mutex);
     } else {
         iothread_requesting_mutex = true;
@@ -1056,13 +1145,108 @@ void qemu_mutex_lock_iothread(void)
         iothread_requesting_mutex = false;
         qemu_cond_broadcast(&qemu_io_proceeded_cond);
     }
+    tls_var(iothread_locked) = true;
 }
 
 void qemu_mutex_unlock_iothread(void)
 {
+    tls_var(iothread_locked) = false;
     qemu_mutex_unlock(&qemu_global_mutex);
 }
 
+bool qemu_mutex_iothread_locked(void)
+{
+    return tls_var(iothread_locked);
+}
+
+bool qemu_tcg_lock_iothread(void)
+{
+    if (!parallel_cpus || tls_var(iothread_locked)) {
+        return false;
+    }
+    qemu_mutex_lock_iothread();
+    return true;
+}
+
+/* Exclusive sections, modelled on the ones of linux-user/main.c with the
+ * iothread lock in place of exclusive_lock: the vCPU threads flag
+ * themselves as running while in cpu_exec, and qemu_tcg_start_exclusive
+ * kicks them out and waits for them.  They are only needed with
+ * -tcg-threads multi, where tb_flush and the eviction of a region of the
+ * translation buffer use them.
+ */
+static inline void exclusive_idle(void)
+{
+    while (pending_cpus) {
+        qemu_cond_wait(&exclusive_resume, &qemu_global_mutex);
+    }
+}
+
+void qemu_tcg_start_exclusive(void)
+{
+    CPUState *other_cpu;
+
+    exclusive_idle();
+
+    pending_cpus = 1;
+    CPU_FOREACH(other_cpu) {
+        if (other_cpu->running) {
+            pending_cpus++;
+            cpu_exit(other_cpu);
+        }
+    }
+    while (pending_cpus > 1) {
+        qemu_cond_wait(&exclusive_cond, &qemu_global_mutex);
+    }
+}
+
+void qemu_tcg_end_exclusive(void)
+{
+    pending_cpus = 0;
+    qemu_cond_broadcast(&exclusive_resume);
+}
+
+/* The vCPU counts as out of cpu_exec while in its own section.  It
+ * can't wait for the section of another thread, which waits for it to
+ * leave cpu_exec.  */
+bool qemu_tcg_cpu_start_exclusive(CPUState *cpu)
+{
+    qemu_mutex_lock_iothread();
+    if (pending_cpus) {
+        qemu_mutex_unlock_iothread();
+        return false;
+    }
+
+    cpu->running = false;
+    qemu_tcg_start_exclusive();
+    return true;
+}
+
+void qemu_tcg_cpu_end_exclusive(CPUState *cpu)
+{
+    cpu->running = true;
+    qemu_tcg_end_exclusive();
+    qemu_mutex_unlock_iothread();
+}
+
+static void tcg_cpu_exec_start(CPUState *cpu)
+{
+    exclusive_idle();
+    cpu->running = true;
+}
+
+static void tcg_cpu_exec_end(CPUState *cpu)
+{
+    cpu->running = false;
+    if (pending_cpus > 1) {
+        pending_cpus--;
+        if (pending_cpus == 1) {
+            qemu_cond_signal(&exclusive_cond);
+        }
+    }
+    exclusive_idle();
+}
+
 static int all_vcpus_paused(void)
 {
     CPUState *cpu;
@@ -1088,7 +1272,7 @@ void pause_all_vcpus(void)
 
     if (qemu_in_vcpu_thread()) {
         cpu_stop_current();
-        if (!kvm_enabled()) {
+        if (!kvm_enabled() && !parallel_cpus) {
             CPU_FOREACH(cpu) {
                 cpu->stop = false;
                 cpu->stopped = true;
@@ -1127,12 +1311,36 @@ void resume_all_vcpus(void)
 /* For temporary buffers for forming a name */
 #define VCPU_THREAD_NAME_SIZE 16
 
+static void qemu_tcg_start_mt_vcpu(CPUState *cpu)
+{
+    char thread_name[VCPU_THREAD_NAME_SIZE];
+
+    snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
+             cpu->cpu_index);
+    qemu_thread_create(cpu->thread, thread_name, qemu_tcg_mt_cpu_thread_fn,
+                       cpu, QEMU_THREAD_JOINABLE);
+#ifdef _WIN32
+    cpu->hThread = qemu_thread_get_handle(cpu->thread);
+#endif
+    while (!cpu->created) {
+        qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+    }
+}
+
 static void qemu_tcg_init_vcpu(CPUState *cpu)
 {
     char thread_name[VCPU_THREAD_NAME_SIZE];
 
     tcg_cpu_address_space_init(cpu, cpu->as);
 
+    if (parallel_cpus) {
+        cpu->thread = g_malloc0(sizeof(QemuThread));
+        cpu->halt_cond = g_malloc0(sizeof(QemuCond));
+        qemu_cond_init(cpu->halt_cond);
+        qemu_tcg_start_mt_vcpu(cpu);
+        return;
+    }
+
     /* share a single thread for all cpus with TCG */
     if (!tcg_cpu_thread) {
         cpu->thread = g_malloc0(sizeof(QemuThread));
@@ -1156,6 +1364,48 @@ static void qemu_tcg_init_vcpu(CPUState *cpu)
     }
 }
 
+/* fork() only duplicates the calling thread: re-create the TCG vCPU
+ * threads in a child of the TCG plugins' fork server.  The caller holds
+ * the iothread lock and the vCPUs are stopped.  */
+void qemu_tcg_restart_vcpu_thread(void)
+{
+    char thread_name[VCPU_THREAD_NAME_SIZE];
+    CPUState *cpu;
+
+    if (!tcg_enabled() || (!tcg_cpu_thread && !parallel_cpus)) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        cpu->created = false;
+    }
+
+    /* Forget about the waiters of the parent.  */
+    qemu_cond_init(&qemu_cpu_cond);
+    qemu_cond_init(&qemu_pause_cond);
+
+    if (parallel_cpus) {
+        qemu_cond_init(&exclusive_cond);
+        qemu_cond_init(&exclusive_resume);
+        CPU_FOREACH(cpu) {
+            qemu_cond_init(cpu->halt_cond);
+            qemu_tcg_start_mt_vcpu(cpu);
+        }
+        return;
+    }
+
+    qemu_cond_init(tcg_halt_cond);
+
+    cpu = first_cpu;
+    snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
+             cpu->cpu_index);
+    qemu_thread_create(tcg_cpu_thread, thread_name, qemu_tcg_cpu_thread_fn,
+                       cpu, QEMU_THREAD_JOINABLE);
+    while (!cpu->created) {
+        qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+    }
+}
+
 static void qemu_kvm_start_vcpu(CPUState *cpu)
 {
     char thread_name[VCPU_THREAD_NAME_SIZE];
@@ -29,6 +29,8 @@
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
+#include "tcg/tcg-plugin.h"
+#include "qemu/main-loop.h"
 
 //#define DEBUG_TLB
 //#define DEBUG_TLB_CHECK
@@ -36,6 +38,46 @@
 /* statistics */
 int tlb_flush_count;
 
+/* Number of consecutive flushes of a TLB with less than 30% of its
+   entries used before it shrinks.  */
+#define TLB_SHRINK_DELAY 4
+
+/* Choose the size of the TLB of "mmu_idx" until the next flush from
+   its use since the previous one: double it when more than 70% of the
+   entries were used or when more entries were evicted than the TLB
+   holds, halve it when it was mostly unused for a while.  Large TLBs
+   make the guests with a large working set miss less while the small
+   ones are faster to flush, which some guests do very often.  */
+static void tlb_resize(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_desc[mmu_idx];
+    unsigned int size = 1 << desc->bits;
+
+    if (!TCG_TARGET_DYNAMIC_TLB) {
+        desc->bits = CPU_TLB_BITS;
+    } else if (desc->bits == 0) {
+        desc->bits = MIN(CPU_TLB_DYN_DEFAULT_BITS, CPU_TLB_BITS);
+    } else if (desc->used * 10 > size * 7 || desc->evictions > size) {
+        if (desc->bits < CPU_TLB_BITS) {
+            desc->bits++;
+        }
+        desc->low_usage = 0;
+    } else if (desc->used * 10 < size * 3) {
+        if (++desc->low_usage >= TLB_SHRINK_DELAY
+            && desc->bits > CPU_TLB_DYN_MIN_BITS) {
+            desc->bits--;
+            desc->low_usage = 0;
+        }
+    } else {
+        desc->low_usage = 0;
+    }
+
+    desc->used = 0;
+    desc->evictions = 0;
+    env->tlb_mask[mmu_idx] =
+        ((uintptr_t)(1 << desc->bits) - 1) << CPU_TLB_ENTRY_BITS;
+}
+
 /* NOTE:
  * If flush_global is true (the usual case), flush all tlb entries.
  * If flush_global is false, flush (at least) all tlb entries not
@@ -48,9 +90,33 @@ int tlb_flush_count;
  * entries from the TLB at any time, so flushing more entries than
  * required is only an efficiency issue, not a correctness issue.
  */
+static void tlb_flush_async_work(void *opaque)
+{
+    tlb_flush(opaque, 1);
+}
+
+/* With -tcg-threads multi, the TLB of a vCPU is only modified by its own
+   thread: the flushes requested by the other threads are queued, and done
+   before the vCPU runs again.  */
+static bool tlb_flush_is_remote(CPUState *cpu)
+{
+    return parallel_cpus && cpu->created && !qemu_cpu_is_self(cpu);
+}
+
 void tlb_flush(CPUState *cpu, int flush_global)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    if (tlb_flush_is_remote(cpu)) {
+        bool iothread_locked = qemu_tcg_lock_iothread();
+
+        async_run_on_cpu(cpu, tlb_flush_async_work, cpu);
+        if (iothread_locked) {
+            qemu_mutex_unlock_iothread();
+        }
+        return;
+    }
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -59,9 +125,17 @@ void tlb_flush(CPUState *cpu, int flush_global)
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
+    /* Only the entries in use after the resize need to be invalidated,
+       the other ones will be when the TLB grows.  */
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_resize(env, mmu_idx);
+        memset(env->tlb_table[mmu_idx], -1,
+               tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
+    }
+    memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
 
+    env->vtlb_index = 0;
     env->tlb_flush_addr = -1;
     env->tlb_flush_mask = 0;
     tlb_flush_count++;
@@ -79,12 +153,37 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
     }
 }
 
+typedef struct TLBFlushPageWork {
+    CPUState *cpu;
+    target_ulong addr;
+} TLBFlushPageWork;
+
+static void tlb_flush_page_async_work(void *opaque)
+{
+    TLBFlushPageWork *work = opaque;
+
+    tlb_flush_page(work->cpu, work->addr);
+    g_free(work);
+}
+
 void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
     int mmu_idx;
 
+    if (tlb_flush_is_remote(cpu)) {
+        TLBFlushPageWork *work = g_new(TLBFlushPageWork, 1);
+        bool iothread_locked = qemu_tcg_lock_iothread();
+
+        work->cpu = cpu;
+        work->addr = addr;
+        async_run_on_cpu(cpu, tlb_flush_page_async_work, work);
+        if (iothread_locked) {
+            qemu_mutex_unlock_iothread();
+        }
+        return;
+    }
+
 #if defined(DEBUG_TLB)
     printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
 #endif
@@ -103,9 +202,17 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
     cpu->current_tb = NULL;
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        tlb_flush_entry(&env->tlb_table[mmu_idx][tlb_index(env, mmu_idx, addr)],
+                        addr);
+    }
+
+    /* check whether there are entries that need to be flushed in the vtlb */
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        int k;
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+        }
     }
 
     tb_flush_jmp_cache(cpu, addr);
@@ -140,7 +247,9 @@ void tlb_reset_dirty_range(CPUTLBEntry *tlb_entry, uintptr_t start,
     if (tlb_is_dirty_ram(tlb_entry)) {
         addr = (tlb_entry->addr_write & TARGET_PAGE_MASK) + tlb_entry->addend;
         if ((addr - start) < length) {
-            tlb_entry->addr_write |= TLB_NOTDIRTY;
+            /* may be the TLB of a vCPU running in another thread */
+            atomic_set(&tlb_entry->addr_write,
+                       tlb_entry->addr_write | TLB_NOTDIRTY);
         }
     }
 }
@@ -167,19 +276,25 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
         env = cpu->env_ptr;
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
             unsigned int i;
+            unsigned int n = tlb_n_entries(env, mmu_idx);
 
-            for (i = 0; i < CPU_TLB_SIZE; i++) {
+            for (i = 0; i < n; i++) {
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
+
+            for (i = 0; i < CPU_VTLB_SIZE; i++) {
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+            }
         }
     }
 }
 
 static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
 {
-    if (tlb_entry->addr_write == (vaddr | TLB_NOTDIRTY)) {
-        tlb_entry->addr_write = vaddr;
+    if ((tlb_entry->addr_write & ~TLB_WATCHED) == (vaddr | TLB_NOTDIRTY)) {
+        tlb_entry->addr_write &= ~TLB_NOTDIRTY;
     }
 }
 
@@ -187,14 +302,26 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
    so that it is no longer dirty */
 void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
 {
-    int i;
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(&env->tlb_table[mmu_idx][tlb_index(env, mmu_idx, vaddr)],
+                       vaddr);
     }
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        int k;
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][k], vaddr);
+        }
+    }
+}
+
+static inline bool tlb_entry_is_valid(const CPUTLBEntry *te)
+{
+    return !(te->addr_read & te->addr_write & te->addr_code
+             & TLB_INVALID_MASK);
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
@@ -266,9 +393,22 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+
+    /* Don't discard the translation held in te, evict it into the
+       victim TLB (round-robin) unless it is unused.  */
+    if (tlb_entry_is_valid(te)) {
+        unsigned int vidx = env->vtlb_index++ % CPU_VTLB_SIZE;
+
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+        env->tlb_desc[mmu_idx].evictions++;
+    } else {
+        env->tlb_desc[mmu_idx].used++;
+    }
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -296,6 +436,19 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
     } else {
         te->addr_write = -1;
     }
+
+#ifdef CONFIG_TCG_PLUGIN
+    /* Force accesses to pages watched by a TCG plugin through the
+       slow path, see softmmu_template.h.  */
+    if (tcgplugin_page_watched(vaddr)) {
+        if (te->addr_read != -1) {
+            te->addr_read |= TLB_WATCHED;
+        }
+        if (te->addr_write != -1) {
+            te->addr_write |= TLB_WATCHED;
+        }
+    }
+#endif
 }
 
 /* NOTE: this function can trigger an exception */
@@ -310,8 +463,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     MemoryRegion *mr;
     CPUState *cpu = ENV_GET_CPU(env1);
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
@@ -332,6 +485,104 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     return qemu_ram_addr_from_host_nofail(p);
 }
 
+/* The entry of the page "page" isn't in tlb_table[mmu_idx][index],
+   typically because another page with the same index evicted it: look
+   for it in the victim TLB and swap both entries if found, which is
+   much cheaper than tlb_fill().  "access_type" is the one of
+   tlb_fill().  */
+static bool victim_tlb_hit(CPUArchState *env, int mmu_idx, int index,
+                           int access_type, target_ulong page)
+{
+    int vidx;
+
+    for (vidx = 0; vidx < CPU_VTLB_SIZE; vidx++) {
+        CPUTLBEntry *vte = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong cmp;
+
+        switch (access_type) {
+        case 0:
+            cmp = vte->addr_read;
+            break;
+        case 1:
+            cmp = vte->addr_write;
+            break;
+        default:
+            cmp = vte->addr_code;
+            break;
+        }
+
+        if ((cmp & (TARGET_PAGE_MASK | TLB_INVALID_MASK)) == page) {
+            CPUTLBEntry *te = &env->tlb_table[mmu_idx][index];
+            CPUTLBEntry tmptlb = *te;
+            hwaddr tmpiotlb = env->iotlb[mmu_idx][index];
+
+            *te = *vte;
+            *vte = tmptlb;
+            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = tmpiotlb;
+
+            env->vtlb_hits++;
+            return true;
+        }
+    }
+
+    env->vtlb_misses++;
+    return false;
+}
+
+static void dump_tlb_stats(FILE *f, fprintf_function cpu_fprintf,
+                           uint64_t hits, uint64_t misses)
+{
+    cpu_fprintf(f, "victim TLB hits     %" PRIu64 "/%" PRIu64 " (%d%%)\n",
+                hits, hits + misses,
+                hits + misses ? (int)(hits * 100 / (hits + misses)) : 0);
+}
+
+/* Print how many softmmu slow path lookups were served by the victim
+   TLB rather than by tlb_fill(), for "cpu" or for all the CPUs if
+   NULL.  For a single CPU, also print the current size of the TLB of
+   each MMU mode.  */
+void dump_tlb_info(FILE *f, fprintf_function cpu_fprintf, CPUState *cpu)
+{
+    CPUArchState *env;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    if (cpu) {
+        int mmu_idx;
+
+        env = cpu->env_ptr;
+        cpu_fprintf(f, "TLB entries        ");
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            cpu_fprintf(f, " %d", tlb_n_entries(env, mmu_idx));
+        }
+        cpu_fprintf(f, "\n");
+        dump_tlb_stats(f, cpu_fprintf, env->vtlb_hits, env->vtlb_misses);
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        env = cpu->env_ptr;
+        hits += env->vtlb_hits;
+        misses += env->vtlb_misses;
+    }
+    dump_tlb_stats(f, cpu_fprintf, hits, misses);
+}
+
+/* With -tcg-threads multi, the page table walk and the lookup of the
+   memory map done by tlb_fill need the iothread lock.  A guest fault
+   longjmps out of tlb_fill with the lock held, cpu_exec releases it.  */
+static void tlb_fill_iothread(CPUState *cpu, target_ulong addr, int is_write,
+                              int mmu_idx, uintptr_t retaddr)
+{
+    bool iothread_locked = qemu_tcg_lock_iothread();
+
+    tlb_fill(cpu, addr, is_write, mmu_idx, retaddr);
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 #define MMUSUFFIX _mmu
 
 #define SHIFT 0
@@ -6,6 +6,7 @@
 
 #include "cpu.h"
 #include "disas/disas.h"
+#include "qemu/thread.h"
 
 typedef struct CPUDebug {
     struct disassemble_info info;
@@ -405,33 +406,228 @@ void disas(FILE *out, void *code, unsigned long size)
     }
 }
 
-/* Look up symbol for debugging purpose.  Returns "" if unknown. */
-const char *lookup_symbol(target_ulong orig_addr)
+/* Function symbols of all the syminfos merged into a single array
+ * sorted by start address, rebuilt each time symbols are loaded.  */
+typedef struct SymbolEntry {
+    uint64_t start;
+    uint64_t end;
+    /* Highest "end" of this entry and the previous ones, this makes
+     * the lookup of overlapping symbols a binary search too.  */
+    uint64_t max_end;
+    /* Load order, the latest loaded syminfo wins on overlap.  */
+    unsigned int rank;
+    const char *name;
+    const char *filename;
+} SymbolEntry;
+
+static SymbolEntry *symbol_index;
+static size_t symbol_index_size;
+static unsigned int nb_indexed_syminfos;
+
+/* Lookups mostly hit a few pages, remember which entries overlap them
+ * in a 2-way set-associative LRU cache.  */
+#define SYMBOL_CACHE_SETS 256
+
+typedef struct SymbolCacheWay {
+    bool valid;
+    target_ulong page;
+    size_t lo;
+    size_t hi;
+} SymbolCacheWay;
+
+static struct {
+    SymbolCacheWay way[2];
+    unsigned int lru;
+} symbol_cache[SYMBOL_CACHE_SETS];
+
+/* Symbols are loaded/looked up by the vCPU threads in user-mode.  */
+static QemuMutex symbol_index_lock;
+
+static void __attribute__((constructor)) symbol_index_init(void)
 {
-    const char *symbol = "";
-    struct syminfo *s;
+    qemu_mutex_init(&symbol_index_lock);
+}
+
+static int symbol_entry_cmp(const void *p0, const void *p1)
+{
+    const SymbolEntry *e0 = p0;
+    const SymbolEntry *e1 = p1;
+
+    if (e0->start != e1->start) {
+        return e0->start < e1->start ? -1 : 1;
+    }
+    return e0->rank > e1->rank ? -1 : (e0->rank < e1->rank ? 1 : 0);
+}
+
+/* Link "s" into syminfos and merge its function symbols, "elf_class"
+ * tells the type of its symbol table (ELFCLASS32 or ELFCLASS64).  */
+void syminfo_register(struct syminfo *s, int elf_class)
+{
+    unsigned int rank;
+    size_t i, n;
+
+    qemu_mutex_lock(&symbol_index_lock);
+
+    s->next = syminfos;
+    syminfos = s;
+
+    rank = nb_indexed_syminfos++;
+    symbol_index = g_renew(SymbolEntry, symbol_index,
+                           symbol_index_size + s->disas_num_syms);
+
+    n = symbol_index_size;
+    for (i = 0; i < s->disas_num_syms; i++) {
+        uint64_t value, size;
+        uint32_t name;
+
+        if (elf_class == ELFCLASS64) {
+            value = s->disas_symtab.elf64[i].st_value;
+            size = s->disas_symtab.elf64[i].st_size;
+            name = s->disas_symtab.elf64[i].st_name;
+        } else {
+            value = s->disas_symtab.elf32[i].st_value;
+            size = s->disas_symtab.elf32[i].st_size;
+            name = s->disas_symtab.elf32[i].st_name;
+        }
+
+        /* Such symbols never matched in the per-syminfo lookup.  */
+        if (size == 0) {
+            continue;
+        }
 
-    for (s = syminfos; s; s = s->next) {
-        symbol = s->lookup_symbol(s, orig_addr);
-        if (symbol[0] != '\0') {
+        symbol_index[n].start = value;
+        symbol_index[n].end = value + size;
+        symbol_index[n].rank = rank;
+        symbol_index[n].name = s->disas_strtab + name;
+        symbol_index[n].filename = s->filename ?: "";
+        n++;
+    }
+    symbol_index_size = n;
+
+    qsort(symbol_index, symbol_index_size, sizeof(*symbol_index),
+          symbol_entry_cmp);
+
+    for (i = 0; i < symbol_index_size; i++) {
+        symbol_index[i].max_end = symbol_index[i].end;
+        if (i > 0 && symbol_index[i - 1].max_end > symbol_index[i].end) {
+            symbol_index[i].max_end = symbol_index[i - 1].max_end;
+        }
+    }
+
+    memset(symbol_cache, 0, sizeof(symbol_cache));
+
+    qemu_mutex_unlock(&symbol_index_lock);
+}
+
+/* Index of the first entry in [lo, hi[ that starts after "addr".  */
+static size_t symbol_index_upper_bound(size_t lo, size_t hi, uint64_t addr)
+{
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (symbol_index[mid].start <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Index of the first entry that ends after "addr", or of an earlier
+ * entry (max_end is not decreasing).  */
+static size_t symbol_index_lower_bound_end(uint64_t addr)
+{
+    size_t lo = 0;
+    size_t hi = symbol_index_size;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (symbol_index[mid].max_end <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Return the range of entries that overlap the page of "addr".  */
+static void symbol_cache_lookup(target_ulong addr, size_t *lo, size_t *hi)
+{
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    unsigned int set = (page >> TARGET_PAGE_BITS) % SYMBOL_CACHE_SETS;
+    SymbolCacheWay *way;
+    unsigned int i;
+
+    for (i = 0; i < 2; i++) {
+        way = &symbol_cache[set].way[i];
+        if (way->valid && way->page == page) {
+            symbol_cache[set].lru = !i;
+            *lo = way->lo;
+            *hi = way->hi;
+            return;
+        }
+    }
+
+    i = symbol_cache[set].lru;
+    way = &symbol_cache[set].way[i];
+    way->lo = symbol_index_lower_bound_end(page);
+    way->hi = symbol_index_upper_bound(way->lo, symbol_index_size,
+                                       (uint64_t)page + TARGET_PAGE_SIZE - 1);
+    way->page = page;
+    way->valid = true;
+    symbol_cache[set].lru = !i;
+
+    *lo = way->lo;
+    *hi = way->hi;
+}
+
+static const SymbolEntry *symbol_index_lookup(target_ulong addr)
+{
+    const SymbolEntry *found = NULL;
+    size_t lo, hi, i;
+
+    symbol_cache_lookup(addr, &lo, &hi);
+
+    /* Walk back from the last entry starting before "addr" until no
+     * previous entry can cover it.  */
+    for (i = symbol_index_upper_bound(lo, hi, addr); i > lo; i--) {
+        const SymbolEntry *entry = &symbol_index[i - 1];
+
+        if (entry->max_end <= addr) {
             break;
         }
+        if (addr < entry->end && (!found || entry->rank > found->rank)) {
+            found = entry;
+        }
     }
 
+    return found;
+}
+
+/* Look up symbol for debugging purpose.  Returns "" if unknown. */
+const char *lookup_symbol(target_ulong orig_addr)
+{
+    const char *symbol;
+    const char *filename;
+
+    lookup_symbol2(orig_addr, &symbol, &filename);
     return symbol;
 }
 
 /* Look up symbol/filename for debugging purpose.  */
 bool lookup_symbol2(target_ulong orig_addr, const char **symbol, const char **filename)
 {
-    struct syminfo *s;
+    const SymbolEntry *entry;
 
-    for (s = syminfos; s; s = s->next) {
-        *symbol = s->lookup_symbol(s, orig_addr);
-        if (*symbol[0] != '\0') {
-            *filename = s->filename;
-            return true;
-        }
+    qemu_mutex_lock(&symbol_index_lock);
+    entry = symbol_index_lookup(orig_addr);
+    qemu_mutex_unlock(&symbol_index_lock);
+
+    if (entry) {
+        *symbol = entry->name;
+        *filename = entry->filename;
+        return true;
     }
 
     *symbol = "";
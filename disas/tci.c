@@ -20,40 +20,37 @@
 #include "disas/bfd.h"
 #include "tcg/tcg.h"
 
-/* Disassemble TCI bytecode. */
+static const char *const tci_op_names[TCI_NB_OPS] = {
+#define TCI_NAME(name) [TCI_##name] = #name,
+    TCI_OPS(TCI_NAME)
+#undef TCI_NAME
+};
+
+/* Disassemble TCI bytecode, one TCIInsn. */
 int print_insn_tci(bfd_vma addr, disassemble_info *info)
 {
-    int length;
-    uint8_t byte;
+    TCIInsn insn;
     int status;
-    TCGOpcode op;
-
-    status = info->read_memory_func(addr, &byte, 1, info);
-    if (status != 0) {
-        info->memory_error_func(status, addr, info);
-        return -1;
-    }
-    op = byte;
 
-    addr++;
-    status = info->read_memory_func(addr, &byte, 1, info);
+    status = info->read_memory_func(addr, (bfd_byte *)&insn, sizeof(insn),
+                                    info);
     if (status != 0) {
         info->memory_error_func(status, addr, info);
         return -1;
     }
-    length = byte;
 
-    if (op >= tcg_op_defs_max) {
-        info->fprintf_func(info->stream, "illegal opcode %d", op);
+    if (insn.opc >= TCI_NB_OPS) {
+        info->fprintf_func(info->stream, "illegal opcode %d", insn.opc);
     } else {
-        const TCGOpDef *def = &tcg_op_defs[op];
-        int nb_oargs = def->nb_oargs;
-        int nb_iargs = def->nb_iargs;
-        int nb_cargs = def->nb_cargs;
-        /* TODO: Improve disassembler output. */
-        info->fprintf_func(info->stream, "%s\to=%d i=%d c=%d",
-                           def->name, nb_oargs, nb_iargs, nb_cargs);
+        /* The meaning of the operands depends on the opcode, see tci.c. */
+        info->fprintf_func(info->stream,
+                           "%-24s a=%d,%d,%d,%d,%d,%d i=0x%" PRIxPTR,
+                           tci_op_names[insn.opc], insn.a[0], insn.a[1],
+                           insn.a[2], insn.a[3], insn.a[4], insn.a[5], insn.i);
+        if (insn.target) {
+            info->fprintf_func(info->stream, " -> 0x%" PRIxPTR, insn.target);
+        }
     }
 
-    return length;
+    return sizeof(insn);
 }
@@ -43,6 +43,7 @@
 #else /* !CONFIG_USER_ONLY */
 #include "sysemu/xen-mapcache.h"
 #include "trace.h"
+#include "qemu/main-loop.h"
 #endif
 #include "exec/cpu-all.h"
 
@@ -2021,6 +2022,7 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
     hwaddr addr1;
     MemoryRegion *mr;
     bool error = false;
+    bool iothread_locked = qemu_tcg_lock_iothread();
 
     while (len > 0) {
         l = len;
@@ -2101,6 +2103,9 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
         addr += l;
     }
 
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
     return error;
 }
 
@@ -2236,6 +2241,8 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
 {
     MemoryRegion *mr;
     hwaddr l, xlat;
+    bool valid = true;
+    bool iothread_locked = qemu_tcg_lock_iothread();
 
     while (len > 0) {
         l = len;
@@ -2243,14 +2250,18 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
         if (!memory_access_is_direct(mr, is_write)) {
             l = memory_access_size(mr, l, addr);
             if (!memory_region_access_valid(mr, xlat, l, is_write)) {
-                return false;
+                valid = false;
+                break;
             }
         }
 
         len -= l;
         addr += l;
     }
-    return true;
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return valid;
 }
 
 /* Map a physical memory region into a host virtual address.
@@ -2260,10 +2271,10 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
  * Use cpu_register_map_client() to know when retrying the map operation is
  * likely to succeed.
  */
-void *address_space_map(AddressSpace *as,
-                        hwaddr addr,
-                        hwaddr *plen,
-                        bool is_write)
+static void *address_space_do_map(AddressSpace *as,
+                                  hwaddr addr,
+                                  hwaddr *plen,
+                                  bool is_write)
 {
     hwaddr len = *plen;
     hwaddr done = 0;
@@ -2320,6 +2331,20 @@ void *address_space_map(AddressSpace *as,
     return qemu_ram_ptr_length(raddr + base, plen);
 }
 
+void *address_space_map(AddressSpace *as,
+                        hwaddr addr,
+                        hwaddr *plen,
+                        bool is_write)
+{
+    bool iothread_locked = qemu_tcg_lock_iothread();
+    void *ptr = address_space_do_map(as, addr, plen, is_write);
+
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return ptr;
+}
+
 /* Unmaps a memory region previously mapped by address_space_map().
  * Will also mark the memory as dirty if is_write == 1.  access_len gives
  * the amount of memory that was actually read or written by the caller.
@@ -2373,6 +2398,7 @@ static inline uint32_t ldl_phys_internal(AddressSpace *as, hwaddr addr,
     MemoryRegion *mr;
     hwaddr l = 4;
     hwaddr addr1;
+    bool iothread_locked = qemu_tcg_lock_iothread();
 
     mr = address_space_translate(as, addr, &addr1, &l, false);
     if (l < 4 || !memory_access_is_direct(mr, false)) {
@@ -2404,6 +2430,9 @@ static inline uint32_t ldl_phys_internal(AddressSpace *as, hwaddr addr,
             break;
         }
     }
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
     return val;
 }
 
@@ -2431,6 +2460,7 @@ static inline uint64_t ldq_phys_internal(AddressSpace *as, hwaddr addr,
     MemoryRegion *mr;
     hwaddr l = 8;
     hwaddr addr1;
+    bool iothread_locked = qemu_tcg_lock_iothread();
 
     mr = address_space_translate(as, addr, &addr1, &l,
                                  false);
@@ -2463,6 +2493,9 @@ static inline uint64_t ldq_phys_internal(AddressSpace *as, hwaddr addr,
             break;
         }
     }
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
     return val;
 }
 
@@ -2498,6 +2531,7 @@ static inline uint32_t lduw_phys_internal(AddressSpace *as, hwaddr addr,
     MemoryRegion *mr;
     hwaddr l = 2;
     hwaddr addr1;
+    bool iothread_locked = qemu_tcg_lock_iothread();
 
     mr = address_space_translate(as, addr, &addr1, &l,
                                  false);
@@ -2530,6 +2564,9 @@ static inline uint32_t lduw_phys_internal(AddressSpace *as, hwaddr addr,
             break;
         }
     }
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
     return val;
 }
 
@@ -2557,6 +2594,7 @@ void stl_phys_notdirty(AddressSpace *as, hwaddr addr, uint32_t val)
     MemoryRegion *mr;
     hwaddr l = 4;
     hwaddr addr1;
+    bool iothread_locked = qemu_tcg_lock_iothread();
 
     mr = address_space_translate(as, addr, &addr1, &l,
                                  true);
@@ -2576,6 +2614,9 @@ void stl_phys_notdirty(AddressSpace *as, hwaddr addr, uint32_t val)
             }
         }
     }
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 /* warning: addr must be aligned */
@@ -2587,6 +2628,7 @@ static inline void stl_phys_internal(AddressSpace *as,
     MemoryRegion *mr;
     hwaddr l = 4;
     hwaddr addr1;
+    bool iothread_locked = qemu_tcg_lock_iothread();
 
     mr = address_space_translate(as, addr, &addr1, &l,
                                  true);
@@ -2618,6 +2660,9 @@ static inline void stl_phys_internal(AddressSpace *as,
         }
         invalidate_and_set_dirty(addr1, 4);
     }
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 void stl_phys(AddressSpace *as, hwaddr addr, uint32_t val)
@@ -2651,6 +2696,7 @@ static inline void stw_phys_internal(AddressSpace *as,
     MemoryRegion *mr;
     hwaddr l = 2;
     hwaddr addr1;
+    bool iothread_locked = qemu_tcg_lock_iothread();
 
     mr = address_space_translate(as, addr, &addr1, &l, true);
     if (l < 2 || !memory_access_is_direct(mr, true)) {
@@ -2681,6 +2727,9 @@ static inline void stw_phys_internal(AddressSpace *as,
         }
         invalidate_and_set_dirty(addr1, 2);
     }
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 void stw_phys(AddressSpace *as, hwaddr addr, uint32_t val)
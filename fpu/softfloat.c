@@ -62,6 +62,157 @@ these four paragraphs for those parts of this code that are retained.
 *----------------------------------------------------------------------------*/
 #include "softfloat-specialize.h"
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path.  Once the inexact flag is raised, and with the
+| round-to-nearest-even mode (the one of the host FPU, which QEMU never
+| changes), an operation on normal or zero operands gives the same result
+| and flags on the host FPU as in software, unless the result overflows or
+| is tiny: softfloat raises more flags for these, and the host FPU results
+| for them are recomputed in software.  Hosts that compute floats with
+| excess precision (x87) always use software.
+*----------------------------------------------------------------------------*/
+#include <float.h>
+#include <math.h>
+
+#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ == 0
+#define SOFTFLOAT_HOSTFP 1
+#else
+#define SOFTFLOAT_HOSTFP 0
+#endif
+
+enum {
+    hostfp_add,
+    hostfp_sub,
+    hostfp_mul,
+    hostfp_div,
+};
+
+static inline flag hostfp_enabled(float_status *status)
+{
+    return SOFTFLOAT_HOSTFP
+        && (STATUS(float_exception_flags) & float_flag_inexact)
+        && STATUS(float_rounding_mode) == float_round_nearest_even;
+}
+
+static inline flag float32_is_zero_or_normal(float32 a)
+{
+    uint32_t exp = float32_val(a) & 0x7f800000;
+
+    return float32_is_zero(a) || (exp != 0 && exp != 0x7f800000);
+}
+
+static inline flag float64_is_zero_or_normal(float64 a)
+{
+    uint64_t exp = float64_val(a) & LIT64(0x7ff0000000000000);
+
+    return float64_is_zero(a)
+        || (exp != 0 && exp != LIT64(0x7ff0000000000000));
+}
+
+static inline float float32_to_host(float32 a)
+{
+    union { uint32_t s; float h; } u;
+
+    u.s = float32_val(a);
+    return u.h;
+}
+
+static inline float32 float32_from_host(float h)
+{
+    union { uint32_t s; float h; } u;
+
+    u.h = h;
+    return make_float32(u.s);
+}
+
+static inline double float64_to_host(float64 a)
+{
+    union { uint64_t s; double h; } u;
+
+    u.s = float64_val(a);
+    return u.h;
+}
+
+static inline float64 float64_from_host(double h)
+{
+    union { uint64_t s; double h; } u;
+
+    u.h = h;
+    return make_float64(u.s);
+}
+
+/*----------------------------------------------------------------------------
+| Computes `a' `op' `b' on the host FPU into `*z', and returns 1, or returns
+| 0 if the operation must be done in software.
+*----------------------------------------------------------------------------*/
+
+static inline flag float32_hostfp(int op, float32 a, float32 b, float32 *z
+                                  STATUS_PARAM)
+{
+    float ha, hb, hz;
+
+    if (!hostfp_enabled(status)
+        || !float32_is_zero_or_normal(a) || !float32_is_zero_or_normal(b)
+        || (op == hostfp_div && float32_is_zero(b))) {
+        return 0;
+    }
+    ha = float32_to_host(a);
+    hb = float32_to_host(b);
+    switch (op) {
+    case hostfp_add:
+        hz = ha + hb;
+        break;
+    case hostfp_sub:
+        hz = ha - hb;
+        break;
+    case hostfp_mul:
+        hz = ha * hb;
+        break;
+    default:
+        hz = ha / hb;
+        break;
+    }
+    /* Also false for the zeros, which may have underflowed.  */
+    if (!(fabsf(hz) > FLT_MIN && fabsf(hz) <= FLT_MAX)) {
+        return 0;
+    }
+    *z = float32_from_host(hz);
+    return 1;
+}
+
+static inline flag float64_hostfp(int op, float64 a, float64 b, float64 *z
+                                  STATUS_PARAM)
+{
+    double ha, hb, hz;
+
+    if (!hostfp_enabled(status)
+        || !float64_is_zero_or_normal(a) || !float64_is_zero_or_normal(b)
+        || (op == hostfp_div && float64_is_zero(b))) {
+        return 0;
+    }
+    ha = float64_to_host(a);
+    hb = float64_to_host(b);
+    switch (op) {
+    case hostfp_add:
+        hz = ha + hb;
+        break;
+    case hostfp_sub:
+        hz = ha - hb;
+        break;
+    case hostfp_mul:
+        hz = ha * hb;
+        break;
+    default:
+        hz = ha / hb;
+        break;
+    }
+    if (!(fabs(hz) > DBL_MIN && fabs(hz) <= DBL_MAX)) {
+        return 0;
+    }
+    *z = float64_from_host(hz);
+    return 1;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the half-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -2025,6 +2176,11 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 float32 float32_add( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+    float32 z;
+
+    if (float32_hostfp(hostfp_add, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2048,6 +2204,11 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
 float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+    float32 z;
+
+    if (float32_hostfp(hostfp_sub, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2075,7 +2236,11 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
     uint32_t aSig, bSig;
     uint64_t zSig64;
     uint32_t zSig;
+    float32 z;
 
+    if (float32_hostfp(hostfp_mul, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2136,6 +2301,11 @@ float32 float32_div( float32 a, float32 b STATUS_PARAM )
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+    float32 z;
+
+    if (float32_hostfp(hostfp_div, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2527,6 +2697,11 @@ float32 float32_sqrt( float32 a STATUS_PARAM )
     int_fast16_t aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+
+    if (hostfp_enabled(status) && float32_is_zero_or_normal(a)
+        && !float32_is_neg(a)) {
+        return float32_from_host(sqrtf(float32_to_host(a)));
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat32Frac( a );
@@ -3769,6 +3944,11 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 float64 float64_add( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+    float64 z;
+
+    if (float64_hostfp(hostfp_add, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3792,6 +3972,11 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
 float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+    float64 z;
+
+    if (float64_hostfp(hostfp_sub, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3817,7 +4002,11 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
+    float64 z;
 
+    if (float64_hostfp(hostfp_mul, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3880,6 +4069,11 @@ float64 float64_div( float64 a, float64 b STATUS_PARAM )
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+    float64 z;
+
+    if (float64_hostfp(hostfp_div, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -4283,6 +4477,11 @@ float64 float64_sqrt( float64 a STATUS_PARAM )
     int_fast16_t aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+
+    if (hostfp_enabled(status) && float64_is_zero_or_normal(a)
+        && !float64_is_neg(a)) {
+        return float64_from_host(sqrt(float64_to_host(a)));
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat64Frac( a );
@@ -846,6 +846,37 @@ STEXI
 @findex nmi
 Inject an NMI (x86) or RESTART (s390x) on the given CPU.
 
+ETEXI
+
+    {
+        .name       = "guest_profile_start",
+        .args_type  = "frequency:i?",
+        .params     = "[frequency]",
+        .help       = "start sampling the guest code, 'frequency' times "
+                      "per second (default 997)",
+        .mhandler.cmd = hmp_guest_profile_start,
+    },
+
+STEXI
+@item guest_profile_start [@var{frequency}]
+@findex guest_profile_start
+Start sampling the guest code that the vCPUs run, @var{frequency} times
+per second and per vCPU (997 by default), and drop the previous samples.
+Only with the TCG accelerator.  See @code{info guest-profile}.
+ETEXI
+
+    {
+        .name       = "guest_profile_stop",
+        .args_type  = "",
+        .params     = "",
+        .help       = "stop sampling the guest code",
+        .mhandler.cmd = hmp_guest_profile_stop,
+    },
+
+STEXI
+@item guest_profile_stop
+@findex guest_profile_stop
+Stop sampling the guest code.
 ETEXI
 
     {
@@ -1730,6 +1761,7 @@ show i8259 (PIC) state
 show emulated PCI device info
 @item info tlb
 show virtual to physical memory mappings (i386, SH4, SPARC, PPC, and Xtensa only)
+and how many softmmu TLB misses the victim TLB served
 @item info mem
 show the active virtual memory mappings (i386 only)
 @item info jit
@@ -1744,6 +1776,8 @@ show USB devices plugged on the virtual USB hub
 show all USB host devices
 @item info profile
 show profiling information
+@item info guest-profile
+show the samples of guest_profile_start, as folded stacks
 @item info capture
 show information about active capturing
 @item info snapshots
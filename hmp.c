@@ -868,6 +868,49 @@ void hmp_inject_nmi(Monitor *mon, const QDict *qdict)
     hmp_handle_error(mon, &err);
 }
 
+void hmp_guest_profile_start(Monitor *mon, const QDict *qdict)
+{
+    bool has_frequency = qdict_haskey(qdict, "frequency");
+    int64_t frequency = qdict_get_try_int(qdict, "frequency", 0);
+    Error *err = NULL;
+
+    qmp_guest_profile_start(has_frequency, frequency, &err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_guest_profile_stop(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_guest_profile_stop(&err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_info_guest_profile(Monitor *mon, const QDict *qdict)
+{
+    GuestProfile *info;
+    GuestProfileStackList *stack;
+    Error *err = NULL;
+
+    info = qmp_query_guest_profile(&err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    /* a line that flamegraph.pl ignores */
+    monitor_printf(mon, "# %s, %" PRId64 " samples at %" PRId64 " Hz, "
+                   "%" PRId64 " lost\n",
+                   info->running ? "running" : "stopped",
+                   info->samples, info->frequency, info->lost);
+    for (stack = info->stacks; stack; stack = stack->next) {
+        monitor_printf(mon, "%s %" PRId64 "\n",
+                       stack->value->stack, stack->value->count);
+    }
+
+    qapi_free_GuestProfile(info);
+}
+
 void hmp_set_link(Monitor *mon, const QDict *qdict)
 {
     const char *name = qdict_get_str(qdict, "name");
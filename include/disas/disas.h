@@ -45,4 +45,8 @@ struct syminfo {
 /* Filled in by elfload.c.  Simplistic, but will do for now. */
 extern struct syminfo *syminfos;
 
+/* Add "s" to syminfos and to the index used by lookup_symbol(), its
+ * symbol table is of the given ELFCLASS32/ELFCLASS64 type.  */
+void syminfo_register(struct syminfo *s, int elf_class);
+
 #endif /* _QEMU_DISAS_H */
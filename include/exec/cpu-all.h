@@ -331,8 +331,11 @@ extern RAMList ram_list;
 #define TLB_NOTDIRTY    (1 << 4)
 /* Set if TLB entry is an IO callback.  */
 #define TLB_MMIO        (1 << 5)
+/* Set if accesses to the page may be intercepted by a TCG plugin.  */
+#define TLB_WATCHED     (1 << 6)
 
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf);
+void dump_tlb_info(FILE *f, fprintf_function cpu_fprintf, CPUState *cpu);
 ram_addr_t last_ram_offset(void);
 void qemu_mutex_lock_ramlist(void);
 void qemu_mutex_unlock_ramlist(void);
@@ -69,8 +69,22 @@ typedef uint64_t target_ulong;
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
 #if !defined(CONFIG_USER_ONLY)
+/* Size of tlb_table, that is, the largest size of the TLB of an MMU
+   mode.  When the TCG backend supports it (TCG_TARGET_DYNAMIC_TLB) the
+   number of entries in use varies between 1 << CPU_TLB_DYN_MIN_BITS
+   and CPU_TLB_SIZE, see tlb_mask.  The x86 backend can index a larger
+   table than the other ones.  */
+#if defined(__i386__) || defined(__x86_64__)
+#define CPU_TLB_BITS 10
+#else
 #define CPU_TLB_BITS 8
+#endif
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+/* Fully associative TLB of the entries recently evicted from tlb_table,
+   looked up in the softmmu slow path before walking the page tables.  */
+#define CPU_VTLB_SIZE 8
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -100,12 +114,30 @@ typedef struct CPUTLBEntry {
 
 QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 
+/* Use of the TLB of an MMU mode since it was last flushed, to decide
+   its next size.  */
+typedef struct CPUTLBDesc {
+    unsigned int bits;          /* log2 of the number of entries in use */
+    unsigned int used;          /* entries filled while invalid */
+    unsigned int evictions;     /* entries filled while valid */
+    unsigned int low_usage;     /* consecutive flushes with few entries used */
+} CPUTLBDesc;
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
+    /* Mask of the byte offsets of the tlb_table entries in use. */     \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
     hwaddr iotlb[NB_MMU_MODES][CPU_TLB_SIZE];               \
+    hwaddr iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                        \
     target_ulong tlb_flush_addr;                                        \
-    target_ulong tlb_flush_mask;
+    target_ulong tlb_flush_mask;                                        \
+    unsigned int vtlb_index;                                            \
+    /* Slow path lookups served by the victim TLB, or by tlb_fill(). */ \
+    uint64_t vtlb_hits;                                                 \
+    uint64_t vtlb_misses;                                               \
+    CPUTLBDesc tlb_desc[NB_MMU_MODES];
 
 #else
 
@@ -163,6 +163,20 @@
 /* The memory helpers for tcg-generated code need tcg_target_long etc.  */
 #include "tcg.h"
 
+/* Index of the entry of "addr" in the TLB of "mmu_idx", whose size may
+   vary, see tlb_mask.  */
+static inline int tlb_index(CPUArchState *env, int mmu_idx, target_ulong addr)
+{
+    return (addr >> TARGET_PAGE_BITS)
+        & (env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS);
+}
+
+/* Number of entries in use in the TLB of "mmu_idx".  */
+static inline int tlb_n_entries(CPUArchState *env, int mmu_idx)
+{
+    return (env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS) + 1;
+}
+
 uint8_t helper_ldb_mmu(CPUArchState *env, target_ulong addr, int mmu_idx);
 uint16_t helper_ldw_mmu(CPUArchState *env, target_ulong addr, int mmu_idx);
 uint32_t helper_ldl_mmu(CPUArchState *env, target_ulong addr, int mmu_idx);
@@ -361,7 +375,7 @@ uint64_t helper_ldq_cmmu(CPUArchState *env, target_ulong addr, int mmu_idx);
 static inline void *tlb_vaddr_to_host(CPUArchState *env, target_ulong addr,
                                       int access_type, int mmu_idx)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     CPUTLBEntry *tlbentry = &env->tlb_table[mmu_idx][index];
     target_ulong tlb_addr;
     uintptr_t haddr;
@@ -21,6 +21,7 @@
 #define _EXEC_ALL_H_
 
 #include "qemu-common.h"
+#include "qemu/atomic.h"
 
 /* allow to see translation results - the slowdown should be negligible, so we leave it */
 #define DEBUG_DISAS
@@ -126,8 +127,9 @@ static inline void tlb_flush(CPUState *cpu, int flush_global)
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
-#define CODE_GEN_PHYS_HASH_BITS     15
-#define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
+/* initial number of entries of tb_ctx.htable, it grows as needed */
+#define CODE_GEN_HTABLE_BITS     15
+#define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
 /* estimated block size for TB allocation */
 /* XXX: use a per code average code fragment size and modulate it
@@ -152,13 +154,12 @@ struct TranslationBlock {
     uint64_t flags; /* flags defining in which context the code was generated */
     uint16_t size;      /* size of target code for this block (1 <=
                            size <= TARGET_PAGE_SIZE) */
-    uint16_t cflags;    /* compile flags */
+    uint32_t cflags;    /* compile flags */
 #define CF_COUNT_MASK  0x7fff
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
+#define CF_SUPERBLOCK  0x10000 /* Hot TB, see tb_trace_branch().  */
 
     void *tc_ptr;    /* pointer to the translated code */
-    /* next matching tb for physical address. */
-    struct TranslationBlock *phys_hash_next;
     /* first and second physical page containing code. The lower bit
        of the pointer tells the index in page_next[] */
     struct TranslationBlock *page_next[2];
@@ -180,24 +181,62 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_first;
     uint32_t icount;
 
+    /* With tb_hot_threshold: the number of times a cold TB was run from
+       cpu_exec, and left by each goto_tb slot, see tb_trace_branch().
+       For a superblock, the slot followed at each of its conditional
+       branches, 2 bits per branch.  */
+    uint32_t exec_count;
+    uint32_t exit_count[2];
+    uint32_t trace;
+
+    /* What the TCG plugins did when translating this TB, replayed by
+       cpu_restore_state_from_tb(), see tcg/tcg-plugin.c.  */
     void *tcg_plugin_opaque;
 };
 
 #include "exec/spinlock.h"
+#include "qemu/qht.h"
 
 typedef struct TBContext TBContext;
 
+/* The translation buffer is split into regions which are filled in
+   turn.  Once the last one is full, the oldest region is evicted
+   instead of flushing all the translated code.  */
+#define TB_MAX_REGIONS 8
+
+typedef struct TBRegion {
+    void *code_start;
+    /* end of the generated code, valid once the region is full */
+    void *code_end;
+    /* threshold to move on to the next region */
+    void *code_max;
+    /* the TBs of the region are tbs[first_tb .. first_tb + nb_tbs - 1],
+       sorted by tc_ptr */
+    int first_tb;
+    int nb_tbs;
+    int max_tbs;
+} TBRegion;
+
 struct TBContext {
 
     TranslationBlock *tbs;
-    TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+    /* the valid TBs, see tb_hash_func() */
+    QHT htable;
+    /* number of TBs in all the regions */
     int nb_tbs;
-    /* any access to the tbs or the page table must use this lock */
+    TBRegion regions[TB_MAX_REGIONS];
+    int nb_regions;
+    int current_region;
+    /* user mode lock behind tb_lock(), see translate-all.c */
     spinlock_t tb_lock;
 
     /* statistics */
     int tb_flush_count;
     int tb_phys_invalidate_count;
+    int tb_region_evict_count;
+    int64_t tb_evict_count;
+    int64_t tb_gen_count;
+    int64_t tb_gen_target_size;
 
     int tb_invalidated_flag;
 };
@@ -217,23 +256,53 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 	    | (tmp & TB_JMP_ADDR_MASK));
 }
 
-static inline unsigned int tb_phys_hash_func(tb_page_addr_t pc)
+static inline uint64_t tb_hash_mix(uint64_t h, uint64_t v)
 {
-    return (pc >> 2) & (CODE_GEN_PHYS_HASH_SIZE - 1);
+    h ^= v * 0xc2b2ae3d27d4eb4fULL;
+    h = (h << 31) | (h >> 33);
+    return h * 0x9e3779b185ebca87ULL;
+}
+
+/* Hash of the key of a TB in tb_ctx.htable, mixed like in xxHash so
+   that the TBs of a page, or of a PC in several CPU modes, spread over
+   the buckets.  */
+static inline uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc,
+                                    uint64_t flags, target_ulong cs_base)
+{
+    uint64_t h = 0x27d4eb2f165667c5ULL;
+
+    h = tb_hash_mix(h, phys_pc);
+    h = tb_hash_mix(h, pc);
+    h = tb_hash_mix(h, flags);
+    h = tb_hash_mix(h, cs_base);
+
+    h ^= h >> 33;
+    h *= 0xc2b2ae3d27d4eb4fULL;
+    h ^= h >> 29;
+    h *= 0x165667b19e3779f9ULL;
+    h ^= h >> 32;
+    return h;
 }
 
 void tb_free(TranslationBlock *tb);
-void tb_flush(CPUArchState *env);
+bool tb_flush(CPUArchState *env);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+void tb_lock(void);
+void tb_unlock(void);
+void tb_lock_reset(void);
+#if !defined(CONFIG_USER_ONLY)
+void tb_run_deferred_work(CPUArchState *env);
+void tcg_atomic_lock(uintptr_t retaddr);
+void tcg_atomic_unlock(void);
+#endif
 
 #if defined(USE_DIRECT_JUMP)
 
 #if defined(CONFIG_TCG_INTERPRETER)
 static inline void tb_set_jmp_target1(uintptr_t jmp_addr, uintptr_t addr)
 {
-    /* patch the branch destination */
-    *(uint32_t *)jmp_addr = addr - (jmp_addr + 4);
-    /* no need to flush icache explicitly */
+    /* patch the target of the goto_tb instruction, a TCIInsn */
+    atomic_set((uintptr_t *)jmp_addr, addr);
 }
 #elif defined(_ARCH_PPC)
 void ppc_tb_set_jmp_target(uintptr_t jmp_addr, uintptr_t addr);
@@ -241,8 +310,9 @@ void ppc_tb_set_jmp_target(uintptr_t jmp_addr, uintptr_t addr);
 #elif defined(__i386__) || defined(__x86_64__)
 static inline void tb_set_jmp_target1(uintptr_t jmp_addr, uintptr_t addr)
 {
-    /* patch the branch destination */
-    stl_le_p((void*)jmp_addr, addr - (jmp_addr + 4));
+    /* patch the branch destination, aligned by tcg_out_op so that the
+       store is atomic */
+    atomic_set((int32_t *)jmp_addr, addr - (jmp_addr + 4));
     /* no need to flush icache explicitly */
 }
 #elif defined(__s390x__)
@@ -356,6 +426,9 @@ bool io_mem_write(struct MemoryRegion *mr, hwaddr addr,
 void tlb_fill(CPUState *cpu, target_ulong addr, int is_write, int mmu_idx,
               uintptr_t retaddr);
 
+/* cpu-profile.c */
+void cpu_profile_sample(CPUState *cpu, target_ulong pc);
+
 #endif
 
 #if defined(CONFIG_USER_ONLY)
@@ -375,9 +448,16 @@ void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler);
 /* vl.c */
 extern int singlestep;
 
+/* translate-all.c */
+extern unsigned int tb_hot_threshold;
+
 /* cpu-exec.c */
 extern volatile sig_atomic_t exit_request;
 
+#define TB_TRACE_MAX_BRANCHES 16
+int tb_trace_branch(CPUArchState *env, TranslationBlock *tb, int n,
+                    target_ulong block_pc, bool search_pc);
+
 /**
  * cpu_can_do_io:
  * @cpu: The CPU for which to check IO.
@@ -0,0 +1,28 @@
+/*
+ * Persistent translation cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef TRANSLATE_CACHE_H
+#define TRANSLATE_CACHE_H
+
+#include "exec/exec-all.h"
+
+/* tb_cache_init (qemu-common.h) uses the file "path" as translation
+   cache, for the TCG configuration described by "config" (machine, CPU
+   model, ...).  */
+
+/* Fill "tb" with the code that a previous run generated for it, if its
+   guest code didn't change meanwhile.  Called with tb_lock held by
+   tb_gen_code, the size of the host code is returned in "code_size".  */
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, int *code_size);
+
+/* Save the code just generated for "tb", if it can be reused.  */
+void tb_cache_save(CPUState *cpu, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, int code_size);
+
+#endif
@@ -258,6 +258,9 @@ typedef struct PCIHostDeviceAddress {
 
 void tcg_exec_init(unsigned long tb_size);
 bool tcg_enabled(void);
+void tb_cache_init(const char *path, const char *config);
+void tb_hot_init(unsigned int threshold);
+void tcg_perf_init(bool perf_map, bool jitdump);
 
 void cpu_exec_init_all(void);
 
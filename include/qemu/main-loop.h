@@ -299,6 +299,23 @@ void qemu_mutex_lock_iothread(void);
  */
 void qemu_mutex_unlock_iothread(void);
 
+/**
+ * qemu_mutex_iothread_locked: Return whether the calling thread holds the
+ * main loop mutex, taken with qemu_mutex_lock_iothread.
+ */
+bool qemu_mutex_iothread_locked(void);
+
+/**
+ * qemu_tcg_lock_iothread: Lock the main loop mutex from a vCPU thread.
+ *
+ * With -tcg-threads multi the vCPU threads run the guest code without the
+ * main loop mutex, and must take it to access the devices and the other
+ * state shared with the main loop.  Return true if the mutex was taken,
+ * in which case the caller unlocks it with qemu_mutex_unlock_iothread;
+ * return false if it was already held or isn't needed.
+ */
+bool qemu_tcg_lock_iothread(void);
+
 /* internal interfaces */
 
 void qemu_fd_register(int fd);
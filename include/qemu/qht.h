@@ -0,0 +1,87 @@
+/*
+ * QHT: resizable hash table with lock-free lookups
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_QHT_H
+#define QEMU_QHT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "qemu/thread.h"
+
+/* QHT: resizable hash table with lock-free lookups
+ *
+ * The table stores pointers along with their 32-bit hash, the caller
+ * computes the hashes and compares the keys (see qht_lookup).  It is
+ * meant for read-mostly workloads:
+ *
+ * 1. Lookups take no lock: each bucket is protected by a seqlock and a
+ *    lookup is retried if a writer modified the bucket meanwhile.
+ * 2. Insertions, removals and resizes are serialized by a mutex.
+ * 3. With QHT_MODE_AUTO_RESIZE, the number of buckets doubles when too
+ *    many chained buckets were needed, which keeps the chains short.
+ *
+ * A lookup may call the comparison function on an object being removed
+ * concurrently, so the objects must stay readable while lookups run.
+ * For the same reason, the buckets replaced by a resize are only freed
+ * by qht_destroy; since the table only grows by doubling, they take at
+ * most as much memory as the current buckets.
+ */
+
+#define QHT_MODE_AUTO_RESIZE 0x1
+
+typedef struct QHTMap QHTMap;
+
+typedef struct QHT {
+    QHTMap *map;
+    QemuMutex lock;     /* serializes the writers */
+    unsigned int mode;
+} QHT;
+
+typedef struct QHTStats {
+    size_t head_buckets;        /* number of buckets */
+    size_t used_head_buckets;   /* buckets holding at least one entry */
+    size_t entries;
+    size_t max_chain;           /* longest chain, in buckets */
+    double avg_chain;           /* average chain of the used buckets */
+} QHTStats;
+
+/* Return true if the object "obj" has the key "userp".  */
+typedef bool (*QHTLookupFunc)(const void *obj, const void *userp);
+typedef void (*QHTIterFunc)(QHT *ht, void *p, uint32_t hash, void *userp);
+
+/* Initialize "ht" to hold "n_elems" entries without resizing.  */
+void qht_init(QHT *ht, size_t n_elems, unsigned int mode);
+void qht_destroy(QHT *ht);
+
+/* Insert "p" (not NULL) with "hash".  Return false if it already is in
+   the table.  */
+bool qht_insert(QHT *ht, void *p, uint32_t hash);
+
+/* Remove "p", which was inserted with "hash".  Return false if it isn't
+   in the table.  */
+bool qht_remove(QHT *ht, const void *p, uint32_t hash);
+
+/* Return the first entry with "hash" for which "func" returns true, or
+   NULL.  May be called concurrently with the writers.  */
+void *qht_lookup(QHT *ht, QHTLookupFunc func, const void *userp,
+                 uint32_t hash);
+
+/* Remove all the entries, keeping the size of the table.  */
+void qht_reset(QHT *ht);
+
+/* Resize the table to hold "n_elems" entries.  Return false if the
+   size wouldn't change.  */
+bool qht_resize(QHT *ht, size_t n_elems);
+
+/* Call "func" on every entry, the table must not be modified meanwhile.  */
+void qht_iter(QHT *ht, QHTIterFunc func, void *userp);
+
+void qht_statistics(QHT *ht, QHTStats *stats);
+
+#endif
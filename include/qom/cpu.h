@@ -187,7 +187,8 @@ struct kvm_run;
  * @nr_threads: Number of threads within this CPU.
  * @numa_node: NUMA node this CPU is belonging to.
  * @host_tid: Host thread ID.
- * @running: #true if CPU is currently running (usermode).
+ * @running: #true if CPU is currently running (usermode, and system mode
+ *   with -tcg-threads multi, see qemu_tcg_start_exclusive).
  * @created: Indicates whether the CPU thread has been successfully created.
  * @interrupt_request: Indicates a pending interrupt request.
  * @halted: Nonzero if the CPU is in suspended state.
@@ -208,6 +209,8 @@ struct kvm_run;
  * @gdb_num_g_regs: Number of registers in GDB 'g' packets.
  * @next_cpu: Next CPU sharing TB cache.
  * @opaque: User data.
+ * @profile: Guest PCs sampled by the profiler, see cpu-profile.c.
+ * @profile_request: Set by the profiler for the next TB to take a sample.
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @mem_io_vaddr: Target virtual address at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
@@ -261,6 +264,9 @@ struct CPUState {
 
     void *opaque;
 
+    struct CPUProfile *profile;
+    volatile sig_atomic_t profile_request;
+
     /* In order to avoid passing too many arguments to the MMIO helpers,
      * we store some rarely used information in the CPU context.
      */
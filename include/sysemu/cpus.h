@@ -6,6 +6,20 @@ void qemu_init_cpu_loop(void);
 void resume_all_vcpus(void);
 void pause_all_vcpus(void);
 void cpu_stop_current(void);
+void qemu_tcg_restart_vcpu_thread(void);
+void qemu_tcg_configure(const char *mode);
+
+/* With -tcg-threads multi, run with the other vCPUs out of cpu_exec.
+   The caller holds the iothread lock, and must not be in cpu_exec.  */
+void qemu_tcg_start_exclusive(void);
+void qemu_tcg_end_exclusive(void);
+
+/* Same, from a helper of the vCPU "cpu" that holds no lock.  Return
+   false, without waiting, if another exclusive section is pending: the
+   vCPU must leave cpu_exec for it to start.  The section is left with
+   the iothread lock released.  */
+bool qemu_tcg_cpu_start_exclusive(CPUState *cpu);
+void qemu_tcg_cpu_end_exclusive(CPUState *cpu);
 
 void cpu_synchronize_all_states(void);
 void cpu_synchronize_all_post_reset(void);
@@ -2163,9 +2163,8 @@ static void load_symbols_(struct elfhdr *hdr, int fd, const char *filename, abi_
     s->disas_symtab.elf64 = syms;
 #endif
     s->lookup_symbol = lookup_symbolxx;
-    s->next = syminfos;
     s->filename = g_strdup(filename);
-    syminfos = s;
+    syminfo_register(s, ELF_CLASS);
 
     return;
 
@@ -43,6 +43,8 @@ const char *argv0;
 int gdbstub_port;
 envlist_t *envlist;
 static const char *cpu_model;
+static int tb_hot;
+static bool perf_map, jitdump;
 unsigned long mmap_min_addr;
 #if defined(CONFIG_USE_GUEST_BASE)
 unsigned long guest_base;
@@ -3620,6 +3622,25 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tb_hot(const char *arg)
+{
+    tb_hot = strtol(arg, NULL, 0);
+    if (tb_hot <= 0) {
+        fprintf(stderr, "Invalid -tb-hot threshold '%s'\n", arg);
+        exit(1);
+    }
+}
+
+static void handle_arg_perfmap(const char *arg)
+{
+    perf_map = true;
+}
+
+static void handle_arg_jitdump(const char *arg)
+{
+    jitdump = true;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3675,6 +3696,12 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tb-hot",     "QEMU_TB_HOT",      true,  handle_arg_tb_hot,
+     "n",          "translate again as superblocks the blocks run n times"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "describe the generated code to perf in /tmp/perf-PID.map"},
+    {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
+     "",           "describe the generated code to perf in /tmp/jit-PID.dump"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
@@ -3918,6 +3945,12 @@ int main(int argc, char **argv, char **envp)
 #endif
     }
     tcg_exec_init(0);
+    if (tb_hot) {
+        tb_hot_init(tb_hot);
+    }
+    if (perf_map || jitdump) {
+        tcg_perf_init(perf_map, jitdump);
+    }
     cpu_exec_init_all();
     /* NOTE: we need to init the CPU at this stage to get
        qemu_host_page_size */
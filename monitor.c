@@ -1938,6 +1938,15 @@ static void tlb_info(Monitor *mon, const QDict *qdict)
 }
 #endif
 
+static void do_info_tlb(Monitor *mon, const QDict *qdict)
+{
+#if defined(TARGET_I386) || defined(TARGET_SH4) || defined(TARGET_SPARC) || \
+    defined(TARGET_PPC) || defined(TARGET_XTENSA)
+    tlb_info(mon, qdict);
+#endif
+    dump_tlb_info((FILE *)mon, monitor_fprintf, ENV_GET_CPU(mon_get_cpu()));
+}
+
 static void do_info_mtree(Monitor *mon, const QDict *qdict)
 {
     mtree_info((fprintf_function)monitor_printf, mon);
@@ -2698,16 +2707,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show PCI info",
         .mhandler.cmd = hmp_info_pci,
     },
-#if defined(TARGET_I386) || defined(TARGET_SH4) || defined(TARGET_SPARC) || \
-    defined(TARGET_PPC) || defined(TARGET_XTENSA)
     {
         .name       = "tlb",
         .args_type  = "",
         .params     = "",
-        .help       = "show virtual to physical memory mappings",
-        .mhandler.cmd = tlb_info,
+        .help       = "show virtual to physical memory mappings and TLB statistics",
+        .mhandler.cmd = do_info_tlb,
     },
-#endif
 #if defined(TARGET_I386)
     {
         .name       = "mem",
@@ -2766,6 +2772,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show profiling information",
         .mhandler.cmd = do_info_profile,
     },
+    {
+        .name       = "guest-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the samples of the guest code, as folded stacks",
+        .mhandler.cmd = hmp_info_guest_profile,
+    },
     {
         .name       = "capture",
         .args_type  = "",
@@ -3130,6 +3130,78 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tcg-threads", HAS_ARG, QEMU_OPTION_tcg_threads, \
+    "-tcg-threads single|multi\n" \
+    "                run the TCG vCPUs in a single host thread (default),\n" \
+    "                or each in its own host thread\n", QEMU_ARCH_ALL)
+STEXI
+@item -tcg-threads single|multi
+@findex -tcg-threads
+With @option{multi}, each emulated CPU runs in its own host thread instead
+of sharing a single one, so that SMP guests use several host CPUs.  It is
+only supported for x86 and ARM guests on x86 and AArch64 hosts, and not
+with @option{-icount}.
+ETEXI
+
+DEF("tb-cache", HAS_ARG, QEMU_OPTION_tb_cache, \
+    "-tb-cache file  save the translated code to file, and reuse it\n" \
+    "                in the next runs\n", QEMU_ARCH_ALL)
+STEXI
+@item -tb-cache @var{file}
+@findex -tb-cache
+Save the host code generated by TCG to @var{file}, and copy it back
+instead of translating the same guest code again in the next runs with
+the same QEMU binary, machine and CPU model.  A block is only reused if
+the guest code in memory did not change.  The file is replaced when the
+configuration changes.  The cache is only supported on x86_64 hosts, and
+only works across runs if the QEMU binary is loaded at the same address:
+build it without @option{--enable-pie}, or disable address space layout
+randomization.  Not available with @option{-tcg-plugin}.
+ETEXI
+
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        describe the generated code to perf in /tmp/perf-PID.map\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -perfmap
+@findex -perfmap
+Write the host address, the size and the guest symbol of the code
+generated for each block to @file{/tmp/perf-@var{pid}.map}, so that the
+@command{perf} tool of Linux reports the host time spent in the guest
+functions.  The addresses of the generated code are reused after the
+translation buffer is flushed, which perf cannot tell apart: use
+@option{-jitdump} for long runs.
+ETEXI
+
+DEF("jitdump", 0, QEMU_OPTION_jitdump, \
+    "-jitdump        describe the generated code to perf in /tmp/jit-PID.dump\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -jitdump
+@findex -jitdump
+Write the generated code of each block, with its guest symbol, to the
+jitdump file @file{/tmp/jit-@var{pid}.dump}.  The records are timestamped,
+so that the samples are attributed to the right block even after the
+translation buffer was flushed.  Record with @code{perf record -k mono},
+then run @code{perf inject --jit} on the result before @code{perf report}.
+ETEXI
+
+DEF("tb-hot", HAS_ARG, QEMU_OPTION_tb_hot, \
+    "-tb-hot n       translate again as superblocks the blocks run n times\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-hot @var{n}
+@findex -tb-hot
+Translate again the blocks of guest code that ran @var{n} times, as
+superblocks: the translation goes on across the direct jumps forward in
+the same page, and across the conditional jumps that mostly go the same
+way, so that the generated code is optimized over several blocks.  Until
+they run @var{n} times, the blocks are not chained together, for their
+executions to be counted: a few hundreds is a good value.  Only
+supported for x86 guests, and not with @option{-icount} or
+@option{-tcg-plugin}.
+ETEXI
+
 #ifdef CONFIG_TCG_PLUGIN
 DEF("tcg-plugin", HAS_ARG, QEMU_OPTION_tcg_plugin, \
     "-tcg-plugin dso load the dynamic shared object as TCG plugin\n", QEMU_ARCH_ALL)
@@ -3140,6 +3212,7 @@ The TCG plugin support allows an external shared library to be
 notified each time a basic block is translated into the TCG internal
 representation, in the aim of instrumenting the emulated code to
 produce program analysis, à la Valgrind or DynamoRIO for instance.
+This option can be repeated to load several plugins.
 ETEXI
 #endif
 
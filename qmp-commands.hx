@@ -3754,4 +3754,91 @@ Example:
 -> { "execute": "rtc-reset-reinjection" }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "guest-profile-start",
+        .args_type  = "frequency:i?",
+        .mhandler.cmd_new = qmp_marshal_input_guest_profile_start,
+    },
+
+SQMP
+guest-profile-start
+-------------------
+
+Start sampling the guest code that the vCPUs run.  The samples of the
+previous profile are dropped.  Only with the TCG accelerator.
+
+Arguments:
+
+- "frequency": number of samples per second and per vCPU, up to 10000
+               (json-int, optional, default 997)
+
+Example:
+
+-> { "execute": "guest-profile-start", "arguments": { "frequency": 499 } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "guest-profile-stop",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_guest_profile_stop,
+    },
+
+SQMP
+guest-profile-stop
+------------------
+
+Stop sampling the guest code.  The profile remains available to
+query-guest-profile.
+
+Arguments: None.
+
+Example:
+
+-> { "execute": "guest-profile-stop" }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "query-guest-profile",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_guest_profile,
+    },
+
+SQMP
+query-guest-profile
+-------------------
+
+Return the samples taken since guest-profile-start, merged by guest
+function.
+
+Return a json-object with the following information:
+
+- "running": true if the profiler is sampling (json-bool)
+- "frequency": number of samples per second and per vCPU (json-int)
+- "samples": number of samples in "stacks" (json-int)
+- "lost": number of samples that did not fit in the histogram of their
+          vCPU (json-int)
+- "stacks": a json-array of json-objects, the most sampled first:
+  - "stack": "cpuN;symbol", the vCPU and the guest function, in the
+             folded stack format of flamegraph.pl.  The PC replaces the
+             symbol when it is unknown, "[idle]" stands for a halted vCPU
+             (json-string)
+  - "count": number of samples (json-int)
+
+Example:
+
+-> { "execute": "query-guest-profile" }
+<- { "return": { "running": true, "frequency": 997, "samples": 2991,
+                 "lost": 0,
+                 "stacks": [ { "stack": "cpu0;memcpy", "count": 2011 },
+                             { "stack": "cpu0;[idle]", "count": 702 },
+                             { "stack": "cpu0;0xc0101f40", "count": 278 } ]
+               }
+   }
+
 EQMP
@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+#
+# Micro-benchmark of the TCG plugins: host instructions generated (and
+# optionally executed) per guest instruction, with and without
+# instrumentation.
+#
+# This work is licensed under the terms of the GNU GPL, version 2.  See
+# the COPYING file in the top-level directory.
+#
+# For help see tcg/plugins/README
+
+import os
+import re
+import sys
+import time
+import tempfile
+import subprocess
+
+def count_log(filename):
+    '''Return the number of guest and host instructions logged by
+       "-d in_asm,out_asm" into filename'''
+    guest = host = 0
+    section = None
+    with open(filename) as fobj:
+        for line in fobj:
+            if line.startswith('IN:'):
+                section = 'in'
+            elif line.startswith('OUT:'):
+                section = 'out'
+            elif line.startswith('PROLOGUE:') or line.startswith('---'):
+                section = None
+            elif line.startswith('0x'):
+                if section == 'in':
+                    guest += 1
+                elif section == 'out':
+                    host += 1
+    return guest, host
+
+def qemu_args(command, plugins, options=()):
+    '''Return the command line of the emulator with the given plugins and
+       options'''
+    args = [command[0]] + list(options)
+    for plugin in plugins:
+        args += ['-tcg-plugin', plugin]
+    return args + command[1:]
+
+def run(args):
+    '''Run the command line, return the wall-clock time and the output'''
+    start = time.time()
+    process = subprocess.Popen(args, stdout=subprocess.PIPE,
+                               stderr=subprocess.STDOUT)
+    output = process.communicate()[0]
+    return time.time() - start, output
+
+def translated(command, plugins):
+    '''Return the number of guest and host instructions translated'''
+    fd, log = tempfile.mkstemp(prefix='tcg-plugin-bench.')
+    os.close(fd)
+    try:
+        run(qemu_args(command, plugins, ['-d', 'in_asm,out_asm', '-D', log]))
+        return count_log(log)
+    finally:
+        os.unlink(log)
+
+def executed_guest(command):
+    '''Return the number of guest instructions executed, as counted by the
+       plugin icount-inlined'''
+    _, output = run(qemu_args(command, ['icount-inlined']))
+    return sum(int(n) for n in
+               re.findall(r'number of executed instructions on CPU #\d+ = (\d+)',
+                          output.decode('ascii', 'replace')))
+
+def executed_host(command, plugins):
+    '''Return the number of host instructions executed, as counted by
+       perf(1)'''
+    fd, stat = tempfile.mkstemp(prefix='tcg-plugin-bench.')
+    os.close(fd)
+    try:
+        run(['perf', 'stat', '-x,', '-e', 'instructions', '-o', stat]
+            + qemu_args(command, plugins))
+        with open(stat) as fobj:
+            for line in fobj:
+                fields = line.split(',')
+                if len(fields) > 2 and fields[2].startswith('instructions'):
+                    return int(fields[0])
+    finally:
+        os.unlink(stat)
+    return 0
+
+def main():
+    argv = sys.argv[1:]
+    configurations = [[]]
+    repeat = 5
+    perf = False
+
+    while argv and argv[0] != '--':
+        option = argv.pop(0)
+        if option == '--plugin' and argv:
+            configurations.append(argv.pop(0).split(','))
+        elif option == '--repeat' and argv:
+            repeat = int(argv.pop(0))
+        elif option == '--perf':
+            perf = True
+        else:
+            argv = []
+    command = argv[1:]
+
+    if not command:
+        sys.stderr.write('usage: %s [--repeat N] [--perf] [--plugin name[,name...]]... '
+                         '-- <qemu-user> <program> [<args>...]\n' % sys.argv[0])
+        sys.exit(1)
+
+    guest_executed = executed_guest(command) if perf else 0
+
+    print('%-24s %10s %10s %8s %10s' % ('PLUGINS', 'TIME (s)', 'GUEST', 'HOST/GI',
+                                        'EXEC/GI'))
+    for plugins in configurations:
+        best = min(run(qemu_args(command, plugins))[0] for _ in range(repeat))
+        guest, host = translated(command, plugins)
+        ratio = float(host) / guest if guest else 0.0
+        if perf and guest_executed:
+            executed = '%10.2f' % (float(executed_host(command, plugins))
+                                   / guest_executed)
+        else:
+            executed = '%10s' % '-'
+        print('%-24s %10.3f %10d %8.2f %s' % (','.join(plugins) or '(none)',
+                                              best, guest, ratio, executed))
+
+if __name__ == '__main__':
+    main()
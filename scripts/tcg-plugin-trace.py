@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+#
+# Pretty-printer for the binary traces of the TCG plugin "trace"
+#
+# This work is licensed under the terms of the GNU GPL, version 2.  See
+# the COPYING file in the top-level directory.
+#
+# For help see tcg/plugins/README
+
+import sys
+import mmap
+import struct
+
+header_magic = 'TPITRACE'
+header_version = 1
+
+header_fmt = '=8sIIIIQ'
+record_fmt = '=QQIHH'
+
+def read_symbols(fobj):
+    '''Read the symbol file, return the executable name and a dictionary
+       mapping block addresses to (filename, symbol)'''
+    executable = '<unknown>'
+    symbols = {}
+    for line in fobj:
+        line = line.rstrip('\n')
+        if line.startswith('# '):
+            executable = line[2:]
+            continue
+        address, filename, symbol = line.split('\t', 2)
+        symbols[int(address, 16)] = (filename, symbol)
+    return executable, symbols
+
+def read_records(buf):
+    '''Yield the records of a trace as tuples (pc, timestamp, icount,
+       cpu_index, size), and return its header first'''
+    hlen = struct.calcsize(header_fmt)
+    if len(buf) < hlen:
+        raise ValueError('truncated header')
+    magic, version, record_size, pid, _, start_time = \
+        struct.unpack_from(header_fmt, buf, 0)
+    if magic != header_magic:
+        raise ValueError('not a trace file (or not a trace from this host)')
+    if version != header_version:
+        raise ValueError('unsupported trace version %d' % version)
+    if record_size != struct.calcsize(record_fmt):
+        raise ValueError('unexpected record size %d' % record_size)
+
+    yield pid, start_time
+
+    offset = hlen
+    while offset + record_size <= len(buf):
+        yield struct.unpack_from(record_fmt, buf, offset)
+        offset += record_size
+
+def process(trace_filename, symbol_filename, sort=False, timestamps=False,
+            out=sys.stdout):
+    with open(symbol_filename) as fobj:
+        executable, symbols = read_symbols(fobj)
+
+    with open(trace_filename, 'rb') as fobj:
+        buf = mmap.mmap(fobj.fileno(), 0, access=mmap.ACCESS_READ)
+        try:
+            records = read_records(buf)
+            pid, start_time = next(records)
+
+            # Records are written in batches per vCPU.
+            if sort:
+                records = sorted(records, key=lambda r: r[1])
+
+            for pc, timestamp, icount, cpu_index, size in records:
+                filename, symbol = symbols.get(pc, ('<unknown>', '<unknown>'))
+                if timestamps:
+                    out.write('%d ' % (timestamp - start_time))
+                out.write("%s (%d): CPU #%d - 0x%016x [%d]: %d instruction(s) in '%s:%s'\n" %
+                          (executable, pid, cpu_index, pc, size, icount,
+                           filename, symbol))
+        finally:
+            buf.close()
+
+def main():
+    args = [arg for arg in sys.argv[1:] if not arg.startswith('--')]
+    options = [arg for arg in sys.argv[1:] if arg.startswith('--')]
+
+    if len(args) not in (1, 2) or set(options) - set(['--sort', '--timestamps']):
+        sys.stderr.write('usage: %s [--sort] [--timestamps] <trace-file> [<symbol-file>]\n' % sys.argv[0])
+        sys.exit(1)
+
+    trace_filename = args[0]
+    symbol_filename = args[1] if len(args) == 2 else trace_filename + '.sym'
+
+    try:
+        process(trace_filename, symbol_filename,
+                sort='--sort' in options,
+                timestamps='--timestamps' in options)
+    except ValueError, e:
+        sys.stderr.write('%s: %s\n' % (trace_filename, e))
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
@@ -84,6 +84,15 @@
 # define BSWAP(X)  (X)
 #endif
 
+/* Memory operation handed over to TCG plugins that watch a page.  */
+#if DATA_SIZE == 1
+# define MEMOP_LE  MO_UB
+# define MEMOP_BE  MO_UB
+#else
+# define MEMOP_LE  (MO_LE | SHIFT)
+# define MEMOP_BE  (MO_BE | SHIFT)
+#endif
+
 #ifdef TARGET_WORDS_BIGENDIAN
 # define TGT_BE(X)  (X)
 # define TGT_LE(X)  BSWAP(X)
@@ -124,6 +133,7 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
 {
     uint64_t val;
     CPUState *cpu = ENV_GET_CPU(env);
+    bool iothread_locked = qemu_tcg_lock_iothread();
     MemoryRegion *mr = iotlb_to_region(cpu->as, physaddr);
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
@@ -134,6 +144,9 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
 
     cpu->mem_io_vaddr = addr;
     io_mem_read(mr, physaddr, &val, 1 << SHIFT);
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
     return val;
 }
 #endif
@@ -144,7 +157,7 @@ static __attribute__((unused))
 WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
                             uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     uintptr_t haddr;
     DATA_TYPE res;
@@ -161,10 +174,26 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
                                  mmu_idx, retaddr);
         }
 #endif
-        tlb_fill(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE, mmu_idx, retaddr);
+        if (!victim_tlb_hit(env, mmu_idx, index, READ_ACCESS_TYPE,
+                            addr & TARGET_PAGE_MASK)) {
+            tlb_fill_iothread(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
+                              mmu_idx, retaddr);
+        }
         tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     }
 
+#if defined(CONFIG_TCG_PLUGIN) && !defined(SOFTMMU_CODE_ACCESS)
+    /* Give a TCG plugin watching this page a chance to handle the
+       access, otherwise proceed as usual.  */
+    if (unlikely(tlb_addr & TLB_WATCHED)) {
+        uint64_t val;
+        if (tcgplugin_intercept_qemu_ld(env, addr, MEMOP_LE, &val)) {
+            return (DATA_TYPE)val;
+        }
+        tlb_addr &= ~TLB_WATCHED;
+    }
+#endif
+
     /* Handle an IO access.  */
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         hwaddr ioaddr;
@@ -229,7 +258,7 @@ static __attribute__((unused))
 WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
                             uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     uintptr_t haddr;
     DATA_TYPE res;
@@ -246,10 +275,26 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
                                  mmu_idx, retaddr);
         }
 #endif
-        tlb_fill(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE, mmu_idx, retaddr);
+        if (!victim_tlb_hit(env, mmu_idx, index, READ_ACCESS_TYPE,
+                            addr & TARGET_PAGE_MASK)) {
+            tlb_fill_iothread(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
+                              mmu_idx, retaddr);
+        }
         tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     }
 
+#if defined(CONFIG_TCG_PLUGIN) && !defined(SOFTMMU_CODE_ACCESS)
+    /* Give a TCG plugin watching this page a chance to handle the
+       access, otherwise proceed as usual.  */
+    if (unlikely(tlb_addr & TLB_WATCHED)) {
+        uint64_t val;
+        if (tcgplugin_intercept_qemu_ld(env, addr, MEMOP_BE, &val)) {
+            return (DATA_TYPE)val;
+        }
+        tlb_addr &= ~TLB_WATCHED;
+    }
+#endif
+
     /* Handle an IO access.  */
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         hwaddr ioaddr;
@@ -338,6 +383,7 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
                                           uintptr_t retaddr)
 {
     CPUState *cpu = ENV_GET_CPU(env);
+    bool iothread_locked = qemu_tcg_lock_iothread();
     MemoryRegion *mr = iotlb_to_region(cpu->as, physaddr);
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
@@ -348,12 +394,15 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
     cpu->mem_io_vaddr = addr;
     cpu->mem_io_pc = retaddr;
     io_mem_write(mr, physaddr, val, 1 << SHIFT);
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                        int mmu_idx, uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     uintptr_t haddr;
 
@@ -368,10 +417,23 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
             cpu_unaligned_access(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
         }
 #endif
-        tlb_fill(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
+        if (!victim_tlb_hit(env, mmu_idx, index, 1, addr & TARGET_PAGE_MASK)) {
+            tlb_fill_iothread(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
+        }
         tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     }
 
+#ifdef CONFIG_TCG_PLUGIN
+    /* Give a TCG plugin watching this page a chance to handle the
+       access, otherwise proceed as usual.  */
+    if (unlikely(tlb_addr & TLB_WATCHED)) {
+        if (tcgplugin_intercept_qemu_st(env, addr, MEMOP_LE, val)) {
+            return;
+        }
+        tlb_addr &= ~TLB_WATCHED;
+    }
+#endif
+
     /* Handle an IO access.  */
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         hwaddr ioaddr;
@@ -429,7 +491,7 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                        int mmu_idx, uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     uintptr_t haddr;
 
@@ -444,10 +506,23 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
             cpu_unaligned_access(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
         }
 #endif
-        tlb_fill(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
+        if (!victim_tlb_hit(env, mmu_idx, index, 1, addr & TARGET_PAGE_MASK)) {
+            tlb_fill_iothread(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
+        }
         tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     }
 
+#ifdef CONFIG_TCG_PLUGIN
+    /* Give a TCG plugin watching this page a chance to handle the
+       access, otherwise proceed as usual.  */
+    if (unlikely(tlb_addr & TLB_WATCHED)) {
+        if (tcgplugin_intercept_qemu_st(env, addr, MEMOP_BE, val)) {
+            return;
+        }
+        tlb_addr &= ~TLB_WATCHED;
+    }
+#endif
+
     /* Handle an IO access.  */
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
         hwaddr ioaddr;
@@ -521,6 +596,8 @@ glue(glue(helper_st, SUFFIX), MMUSUFFIX)(CPUArchState *env, target_ulong addr,
 #undef BSWAP
 #undef TGT_BE
 #undef TGT_LE
+#undef MEMOP_LE
+#undef MEMOP_BE
 #undef CPU_BE
 #undef CPU_LE
 #undef helper_le_ld_name
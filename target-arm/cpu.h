@@ -1080,6 +1080,9 @@ bool write_cpustate_to_list(ARMCPU *cpu);
 #define TARGET_PAGE_BITS 10
 #endif
 
+/* ARM only orders the accesses with barriers (TCGBar, see tcg/tcg.h) */
+#define TCG_GUEST_DEFAULT_MO 0
+
 #if defined(TARGET_AARCH64)
 #  define TARGET_PHYS_ADDR_SPACE_BITS 48
 #  define TARGET_VIRT_ADDR_SPACE_BITS 64
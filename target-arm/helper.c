@@ -1598,7 +1598,8 @@ static void xscale_cpar_write(CPUARMState *env, const ARMCPRegInfo *ri,
 {
     value &= 0x3fff;
     if (env->cp15.c15_cpar != value) {
-        /* Changes cp0 to cp13 behavior, so needs a TB flush.  */
+        /* Changes cp0 to cp13 behavior, so needs a TB flush.  A deferred
+           one is enough: the write ends the TB.  */
         tb_flush(env);
         env->cp15.c15_cpar = value;
     }
@@ -20,6 +20,9 @@
 #include "exec/helper-proto.h"
 #include "internals.h"
 #include "exec/cpu_ldst.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "qemu/main-loop.h"
+#endif
 
 #define SIGNBIT (uint32_t)0x80000000
 #define SIGNBIT64 ((uint64_t)1 << 63)
@@ -229,6 +232,21 @@ void HELPER(wfe)(CPUARMState *env)
     cpu_loop_exit(cs);
 }
 
+#if !defined(CONFIG_USER_ONLY)
+/* With -tcg-threads multi, the store exclusives of the vCPU threads run
+ * in an exclusive section (see docs/multi-thread-tcg.txt).
+ */
+void HELPER(exclusive_lock)(void)
+{
+    tcg_atomic_lock(GETPC());
+}
+
+void HELPER(exclusive_unlock)(void)
+{
+    tcg_atomic_unlock();
+}
+#endif
+
 /* Raise an internal-to-QEMU exception. This is limited to only
  * those EXCP values which are special cases for QEMU to interrupt
  * execution and not to be used for exceptions which are passed to
@@ -316,32 +334,63 @@ void HELPER(access_check_cp_reg)(CPUARMState *env, void *rip, uint32_t syndrome)
     raise_exception(env, EXCP_UDEF);
 }
 
+/* The ARM_CP_IO registers are backed by devices (the generic timers),
+ * with -tcg-threads multi they are accessed with the iothread lock held.
+ */
+static bool cp_reg_lock_iothread(const ARMCPRegInfo *ri)
+{
+#if !defined(CONFIG_USER_ONLY)
+    return (ri->type & ARM_CP_IO) && qemu_tcg_lock_iothread();
+#else
+    return false;
+#endif
+}
+
+static void cp_reg_unlock_iothread(bool iothread_locked)
+{
+#if !defined(CONFIG_USER_ONLY)
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
+#endif
+}
+
 void HELPER(set_cp_reg)(CPUARMState *env, void *rip, uint32_t value)
 {
     const ARMCPRegInfo *ri = rip;
+    bool iothread_locked = cp_reg_lock_iothread(ri);
 
     ri->writefn(env, ri, value);
+    cp_reg_unlock_iothread(iothread_locked);
 }
 
 uint32_t HELPER(get_cp_reg)(CPUARMState *env, void *rip)
 {
     const ARMCPRegInfo *ri = rip;
+    bool iothread_locked = cp_reg_lock_iothread(ri);
+    uint32_t res = ri->readfn(env, ri);
 
-    return ri->readfn(env, ri);
+    cp_reg_unlock_iothread(iothread_locked);
+    return res;
 }
 
 void HELPER(set_cp_reg64)(CPUARMState *env, void *rip, uint64_t value)
 {
     const ARMCPRegInfo *ri = rip;
+    bool iothread_locked = cp_reg_lock_iothread(ri);
 
     ri->writefn(env, ri, value);
+    cp_reg_unlock_iothread(iothread_locked);
 }
 
 uint64_t HELPER(get_cp_reg64)(CPUARMState *env, void *rip)
 {
     const ARMCPRegInfo *ri = rip;
+    bool iothread_locked = cp_reg_lock_iothread(ri);
+    uint64_t res = ri->readfn(env, ri);
 
-    return ri->readfn(env, ri);
+    cp_reg_unlock_iothread(iothread_locked);
+    return res;
 }
 
 void HELPER(msr_i_pstate)(CPUARMState *env, uint32_t op, uint32_t imm)
@@ -1176,8 +1176,10 @@ static void handle_sync(DisasContext *s, uint32_t insn,
         return;
     case 4: /* DSB */
     case 5: /* DMB */
+        tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
+        return;
     case 6: /* ISB */
-        /* We don't emulate caches so barriers are no-ops */
+        /* We don't emulate caches so this is a no-op */
         return;
     default:
         unallocated_encoding(s);
@@ -1634,6 +1636,10 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     TCGv_i64 addr = tcg_temp_local_new_i64();
     TCGv_i64 tmp;
 
+    if (parallel_cpus) {
+        gen_helper_exclusive_lock();
+    }
+
     /* Copy input into a local temp so it is not trashed when the
      * basic block ends at the branch insn.
      */
@@ -1676,7 +1682,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     tcg_gen_movi_i64(cpu_reg(s, rd), 1);
     gen_set_label(done_label);
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
-
+    if (parallel_cpus) {
+        gen_helper_exclusive_unlock();
+    }
 }
 #endif
 
@@ -1720,9 +1728,12 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
     }
     tcg_addr = read_cpu_reg_sp(s, rn, 1);
 
-    /* Note that since TCG is single threaded load-acquire/store-release
-     * semantics require no extra if (is_lasr) { ... } handling.
+    /* Load-acquire/store-release only need barriers with -tcg-threads
+     * multi, which tcg_gen_mb checks.
      */
+    if (is_lasr && is_store) {
+        tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
+    }
 
     if (is_excl) {
         if (!is_store) {
@@ -1747,6 +1758,10 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
             }
         }
     }
+
+    if (is_lasr && !is_store) {
+        tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
+    }
 }
 
 /*
@@ -4973,6 +4973,59 @@ static const uint8_t neon_2rm_sizes[] = {
    We process data in a mixture of 32-bit and 64-bit chunks.
    Mostly we use 32-bit chunks so we can use normal scalar instructions.  */
 
+/* The integer operations of the "three registers of the same length"
+   group that TCG implements inline, with the host vector instructions if
+   it has some.  Return false for the others.  */
+static bool gen_neon_3reg_vec(int op, int u, int size, int q,
+                              int rd, int rn, int rm)
+{
+    long dofs = vfp_reg_offset(1, rd);
+    long aofs = vfp_reg_offset(1, rn);
+    long bofs = vfp_reg_offset(1, rm);
+    int oprsz = q ? 16 : 8;
+
+    switch (op) {
+    case NEON_3R_VADD_VSUB:
+        if (u) {
+            tcg_gen_vec_sub(cpu_env, dofs, aofs, bofs, oprsz, size);
+        } else {
+            tcg_gen_vec_add(cpu_env, dofs, aofs, bofs, oprsz, size);
+        }
+        return true;
+    case NEON_3R_LOGIC:
+        switch ((u << 2) | size) {
+        case 0: /* VAND */
+            tcg_gen_vec_and(cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        case 1: /* BIC */
+            tcg_gen_vec_andc(cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        case 2: /* VORR */
+            tcg_gen_vec_or(cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        case 4: /* VEOR */
+            tcg_gen_vec_xor(cpu_env, dofs, aofs, bofs, oprsz);
+            return true;
+        default:
+            return false;
+        }
+    case NEON_3R_VTST_VCEQ:
+        if (!u) { /* VTST */
+            return false;
+        }
+        tcg_gen_vec_cmpeq(cpu_env, dofs, aofs, bofs, oprsz, size);
+        return true;
+    case NEON_3R_VCGT:
+        if (u) { /* unsigned */
+            return false;
+        }
+        tcg_gen_vec_cmpgt(cpu_env, dofs, aofs, bofs, oprsz, size);
+        return true;
+    default:
+        return false;
+    }
+}
+
 static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t insn)
 {
     int op;
@@ -5062,6 +5115,9 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
             tcg_temp_free_i32(tmp3);
             return 0;
         }
+        if (gen_neon_3reg_vec(op, u, size, q, rd, rn, rm)) {
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -6392,6 +6448,13 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
                 }
                 switch (op) {
                 case NEON_2RM_VREV64:
+                    if (size == 2) {
+                        /* Swap the words of each doubleword.  */
+                        tcg_gen_vec_shuf32(cpu_env, vfp_reg_offset(1, rd),
+                                           vfp_reg_offset(1, rm), 0xb1,
+                                           q ? 16 : 8);
+                        break;
+                    }
                     for (pass = 0; pass < (q ? 2 : 1); pass++) {
                         tmp = neon_load_reg(rm, pass * 2);
                         tmp2 = neon_load_reg(rm, pass * 2 + 1);
@@ -7342,6 +7405,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
        } else {
          {Rd} = 1;
        } */
+    if (parallel_cpus) {
+        gen_helper_exclusive_lock();
+    }
     fail_label = gen_new_label();
     done_label = gen_new_label();
     extaddr = tcg_temp_new_i64();
@@ -7410,6 +7476,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     tcg_gen_movi_i32(cpu_R[rd], 1);
     gen_set_label(done_label);
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
+    if (parallel_cpus) {
+        gen_helper_exclusive_unlock();
+    }
 }
 #endif
 
@@ -7570,9 +7639,12 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
                 return;
             case 4: /* dsb */
             case 5: /* dmb */
+                ARCH(7);
+                tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
+                return;
             case 6: /* isb */
                 ARCH(7);
-                /* We don't emulate caches so these are a no-op.  */
+                /* We don't emulate caches so this is a no-op.  */
                 return;
             default:
                 goto illegal_op;
@@ -8194,9 +8266,11 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
                         addr = tcg_temp_local_new_i32();
                         load_reg_var(s, addr, rn);
 
-                        /* Since the emulation does not have barriers,
-                           the acquire/release semantics need no special
-                           handling */
+                        /* Acquire/release semantics only need barriers
+                           with -tcg-threads multi, tcg_gen_mb knows.  */
+                        if (op2 != 3 && !(insn & (1 << 20))) {
+                            tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
+                        }
                         if (op2 == 0) {
                             if (insn & (1 << 20)) {
                                 tmp = tcg_temp_new_i32();
@@ -8268,6 +8342,9 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
                                 abort();
                             }
                         }
+                        if (op2 != 3 && (insn & (1 << 20))) {
+                            tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
+                        }
                         tcg_temp_free_i32(addr);
                     } else {
                         /* SWP instruction */
@@ -9743,8 +9820,10 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                             break;
                         case 4: /* dsb */
                         case 5: /* dmb */
+                            tcg_gen_mb(TCG_MO_ALL | TCG_BAR_SC);
+                            break;
                         case 6: /* isb */
-                            /* These execute as NOPs.  */
+                            /* This executes as a NOP.  */
                             break;
                         default:
                             goto illegal_op;
@@ -36,6 +36,9 @@
 
 #define TARGET_HAS_ICE 1
 
+/* the translator forms superblocks, see tb_trace_branch() */
+#define TARGET_HAS_SUPERBLOCKS 1
+
 #ifdef TARGET_X86_64
 #define ELF_MACHINE     EM_X86_64
 #define ELF_MACHINE_UNAME "x86_64"
@@ -1132,6 +1135,9 @@ uint64_t cpu_get_tsc(CPUX86State *env);
 
 #define TARGET_PAGE_BITS 12
 
+/* x86 only reorders a store with a later load (TCGBar, see tcg/tcg.h) */
+#define TCG_GUEST_DEFAULT_MO (TCG_MO_ALL & ~TCG_MO_ST_LD)
+
 #ifdef TARGET_X86_64
 #define TARGET_PHYS_ADDR_SPACE_BITS 52
 /* ??? This is really 48 bits, sign-extended, but the only thing
@@ -23,16 +23,28 @@
 
 /* broken thread support */
 
+#if defined(CONFIG_USER_ONLY)
 static spinlock_t global_cpu_lock = SPIN_LOCK_UNLOCKED;
+#endif
 
+/* With -tcg-threads multi, the locked instructions of the vCPU threads
+   run in an exclusive section (see docs/multi-thread-tcg.txt).  */
 void helper_lock(void)
 {
+#if defined(CONFIG_USER_ONLY)
     spin_lock(&global_cpu_lock);
+#else
+    tcg_atomic_lock(GETPC());
+#endif
 }
 
 void helper_unlock(void)
 {
+#if defined(CONFIG_USER_ONLY)
     spin_unlock(&global_cpu_lock);
+#else
+    tcg_atomic_unlock();
+#endif
 }
 
 void helper_cmpxchg8b(CPUX86State *env, target_ulong a0)
@@ -21,6 +21,9 @@
 #include "exec/ioport.h"
 #include "exec/helper-proto.h"
 #include "exec/cpu_ldst.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "qemu/main-loop.h"
+#endif
 
 void helper_outb(uint32_t port, uint32_t data)
 {
@@ -110,7 +113,13 @@ target_ulong helper_read_crN(CPUX86State *env, int reg)
         break;
     case 8:
         if (!(env->hflags2 & HF2_VINTR_MASK)) {
+            /* the APIC is a device, see docs/multi-thread-tcg.txt */
+            bool iothread_locked = qemu_tcg_lock_iothread();
+
             val = cpu_get_apic_tpr(x86_env_get_cpu(env)->apic_state);
+            if (iothread_locked) {
+                qemu_mutex_unlock_iothread();
+            }
         } else {
             val = env->v_tpr;
         }
@@ -134,7 +143,12 @@ void helper_write_crN(CPUX86State *env, int reg, target_ulong t0)
         break;
     case 8:
         if (!(env->hflags2 & HF2_VINTR_MASK)) {
+            bool iothread_locked = qemu_tcg_lock_iothread();
+
             cpu_set_apic_tpr(x86_env_get_cpu(env)->apic_state, t0);
+            if (iothread_locked) {
+                qemu_mutex_unlock_iothread();
+            }
         }
         env->v_tpr = t0 & 0x0f;
         break;
@@ -243,7 +257,14 @@ void helper_wrmsr(CPUX86State *env)
         env->sysenter_eip = val;
         break;
     case MSR_IA32_APICBASE:
-        cpu_set_apic_base(x86_env_get_cpu(env)->apic_state, val);
+        {
+            bool iothread_locked = qemu_tcg_lock_iothread();
+
+            cpu_set_apic_base(x86_env_get_cpu(env)->apic_state, val);
+            if (iothread_locked) {
+                qemu_mutex_unlock_iothread();
+            }
+        }
         break;
     case MSR_EFER:
         {
@@ -394,7 +415,14 @@ void helper_rdmsr(CPUX86State *env)
         val = env->sysenter_eip;
         break;
     case MSR_IA32_APICBASE:
-        val = cpu_get_apic_base(x86_env_get_cpu(env)->apic_state);
+        {
+            bool iothread_locked = qemu_tcg_lock_iothread();
+
+            val = cpu_get_apic_base(x86_env_get_cpu(env)->apic_state);
+            if (iothread_locked) {
+                qemu_mutex_unlock_iothread();
+            }
+        }
         break;
     case MSR_EFER:
         val = env->efer;
@@ -122,9 +122,19 @@ typedef struct DisasContext {
     int cpuid_ext2_features;
     int cpuid_ext3_features;
     int cpuid_7_0_ebx_features;
+    /* superblock (CF_SUPERBLOCK), see gen_trace_jmp */
+    bool trace;           /* the direct jumps may be followed */
+    bool traced;          /* one was */
+    bool search_pc;
+    target_ulong block_pc; /* start of the cold TB being translated */
+    int nb_trace_branches;
+    int nb_side_exits;
+    int side_exit_label[TB_TRACE_MAX_BRANCHES];
+    target_ulong side_exit_eip[TB_TRACE_MAX_BRANCHES];
 } DisasContext;
 
 static void gen_eob(DisasContext *s);
+static void gen_jr(DisasContext *s);
 static void gen_jmp(DisasContext *s, target_ulong eip);
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num);
 static void gen_op(DisasContext *s1, int op, TCGMemOp ot, int d);
@@ -2540,7 +2550,7 @@ static void gen_debug(DisasContext *s, target_ulong cur_eip)
 
 /* generate a generic end of block. Trace exception is also generated
    if needed */
-static void gen_eob(DisasContext *s)
+static void do_gen_eob(DisasContext *s, bool jr)
 {
     gen_update_cc_op(s);
     if (s->tb->flags & HF_INHIBIT_IRQ_MASK) {
@@ -2553,12 +2563,29 @@ static void gen_eob(DisasContext *s)
         gen_helper_debug(cpu_env);
     } else if (s->tf) {
         gen_helper_single_step(cpu_env);
+    } else if (jr && s->jmp_opt) {
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
     } else {
+        /* Also when leaving an interrupt shadow (jmp_opt is false then):
+           cpu_exec must check for pending interrupts before the next
+           block.  */
         tcg_gen_exit_tb(0);
     }
     s->is_jmp = DISAS_TB_JUMP;
 }
 
+static void gen_eob(DisasContext *s)
+{
+    do_gen_eob(s, false);
+}
+
+/* end of block after an indirect jump, env->eip being already set: look
+   up the next TB from the generated code rather than from cpu_exec */
+static void gen_jr(DisasContext *s)
+{
+    do_gen_eob(s, true);
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -2579,6 +2606,68 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/* Superblocks: a direct jump to "eip" can be followed, translating its
+   target in the same TB, if it is forward in the page of the TB.  The
+   instructions translated after a followed jump must not cross the end
+   of the page (15 bytes being the longest instruction): they may not be
+   run, and must not fault.  */
+static bool gen_trace_follow(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if (!s->trace || (s->prefix & PREFIX_LOCK) || pc < s->pc ||
+        ((pc + 15) & TARGET_PAGE_MASK) != (s->tb->pc & TARGET_PAGE_MASK)) {
+        return false;
+    }
+    s->pc = pc;
+    s->block_pc = pc;
+    s->traced = true;
+    return true;
+}
+
+/* Translate the target of a jmp or a call in the same TB if possible.  */
+static bool gen_trace_jmp(DisasContext *s, target_ulong eip)
+{
+    return gen_trace_follow(s, eip);
+}
+
+/* Translate the way that a conditional jump mostly takes in the same TB,
+   if possible.  The other way becomes a side exit, see gen_side_exits.  */
+static bool gen_trace_jcc(CPUX86State *env, DisasContext *s, int b,
+                          target_ulong val, target_ulong next_eip)
+{
+    int slot, l1;
+
+    if (!s->trace) {
+        return false;
+    }
+    /* slot 0 is the fall-through, slot 1 the jump, as in gen_jcc */
+    slot = tb_trace_branch(env, s->tb, s->nb_trace_branches++, s->block_pc,
+                           s->search_pc);
+    if (slot < 0 || !gen_trace_follow(s, slot ? val : next_eip)) {
+        return false;
+    }
+
+    l1 = gen_new_label();
+    gen_jcc1(s, slot ? b ^ 1 : b, l1);
+    s->side_exit_label[s->nb_side_exits] = l1;
+    s->side_exit_eip[s->nb_side_exits++] = slot ? next_eip : val;
+    return true;
+}
+
+/* The side exits of a superblock, after its end.  The CPU state is the
+   one of the conditional jump, after gen_jcc1.  */
+static void gen_side_exits(DisasContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_side_exits; i++) {
+        gen_set_label(s->side_exit_label[i]);
+        gen_jmp_im(s->side_exit_eip[i]);
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
+    }
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(cpu_tmp1_i64, cpu_A0, s->mem_index, MO_LEQ);
@@ -2967,6 +3056,50 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* The MMX and SSE2 integer operations that TCG implements inline, with
+   the host vector instructions if it has some.  Return false for the
+   others, which call the helpers of sse_op_table1.  */
+static bool gen_sse_vec(int b, int oprsz, int op1_offset, int op2_offset)
+{
+    switch (b) {
+    case 0xfc ... 0xfe: /* paddb, paddw, paddl */
+        tcg_gen_vec_add(cpu_env, op1_offset, op1_offset, op2_offset,
+                        oprsz, b - 0xfc);
+        break;
+    case 0xd4: /* paddq */
+        tcg_gen_vec_add(cpu_env, op1_offset, op1_offset, op2_offset,
+                        oprsz, MO_64);
+        break;
+    case 0xf8 ... 0xfb: /* psubb, psubw, psubl, psubq */
+        tcg_gen_vec_sub(cpu_env, op1_offset, op1_offset, op2_offset,
+                        oprsz, b - 0xf8);
+        break;
+    case 0xdb: /* pand */
+        tcg_gen_vec_and(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        break;
+    case 0xdf: /* pandn */
+        tcg_gen_vec_andc(cpu_env, op1_offset, op2_offset, op1_offset, oprsz);
+        break;
+    case 0xeb: /* por */
+        tcg_gen_vec_or(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        break;
+    case 0xef: /* pxor */
+        tcg_gen_vec_xor(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        break;
+    case 0x74 ... 0x76: /* pcmpeqb, pcmpeqw, pcmpeql */
+        tcg_gen_vec_cmpeq(cpu_env, op1_offset, op1_offset, op2_offset,
+                          oprsz, b - 0x74);
+        break;
+    case 0x64 ... 0x66: /* pcmpgtb, pcmpgtw, pcmpgtl */
+        tcg_gen_vec_cmpgt(cpu_env, op1_offset, op1_offset, op2_offset,
+                          oprsz, b - 0x64);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4350,6 +4483,15 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
         case 0x70: /* pshufx insn */
         case 0xc6: /* pshufx insn */
             val = cpu_ldub_code(env, s->pc++);
+#ifndef HOST_WORDS_BIGENDIAN
+            /* The elements of XMMReg are in reverse order on big-endian
+               hosts, unlike those of tcg_gen_vec_shuf32.  */
+            if (b == 0x70 && b1 == 1) {
+                /* pshufd */
+                tcg_gen_vec_shuf32(cpu_env, op1_offset, op2_offset, val, 16);
+                break;
+            }
+#endif
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             /* XXX: introduce a new table? */
@@ -4382,6 +4524,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_vec(b, is_xmm ? 16 : 8, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4937,7 +5082,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             tcg_gen_movi_tl(cpu_T[1], next_eip);
             gen_push_v(s, cpu_T[1]);
             gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -4964,7 +5109,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
                 tcg_gen_ext16u_tl(cpu_T[0], cpu_T[0]);
             }
             gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -6378,14 +6523,14 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         gen_stack_update(s, val + (1 << ot));
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
         gen_pop_update(s, ot);
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xca: /* lret im */
         val = cpu_ldsw_code(env, s->pc);
@@ -6453,7 +6598,9 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             }
             tcg_gen_movi_tl(cpu_T[0], next_eip);
             gen_push_v(s, cpu_T[0]);
-            gen_jmp(s, tval);
+            if (!gen_trace_jmp(s, tval)) {
+                gen_jmp(s, tval);
+            }
         }
         break;
     case 0x9a: /* lcall im */
@@ -6482,7 +6629,9 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         } else if (!CODE64(s)) {
             tval &= 0xffffffff;
         }
-        gen_jmp(s, tval);
+        if (!gen_trace_jmp(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0xea: /* ljmp im */
         {
@@ -6504,7 +6653,9 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        if (!gen_trace_jmp(s, tval)) {
+            gen_jmp(s, tval);
+        }
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -6521,7 +6672,9 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jcc(s, b, tval, next_eip);
+        if (!gen_trace_jcc(env, s, b, tval, next_eip)) {
+            gen_jcc(s, b, tval, next_eip);
+        }
         break;
 
     case 0x190 ... 0x19f: /* setcc Gv */
@@ -7752,6 +7905,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         case 6: /* mfence */
             if ((modrm & 0xc7) != 0xc0 || !(s->cpuid_features & CPUID_SSE2))
                 goto illegal_op;
+            tcg_gen_mb((op == 5 ? TCG_MO_LD_LD : TCG_MO_ALL) | TCG_BAR_SC);
             break;
         case 7: /* sfence / clflush */
             if ((modrm & 0xc7) == 0xc0) {
@@ -7759,6 +7913,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
                 /* XXX: also check for cpuid_ext2_features & CPUID_EXT2_EMMX */
                 if (!(s->cpuid_features & CPUID_SSE))
                     goto illegal_op;
+                tcg_gen_mb(TCG_MO_ST_ST | TCG_BAR_SC);
             } else {
                 /* clflush */
                 if (!(s->cpuid_features & CPUID_CLFLUSH))
@@ -7950,6 +8105,13 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
                     || (flags & HF_SOFTMMU_MASK)
 #endif
                     );
+    /* With -singlestep, each instruction is a TB of its own.  */
+    dc->trace = (tb->cflags & CF_SUPERBLOCK) && dc->jmp_opt && !singlestep;
+    dc->traced = false;
+    dc->search_pc = search_pc;
+    dc->block_pc = tb->pc;
+    dc->nb_trace_branches = 0;
+    dc->nb_side_exits = 0;
 #if 0
     /* check addseg logic */
     if (!dc->addseg && (dc->vm86 || !dc->pe || !dc->code32))
@@ -7970,6 +8132,10 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
     cpu_cc_srcT = tcg_temp_local_new();
 
     gen_opc_end = tcg_ctx.gen_opc_buf + OPC_MAX_SIZE;
+    if (dc->trace) {
+        /* room for the side exits */
+        gen_opc_end -= TB_TRACE_MAX_BRANCHES * 8;
+    }
 
     dc->is_jmp = DISAS_NEXT;
     pc_ptr = pc_start;
@@ -8026,7 +8192,9 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
         /* if too long translation, stop generation too */
         if (tcg_ctx.gen_opc_ptr >= gen_opc_end ||
             (pc_ptr - pc_start) >= (TARGET_PAGE_SIZE - 32) ||
-            num_insns >= max_insns) {
+            num_insns >= max_insns ||
+            (dc->traced && ((pc_ptr + 15) & TARGET_PAGE_MASK) !=
+                           (pc_start & TARGET_PAGE_MASK))) {
             gen_jmp_im(pc_ptr - dc->cs_base);
             gen_eob(dc);
             break;
@@ -8037,6 +8205,7 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
             break;
         }
     }
+    gen_side_exits(dc);
     if (tb->cflags & CF_LAST_IO)
         gen_io_end();
     gen_tb_end(tb, num_insns);
@@ -31,6 +31,9 @@
 
 #define DEF_HELPER_FLAGS_2(name, flags, ret, t1, t2) \
   dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2));
+#define DEF_HELPER_FLAGS_4(name, flags, ret, t1, t2, t3, t4) \
+  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2), dh_ctype(t3), \
+                              dh_ctype(t4));
 
 #include "tcg-runtime.h"
 
@@ -107,3 +110,53 @@ int64_t HELPER(mulsh_i64)(int64_t arg1, int64_t arg2)
     muls64(&l, &h, arg1, arg2);
     return h;
 }
+
+/* Vector helpers, for the hosts without TCG_TARGET_HAS_vec.  "desc" is
+   the VEC_DESC of tcg.h: the size of the vectors in bits 2 and up, the
+   log2 size of their elements in bits 0-1.  */
+
+#define VEC_CMP(d, a, b, desc, type, cond)                      \
+    do {                                                        \
+        type *vd = d, *va = a, *vb = b;                         \
+        unsigned i;                                             \
+                                                                \
+        for (i = 0; i < ((desc) >> 2) / sizeof(type); i++) {    \
+            vd[i] = va[i] cond vb[i] ? -1 : 0;                  \
+        }                                                       \
+    } while (0)
+
+void HELPER(vec_cmpeq)(void *d, void *a, void *b, uint32_t desc)
+{
+    switch (desc & 3) {
+    case 0:
+        VEC_CMP(d, a, b, desc, int8_t, ==);
+        break;
+    case 1:
+        VEC_CMP(d, a, b, desc, int16_t, ==);
+        break;
+    case 2:
+        VEC_CMP(d, a, b, desc, int32_t, ==);
+        break;
+    default:
+        VEC_CMP(d, a, b, desc, int64_t, ==);
+        break;
+    }
+}
+
+void HELPER(vec_cmpgt)(void *d, void *a, void *b, uint32_t desc)
+{
+    switch (desc & 3) {
+    case 0:
+        VEC_CMP(d, a, b, desc, int8_t, >);
+        break;
+    case 1:
+        VEC_CMP(d, a, b, desc, int16_t, >);
+        break;
+    case 2:
+        VEC_CMP(d, a, b, desc, int32_t, >);
+        break;
+    default:
+        VEC_CMP(d, a, b, desc, int64_t, >);
+        break;
+    }
+}
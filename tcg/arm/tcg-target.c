@@ -1139,7 +1139,8 @@ static TCGReg tcg_out_arg_reg64(TCGContext *s, TCGReg argreg,
 
 #define TLB_SHIFT	(CPU_TLB_ENTRY_BITS + CPU_TLB_BITS)
 
-/* We're expecting to use an 8-bit immediate and to mask.  */
+/* The entries in use are masked with env->tlb_mask, but keep tlb_table
+   small enough for the offsets below.  */
 QEMU_BUILD_BUG_ON(CPU_TLB_BITS > 8);
 
 /* We're expecting to use an 8-bit immediate add + 8-bit ldrd offset.
@@ -1162,15 +1163,22 @@ static TCGReg tcg_out_tlb_read(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     int add_off = offsetof(CPUArchState, tlb_table[mem_index][0].addend);
 
     /* Should generate something like the following:
+     *   ldr    r1, [env, #mask]
      *   shr    tmp, addrlo, #TARGET_PAGE_BITS                    (1)
      *   add    r2, env, #high
-     *   and    r0, tmp, #(CPU_TLB_SIZE - 1)                      (2)
-     *   add    r2, r2, r0, lsl #CPU_TLB_ENTRY_BITS               (3)
+     *   and    r0, r1, tmp, lsl #CPU_TLB_ENTRY_BITS              (2)
+     *   add    r2, r2, r0                                        (3)
      *   ldr    r0, [r2, #cmp]                                    (4)
      *   tst    addrlo, #s_mask
      *   ldr    r2, [r2, #add]                                    (5)
      *   cmpeq  r0, tmp, lsl #TARGET_PAGE_BITS
      */
+
+    /* The size of the TLB changes at run-time, see tlb_resize().  This
+       may clobber TMP, so do it first.  */
+    tcg_out_ld32u(s, COND_AL, TCG_REG_R1, TCG_AREG0,
+                  offsetof(CPUArchState, tlb_mask[mem_index]));
+
     tcg_out_dat_reg(s, COND_AL, ARITH_MOV, TCG_REG_TMP,
                     0, addrlo, SHIFT_IMM_LSR(TARGET_PAGE_BITS));
 
@@ -1183,10 +1191,10 @@ static TCGReg tcg_out_tlb_read(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
         cmp_off &= 0xff;
     }
 
-    tcg_out_dat_imm(s, COND_AL, ARITH_AND,
-                    TCG_REG_R0, TCG_REG_TMP, CPU_TLB_SIZE - 1);
+    tcg_out_dat_reg(s, COND_AL, ARITH_AND, TCG_REG_R0, TCG_REG_R1,
+                    TCG_REG_TMP, SHIFT_IMM_LSL(CPU_TLB_ENTRY_BITS));
     tcg_out_dat_reg(s, COND_AL, ARITH_ADD, TCG_REG_R2, base,
-                    TCG_REG_R0, SHIFT_IMM_LSL(CPU_TLB_ENTRY_BITS));
+                    TCG_REG_R0, SHIFT_IMM_LSL(0));
 
     /* Load the tlb comparator.  Use ldrd if needed and available,
        but due to how the pointer needs setting up, ldm isn't useful.
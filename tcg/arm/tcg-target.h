@@ -62,6 +62,9 @@ extern bool use_idiv_instructions;
 #define TCG_TARGET_CALL_ALIGN_ARGS	1
 #define TCG_TARGET_CALL_STACK_OFFSET	0
 
+/* The softmmu TLB is indexed with env->tlb_mask.  */
+#define TCG_TARGET_DYNAMIC_TLB 1
+
 /* optional instructions */
 #define TCG_TARGET_HAS_ext8s_i32        1
 #define TCG_TARGET_HAS_ext16s_i32       1
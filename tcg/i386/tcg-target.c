@@ -133,6 +133,10 @@ static bool have_movbe;
    it there.  Therefore we always define the variable.  */
 bool have_bmi1;
 
+#ifndef have_sse2
+bool have_sse2;
+#endif
+
 #if defined(CONFIG_CPUID_H) && defined(bit_BMI2)
 static bool have_bmi2;
 #else
@@ -318,6 +322,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_JCC_long	(0x80 | P_EXT)	/* ... plus condition code */
 #define OPC_JCC_short	(0x70)		/* ... plus condition code */
 #define OPC_JMP_long	(0xe9)
+#define OPC_NOP		(0x90)
 #define OPC_JMP_short	(0xeb)
 #define OPC_LEA         (0x8d)
 #define OPC_MOVB_EvGv	(0x88)		/* stores, more or less */
@@ -328,11 +333,34 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_MOVL_Iv     (0xb8)
 #define OPC_MOVBE_GyMy  (0xf0 | P_EXT38)
 #define OPC_MOVBE_MyGy  (0xf1 | P_EXT38)
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq   (0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq   (0xd6 | P_EXT | P_DATA16)
 #define OPC_MOVSBL	(0xbe | P_EXT)
 #define OPC_MOVSWL	(0xbf | P_EXT)
 #define OPC_MOVSLQ	(0x63 | P_REXW)
 #define OPC_MOVZBL	(0xb6 | P_EXT)
 #define OPC_MOVZWL	(0xb7 | P_EXT)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB     (0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW     (0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD     (0x76 | P_EXT | P_DATA16)
+#define OPC_PCMPGTB     (0x64 | P_EXT | P_DATA16)
+#define OPC_PCMPGTW     (0x65 | P_EXT | P_DATA16)
+#define OPC_PCMPGTD     (0x66 | P_EXT | P_DATA16)
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PSHUFD      (0x70 | P_EXT | P_DATA16)
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
 #define OPC_POP_r32	(0x58)
 #define OPC_PUSH_r32	(0x50)
 #define OPC_PUSH_Iv	(0x68)
@@ -427,6 +455,10 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
         /* We should never be asking for both 16 and 64-bit operation.  */
         assert((opc & P_REXW) == 0);
         tcg_out8(s, 0x66);
+    } else if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
     }
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
@@ -464,6 +496,10 @@ static void tcg_out_opc(TCGContext *s, int opc)
 {
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
+    } else if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
     }
     if (opc & (P_EXT | P_EXT38)) {
         tcg_out8(s, 0x0f);
@@ -631,6 +667,80 @@ static inline void tgen_arithr(TCGContext *s, int subop, int dest, int src)
     tcg_out_modrm(s, OPC_ARITH_GvEv + (subop << 3) + ext, dest, src);
 }
 
+static void tcg_out_mb(TCGContext *s, TCGArg a0)
+{
+    /* x86 only reorders the stores with the later loads.  A locked
+       instruction on the stack is a full barrier, cheaper than mfence.  */
+    if (a0 & TCG_MO_ST_LD) {
+        tcg_out8(s, 0xf0); /* lock */
+        tcg_out_modrm_offset(s, OPC_ARITH_EvIb, ARITH_OR, TCG_REG_ESP, 0);
+        tcg_out8(s, 0);
+    }
+}
+
+/* The vector operations load their operands from the CPU state into
+   %xmm0 and %xmm1, which the generated code uses for nothing else, and
+   which are call-clobbered.  The unaligned loads and stores let the
+   guests lay out their registers as they like.  */
+static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc, const TCGArg *args)
+{
+    static const int padd[4] = { OPC_PADDB, OPC_PADDW, OPC_PADDD, OPC_PADDQ };
+    static const int psub[4] = { OPC_PSUBB, OPC_PSUBW, OPC_PSUBD, OPC_PSUBQ };
+    static const int pcmpeq[3] = { OPC_PCMPEQB, OPC_PCMPEQW, OPC_PCMPEQD };
+    static const int pcmpgt[3] = { OPC_PCMPGTB, OPC_PCMPGTW, OPC_PCMPGTD };
+    TCGReg base = args[0];
+    intptr_t dofs = args[1], aofs = args[2], bofs = args[3];
+    unsigned vece = VEC_DESC_VECE(args[4]);
+    bool q = VEC_DESC_OPRSZ(args[4]) == 16;
+    int ld = q ? OPC_MOVDQU_VxWx : OPC_MOVQ_VqWq;
+    int st = q ? OPC_MOVDQU_WxVx : OPC_MOVQ_WqVq;
+    int insn;
+
+    if (opc == INDEX_op_shuf32_vec) {
+        tcg_out_modrm_offset(s, ld, 0, base, aofs);
+        tcg_out_modrm(s, OPC_PSHUFD, 0, 0);
+        tcg_out8(s, args[3]);
+        tcg_out_modrm_offset(s, st, 0, base, dofs);
+        return;
+    }
+
+    switch (opc) {
+    case INDEX_op_add_vec:
+        insn = padd[vece];
+        break;
+    case INDEX_op_sub_vec:
+        insn = psub[vece];
+        break;
+    case INDEX_op_and_vec:
+        insn = OPC_PAND;
+        break;
+    case INDEX_op_or_vec:
+        insn = OPC_POR;
+        break;
+    case INDEX_op_xor_vec:
+        insn = OPC_PXOR;
+        break;
+    case INDEX_op_andc_vec:
+        /* pandn complements its destination: compute ~b & a.  */
+        insn = OPC_PANDN;
+        aofs = args[3];
+        bofs = args[2];
+        break;
+    case INDEX_op_cmpeq_vec:
+        insn = pcmpeq[vece];
+        break;
+    case INDEX_op_cmpgt_vec:
+        insn = pcmpgt[vece];
+        break;
+    default:
+        tcg_abort();
+    }
+    tcg_out_modrm_offset(s, ld, 0, base, aofs);
+    tcg_out_modrm_offset(s, ld, 1, base, bofs);
+    tcg_out_modrm(s, insn, 0, 1);
+    tcg_out_modrm_offset(s, st, 0, base, dofs);
+}
+
 static inline void tcg_out_mov(TCGContext *s, TCGType type,
                                TCGReg ret, TCGReg arg)
 {
@@ -660,9 +770,10 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         return;
     }
 
-    /* Try a 7 byte pc-relative lea before the 10 byte movq.  */
+    /* Try a 7 byte pc-relative lea before the 10 byte movq, unless the
+       code may be moved.  */
     diff = arg - ((uintptr_t)s->code_ptr + 7);
-    if (diff == (int32_t)diff) {
+    if (diff == (int32_t)diff && !s->code_gen_relocatable) {
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
@@ -673,6 +784,32 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     tcg_out64(s, arg);
 }
 
+/* Load the address "ptr" within the code being generated.  */
+static void tcg_out_movi_code(TCGContext *s, TCGReg ret, tcg_insn_unit *ptr)
+{
+    if (TCG_TARGET_REG_BITS == 64 && s->code_gen_relocatable) {
+        /* pc-relative, so that it follows the code when it is copied */
+        tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
+        tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
+        tcg_out32(s, tcg_pcrel_diff(s, ptr) - 4);
+        return;
+    }
+    tcg_out_movi(s, TCG_TYPE_PTR, ret, (uintptr_t)ptr);
+}
+
+/* Load the pointer to the TB that exit_tb returns.  */
+static void tcg_out_movi_tb(TCGContext *s, TCGReg ret, tcg_target_long arg)
+{
+    if (TCG_TARGET_REG_BITS == 64 && s->code_gen_relocatable && arg != 0) {
+        /* always a movq, rewritten when the code is copied */
+        tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+        tcg_out_tb_reloc(s, s->code_ptr);
+        tcg_out64(s, arg);
+        return;
+    }
+    tcg_out_movi(s, TCG_TYPE_PTR, ret, arg);
+}
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -1103,7 +1240,11 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
 {
     intptr_t disp = tcg_pcrel_diff(s, dest) - 5;
 
-    if (disp == (int32_t)disp) {
+    /* Code that may be moved can only use relative branches within
+       itself: the displacement to the helpers would change.  */
+    if (disp == (int32_t)disp &&
+        (!s->code_gen_relocatable ||
+         (dest >= s->code_buf && dest <= s->code_ptr))) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
         tcg_out32(s, disp);
     } else {
@@ -1200,8 +1341,10 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     tgen_arithi(s, ARITH_AND + trexw, r1,
                 TARGET_PAGE_MASK | ((1 << s_bits) - 1), 0);
-    tgen_arithi(s, ARITH_AND + hrexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
+    /* and r0, tlb_mask[mem_index](env): the size of the TLB changes at
+       run-time, see tlb_resize().  */
+    tcg_out_modrm_offset(s, OPC_ARITH_GvEv + (ARITH_AND << 3) + hrexw, r0,
+                         TCG_AREG0, offsetof(CPUArchState, tlb_mask[mem_index]));
 
     tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
                              offsetof(CPUArchState, tlb_table[mem_index][0])
@@ -1304,8 +1447,7 @@ static void tcg_out_qemu_ld_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
         /* The second argument is already loaded with addrlo.  */
         tcg_out_movi(s, TCG_TYPE_I32, tcg_target_call_iarg_regs[2],
                      l->mem_index);
-        tcg_out_movi(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[3],
-                     (uintptr_t)l->raddr);
+        tcg_out_movi_code(s, tcg_target_call_iarg_regs[3], l->raddr);
     }
 
     tcg_out_call(s, qemu_ld_helpers[opc & ~MO_SIGN]);
@@ -1403,10 +1545,10 @@ static void tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
 
         if (ARRAY_SIZE(tcg_target_call_iarg_regs) > 4) {
             retaddr = tcg_target_call_iarg_regs[4];
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_code(s, retaddr, l->raddr);
         } else {
             retaddr = TCG_REG_RAX;
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_code(s, retaddr, l->raddr);
             tcg_out_st(s, TCG_TYPE_PTR, retaddr, TCG_REG_ESP,
                        TCG_TARGET_CALL_STACK_OFFSET);
         }
@@ -1731,12 +1873,16 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 
     switch(opc) {
     case INDEX_op_exit_tb:
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        tcg_out_movi_tb(s, TCG_REG_EAX, args[0]);
         tcg_out_jmp(s, tb_ret_addr);
         break;
     case INDEX_op_goto_tb:
         if (s->tb_jmp_offset) {
-            /* direct jump method */
+            /* direct jump method; the displacement is aligned so that
+               the other vCPU threads never see it half patched */
+            while (((uintptr_t)s->code_ptr + 1) & 3) {
+                tcg_out8(s, OPC_NOP);
+            }
             tcg_out8(s, OPC_JMP_long); /* jmp im */
             s->tb_jmp_offset[args[0]] = tcg_current_code_size(s);
             tcg_out32(s, 0);
@@ -1747,9 +1893,27 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_next_offset[args[0]] = tcg_current_code_size(s);
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp *reg */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_br:
         tcg_out_jxx(s, JCC_JMP, args[0], 0);
         break;
+    case INDEX_op_mb:
+        tcg_out_mb(s, args[0]);
+        break;
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_andc_vec:
+    case INDEX_op_cmpeq_vec:
+    case INDEX_op_cmpgt_vec:
+    case INDEX_op_shuf32_vec:
+        tcg_out_vec_op(s, opc, args);
+        break;
     OP_32_64(ld8u):
         /* Note that we can ignore REXW for the zero-extend to 64-bit.  */
         tcg_out_modrm_offset(s, OPC_MOVZBL, args[0], args[1], args[2]);
@@ -2070,6 +2234,17 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
+    { INDEX_op_mb, { } },
+    { INDEX_op_add_vec, { "r" } },
+    { INDEX_op_sub_vec, { "r" } },
+    { INDEX_op_and_vec, { "r" } },
+    { INDEX_op_or_vec, { "r" } },
+    { INDEX_op_xor_vec, { "r" } },
+    { INDEX_op_andc_vec, { "r" } },
+    { INDEX_op_cmpeq_vec, { "r" } },
+    { INDEX_op_cmpgt_vec, { "r" } },
+    { INDEX_op_shuf32_vec, { "r" } },
     { INDEX_op_br, { } },
     { INDEX_op_ld8u_i32, { "r", "r" } },
     { INDEX_op_ld8s_i32, { "r", "r" } },
@@ -2262,6 +2437,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr.  Set TCG_REG_EAX to 0, the value that
+       an "exit_tb 0" would return.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2298,6 +2478,10 @@ static void tcg_target_init(TCGContext *s)
         /* MOVBE is only available on Intel Atom and Haswell CPUs, so we
            need to probe for it.  */
         have_movbe = (c & bit_MOVBE) != 0;
+#endif
+#ifndef have_sse2
+        /* For the vector operations, else lowered to integer ones.  */
+        have_sse2 = (d & bit_SSE2) != 0;
 #endif
     }
 
@@ -75,7 +75,29 @@ typedef enum {
 
 extern bool have_bmi1;
 
+/* SSE2 is part of x86_64, and probed on i386.  */
+#if TCG_TARGET_REG_BITS == 64
+# define have_sse2 1
+#else
+extern bool have_sse2;
+#endif
+
+/* The softmmu TLB is indexed with env->tlb_mask.  */
+#define TCG_TARGET_DYNAMIC_TLB 1
+
+/* The code can be generated relocatable, for the persistent translation
+   cache (see translate-cache.c).  */
+#if TCG_TARGET_REG_BITS == 64
+#define TCG_TARGET_TB_CACHE 1
+#endif
+
+/* Only the stores followed by loads need a barrier.  */
+#define TCG_TARGET_DEFAULT_MO (TCG_MO_ALL & ~TCG_MO_ST_LD)
+
 /* optional instructions */
+#define TCG_TARGET_HAS_goto_ptr         1
+#define TCG_TARGET_HAS_mb               1
+#define TCG_TARGET_HAS_vec              have_sse2
 #define TCG_TARGET_HAS_div2_i32         1
 #define TCG_TARGET_HAS_rot_i32          1
 #define TCG_TARGET_HAS_ext8s_i32        1
@@ -77,6 +77,23 @@ static void reset_all_temps(int nb_temps)
     }
 }
 
+/* Reset the temporaries after a conditional branch.  The code that
+   follows is only reached from the branch: the globals and local temps
+   keep their known values, but the temps die and the copies are lost.  */
+static void reset_temps_cond_branch(TCGContext *s, int nb_temps)
+{
+    int i;
+
+    for (i = 0; i < nb_temps; i++) {
+        if (i >= s->nb_globals && !s->temps[i].temp_local) {
+            temps[i].state = TCG_TEMP_UNDEF;
+            temps[i].mask = -1;
+        } else if (temps[i].state == TCG_TEMP_COPY) {
+            temps[i].state = TCG_TEMP_UNDEF;
+        }
+    }
+}
+
 static int op_bits(TCGOpcode op)
 {
     const TCGOpDef *def = &tcg_op_defs[op];
@@ -1364,7 +1381,9 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                We trash everything if the operation is the end of a basic
                block, otherwise we only trash the output args.  "mask" is
                the non-zero bits mask for the first output arg.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                reset_temps_cond_branch(s, nb_temps);
+            } else if (def->flags & TCG_OPF_BB_END) {
                 reset_all_temps(nb_temps);
             } else {
         do_reset_output:
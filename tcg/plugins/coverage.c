@@ -0,0 +1,275 @@
+/*
+ * TCG plugin for QEMU: AFL-style edge (or block) coverage, recorded by
+ *                      inline TCG opcodes into a bitmap that can be
+ *                      shared with a fuzzer.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+
+#include "qemu-common.h"
+#include "tcg-op.h"
+#include "tcg-plugin.h"
+
+#define MAP_SIZE_POW2_DEFAULT 16
+#define MAP_SIZE_POW2_MAX     24
+
+/* Bitmap of 8-bit hit counters, indexed by "prev_loc ^ cur_loc" in
+ * edge mode or by "cur_loc" in block mode.  */
+static uint8_t *coverage_map;
+static uint32_t map_size;
+
+/* Location of the previous block executed by each vCPU, shifted right
+ * by one so that A->B and B->A are different edges.  Each vCPU has its
+ * own cache line.  */
+#define PREV_LOC_STRIDE_BITS 6
+static uint32_t *prev_locs;
+
+static bool block_mode;
+static bool deterministic;
+
+/* Random location assigned to each block address, so it remains the
+ * same when the block is translated again.  */
+static GHashTable *locations;
+
+/* Finalizer of MurmurHash3, spreads aligned addresses over the map.  */
+static uint32_t hash_pc(uint64_t pc)
+{
+    pc ^= pc >> 33;
+    pc *= 0xff51afd7ed558ccdULL;
+    pc ^= pc >> 33;
+    pc *= 0xc4ceb9fe1a85ec53ULL;
+    pc ^= pc >> 33;
+
+    return pc;
+}
+
+static uint32_t get_location(uint64_t pc)
+{
+    gpointer location;
+    uint64_t *key;
+
+    if (deterministic) {
+        return hash_pc(pc) & (map_size - 1);
+    }
+
+    if (g_hash_table_lookup_extended(locations, &pc, NULL, &location)) {
+        return GPOINTER_TO_UINT(location);
+    }
+
+    key = g_new(uint64_t, 1);
+    *key = pc;
+    location = GUINT_TO_POINTER(g_random_int() & (map_size - 1));
+    g_hash_table_insert(locations, key, location);
+
+    return GPOINTER_TO_UINT(location);
+}
+
+/* Generate "(*entry)++", the counter wraps around as in AFL.  */
+static void gen_map_increment(TCGv_ptr entry)
+{
+    TCGv_i32 count = tcg_temp_new_i32();
+
+    tcg_gen_ld8u_i32(count, entry, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st8_i32(count, entry, 0);
+
+    tcg_temp_free_i32(count);
+}
+
+/* Generate at the entry of the block:
+ *
+ *     coverage_map[prev_locs[cpu_index] ^ cur_loc]++;
+ *     prev_locs[cpu_index] = cur_loc >> 1;
+ *
+ * or "coverage_map[cur_loc]++" in block mode.  */
+static void before_gen_tb(const TCGPluginInterface *tpi)
+{
+    uint32_t cur_loc = get_location(tpi->tb->pc);
+    TCGv_ptr prev_base;
+    TCGv_ptr prev_ptr;
+    TCGv_ptr map_base;
+    TCGv_ptr entry;
+    TCGv_i32 index;
+
+    if (block_mode) {
+        entry = tcg_const_ptr(coverage_map + cur_loc);
+        gen_map_increment(entry);
+        tcg_temp_free_ptr(entry);
+        return;
+    }
+
+    index = tcg_temp_new_i32();
+    prev_ptr = tcg_temp_new_ptr();
+    prev_base = tcg_const_ptr(prev_locs);
+
+    /* prev_ptr = &prev_locs[cpu_index] */
+    tcgplugin_gen_cpu_index(index);
+    tcg_gen_shli_i32(index, index, PREV_LOC_STRIDE_BITS);
+    tcg_gen_andi_i32(index, index, (TPI_MAX_CPUS - 1) << PREV_LOC_STRIDE_BITS);
+    tcg_gen_ext_i32_ptr(prev_ptr, index);
+    tcg_gen_add_ptr(prev_ptr, prev_ptr, prev_base);
+
+    /* entry = &coverage_map[*prev_ptr ^ cur_loc] */
+    entry = tcg_temp_new_ptr();
+    map_base = tcg_const_ptr(coverage_map);
+    tcg_gen_ld_i32(index, prev_ptr, 0);
+    tcg_gen_xori_i32(index, index, cur_loc);
+    tcg_gen_ext_i32_ptr(entry, index);
+    tcg_gen_add_ptr(entry, entry, map_base);
+
+    gen_map_increment(entry);
+
+    /* *prev_ptr = cur_loc >> 1 */
+    tcg_gen_movi_i32(index, cur_loc >> 1);
+    tcg_gen_st_i32(index, prev_ptr, 0);
+
+    tcg_temp_free_ptr(map_base);
+    tcg_temp_free_ptr(entry);
+    tcg_temp_free_ptr(prev_base);
+    tcg_temp_free_ptr(prev_ptr);
+    tcg_temp_free_i32(index);
+}
+
+static void cpus_stopped(const TCGPluginInterface *tpi)
+{
+    uint32_t covered = 0;
+    uint32_t i;
+
+    for (i = 0; i < map_size; i++) {
+        if (coverage_map[i]) {
+            covered++;
+        }
+    }
+
+    fprintf(tpi->output, "%s (%d): number of covered %s = %" PRIu32 " / %" PRIu32 "\n",
+            tcg_plugin_get_filename(), getpid(),
+            block_mode ? "blocks" : "edges", covered, map_size);
+}
+
+/* Attach the System V segment "id", as created by the fuzzer.  */
+static uint8_t *attach_sysv_map(const char *id)
+{
+    void *map = shmat(atoi(id), NULL, 0);
+
+    if (map == (void *)-1) {
+        fprintf(stderr, "coverage: error: can't attach the shared memory %s: %s\n",
+                id, strerror(errno));
+        return NULL;
+    }
+
+    return map;
+}
+
+/* Map the POSIX shared memory object "name", created if needed.  */
+static uint8_t *map_posix_map(const char *name)
+{
+    void *map;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "coverage: error: can't open the shared memory %s: %s\n",
+                name, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, map_size) < 0) {
+        fprintf(stderr, "coverage: error: can't resize the shared memory %s: %s\n",
+                name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "coverage: error: can't map the shared memory %s: %s\n",
+                name, strerror(errno));
+        return NULL;
+    }
+
+    return map;
+}
+
+void tpi_init(TCGPluginInterface *tpi)
+{
+    size_t prev_locs_size = TPI_MAX_CPUS << PREV_LOC_STRIDE_BITS;
+    unsigned int map_size_pow2 = MAP_SIZE_POW2_DEFAULT;
+    const char *shm_id;
+    const char *shm_name;
+
+    TPI_INIT_VERSION(*tpi);
+
+    if (getenv("TPI_COVERAGE_MAP_SIZE_POW2")) {
+        map_size_pow2 = atoi(getenv("TPI_COVERAGE_MAP_SIZE_POW2"));
+        if (map_size_pow2 == 0 || map_size_pow2 > MAP_SIZE_POW2_MAX) {
+            fprintf(stderr, "coverage: error: TPI_COVERAGE_MAP_SIZE_POW2 "
+                    "shall be in [1, %d]\n", MAP_SIZE_POW2_MAX);
+            tpi->version = 0;
+            return;
+        }
+    }
+    map_size = 1 << map_size_pow2;
+
+    block_mode = getenv("TPI_COVERAGE_BLOCKS") != NULL;
+    deterministic = getenv("TPI_COVERAGE_DETERMINISTIC") != NULL;
+
+    /* AFL exports the identifier of its segment as __AFL_SHM_ID.  */
+    shm_id = getenv("TPI_COVERAGE_SHM_ID");
+    if (!shm_id) {
+        shm_id = getenv("__AFL_SHM_ID");
+    }
+    shm_name = getenv("TPI_COVERAGE_SHM_NAME");
+
+    if (shm_id) {
+        coverage_map = attach_sysv_map(shm_id);
+    }
+    else if (shm_name) {
+        coverage_map = map_posix_map(shm_name);
+    }
+    else {
+        coverage_map = g_malloc0(map_size);
+    }
+
+    if (!coverage_map) {
+        tpi->version = 0;
+        return;
+    }
+
+    prev_locs = qemu_memalign(1 << PREV_LOC_STRIDE_BITS, prev_locs_size);
+    memset(prev_locs, 0, prev_locs_size);
+
+    locations = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+    tpi->before_gen_tb = before_gen_tb;
+    tpi->cpus_stopped  = cpus_stopped;
+}
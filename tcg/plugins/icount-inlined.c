@@ -1,6 +1,6 @@
 /*
  * TCG plugin for QEMU: count the number of executed instructions per
- *                      CPU.  This plugin is *not* thread-safe!
+ *                      CPU with inline TCG opcodes.
  *
  * Copyright (C) 2011 STMicroelectronics
  *
@@ -34,8 +34,7 @@
 #include "tcg-op.h"
 #include "tcg-plugin.h"
 
-static TCGArg **icount_total_args;
-static uint64_t *icount_total;
+static TPICounter *icount_total;
 
 static void cpus_stopped(const TCGPluginInterface *tpi)
 {
@@ -43,54 +42,15 @@ static void cpus_stopped(const TCGPluginInterface *tpi)
     for (i = 0; i < tpi->nb_cpus; i++) {
         fprintf(tpi->output,
                 "%s (%d): number of executed instructions on CPU #%d = %" PRIu64 "\n",
-                tcg_plugin_get_filename(), getpid(), i, icount_total[i]);
+                tcg_plugin_get_filename(), getpid(), i,
+                tcgplugin_counter_read(icount_total, i));
     }
 }
 
-/* This function generates code which is *not* thread-safe!  */
 static void before_gen_tb(const TCGPluginInterface *tpi)
 {
-    TCGv_ptr icount_ptr;
-    TCGv_i64 icount_tmp;
-    TCGv_i32 tb_icount32;
-    TCGv_i64 tb_icount64;
-    
-    CPUState *cpu = ENV_GET_CPU((CPUArchState *) tpi->env);
-
-    /* icount_ptr = &icount */
-    icount_ptr = tcg_const_ptr((tcg_target_long)&icount_total[cpu->cpu_index]);
-
-    /* icount_tmp = *icount_ptr */
-    icount_tmp = tcg_temp_new_i64();
-    tcg_gen_ld_i64(icount_tmp, icount_ptr, 0);
-
-    /* icount_args = &tb_icount32 */
-    /* tb_icount32 = fixup(tb->icount) */
-    icount_total_args[cpu->cpu_index] = tpi->tcg_ctx->gen_opparam_ptr + 1;
-    tb_icount32 = tcg_const_i32(0);
-
-    /* tb_icount64 = (int64_t)tb_icount32 */
-    tb_icount64 = tcg_temp_new_i64();
-    tcg_gen_extu_i32_i64(tb_icount64, tb_icount32);
-
-    /* icount_tmp += tb_icount64 */
-    tcg_gen_add_i64(icount_tmp, icount_tmp, tb_icount64);
-
-    /* *icount_ptr = icount_tmp */
-    tcg_gen_st_i64(icount_tmp, icount_ptr, 0);
-
-    tcg_temp_free_i64(tb_icount64);
-    tcg_temp_free_i32(tb_icount32);
-    tcg_temp_free_i64(icount_tmp);
-    tcg_temp_free_ptr(icount_ptr);
-}
-
-static void after_gen_tb(const TCGPluginInterface *tpi)
-{
-    const CPUState *cpu = ENV_GET_CPU((CPUArchState *) tpi->env);
-    
-    /* Patch parameter value.  */
-    *icount_total_args[cpu->cpu_index] = tpi->tb->icount;
+    /* icount_total[cpu_index] += tb->icount */
+    tcgplugin_gen_counter_add_icount(icount_total);
 }
 
 void tpi_init(TCGPluginInterface *tpi)
@@ -99,8 +59,6 @@ void tpi_init(TCGPluginInterface *tpi)
 
     tpi->cpus_stopped  = cpus_stopped;
     tpi->before_gen_tb = before_gen_tb;
-    tpi->after_gen_tb  = after_gen_tb;
 
-    icount_total = g_malloc0(tpi->nb_cpus * sizeof(uint64_t));
-    icount_total_args = g_malloc0(tpi->nb_cpus * sizeof(TCGArg *));
+    icount_total = tcgplugin_counter_new();
 }
@@ -34,23 +34,30 @@
 #include "qemu-common.h"
 #include "tcg-plugin.h"
 
-static uint64_t *icount_total;
-
+/* Each vCPU counts in its own buffer, hence no lock is needed.  */
 static void pre_tb_helper_code(const TCGPluginInterface *tpi,
                                TPIHelperInfo info, uint64_t address,
                                uint64_t data1, uint64_t data2)
 {
-    icount_total[info.cpu_index] += info.icount;
+    uint64_t *icount = tcgplugin_get_cpu_data(tpi, info.cpu_index);
+
+    if (icount) {
+        *icount += info.icount;
+    }
+}
+
+static void print_icount(uint32_t cpu_index, void *data, void *opaque)
+{
+    const TCGPluginInterface *tpi = opaque;
+
+    fprintf(tpi->output,
+            "%s (%d): number of executed instructions on CPU #%d = %" PRIu64 "\n",
+            tcg_plugin_get_filename(), getpid(), cpu_index, *(uint64_t *)data);
 }
 
 static void cpus_stopped(const TCGPluginInterface *tpi)
 {
-    unsigned int i;
-    for (i = 0; i < tpi->nb_cpus; i++) {
-        fprintf(tpi->output,
-                "%s (%d): number of executed instructions on CPU #%d = %" PRIu64 "\n",
-                tcg_plugin_get_filename(), getpid(), i, icount_total[i]);
-    }
+    tcgplugin_foreach_cpu_data(tpi, print_icount, (void *)tpi);
 }
 
 void tpi_init(TCGPluginInterface *tpi)
@@ -59,6 +66,6 @@ void tpi_init(TCGPluginInterface *tpi)
 
     tpi->pre_tb_helper_code = pre_tb_helper_code;
     tpi->cpus_stopped = cpus_stopped;
-
-    icount_total = g_malloc0(tpi->nb_cpus * sizeof(uint64_t));
+    tpi->cpu_data_size = sizeof(uint64_t);
+    tpi->pre_tb_helper_flags = TPI_CALL_NO_GLOBALS;
 }
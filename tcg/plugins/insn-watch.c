@@ -0,0 +1,99 @@
+/*
+ * TCG plugin for QEMU: print the execution and the memory accesses of
+ *                      a few guest instructions, chosen by address.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "qemu-common.h"
+#include "tcg-plugin.h"
+
+/* Addresses of the watched instructions.  */
+static GHashTable *watched;
+
+static void instr_hook(const TCGPluginInterface *tpi, const TPIInstrEvent *event)
+{
+    switch (event->when) {
+    case TPI_INSTR_BEFORE:
+        fprintf(tpi->output, "CPU #%" PRIu32 " 0x%016" PRIx64 ": before\n",
+                event->cpu_index, event->pc);
+        break;
+
+    case TPI_INSTR_AFTER:
+        fprintf(tpi->output, "CPU #%" PRIu32 " 0x%016" PRIx64 ": after\n",
+                event->cpu_index, event->pc);
+        break;
+
+    case TPI_INSTR_MEM_LD:
+    case TPI_INSTR_MEM_ST:
+        fprintf(tpi->output, "CPU #%" PRIu32 " 0x%016" PRIx64 ": %s 0x%016" PRIx64
+                " (%d bytes)\n", event->cpu_index, event->pc,
+                event->when == TPI_INSTR_MEM_LD ? "load" : "store",
+                event->address, 1 << (event->memop & MO_SIZE));
+        break;
+    }
+}
+
+/* Only the watched instructions get a hook, the others run at full
+ * speed.  */
+static void decode_instr(const TCGPluginInterface *tpi, uint64_t pc)
+{
+    if (!g_hash_table_lookup_extended(watched, &pc, NULL, NULL)) {
+        return;
+    }
+
+    tcgplugin_gen_instr_hook(tpi, TPI_INSTR_BEFORE | TPI_INSTR_AFTER
+                             | TPI_INSTR_MEM_LD | TPI_INSTR_MEM_ST,
+                             instr_hook, NULL, 0);
+}
+
+void tpi_init(TCGPluginInterface *tpi)
+{
+    const char *list = getenv("TPI_INSN_WATCH");
+    gchar **addresses;
+    unsigned int i;
+
+    TPI_INIT_VERSION_GENERIC(*tpi);
+
+    if (!list) {
+        fprintf(stderr, "insn-watch: error: TPI_INSN_WATCH isn't defined\n");
+        tpi->version = 0;
+        return;
+    }
+
+    watched = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+    addresses = g_strsplit(list, ",", 0);
+    for (i = 0; addresses[i]; i++) {
+        uint64_t *key = g_new(uint64_t, 1);
+
+        *key = strtoull(addresses[i], NULL, 0);
+        g_hash_table_insert(watched, key, NULL);
+    }
+    g_strfreev(addresses);
+
+    tpi->decode_instr = decode_instr;
+}
@@ -0,0 +1,84 @@
+/*
+ * TCG plugin for QEMU: count the number of guest memory loads and
+ *                      stores per CPU.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "qemu-common.h"
+#include "tcg-plugin.h"
+
+typedef struct {
+    uint64_t nb_loads;
+    uint64_t nb_stores;
+} MemCount;
+
+/* Each vCPU counts in its own buffer, hence no lock is needed.  */
+static void post_qemu_ldst(const TCGPluginInterface *tpi,
+                           uint32_t cpu_index, uint64_t address,
+                           uint64_t value, uint32_t memop, uint32_t flags)
+{
+    MemCount *count = tcgplugin_get_cpu_data(tpi, cpu_index);
+
+    if (!count) {
+        return;
+    }
+
+    if (flags & TPI_MEM_LD) {
+        count->nb_loads++;
+    } else {
+        count->nb_stores++;
+    }
+}
+
+static void print_count(uint32_t cpu_index, void *data, void *opaque)
+{
+    const TCGPluginInterface *tpi = opaque;
+    MemCount *count = data;
+
+    fprintf(tpi->output,
+            "%s (%d): number of loads/stores on CPU #%d = %" PRIu64 "/%" PRIu64 "\n",
+            tcg_plugin_get_filename(), getpid(), cpu_index,
+            count->nb_loads, count->nb_stores);
+}
+
+static void cpus_stopped(const TCGPluginInterface *tpi)
+{
+    tcgplugin_foreach_cpu_data(tpi, print_count, (void *)tpi);
+}
+
+void tpi_init(TCGPluginInterface *tpi)
+{
+    TPI_INIT_VERSION_GENERIC(*tpi);
+
+    tpi->post_qemu_ldst = post_qemu_ldst;
+    tpi->cpus_stopped = cpus_stopped;
+    tpi->cpu_data_size = sizeof(MemCount);
+
+    /* Accesses of any size, anywhere.  */
+    tpi->mem_subscription = TPI_MEM_LD | TPI_MEM_ST | TPI_MEM_POST;
+    tpi->qemu_ldst_flags = TPI_CALL_NO_GLOBALS;
+}
@@ -159,6 +159,7 @@ void tpi_init(TCGPluginInterface *tpi)
     TPI_INIT_VERSION_GENERIC(*tpi);
 
     tpi->pre_tb_helper_code = pre_tb_helper_code;
+    tpi->pre_tb_helper_flags = TPI_CALL_NO_GLOBALS;
     tpi->pre_tb_helper_data = pre_tb_helper_data;
     tpi->cpus_stopped = cpus_stopped;
 
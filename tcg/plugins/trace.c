@@ -28,8 +28,12 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
 #include "tcg-plugin.h"
 #include "disas/disas.h"
 
@@ -61,9 +65,343 @@ static void pre_tb_helper_data(const TCGPluginInterface *tpi,
     *data2 = (uintptr_t)filename;
 }
 
+/*
+ * Binary mode, enabled by TPI_TRACE_BINARY: each vCPU appends
+ * fixed-size records to its own ring, a background thread drains the
+ * rings into "$TPI_TRACE_BINARY.$PID".  Symbols are resolved at
+ * translation-time only and written once per block address into
+ * "$TPI_TRACE_BINARY.$PID.sym".  Use scripts/tcg-plugin-trace.py to
+ * get the same text as the default mode.  Each child of the fork
+ * server writes its own files, with its own drain thread.
+ */
+
+#define TRACE_MAGIC   "TPITRACE"
+#define TRACE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t pid;
+    uint32_t reserved;
+    uint64_t start_time;
+} TraceHeader;
+
+typedef struct {
+    uint64_t pc;
+    uint64_t timestamp;
+    uint32_t icount;
+    uint16_t cpu_index;
+    uint16_t size;
+} TraceRecord;
+
+/* Number of records per vCPU, shall be a power of 2.  */
+#define TRACE_RING_SIZE 65536
+
+/* Single producer (the vCPU), single consumer (the drain thread), the
+ * indexes are free-running and live on separate cache lines.  */
+typedef struct {
+    unsigned long head;
+    unsigned long stalls;
+    char pad1[64 - 2 * sizeof(unsigned long)];
+    unsigned long tail;
+    char pad2[64 - sizeof(unsigned long)];
+    TraceRecord records[TRACE_RING_SIZE];
+} TraceRing;
+
+static FILE *trace_file;
+static FILE *symbol_file;
+static GHashTable *traced_symbols;
+
+static pthread_t drain_thread;
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool drain_running;
+static bool drain_stop;
+
+static void pre_tb_helper_code_binary(const TCGPluginInterface *tpi,
+                                      TPIHelperInfo info, uint64_t address,
+                                      uint64_t data1, uint64_t data2)
+{
+    TraceRing *ring = tcgplugin_get_cpu_data(tpi, info.cpu_index);
+    TraceRecord *record;
+    unsigned long head;
+
+    if (!ring || !info.icount)
+        return;
+
+    /* Wait for the drain thread rather than losing records.  */
+    head = ring->head;
+    while (head - atomic_read(&ring->tail) >= TRACE_RING_SIZE) {
+        ring->stalls++;
+        sched_yield();
+    }
+    smp_mb();
+
+    record = &ring->records[head & (TRACE_RING_SIZE - 1)];
+    record->pc = address;
+    record->timestamp = get_clock();
+    record->icount = info.icount;
+    record->cpu_index = info.cpu_index;
+    record->size = info.size;
+
+    smp_wmb();
+    atomic_set(&ring->head, head + 1);
+}
+
+static void write_symbol(uint64_t address)
+{
+    const char *symbol;
+    const char *filename;
+
+    lookup_symbol2(address, &symbol, &filename);
+    fprintf(symbol_file, "0x%016" PRIx64 "\t%s\t%s\n", address,
+            filename[0] != '\0' ? filename : "<unknown>",
+            symbol[0] != '\0' ? symbol : "<unknown>");
+}
+
+static void pre_tb_helper_data_binary(const TCGPluginInterface *tpi,
+                                      TPIHelperInfo info, uint64_t address,
+                                      uint64_t *data1, uint64_t *data2)
+{
+    if (g_hash_table_lookup(traced_symbols, &address))
+        return;
+    g_hash_table_insert(traced_symbols, g_memdup(&address, sizeof(address)),
+                        GINT_TO_POINTER(1));
+
+    write_symbol(address);
+}
+
+static void drain_ring(uint32_t cpu_index, void *data, void *opaque)
+{
+    TraceRing *ring = data;
+    size_t *nb_records = opaque;
+    unsigned long head = atomic_read(&ring->head);
+    unsigned long tail = ring->tail;
+
+    smp_rmb();
+
+    while (tail != head) {
+        unsigned long start = tail & (TRACE_RING_SIZE - 1);
+        unsigned long count = MIN(head - tail, TRACE_RING_SIZE - start);
+
+        fwrite(&ring->records[start], sizeof(TraceRecord), count, trace_file);
+        tail += count;
+        *nb_records += count;
+    }
+
+    smp_mb();
+    atomic_set(&ring->tail, tail);
+}
+
+static size_t drain_rings(const TCGPluginInterface *tpi)
+{
+    size_t nb_records = 0;
+
+    pthread_mutex_lock(&drain_mutex);
+    tcgplugin_foreach_cpu_data(tpi, drain_ring, &nb_records);
+    pthread_mutex_unlock(&drain_mutex);
+
+    return nb_records;
+}
+
+static void *drain_thread_func(void *opaque)
+{
+    const TCGPluginInterface *tpi = opaque;
+
+    while (!atomic_read(&drain_stop)) {
+        if (!drain_rings(tpi)) {
+            g_usleep(1000);
+        }
+    }
+
+    return NULL;
+}
+
+static bool start_drain_thread(const TCGPluginInterface *tpi)
+{
+    int error;
+
+    atomic_set(&drain_stop, false);
+    error = pthread_create(&drain_thread, NULL, drain_thread_func, (void *)tpi);
+    if (error) {
+        fprintf(stderr, "trace: error: can't create the drain thread: %s\n",
+                strerror(error));
+        return false;
+    }
+
+    drain_running = true;
+    return true;
+}
+
+static void stop_drain_thread(void)
+{
+    if (!drain_running) {
+        return;
+    }
+
+    atomic_mb_set(&drain_stop, true);
+    pthread_join(drain_thread, NULL);
+    drain_running = false;
+}
+
+static void cpus_stopped_binary(const TCGPluginInterface *tpi)
+{
+    /* This is also the last chance to save the trace in user-mode.  */
+    drain_rings(tpi);
+    fflush(trace_file);
+    fflush(symbol_file);
+}
+
+static void print_stalls(uint32_t cpu_index, void *data, void *opaque)
+{
+    const TCGPluginInterface *tpi = opaque;
+    TraceRing *ring = data;
+
+    if (ring->stalls) {
+        fprintf(tpi->output, "trace: CPU #%" PRIu32 " waited %lu times for "
+                "the drain thread\n", cpu_index, ring->stalls);
+    }
+}
+
+static void exit_binary(const TCGPluginInterface *tpi)
+{
+    stop_drain_thread();
+
+    if (!trace_file) {
+        return;
+    }
+
+    drain_rings(tpi);
+    tcgplugin_foreach_cpu_data(tpi, print_stalls, (void *)tpi);
+
+    fclose(trace_file);
+    fclose(symbol_file);
+}
+
+static bool open_binary_files(void)
+{
+    char path[PATH_MAX];
+    TraceHeader header;
+
+    if (getenv("TPI_OUTPUT_NO_PID")) {
+        snprintf(path, PATH_MAX, "%s", getenv("TPI_TRACE_BINARY"));
+    }
+    else {
+        snprintf(path, PATH_MAX, "%s.%d", getenv("TPI_TRACE_BINARY"), getpid());
+    }
+
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        fprintf(stderr, "trace: error: can't open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    pstrcat(path, PATH_MAX, ".sym");
+    symbol_file = fopen(path, "w");
+    if (!symbol_file) {
+        fprintf(stderr, "trace: error: can't open %s: %s\n", path, strerror(errno));
+        fclose(trace_file);
+        trace_file = NULL;
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.pid = getpid();
+    header.start_time = get_clock();
+    fwrite(&header, sizeof(header), 1, trace_file);
+
+    fprintf(symbol_file, "# %s\n", tcg_plugin_get_filename());
+
+    return true;
+}
+
+static void close_binary_files(void)
+{
+    fclose(trace_file);
+    fclose(symbol_file);
+    trace_file = NULL;
+    symbol_file = NULL;
+}
+
+static void before_fork_binary(const TCGPluginInterface *tpi)
+{
+    /* The drain thread doesn't survive the fork, nor would the locks
+     * it may hold: stop it while the rings are empty.  The server
+     * doesn't execute guest code any more.  */
+    stop_drain_thread();
+    drain_rings(tpi);
+    fflush(trace_file);
+    fflush(symbol_file);
+}
+
+static void reset_stalls(uint32_t cpu_index, void *data, void *opaque)
+{
+    TraceRing *ring = data;
+
+    ring->stalls = 0;
+}
+
+static void rewrite_symbol(gpointer key, gpointer value, gpointer opaque)
+{
+    write_symbol(*(uint64_t *)key);
+}
+
+static void after_fork_binary(const TCGPluginInterface *tpi)
+{
+    /* The buffers were flushed by the server, closing the inherited
+     * streams writes nothing.  */
+    close_binary_files();
+    tcgplugin_foreach_cpu_data(tpi, reset_stalls, NULL);
+
+    if (!open_binary_files() || !start_drain_thread(tpi)) {
+        exit(1);
+    }
+
+    /* The blocks translated by the server are not translated again.  */
+    g_hash_table_foreach(traced_symbols, rewrite_symbol, NULL);
+}
+
+static bool init_binary(TCGPluginInterface *tpi)
+{
+    if (!open_binary_files()) {
+        return false;
+    }
+
+    traced_symbols = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                           g_free, NULL);
+
+    if (!start_drain_thread(tpi)) {
+        close_binary_files();
+        return false;
+    }
+
+    tpi->pre_tb_helper_code = pre_tb_helper_code_binary;
+    tpi->pre_tb_helper_data = pre_tb_helper_data_binary;
+    tpi->cpus_stopped = cpus_stopped_binary;
+    tpi->exit = exit_binary;
+    tpi->before_fork = before_fork_binary;
+    tpi->after_fork = after_fork_binary;
+    tpi->cpu_data_size = sizeof(TraceRing);
+    tpi->pre_tb_helper_flags = TPI_CALL_NO_GLOBALS;
+
+    return true;
+}
+
 void tpi_init(TCGPluginInterface *tpi)
 {
     TPI_INIT_VERSION_GENERIC(*tpi);
+
+    if (getenv("TPI_TRACE_BINARY")) {
+        if (!init_binary(tpi)) {
+            tpi->version = 0;
+        }
+        return;
+    }
+
     tpi->pre_tb_helper_code = pre_tb_helper_code;
     tpi->pre_tb_helper_data = pre_tb_helper_data;
+    tpi->pre_tb_helper_flags = TPI_CALL_NO_GLOBALS;
 }
@@ -2582,6 +2582,46 @@ void tcg_gen_qemu_st_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_ld_i64(TCGv_i64, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_st_i64(TCGv_i64, TCGv, TCGArg, TCGMemOp);
 
+/* End the TB by jumping to the TB matching the CPU state, if it is in
+   the jump cache of the CPU, or else by an "exit_tb 0".  The CPU state
+   must be up to date, as for an exit_tb.  */
+void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env);
+
+/* Host memory barrier, for the guest barrier instructions.  Only needed,
+   and only emitted, when the vCPUs run in parallel.  */
+static inline void tcg_gen_mb(TCGBar mb_type)
+{
+    if (parallel_cpus) {
+        tcg_gen_op1i(INDEX_op_mb, mb_type);
+    }
+}
+
+/* Vector operations on the guest registers that "base" (the CPU state)
+   holds at the offsets dofs, aofs and bofs: oprsz is their size, 8 or 16
+   bytes, and vece the size of their elements, MO_8 to MO_64 (MO_32 for
+   the comparisons).  The operands either overlap exactly or not at all.
+   The comparisons set the elements to all ones when true, the signed
+   cmpgt included, and tcg_gen_vec_shuf32 sets the 32-bit element i to
+   the element (sel >> 2 * i) & 3 of the source (see VEC_DESC).  */
+void tcg_gen_vec_add(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                     intptr_t bofs, unsigned oprsz, unsigned vece);
+void tcg_gen_vec_sub(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                     intptr_t bofs, unsigned oprsz, unsigned vece);
+void tcg_gen_vec_and(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                     intptr_t bofs, unsigned oprsz);
+void tcg_gen_vec_or(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                    intptr_t bofs, unsigned oprsz);
+void tcg_gen_vec_xor(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                     intptr_t bofs, unsigned oprsz);
+void tcg_gen_vec_andc(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                      intptr_t bofs, unsigned oprsz);
+void tcg_gen_vec_cmpeq(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                       intptr_t bofs, unsigned oprsz, unsigned vece);
+void tcg_gen_vec_cmpgt(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                       intptr_t bofs, unsigned oprsz, unsigned vece);
+void tcg_gen_vec_shuf32(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                        unsigned sel, unsigned oprsz);
+
 static inline void tcg_gen_qemu_ld8u(TCGv ret, TCGv addr, int mem_index)
 {
     tcg_gen_qemu_ld_tl(ret, addr, mem_index, MO_UB);
@@ -28,6 +28,18 @@ void tcgplugin_helper_post_qemu_ld_i64(CPUArchState *env, target_ulong addr, uin
 void tcgplugin_helper_intercept_qemu_st_i64(CPUArchState *env, target_ulong addr, uint32_t idx, uint64_t val, uint32_t memop);
 void tcgplugin_helper_post_qemu_st_i64(CPUArchState *env, target_ulong addr, uint32_t idx, uint64_t val, uint32_t memop);
 
+void tcgplugin_helper_pre_qemu_ld(CPUArchState *env, target_ulong addr, uint32_t idx, uint32_t memop);
+void tcgplugin_helper_pre_qemu_st_i32(CPUArchState *env, target_ulong addr, uint32_t idx, uint32_t val, uint32_t memop);
+void tcgplugin_helper_pre_qemu_st_i64(CPUArchState *env, target_ulong addr, uint32_t idx, uint64_t val, uint32_t memop);
+
+void tcgplugin_helper_instr(CPUArchState *env, void *hook, uint32_t when);
+void tcgplugin_helper_instr_mem(CPUArchState *env, void *hook, uint32_t when, target_ulong addr, uint32_t memop);
+
+/* Generate the calls to the per-instruction hooks that asked for the
+ * memory accesses of the instruction being translated, see
+ * tcgplugin_gen_instr_hook().  */
+void tcgplugin_gen_instr_mem(TCGv addr, TCGMemOp memop, bool is_store);
+
 
 #define TCGPLUGIN_GEN_HELPER_INTERCEPT_LD(type)                                     \
 		static inline void glue(tcgplugin_gen_helper_intercept_ld_, type)(          \
@@ -110,6 +122,43 @@ static inline void glue(tcgplugin_gen_helper_post_qemu_st_, type)(
 }
 
 
+#define TCGPLUGIN_GEN_HELPER_PRE_ST(type)                                           \
+static inline void glue(tcgplugin_gen_helper_pre_qemu_st_, type)(                   \
+		TCGContext *s,                                                              \
+		TCGv addr,                                                                  \
+		TCGv_i32 idx,                                                               \
+		glue(TCGv_, type) val,                                                      \
+		TCGv_i32 memop)                                                             \
+{                                                                                   \
+	TCGArg args[5] = {                                                              \
+			GET_TCGV_PTR(tcgplugin_cpu_env),                                        \
+			GET_TCGV(addr),                                                         \
+			GET_TCGV_I32(idx),                                                      \
+			glue(GET_TCGV_, type)(val),                                             \
+			GET_TCGV_I32(memop)};                                                   \
+                                                                                    \
+	tcg_gen_callN(s,                                                                \
+		(void *) glue(tcgplugin_helper_pre_qemu_st_, type),                         \
+		TCG_CALL_DUMMY_ARG, 5, args);                                               \
+}
+
+static inline void tcgplugin_gen_helper_pre_qemu_ld(
+		TCGContext *s,
+		TCGv addr,
+		TCGv_i32 idx,
+		TCGv_i32 memop)
+{
+	TCGArg args[4] = {
+			GET_TCGV_PTR(tcgplugin_cpu_env),
+			GET_TCGV(addr),
+			GET_TCGV_I32(idx),
+			GET_TCGV_I32(memop)};
+
+	tcg_gen_callN(s,
+		(void *) tcgplugin_helper_pre_qemu_ld,
+		TCG_CALL_DUMMY_ARG, 4, args);
+}
+
 //static inline void tcgplugin_gen_helper_intercept_ld_i32(
 //				TCGContext *s,
 //				TCGv val,
@@ -140,10 +189,14 @@ TCGPLUGIN_GEN_HELER_INTERCEPT_ST(i64)
 TCGPLUGIN_GEN_HELPER_POST_ST(i32)
 TCGPLUGIN_GEN_HELPER_POST_ST(i64)
 
+TCGPLUGIN_GEN_HELPER_PRE_ST(i32)
+TCGPLUGIN_GEN_HELPER_PRE_ST(i64)
+
 #undef TCGPLUGIN_GEN_HELPER_INTERCEPT_LD
 #undef TCGPLUGIN_GEN_HELPER_POST_LD
 #undef TCGPLUGIN_GEN_HELER_INTERCEPT_ST
 #undef TCGPLUGIN_GEN_HELPER_POST_ST
+#undef TCGPLUGIN_GEN_HELPER_PRE_ST
 #undef GET_TCGV
 
 
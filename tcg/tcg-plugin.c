@@ -33,6 +33,7 @@
 #include <string.h>  /* strlen(3), */
 #include <stdio.h>   /* *printf(3), memset(3), */
 #include <pthread.h> /* pthread_*, */
+#include <sys/wait.h> /* waitpid(2), */
 
 #include "tcg-op.h"
 
@@ -45,12 +46,19 @@
 #include "sysemu/sysemu.h"     /* max_cpus */
 
 #include "tcg-plugin-api.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
+#if defined(CONFIG_SOFTMMU)
+#include "sysemu/cpus.h"
+#include "qemu/main-loop.h"
+#endif
 
 
 
 
 bool tcgplugin_intercept_qemu_ldst = 0;
-bool tcgplugin_monitor_qemu_ldst = 1;
+bool tcgplugin_monitor_qemu_ldst = 0;
+uint32_t tcgplugin_mem_subscription = 0;
 
 TCGv_ptr tcgplugin_cpu_env;
 
@@ -59,39 +67,93 @@ static Notifier exit_notifier;
 static void tcgplugin_machine_init_done(Notifier *notifier, void *data);
 static void tcgplugin_exit(Notifier *notifier, void *data);
 
-/* Interface for the TCG plugin.  */
-static TCGPluginInterface tpi;
+/* Interfaces for the TCG plugins, in loading order.  */
+static TCGPluginInterface tpis[TPI_MAX_PLUGINS];
+static void *tpi_handles[TPI_MAX_PLUGINS];
+static unsigned int nb_tpis;
+
+#define FOREACH_TPI(tpi) for ((tpi) = tpis; (tpi) < tpis + nb_tpis; (tpi)++)
+
+/* The only plugin that implements pre_tb_helper_code(), if any, its
+ * data are passed directly to helper_tcg_plugin_pre_tb().  Otherwise
+ * helper_tcg_plugin_pre_tb_chain() fans out to all of them.  */
+static TCGPluginInterface *pre_tb_direct;
+static unsigned int nb_pre_tb_plugins;
+
+static unsigned int nb_watched_ranges;
 
 static void helper_tcg_plugin_pre_tb(uint64_t address, uint64_t info, uint64_t data1, uint64_t data2);
+static void helper_tcg_plugin_pre_tb_chain(uint64_t address, uint64_t info, uint64_t chain, uint64_t unused);
 
-static void gen_helper_tcg_plugin_pre_tb(TCGContext *s, TCGv_i64 arg1,
+static void helper_tcg_plugin_fork_server(void *tb);
+
+static void gen_helper_tcg_plugin_fork_server(TCGContext *s, TranslationBlock *tb)
+{
+    TCGv_ptr tb_ptr = tcg_const_ptr(tb);
+    TCGArg args[1] = { GET_TCGV_PTR(tb_ptr) };
+
+    tcg_gen_callN(s, helper_tcg_plugin_fork_server, dh_retvar(void), 1, args);
+    tcg_temp_free_ptr(tb_ptr);
+}
+
+static void gen_helper_tcg_plugin_pre_tb(TCGContext *s, void *func, TCGv_i64 arg1,
 		TCGv_i64 arg2, TCGv_i64 arg3, TCGv_i64 arg4)  {
 	TCGArg args[4] = {
 			GET_TCGV_I64(arg1), GET_TCGV_I64(arg2), GET_TCGV_I64(arg3), GET_TCGV_I64(arg4)};
-	tcg_gen_callN(s, (void *)helper_tcg_plugin_pre_tb, dh_retvar(void), 4, args);
+	tcg_gen_callN(s, func, dh_retvar(void), 4, args);
 }
 
 /* Return true if a plugin was loaded with success.  */
 bool tcg_plugin_enabled(void)
 {
-    return tpi.version != 0;
+    return nb_tpis != 0;
 }
 
 static bool mutex_protected;
 
+static void tcg_plugin_load_one(const char *name);
+static void fork_server_init(void);
+static bool fork_server_wanted(const TranslationBlock *tb);
+
+/* Load the comma-separated list of plugins "names", in that order.  */
+void tcg_plugin_load(const char *names)
+{
+    char **list = g_strsplit(names, ",", 0);
+    char **name;
+
+    for (name = list; *name != NULL; name++) {
+        if (**name != '\0') {
+            tcg_plugin_load_one(*name);
+        }
+    }
+
+    g_strfreev(list);
+
+    fork_server_init();
+}
+
 /* Load the dynamic shared object "name" and call its function
  * "tpi_init()" to initialize itself.  Then, some sanity checks are
  * performed to ensure the dynamic shared object is compatible with
  * this instance of QEMU (guest CPU, emulation mode, ...).  */
-void tcg_plugin_load(const char *name)
+static void tcg_plugin_load_one(const char *name)
 {
 #if !defined(CONFIG_SOFTMMU)
     unsigned int max_cpus = 1;
 #endif
+    TCGPluginInterface *tpi = &tpis[nb_tpis];
+    unsigned int old_nb_watched_ranges = nb_watched_ranges;
     tpi_init_t tpi_init;
     char *path = NULL;
     bool done = false;
     void *handle;
+    unsigned int i;
+
+    if (nb_tpis == TPI_MAX_PLUGINS) {
+        fprintf(stderr, "plugin: error: too many plugins (max. %d), "
+                "%s not loaded\n", TPI_MAX_PLUGINS, name);
+        return;
+    }
 
     /* Check if "name" refers to an installed plugin (short form).  */
     if (name[0] != '.' && name[0] != '/') {
@@ -121,6 +183,14 @@ void tcg_plugin_load(const char *name)
         goto error;
     }
 
+    /* Plugins keep their state in static variables.  */
+    for (i = 0; i < nb_tpis; i++) {
+        if (tpi_handles[i] == handle) {
+            fprintf(stderr, "plugin: error: %s is already loaded\n", name);
+            goto error;
+        }
+    }
+
     tpi_init = dlsym(handle, "tpi_init");
     if (!tpi_init) {
         fprintf(stderr, "plugin: error: %s\n", dlerror());
@@ -132,21 +202,24 @@ void tcg_plugin_load(const char *name)
      * plugin initialization.
      */
 
-    TPI_INIT_VERSION(tpi);
+    TPI_INIT_VERSION(*tpi);
 
-    tpi.nb_cpus = max_cpus;
+    tpi->nb_cpus = max_cpus;
 
     /* Plugins output is, in order of priority:
      *
      * 1. the file $TPI_OUTPUT.$PID if the environment variable
-     *    TPI_OUTPUT is defined.
+     *    TPI_OUTPUT is defined, shared by all the plugins.
      *
      * 2. a duplicate of the error stream.
      *
      * 3. the error stream itself.
      */
-    tpi.output = NULL;
-    if (getenv("TPI_OUTPUT")) {
+    tpi->output = NULL;
+    if (getenv("TPI_OUTPUT") && nb_tpis != 0) {
+        tpi->output = tpis[0].output;
+    }
+    else if (getenv("TPI_OUTPUT")) {
         char path[PATH_MAX];
         if (getenv("TPI_OUTPUT_NO_PID")) {
             snprintf(path, PATH_MAX, "%s", getenv("TPI_OUTPUT"));
@@ -154,64 +227,68 @@ void tcg_plugin_load(const char *name)
         else {
             snprintf(path, PATH_MAX, "%s.%d", getenv("TPI_OUTPUT"), getpid());
         }
-        tpi.output = fopen(path, "w");
-        if (!tpi.output) {
+        tpi->output = fopen(path, "w");
+        if (!tpi->output) {
             perror("plugin: warning: can't open TPI_OUTPUT.$PID (fall back to stderr)");
         }
     }
-    if (!tpi.output)
-        tpi.output = fdopen(dup(fileno(stderr)), "a");
-    if (!tpi.output)
-        tpi.output = stderr;
+    if (!tpi->output)
+        tpi->output = fdopen(dup(fileno(stderr)), "a");
+    if (!tpi->output)
+        tpi->output = stderr;
 
     /* This is a compromise between buffered output and truncated
      * output when exiting through _exit(2) in user-mode.  */
-    setlinebuf(tpi.output);
+    setlinebuf(tpi->output);
 
-    tpi.low_pc = 0;
-    tpi.high_pc = UINT64_MAX;
+    tpi->low_pc = 0;
+    tpi->high_pc = UINT64_MAX;
 
     if (getenv("TPI_SYMBOL_PC")) {
 #if 0
         struct syminfo *syminfo =
             reverse_lookup_symbol(getenv("TPI_SYMBOL_PC"));
         if (!syminfo)  {
-            fprintf(tpi.output,
+            fprintf(tpi->output,
                     "plugin: warning: symbol '%s' not found\n",
                     getenv("TPI_SYMBOL_PC"));
         }
-        tpi.low_pc  = syminfo.disas_symtab.elfXX.st_value;
-        tpi.high_pc = tpi.low_pc + syminfo.disas_symtab.elfXX.st_size;
+        tpi->low_pc  = syminfo.disas_symtab.elfXX.st_value;
+        tpi->high_pc = tpi->low_pc + syminfo.disas_symtab.elfXX.st_size;
 #else
-        fprintf(tpi.output,
+        fprintf(tpi->output,
                 "plugin: warning: TPI_SYMBOL_PC parameter not supported yet\n");
 #endif
     }
 
     if (getenv("TPI_LOW_PC")) {
-        tpi.low_pc = (uint64_t) strtoull(getenv("TPI_LOW_PC"), NULL, 0);
-        if (!tpi.low_pc) {
-            fprintf(tpi.output,
+        tpi->low_pc = (uint64_t) strtoull(getenv("TPI_LOW_PC"), NULL, 0);
+        if (!tpi->low_pc) {
+            fprintf(tpi->output,
                     "plugin: warning: can't parse TPI_LOW_PC (fall back to 0)\n");
         }
     }
 
     if (getenv("TPI_HIGH_PC")) {
-        tpi.high_pc = (uint64_t) strtoull(getenv("TPI_HIGH_PC"), NULL, 0);
-        if (!tpi.high_pc) {
-            fprintf(tpi.output,
+        tpi->high_pc = (uint64_t) strtoull(getenv("TPI_HIGH_PC"), NULL, 0);
+        if (!tpi->high_pc) {
+            fprintf(tpi->output,
                     "plugin: warning: can't parse TPI_HIGH_PC (fall back to UINT64_MAX)\n");
-            tpi.high_pc = UINT64_MAX;
+            tpi->high_pc = UINT64_MAX;
         }
     }
 
+    tpi->mem_subscription = 0;
+    tpi->mem_low_addr = 0;
+    tpi->mem_high_addr = UINT64_MAX;
+
     mutex_protected = (getenv("TPI_MUTEX_PROTECTED") != NULL);
 
     /*
      * Tell the plugin to initialize itself.
      */
 
-    tpi_init(&tpi);
+    tpi_init(tpi);
 
     /*
      * Perform some sanity checks to ensure this TCG plugin is
@@ -219,75 +296,115 @@ void tcg_plugin_load(const char *name)
      * mode, ...)
      */
 
-    if (!tpi.version) {
+    if (!tpi->version) {
         fprintf(stderr, "plugin: error: initialization has failed\n");
         goto error;
     }
 
-    if (tpi.version != TPI_VERSION) {
+    if (tpi->version != TPI_VERSION) {
         fprintf(stderr, "plugin: error: incompatible plugin interface (%d != %d)\n",
-                tpi.version, TPI_VERSION);
+                tpi->version, TPI_VERSION);
         goto error;
     }
 
-    if (tpi.sizeof_CPUState != 0
-        && tpi.sizeof_CPUState != sizeof(CPUArchState)) {
+    if (tpi->sizeof_CPUState != 0
+        && tpi->sizeof_CPUState != sizeof(CPUArchState)) {
         fprintf(stderr, "plugin: error: incompatible CPUState size "
-                "(%zu != %zu)\n", tpi.sizeof_CPUState, sizeof(CPUState));
+                "(%zu != %zu)\n", tpi->sizeof_CPUState, sizeof(CPUState));
         goto error;
     }
 
-    if (tpi.sizeof_TranslationBlock != 0
-        && tpi.sizeof_TranslationBlock != sizeof(TranslationBlock)) {
+    if (tpi->sizeof_TranslationBlock != 0
+        && tpi->sizeof_TranslationBlock != sizeof(TranslationBlock)) {
         fprintf(stderr, "plugin: error: incompatible TranslationBlock size "
-                "(%zu != %zu)\n", tpi.sizeof_TranslationBlock,
+                "(%zu != %zu)\n", tpi->sizeof_TranslationBlock,
                 sizeof(TranslationBlock));
         goto error;
     }
 
-    if (strcmp(tpi.guest, TARGET_NAME) != 0
-        && strcmp(tpi.guest, "any") != 0) {
+    if (strcmp(tpi->guest, TARGET_NAME) != 0
+        && strcmp(tpi->guest, "any") != 0) {
         fprintf(stderr, "plugin: warning: incompatible guest CPU "
-                "(%s != %s)\n", tpi.guest, TARGET_NAME);
+                "(%s != %s)\n", tpi->guest, TARGET_NAME);
     }
 
-    if (strcmp(tpi.mode, TARGET_EMULATION_MODE) != 0
-        && strcmp(tpi.mode, "any") != 0) {
+    if (strcmp(tpi->mode, TARGET_EMULATION_MODE) != 0
+        && strcmp(tpi->mode, "any") != 0) {
         fprintf(stderr, "plugin: warning: incompatible emulation mode "
-                "(%s != %s)\n", tpi.mode, TARGET_EMULATION_MODE);
+                "(%s != %s)\n", tpi->mode, TARGET_EMULATION_MODE);
+    }
+
+    tpi->is_generic = strcmp(tpi->guest, "any") == 0 && strcmp(tpi->mode, "any") == 0;
+
+    /* Only generate calls to memory helpers the plugin really
+     * listens to, no size restriction means all sizes.  */
+    if (!tpi->pre_qemu_ldst) {
+        tpi->mem_subscription &= ~TPI_MEM_PRE;
+    }
+    if (!tpi->post_qemu_ldst) {
+        tpi->mem_subscription &= ~TPI_MEM_POST;
+    }
+    if (!(tpi->mem_subscription & TPI_MEM_SIZE_ALL)) {
+        tpi->mem_subscription |= TPI_MEM_SIZE_ALL;
+    }
+    if ((tpi->mem_subscription & (TPI_MEM_LD | TPI_MEM_ST)) != 0
+        && (tpi->mem_subscription & (TPI_MEM_PRE | TPI_MEM_POST)) != 0) {
+        /* Calls are generated for the union of all subscriptions,
+         * tcgplugin_notify_qemu_ldst() filters them per plugin.  */
+        tcgplugin_mem_subscription |= tpi->mem_subscription;
+        tcgplugin_monitor_qemu_ldst = 1;
     }
 
-    tpi.is_generic = strcmp(tpi.guest, "any") == 0 && strcmp(tpi.mode, "any") == 0;
+    if (tpi->pre_tb_helper_code) {
+        nb_pre_tb_plugins++;
+        pre_tb_direct = nb_pre_tb_plugins == 1 ? tpi : NULL;
+    }
 
     if (getenv("TPI_VERBOSE")) {
-        tpi.verbose = true;
-        fprintf(tpi.output, "plugin: info: version = %d\n", tpi.version);
-        fprintf(tpi.output, "plugin: info: guest = %s\n", tpi.guest);
-        fprintf(tpi.output, "plugin: info: mode = %s\n", tpi.mode);
-        fprintf(tpi.output, "plugin: info: sizeof(CPUArchState) = %zu\n", tpi.sizeof_CPUState);
-        fprintf(tpi.output, "plugin: info: sizeof(TranslationBlock) = %zu\n", tpi.sizeof_TranslationBlock);
-        fprintf(tpi.output, "plugin: info: output fd = %d\n", fileno(tpi.output));
-        fprintf(tpi.output, "plugin: info: low pc = 0x%016" PRIx64 "\n", tpi.low_pc);
-        fprintf(tpi.output, "plugin: info: high pc = 0x%016" PRIx64 "\n", tpi.high_pc);
-        fprintf(tpi.output, "plugin: info: cpus_stopped callback = %p\n", tpi.cpus_stopped);
-        fprintf(tpi.output, "plugin: info: before_gen_tb callback = %p\n", tpi.before_gen_tb);
-        fprintf(tpi.output, "plugin: info: after_gen_tb callback = %p\n", tpi.after_gen_tb);
-        fprintf(tpi.output, "plugin: info: after_gen_opc callback = %p\n", tpi.after_gen_opc);
-        fprintf(tpi.output, "plugin: info: pre_tb_helper_code callback = %p\n", tpi.pre_tb_helper_code);
-        fprintf(tpi.output, "plugin: info: pre_tb_helper_data callback = %p\n", tpi.pre_tb_helper_data);
-        fprintf(tpi.output, "plugin: info: is%s generic\n", tpi.is_generic ? "" : " not");
+        tpi->verbose = true;
+        fprintf(tpi->output, "plugin: info: name = %s (#%u)\n", name, nb_tpis);
+        fprintf(tpi->output, "plugin: info: version = %d\n", tpi->version);
+        fprintf(tpi->output, "plugin: info: guest = %s\n", tpi->guest);
+        fprintf(tpi->output, "plugin: info: mode = %s\n", tpi->mode);
+        fprintf(tpi->output, "plugin: info: sizeof(CPUArchState) = %zu\n", tpi->sizeof_CPUState);
+        fprintf(tpi->output, "plugin: info: sizeof(TranslationBlock) = %zu\n", tpi->sizeof_TranslationBlock);
+        fprintf(tpi->output, "plugin: info: output fd = %d\n", fileno(tpi->output));
+        fprintf(tpi->output, "plugin: info: low pc = 0x%016" PRIx64 "\n", tpi->low_pc);
+        fprintf(tpi->output, "plugin: info: high pc = 0x%016" PRIx64 "\n", tpi->high_pc);
+        fprintf(tpi->output, "plugin: info: cpus_stopped callback = %p\n", tpi->cpus_stopped);
+        fprintf(tpi->output, "plugin: info: before_gen_tb callback = %p\n", tpi->before_gen_tb);
+        fprintf(tpi->output, "plugin: info: after_gen_tb callback = %p\n", tpi->after_gen_tb);
+        fprintf(tpi->output, "plugin: info: after_gen_opc callback = %p\n", tpi->after_gen_opc);
+        fprintf(tpi->output, "plugin: info: pre_tb_helper_code callback = %p\n", tpi->pre_tb_helper_code);
+        fprintf(tpi->output, "plugin: info: pre_tb_helper_data callback = %p\n", tpi->pre_tb_helper_data);
+        fprintf(tpi->output, "plugin: info: pre_qemu_ldst callback = %p\n", tpi->pre_qemu_ldst);
+        fprintf(tpi->output, "plugin: info: post_qemu_ldst callback = %p\n", tpi->post_qemu_ldst);
+        fprintf(tpi->output, "plugin: info: intercept_qemu_ld callback = %p\n", tpi->intercept_qemu_ld);
+        fprintf(tpi->output, "plugin: info: intercept_qemu_st callback = %p\n", tpi->intercept_qemu_st);
+        fprintf(tpi->output, "plugin: info: before_fork callback = %p\n", tpi->before_fork);
+        fprintf(tpi->output, "plugin: info: after_fork callback = %p\n", tpi->after_fork);
+        fprintf(tpi->output, "plugin: info: memory subscription = 0x%04" PRIx32 "\n", tpi->mem_subscription);
+        fprintf(tpi->output, "plugin: info: memory low addr = 0x%016" PRIx64 "\n", tpi->mem_low_addr);
+        fprintf(tpi->output, "plugin: info: memory high addr = 0x%016" PRIx64 "\n", tpi->mem_high_addr);
+        fprintf(tpi->output, "plugin: info: per-vCPU data size = %zu\n", tpi->cpu_data_size);
+        fprintf(tpi->output, "plugin: info: call contracts = 0x%x/0x%x/0x%x\n",
+                tpi->pre_tb_helper_flags, tpi->qemu_ldst_flags, tpi->intercept_flags);
+        fprintf(tpi->output, "plugin: info: is%s generic\n", tpi->is_generic ? "" : " not");
     }
 
 //    /* Register helper.  */
 //#define GEN_HELPER 2
 //#include "tcg-plugin-helper.h"
 
-    machine_init_done_notifier.notify = &tcgplugin_machine_init_done;
-    qemu_add_machine_init_done_notifier(&machine_init_done_notifier);
+    if (nb_tpis == 0) {
+        machine_init_done_notifier.notify = &tcgplugin_machine_init_done;
+        qemu_add_machine_init_done_notifier(&machine_init_done_notifier);
 
-    exit_notifier.notify = &tcgplugin_exit;
-    qemu_add_exit_notifier(&exit_notifier);
+        exit_notifier.notify = &tcgplugin_exit;
+        qemu_add_exit_notifier(&exit_notifier);
+    }
 
+    tpi_handles[nb_tpis++] = handle;
     done = true;
 
 error:
@@ -295,66 +412,160 @@ error:
         g_free(path);
 
     if (!done) {
-        memset(&tpi, 0, sizeof(tpi));
+        memset(tpi, 0, sizeof(*tpi));
+        nb_watched_ranges = old_nb_watched_ranges;
     }
 
     return;
 }
 
+/* Contract shared by all the plugins that implement a callback, that
+ * is, the weakest one.  */
+#define TPI_COMMON_CONTRACT(callback, field) ({            \
+            TCGPluginInterface *tpi_;                      \
+            uint32_t contract_ = TPI_CALL_NO_GLOBALS;      \
+            FOREACH_TPI(tpi_) {                            \
+                if (tpi_->callback) {                      \
+                    contract_ &= tpi_->field;              \
+                }                                          \
+            }                                              \
+            contract_;                                     \
+        })
+
+/* Cheapest TCG flags that honor "contract", note that
+ * TCG_CALL_NO_READ_GLOBALS implies TCG_CALL_NO_WRITE_GLOBALS.  */
+static unsigned int tpi_call_flags(uint32_t contract)
+{
+    if ((contract & TPI_CALL_NO_GLOBALS) == TPI_CALL_NO_GLOBALS) {
+        return TCG_CALL_NO_RWG;
+    }
+    if (contract & TPI_CALL_NO_WRITE_GLOBALS) {
+        return TCG_CALL_NO_WG;
+    }
+    return 0;
+}
+
 void tcg_plugin_register_helpers(TCGContext *s)
 {
+	TCGPluginInterface *tpi;
+	unsigned int intercept_flags;
+	unsigned int ldst_flags;
+	unsigned int pre_tb_flags;
+
+	/* A void helper can't be TCG_CALL_NO_SIDE_EFFECTS, the liveness
+	 * analysis would remove it.  The intercept helpers may fall back to
+	 * the guest access, which may raise an exception, and the monitor
+	 * helpers never write the guest registers.  */
+	intercept_flags = tpi_call_flags(TPI_COMMON_CONTRACT(intercept_qemu_ld, intercept_flags)
+					 & TPI_COMMON_CONTRACT(intercept_qemu_st, intercept_flags)
+					 & ~TPI_CALL_NO_READ_GLOBALS);
+	ldst_flags = tpi_call_flags((TPI_COMMON_CONTRACT(pre_qemu_ldst, qemu_ldst_flags)
+				     & TPI_COMMON_CONTRACT(post_qemu_ldst, qemu_ldst_flags))
+				    | TPI_CALL_NO_WRITE_GLOBALS);
+	pre_tb_flags = tpi_call_flags(TPI_COMMON_CONTRACT(pre_tb_helper_code, pre_tb_helper_flags));
+
+	plgapi_register_helper(s,
+				helper_tcg_plugin_pre_tb,
+				"tcg_plugin_pre_tb",
+				pre_tb_flags,
+				dh_sizemask(void, 0) | dh_sizemask(i64, 1) | dh_sizemask(i64, 2) | dh_sizemask(i64, 3) | dh_sizemask(i64, 4));
+	plgapi_register_helper(s,
+				helper_tcg_plugin_pre_tb_chain,
+				"tcg_plugin_pre_tb_chain",
+				pre_tb_flags,
+				dh_sizemask(void, 0) | dh_sizemask(i64, 1) | dh_sizemask(i64, 2) | dh_sizemask(i64, 3) | dh_sizemask(i64, 4));
+	plgapi_register_helper(s,
+				helper_tcg_plugin_fork_server,
+				"tcg_plugin_fork_server",
+				0 /* Leaves the CPU loop */,
+				dh_sizemask(void, 0) | dh_sizemask(ptr, 1));
+
+	/* The per-instruction hooks may read the guest registers.  */
+	plgapi_register_helper(s,
+				tcgplugin_helper_instr,
+				"tcgplugin_helper_instr",
+				TCG_CALL_NO_WG,
+				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(ptr, 2) | dh_sizemask(i32, 3));
+	plgapi_register_helper(s,
+				tcgplugin_helper_instr_mem,
+				"tcgplugin_helper_instr_mem",
+				TCG_CALL_NO_WG,
+				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(ptr, 2) | dh_sizemask(i32, 3) | dh_sizemask(tl, 4) | dh_sizemask(i32, 5));
+
 	plgapi_register_helper(s,
 				tcgplugin_helper_intercept_qemu_ld_i32,
 				"tcgplugin_helper_intercept_qemu_ld_i32",
-				0 /* Can modify globals, can have side effects */,
-				dh_sizemask(i32, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 3));
+				intercept_flags,
+				dh_sizemask(i32, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 4));
 	plgapi_register_helper(s,
 				tcgplugin_helper_post_qemu_ld_i32,
 				"tcgplugin_helper_post_qemu_ld_i32",
-				TCG_CALL_NO_WG_SE,
+				ldst_flags,
 				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 4) | dh_sizemask(i32, 5));
 	plgapi_register_helper(s,
 				tcgplugin_helper_intercept_qemu_st_i32,
 				"tcgplugin_helper_intercept_qemu_st_i32",
-				0 /* Can modify globals, can have side effects */,
-				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 3) | dh_sizemask(i32, 4) | dh_sizemask(i32, 5));
+				intercept_flags,
+				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 4) | dh_sizemask(i32, 5));
 	plgapi_register_helper(s,
 				tcgplugin_helper_post_qemu_st_i32,
-				"tcgplugin_helper_post_qemu_ld_i32",
-				TCG_CALL_NO_WG_SE,
+				"tcgplugin_helper_post_qemu_st_i32",
+				ldst_flags,
 				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 4) | dh_sizemask(i32, 5));
 
 	plgapi_register_helper(s,
 				tcgplugin_helper_intercept_qemu_ld_i64,
 				"tcgplugin_helper_intercept_qemu_ld_i64",
-				0 /* Can modify globals, can have side effects */,
-				dh_sizemask(i32, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 3));
+				intercept_flags,
+				dh_sizemask(i64, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 4));
 	plgapi_register_helper(s,
 				tcgplugin_helper_post_qemu_ld_i64,
 				"tcgplugin_helper_post_qemu_ld_i64",
-				TCG_CALL_NO_WG_SE,
+				ldst_flags,
 				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i64, 4) | dh_sizemask(i32, 5));
 	plgapi_register_helper(s,
 				tcgplugin_helper_intercept_qemu_st_i64,
 				"tcgplugin_helper_intercept_qemu_st_i64",
-				0 /* Can modify globals, can have side effects */,
-				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 3) | dh_sizemask(i64, 4) | dh_sizemask(i32, 5));
+				intercept_flags,
+				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i64, 4) | dh_sizemask(i32, 5));
 	plgapi_register_helper(s,
 				tcgplugin_helper_post_qemu_st_i64,
-				"tcgplugin_helper_post_qemu_ld_i64",
-				TCG_CALL_NO_WG_SE,
+				"tcgplugin_helper_post_qemu_st_i64",
+				ldst_flags,
 				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i64, 4) | dh_sizemask(i32, 5));
-	if (tpi.register_helpers)  {
-		tpi.tcg_ctx = s;
-		tpi.register_helpers(&tpi);
+
+	plgapi_register_helper(s,
+				tcgplugin_helper_pre_qemu_ld,
+				"tcgplugin_helper_pre_qemu_ld",
+				ldst_flags,
+				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 4));
+	plgapi_register_helper(s,
+				tcgplugin_helper_pre_qemu_st_i32,
+				"tcgplugin_helper_pre_qemu_st_i32",
+				ldst_flags,
+				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i32, 4) | dh_sizemask(i32, 5));
+	plgapi_register_helper(s,
+				tcgplugin_helper_pre_qemu_st_i64,
+				"tcgplugin_helper_pre_qemu_st_i64",
+				ldst_flags,
+				dh_sizemask(void, 0) | dh_sizemask(ptr, 1) | dh_sizemask(tl, 2) | dh_sizemask(i32, 3) | dh_sizemask(i64, 4) | dh_sizemask(i32, 5));
+	FOREACH_TPI(tpi) {
+		if (tpi->register_helpers)  {
+			tpi->tcg_ctx = s;
+			tpi->register_helpers(tpi);
+		}
 	}
 }
 
 /* Hook called once all CPUs are stopped/paused.  */
 void tcg_plugin_cpus_stopped(void)
 {
-    if (tpi.cpus_stopped) {
-        tpi.cpus_stopped(&tpi);
+    TCGPluginInterface *tpi;
+
+    FOREACH_TPI(tpi) {
+        if (tpi->cpus_stopped) {
+            tpi->cpus_stopped(tpi);
+        }
     }
 }
 
@@ -365,34 +576,406 @@ static TCGArg *tb_info;
 static TCGArg *tb_data1;
 static TCGArg *tb_data2;
 
+/* Plugins whose pre_tb_helper_code() is called by the TB being
+ * translated, one bit per index in tpis[].  */
+static uint32_t tb_pre_tb_plugins;
+
+/* Parameters of the constants to patch with the number of guest
+ * instructions of the TB being translated, see
+ * tcgplugin_gen_counter_add_icount().  */
+static GArray *tb_icount_args;
+
+/* Calls to pre_tb_helper_code() performed by a TB when several plugins
+ * implement it, see helper_tcg_plugin_pre_tb_chain().  It lives as
+ * long as the generated code.  */
+typedef struct TPIHelperChain {
+    unsigned int nb_calls;
+    struct {
+        TCGPluginInterface *tpi;
+        uint64_t data1;
+        uint64_t data2;
+    } calls[];
+} TPIHelperChain;
+
+/* Hook registered by tcgplugin_gen_instr_hook(), it lives as long as
+ * the generated code.  */
+typedef struct TPIInstrHook {
+    const TCGPluginInterface *tpi;
+    tpi_instr_hook_t func;
+    uint32_t when;
+    uint64_t pc;
+    uint64_t data;
+    TPIInstrRegs regs;
+} TPIInstrHook;
+
+/* Hooks of the guest instruction being translated.  Its
+ * TPI_INSTR_AFTER calls are generated when the next instruction starts
+ * and before each exit of the TB.  */
+static GPtrArray *instr_hooks;
+
+/* TCG opcodes emitted by the plugins (and by this file on their
+ * behalf) from one callback, with the temps and labels they allocated.  */
+typedef struct TPIOpSlice {
+    unsigned int start;
+    unsigned int nb_opc;
+    unsigned int opparam_start;
+    unsigned int nb_opparam;
+    int nb_temps_before;
+    int nb_temps_after;
+    int nb_labels_after;
+    TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
+    TCGTemp *temps;
+    uint16_t *opc;
+    TCGArg *opparam;
+} TPIOpSlice;
+
+/* What the plugins did during the first translation of a TB, stored in
+ * tb->tcg_plugin_opaque.  When the TB is translated again to restore
+ * the CPU state, the opcodes are replayed at the same positions
+ * instead of calling the plugins, so the generated code is identical
+ * and side effects (counting, symbol lookups, ...) don't happen twice.  */
+typedef struct TPITBCache {
+    TPIHelperChain *chain;
+    GPtrArray *instr_hooks;
+    unsigned int nb_slices;
+    TPIOpSlice slices[];
+} TPITBCache;
+
+/* Shared by the TBs the plugins didn't instrument.  */
+static TPITBCache tpi_empty_tb_cache;
+
+/* Slices recorded so far for the TB being translated.  */
+static GArray *tpi_recorded_slices;
+static TPIHelperChain *tpi_recorded_chain;
+static GPtrArray *tpi_recorded_instr_hooks;
+
+/* Cache being replayed, if any, and its next slice.  */
+static TPITBCache *tpi_replay;
+static unsigned int tpi_replay_next;
+
+static void tpi_record_begin(TCGContext *s, TPIOpSlice *slice)
+{
+    slice->start = s->gen_opc_ptr - s->gen_opc_buf;
+    slice->opparam_start = s->gen_opparam_ptr - s->gen_opparam_buf;
+    slice->nb_temps_before = s->nb_temps;
+    slice->nb_labels_after = s->nb_labels;
+}
+
+static void tpi_record_end(TCGContext *s, TPIOpSlice *slice)
+{
+    slice->nb_opc = (s->gen_opc_ptr - s->gen_opc_buf) - slice->start;
+    slice->nb_opparam = (s->gen_opparam_ptr - s->gen_opparam_buf) - slice->opparam_start;
+
+    if (slice->nb_opc == 0
+        && s->nb_temps == slice->nb_temps_before
+        && s->nb_labels == slice->nb_labels_after) {
+        return;
+    }
+
+    slice->nb_temps_after = s->nb_temps;
+    slice->nb_labels_after = s->nb_labels;
+    memcpy(slice->free_temps, s->free_temps, sizeof(s->free_temps));
+
+    slice->temps = NULL;
+    if (slice->nb_temps_after > slice->nb_temps_before) {
+        slice->temps = g_memdup(&s->temps[slice->nb_temps_before],
+                                (slice->nb_temps_after - slice->nb_temps_before)
+                                * sizeof(TCGTemp));
+    }
+
+    /* Opcodes are copied once the TB is complete since the plugins
+     * may still patch their parameters.  */
+    slice->opc = NULL;
+    slice->opparam = NULL;
+
+    g_array_append_val(tpi_recorded_slices, *slice);
+}
+
+/* Save what was recorded during the translation of "tb".  */
+static void tpi_record_tb(TCGContext *s, TranslationBlock *tb)
+{
+    unsigned int nb_slices = tpi_recorded_slices->len;
+    TPITBCache *cache;
+    unsigned int i;
+
+    if (nb_slices == 0 && !tpi_recorded_chain && !tpi_recorded_instr_hooks) {
+        tb->tcg_plugin_opaque = &tpi_empty_tb_cache;
+        return;
+    }
+
+    cache = g_malloc(sizeof(TPITBCache) + nb_slices * sizeof(TPIOpSlice));
+    cache->chain = tpi_recorded_chain;
+    cache->instr_hooks = tpi_recorded_instr_hooks;
+    cache->nb_slices = nb_slices;
+
+    for (i = 0; i < nb_slices; i++) {
+        TPIOpSlice *slice = &cache->slices[i];
+
+        *slice = g_array_index(tpi_recorded_slices, TPIOpSlice, i);
+        slice->opc = g_memdup(&s->gen_opc_buf[slice->start],
+                              slice->nb_opc * sizeof(uint16_t));
+        slice->opparam = g_memdup(&s->gen_opparam_buf[slice->opparam_start],
+                                  slice->nb_opparam * sizeof(TCGArg));
+    }
+
+    tb->tcg_plugin_opaque = cache;
+}
+
+static void tpi_free_tb_cache(TranslationBlock *tb)
+{
+    TPITBCache *cache = tb->tcg_plugin_opaque;
+    unsigned int i;
+
+    tb->tcg_plugin_opaque = NULL;
+
+    if (!cache || cache == &tpi_empty_tb_cache) {
+        return;
+    }
+
+    for (i = 0; i < cache->nb_slices; i++) {
+        g_free(cache->slices[i].temps);
+        g_free(cache->slices[i].opc);
+        g_free(cache->slices[i].opparam);
+    }
+    g_free(cache->chain);
+    if (cache->instr_hooks) {
+        g_ptr_array_free(cache->instr_hooks, TRUE);
+    }
+    g_free(cache);
+}
+
+/* Emit the next recorded slice if it was emitted at this position.  */
+static void tpi_replay_slice(TCGContext *s)
+{
+    const TPIOpSlice *slice;
+    int i;
+
+    if (tpi_replay_next >= tpi_replay->nb_slices) {
+        return;
+    }
+
+    slice = &tpi_replay->slices[tpi_replay_next];
+    if (slice->start != s->gen_opc_ptr - s->gen_opc_buf) {
+        return;
+    }
+    assert(slice->opparam_start == s->gen_opparam_ptr - s->gen_opparam_buf);
+    assert(slice->nb_temps_before == s->nb_temps);
+
+    memcpy(s->gen_opc_ptr, slice->opc, slice->nb_opc * sizeof(uint16_t));
+    s->gen_opc_ptr += slice->nb_opc;
+
+    memcpy(s->gen_opparam_ptr, slice->opparam, slice->nb_opparam * sizeof(TCGArg));
+    s->gen_opparam_ptr += slice->nb_opparam;
+
+    if (slice->temps) {
+        memcpy(&s->temps[slice->nb_temps_before], slice->temps,
+               (slice->nb_temps_after - slice->nb_temps_before) * sizeof(TCGTemp));
+    }
+    s->nb_temps = slice->nb_temps_after;
+    memcpy(s->free_temps, slice->free_temps, sizeof(s->free_temps));
+
+    /* See gen_new_label().  */
+    for (i = s->nb_labels; i < slice->nb_labels_after; i++) {
+        s->labels[i].has_value = 0;
+        s->labels[i].u.first_reloc = NULL;
+    }
+    s->nb_labels = slice->nb_labels_after;
+
+    tpi_replay_next++;
+}
+
 /* Wrapper to ensure only non-generic plugins can access non-generic data.  */
-#define TPI_CALLBACK_NOT_GENERIC(callback, ...) \
+#define TPI_CALLBACK_NOT_GENERIC(tpi, callback, ...) \
     do {                                        \
-        if (!tpi.is_generic) {                  \
-            tpi.env = env;                      \
-            tpi.tb = tb;                        \
+        if (!(tpi)->is_generic) {               \
+            (tpi)->env = env;                   \
+            (tpi)->tb = tb;                     \
         }                                       \
-        tpi.callback(&tpi, ##__VA_ARGS__);      \
-        tpi.env = NULL;                         \
-        tpi.tb = NULL;                          \
+        (tpi)->callback((tpi), ##__VA_ARGS__);  \
+        (tpi)->env = NULL;                      \
+        (tpi)->tb = NULL;                       \
     } while (0);
 
+static inline bool tpi_pc_in_range(const TCGPluginInterface *tpi, uint64_t pc)
+{
+    return pc >= tpi->low_pc && pc < tpi->high_pc;
+}
+
+/* Patch the value of a constant created by tcg_const_i64().  */
+static inline void tpi_patch_const_i64(TCGArg *arg, uint64_t value)
+{
+#if TCG_TARGET_REG_BITS == 64
+    *(uint64_t *)arg = value;
+#else
+    /* i64 variables use 2 arguments on 32-bit host.  */
+    *arg = value & 0xFFFFFFFF;
+    *(arg + 2) = value >> 32;
+#endif
+}
+
+static void gen_helper_tcg_plugin_instr(TCGContext *s, TPIInstrHook *hook,
+                                        uint32_t when)
+{
+    TCGv_ptr hook_ptr = tcg_const_ptr(hook);
+    TCGv_i32 when_i32 = tcg_const_i32(when);
+    TCGArg args[3] = { GET_TCGV_PTR(tcgplugin_cpu_env),
+                       GET_TCGV_PTR(hook_ptr), GET_TCGV_I32(when_i32) };
+
+    tcg_gen_callN(s, tcgplugin_helper_instr, dh_retvar(void), 3, args);
+
+    tcg_temp_free_i32(when_i32);
+    tcg_temp_free_ptr(hook_ptr);
+}
+
+static void gen_helper_tcg_plugin_instr_mem(TCGContext *s, TPIInstrHook *hook,
+                                            uint32_t when, TCGv addr,
+                                            TCGMemOp memop)
+{
+    TCGv_ptr hook_ptr = tcg_const_ptr(hook);
+    TCGv_i32 when_i32 = tcg_const_i32(when);
+    TCGv_i32 memop_i32 = tcg_const_i32(memop);
+    TCGArg args[5] = { GET_TCGV_PTR(tcgplugin_cpu_env),
+                       GET_TCGV_PTR(hook_ptr), GET_TCGV_I32(when_i32),
+                       GET_TCGV(addr), GET_TCGV_I32(memop_i32) };
+
+    tcg_gen_callN(s, tcgplugin_helper_instr_mem, dh_retvar(void), 5, args);
+
+    tcg_temp_free_i32(memop_i32);
+    tcg_temp_free_i32(when_i32);
+    tcg_temp_free_ptr(hook_ptr);
+}
+
+/* Generate the calls to the hooks of the instruction being translated
+ * that were registered for "when".  */
+static void gen_instr_hooks(TCGContext *s, uint32_t when)
+{
+    unsigned int i;
+
+    for (i = 0; i < instr_hooks->len; i++) {
+        TPIInstrHook *hook = g_ptr_array_index(instr_hooks, i);
+
+        if (hook->when & when) {
+            gen_helper_tcg_plugin_instr(s, hook, when);
+        }
+    }
+}
+
+static bool instr_hooks_wanted(uint32_t when)
+{
+    unsigned int i;
+
+    for (i = 0; i < instr_hooks->len; i++) {
+        if (((TPIInstrHook *)g_ptr_array_index(instr_hooks, i))->when & when) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Ways out of the TB, once the instruction being translated is
+ * complete.  The exit_tb that follows a goto_tb isn't one (the
+ * instruction was already complete when reaching the goto_tb), nor the
+ * one returning when the icount budget is exhausted.  */
+static inline bool tpi_is_tb_exit(TCGOpcode opname, const TCGArg *opargs)
+{
+    return opname == INDEX_op_goto_tb
+        || opname == INDEX_op_goto_ptr
+        || (opname == INDEX_op_exit_tb && opargs[0] == 0);
+}
+
+/* Move the exit of the TB just emitted after the calls to the
+ * TPI_INSTR_AFTER hooks of the instruction being translated.  */
+static void gen_before_tb_exit(TCGContext *s, TCGOpcode opname, TCGArg arg)
+{
+    TPIOpSlice slice;
+
+    if (!tpi_replay && !instr_hooks_wanted(TPI_INSTR_AFTER)) {
+        return;
+    }
+
+    s->gen_opc_ptr--;
+    s->gen_opparam_ptr--;
+
+    if (tpi_replay) {
+        tpi_replay_slice(s);
+    }
+    else {
+        tpi_record_begin(s, &slice);
+        gen_instr_hooks(s, TPI_INSTR_AFTER);
+        tpi_record_end(s, &slice);
+    }
+
+    *s->gen_opc_ptr++ = opname;
+    *s->gen_opparam_ptr++ = arg;
+}
+
 /* Hook called before the Intermediate Code Generation (ICG).  */
 void tcg_plugin_before_gen_tb(CPUArchState *env, TCGContext *s, TranslationBlock *tb)
 {
-    if (tb->pc < tpi.low_pc || tb->pc >= tpi.high_pc) {
+    TCGPluginInterface *tpi;
+    TPIOpSlice slice;
+
+    if (!nb_tpis) {
         return;
     }
 
     assert(!in_gen_tpi_helper);
     in_gen_tpi_helper = true;
 
-    if (tpi.before_gen_tb) {
-        TPI_CALLBACK_NOT_GENERIC(before_gen_tb);
+    /* Already translated, this is cpu_restore_state_from_tb().  */
+    if (tb->tcg_plugin_opaque) {
+        tpi_replay = tb->tcg_plugin_opaque;
+        tpi_replay_next = 0;
+        tpi_replay_slice(s);
+        in_gen_tpi_helper = false;
+        return;
+    }
+
+    if (!tpi_recorded_slices) {
+        tpi_recorded_slices = g_array_new(FALSE, FALSE, sizeof(TPIOpSlice));
+    }
+    g_array_set_size(tpi_recorded_slices, 0);
+    tpi_recorded_chain = NULL;
+
+    if (!tb_icount_args) {
+        tb_icount_args = g_array_new(FALSE, FALSE, sizeof(TCGArg *));
+    }
+    g_array_set_size(tb_icount_args, 0);
+
+    if (!instr_hooks) {
+        instr_hooks = g_ptr_array_new();
+    }
+    g_ptr_array_set_size(instr_hooks, 0);
+    tpi_recorded_instr_hooks = NULL;
+
+    tpi_record_begin(s, &slice);
+
+    /* Before anything else, this block is executed again once the
+     * fork server is started.  */
+    if (fork_server_wanted(tb)) {
+        gen_helper_tcg_plugin_fork_server(s, tb);
     }
 
-    /* Generate TCG opcodes to call helper_tcg_plugin_tb*().  */
-    if (tpi.pre_tb_helper_code) {
+    tb_pre_tb_plugins = 0;
+
+    FOREACH_TPI(tpi) {
+        if (!tpi_pc_in_range(tpi, tb->pc)) {
+            continue;
+        }
+
+        if (tpi->before_gen_tb) {
+            TPI_CALLBACK_NOT_GENERIC(tpi, before_gen_tb);
+        }
+
+        if (tpi->pre_tb_helper_code) {
+            tb_pre_tb_plugins |= 1 << (tpi - tpis);
+        }
+    }
+
+    /* Generate TCG opcodes to call helper_tcg_plugin_tb*(), only once
+     * whatever the number of plugins.  */
+    if (tb_pre_tb_plugins) {
         TCGv_i64 data1;
         TCGv_i64 data2;
 
@@ -402,7 +985,8 @@ void tcg_plugin_before_gen_tb(CPUArchState *env, TCGContext *s, TranslationBlock
         tb_info = s->gen_opparam_ptr + 1;
         TCGv_i64 info = tcg_const_i64(0);
 
-        /* Patched in tcg_plugin_after_gen_tb().  */
+        /* Patched in tcg_plugin_after_gen_tb(), this is the chain of
+         * calls if several plugins are involved.  */
         tb_data1 = s->gen_opparam_ptr + 1;
         data1 = tcg_const_i64(0);
 
@@ -410,7 +994,10 @@ void tcg_plugin_before_gen_tb(CPUArchState *env, TCGContext *s, TranslationBlock
         tb_data2 = s->gen_opparam_ptr + 1;
         data2 = tcg_const_i64(0);
 
-        gen_helper_tcg_plugin_pre_tb(s, address, info, data1, data2);
+        gen_helper_tcg_plugin_pre_tb(s, pre_tb_direct
+                                     ? (void *)helper_tcg_plugin_pre_tb
+                                     : (void *)helper_tcg_plugin_pre_tb_chain,
+                                     address, info, data1, data2);
 
         tcg_temp_free_i64(data2);
         tcg_temp_free_i64(data1);
@@ -418,6 +1005,8 @@ void tcg_plugin_before_gen_tb(CPUArchState *env, TCGContext *s, TranslationBlock
         tcg_temp_free_i64(address);
     }
 
+    tpi_record_end(s, &slice);
+
     in_gen_tpi_helper = false;
 }
 
@@ -425,15 +1014,24 @@ void tcg_plugin_before_gen_tb(CPUArchState *env, TCGContext *s, TranslationBlock
 void tcg_plugin_after_gen_tb(CPUArchState *env, TCGContext *s, TranslationBlock *tb)
 {
     CPUState *cpu = ENV_GET_CPU(env);
+    TCGPluginInterface *tpi;
+    unsigned int i;
 
-    if (tb->pc < tpi.low_pc || tb->pc >= tpi.high_pc) {
+    if (!nb_tpis) {
         return;
     }
 
     assert(!in_gen_tpi_helper);
     in_gen_tpi_helper = true;
 
-    if (tpi.pre_tb_helper_code) {
+    if (tpi_replay) {
+        assert(tpi_replay_next == tpi_replay->nb_slices);
+        tpi_replay = NULL;
+        in_gen_tpi_helper = false;
+        return;
+    }
+
+    if (tb_pre_tb_plugins) {
         /* Patch helper_tcg_plugin_tb*() parameters.  */
         ((TPIHelperInfo *)tb_info)->cpu_index = cpu->cpu_index;
         ((TPIHelperInfo *)tb_info)->size = tb->size;
@@ -449,33 +1047,61 @@ void tcg_plugin_after_gen_tb(CPUArchState *env, TCGContext *s, TranslationBlock
          * the opcode "movi_i64 tmp,$value" isn't encoded the same
          * whether $value fits into a given host instruction or
          * not.  */
-        uint64_t data1 = 0;
-        uint64_t data2 = 0;
+        if (pre_tb_direct) {
+            uint64_t data1 = 0;
+            uint64_t data2 = 0;
 
-        if (tpi.pre_tb_helper_data) {
-            TPI_CALLBACK_NOT_GENERIC(pre_tb_helper_data, *(TPIHelperInfo *)tb_info, tb->pc, &data1, &data2);
-        }
+            tpi = pre_tb_direct;
+            if (tpi->pre_tb_helper_data) {
+                TPI_CALLBACK_NOT_GENERIC(tpi, pre_tb_helper_data, *(TPIHelperInfo *)tb_info, tb->pc, &data1, &data2);
+            }
 
-#if TCG_TARGET_REG_BITS == 64
-        *(uint64_t *)tb_data1 = data1;
-        *(uint64_t *)tb_data2 = data2;
-#else
-        /* i64 variables use 2 arguments on 32-bit host.  */
-        *tb_data1 = data1 & 0xFFFFFFFF;
-        *(tb_data1 + 2) = data1 >> 32;
+            tpi_patch_const_i64(tb_data1, data1);
+            tpi_patch_const_i64(tb_data2, data2);
+        }
+        else {
+            unsigned int nb_calls = ctpop32(tb_pre_tb_plugins);
+            TPIHelperChain *chain;
+            unsigned int i = 0;
+
+            chain = g_malloc0(sizeof(TPIHelperChain)
+                              + nb_calls * sizeof(chain->calls[0]));
+            chain->nb_calls = nb_calls;
+
+            FOREACH_TPI(tpi) {
+                if (!(tb_pre_tb_plugins & (1 << (tpi - tpis)))) {
+                    continue;
+                }
+
+                chain->calls[i].tpi = tpi;
+                if (tpi->pre_tb_helper_data) {
+                    TPI_CALLBACK_NOT_GENERIC(tpi, pre_tb_helper_data, *(TPIHelperInfo *)tb_info, tb->pc,
+                                             &chain->calls[i].data1, &chain->calls[i].data2);
+                }
+                i++;
+            }
+
+            tpi_recorded_chain = chain;
+            tpi_patch_const_i64(tb_data1, (uintptr_t)chain);
+            tpi_patch_const_i64(tb_data2, 0);
+        }
+    }
 
-        *tb_data2 = data2 & 0xFFFFFFFF;
-        *(tb_data2 + 2) = data2 >> 32;
-#endif
+    FOREACH_TPI(tpi) {
+        if (tpi->after_gen_tb && tpi_pc_in_range(tpi, tb->pc)) {
+            tpi->tcg_ctx = s;
+            TPI_CALLBACK_NOT_GENERIC(tpi, after_gen_tb);
+        }
     }
 
-    if (tpi.after_gen_tb) {
-    	tpi.tb = tb;
-    	tpi.tcg_ctx = s;
-    	tpi.env = env;
-        TPI_CALLBACK_NOT_GENERIC(after_gen_tb);
+    /* After all the callbacks since after_gen_tb() may generate
+     * counter increments too.  */
+    for (i = 0; i < tb_icount_args->len; i++) {
+        tpi_patch_const_i64(g_array_index(tb_icount_args, TCGArg *, i), tb->icount);
     }
 
+    tpi_record_tb(s, tb);
+
     in_gen_tpi_helper = false;
 }
 
@@ -484,30 +1110,67 @@ static uint64_t current_pc = 0;
 /* Hook called each time a guest intruction is disassembled.  */
 void tcg_plugin_register_info(uint64_t pc, CPUArchState *env, TCGContext *s, TranslationBlock *tb)
 {
+    TCGPluginInterface *tpi;
+    TPIOpSlice slice;
+
     current_pc = pc;
-    if (!tpi.is_generic) {
-        tpi.env = env;
-        tpi.tb  = tb;
+
+    if (!nb_tpis) {
+        return;
+    }
+
+    if (tpi_replay) {
+        tpi_replay_slice(s);
+        return;
+    }
+
+    tpi_record_begin(s, &slice);
+
+    /* The previous instruction of this TB is complete.  */
+    if (instr_hooks->len) {
+        in_gen_tpi_helper = true;
+        gen_instr_hooks(s, TPI_INSTR_AFTER);
+        g_ptr_array_set_size(instr_hooks, 0);
+        in_gen_tpi_helper = false;
     }
-    if (tpi.decode_instr) {
-        TPI_CALLBACK_NOT_GENERIC(decode_instr, pc);
+
+    FOREACH_TPI(tpi) {
+        if (!tpi->is_generic) {
+            tpi->env = env;
+            tpi->tb  = tb;
+        }
+        if (tpi->decode_instr) {
+            TPI_CALLBACK_NOT_GENERIC(tpi, decode_instr, pc);
+        }
     }
+
+    tpi_record_end(s, &slice);
 }
 
 /* Hook called each time a TCG opcode is generated.  */
 void tcg_plugin_after_gen_opc(TCGOpcode opname, uint16_t *opcode,
                               TCGArg *opargs, uint8_t nb_args)
 {
+    TCGPluginInterface *tpi;
     TPIOpCode tpi_opcode;
+    TPIOpSlice slice;
 
-    if (current_pc < tpi.low_pc || current_pc >= tpi.high_pc) {
+    if (in_gen_tpi_helper || !nb_tpis)
         return;
+
+    in_gen_tpi_helper = true;
+
+    if (tpi_is_tb_exit(opname, opargs)) {
+        gen_before_tb_exit(&tcg_ctx, opname, opargs[0]);
+        opcode = tcg_ctx.gen_opc_ptr - 1;
+        opargs = tcg_ctx.gen_opparam_ptr - 1;
     }
 
-    if (in_gen_tpi_helper)
+    if (tpi_replay) {
+        tpi_replay_slice(&tcg_ctx);
+        in_gen_tpi_helper = false;
         return;
-
-    in_gen_tpi_helper = true;
+    }
 
     nb_args = MIN(nb_args, TPI_MAX_OP_ARGS);
 
@@ -518,10 +1181,16 @@ void tcg_plugin_after_gen_opc(TCGOpcode opname, uint16_t *opcode,
     tpi_opcode.opcode = opcode;
     tpi_opcode.opargs = opargs;
 
-    if (tpi.after_gen_opc) {
-        tpi.after_gen_opc(&tpi, &tpi_opcode);
+    tpi_record_begin(&tcg_ctx, &slice);
+
+    FOREACH_TPI(tpi) {
+        if (tpi->after_gen_opc && tpi_pc_in_range(tpi, current_pc)) {
+            tpi->after_gen_opc(tpi, &tpi_opcode);
+        }
     }
 
+    tpi_record_end(&tcg_ctx, &slice);
+
     in_gen_tpi_helper = false;
 }
 
@@ -529,31 +1198,338 @@ void tcg_plugin_after_gen_opc(TCGOpcode opname, uint16_t *opcode,
    concurrent access.  */
 static pthread_mutex_t helper_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-/* TCG helper used to call pre_tb_helper_code() in a thread-safe
- * way.  */
-void helper_tcg_plugin_pre_tb(uint64_t address, uint64_t info,
-                              uint64_t data1, uint64_t data2)
+/* How many times helper_mutex was taken, and was already held by
+   another vCPU.  */
+static unsigned int helper_mutex_taken;
+static unsigned int helper_mutex_contended;
+
+/* Call pre_tb_helper_code() in a thread-safe way.  Plugins that use
+ * per-vCPU data are called without any lock.  */
+static inline void call_pre_tb_helper_code(TCGPluginInterface *tpi,
+                                           uint64_t address, uint64_t info,
+                                           uint64_t data1, uint64_t data2)
 {
+    bool locked = mutex_protected && !tpi->cpu_data_size;
     int error;
 
-    if (mutex_protected) {
-        error = pthread_mutex_lock(&helper_mutex);
+    if (locked) {
+        error = pthread_mutex_trylock(&helper_mutex);
+        if (error == EBUSY) {
+            atomic_inc(&helper_mutex_contended);
+            error = pthread_mutex_lock(&helper_mutex);
+        }
         if (error) {
             fprintf(stderr, "plugin: in call_pre_tb_helper_code(), "
                     "pthread_mutex_lock() has failed: %s\n",
                     strerror(error));
-            goto end;
+            return;
         }
+        helper_mutex_taken++;
     }
 
-    tpi.pre_tb_helper_code(&tpi, *(TPIHelperInfo *)&info, address, data1, data2);
+    tpi->pre_tb_helper_code(tpi, *(TPIHelperInfo *)&info, address, data1, data2);
 
-end:
-    if (mutex_protected) {
+    if (locked) {
         pthread_mutex_unlock(&helper_mutex);
     }
 }
 
+/* In user-mode the same TB is shared by all the threads, report the
+ * vCPU actually executing it rather than the translating one.  */
+static inline uint64_t tpi_fixup_info(uint64_t info)
+{
+    if (current_cpu) {
+        ((TPIHelperInfo *)&info)->cpu_index = current_cpu->cpu_index;
+    }
+    return info;
+}
+
+/* TCG helper used when a single plugin implements pre_tb_helper_code().  */
+void helper_tcg_plugin_pre_tb(uint64_t address, uint64_t info,
+                              uint64_t data1, uint64_t data2)
+{
+    call_pre_tb_helper_code(pre_tb_direct, address, tpi_fixup_info(info),
+                            data1, data2);
+}
+
+/* TCG helper used when several plugins implement pre_tb_helper_code(),
+ * they are called in loading order.  */
+void helper_tcg_plugin_pre_tb_chain(uint64_t address, uint64_t info,
+                                    uint64_t chain, uint64_t unused)
+{
+    const TPIHelperChain *calls = (const TPIHelperChain *)(uintptr_t)chain;
+    unsigned int i;
+
+    info = tpi_fixup_info(info);
+
+    for (i = 0; i < calls->nb_calls; i++) {
+        call_pre_tb_helper_code(calls->calls[i].tpi, address, info,
+                                calls->calls[i].data1, calls->calls[i].data2);
+    }
+}
+
+/* Per-plugin and per-vCPU data buffers, each vCPU allocates its own on
+ * first use.  */
+#define TPI_CACHE_LINE_SIZE 64
+static void *cpu_data[TPI_MAX_PLUGINS][TPI_MAX_CPUS];
+
+void *tcgplugin_get_cpu_data(const TCGPluginInterface *tpi, uint32_t cpu_index)
+{
+    size_t size;
+    void *data;
+    void **slot;
+
+    if (!tpi->cpu_data_size || cpu_index >= TPI_MAX_CPUS) {
+        return NULL;
+    }
+
+    slot = &cpu_data[tpi - tpis][cpu_index];
+
+    data = atomic_read(slot);
+    if (likely(data != NULL)) {
+        return data;
+    }
+
+    /* Another thread may be allocating the same buffer, typically a
+     * report peeking at all vCPUs.  */
+    size = ROUND_UP(tpi->cpu_data_size, TPI_CACHE_LINE_SIZE);
+    data = qemu_memalign(TPI_CACHE_LINE_SIZE, size);
+    memset(data, 0, size);
+    if (atomic_cmpxchg(slot, NULL, data) != NULL) {
+        qemu_vfree(data);
+        data = atomic_read(slot);
+    }
+
+    return data;
+}
+
+void tcgplugin_foreach_cpu_data(const TCGPluginInterface *tpi,
+                                tpi_cpu_data_func_t func, void *opaque)
+{
+    uint32_t i;
+
+    for (i = 0; i < TPI_MAX_CPUS; i++) {
+        void *data = atomic_read(&cpu_data[tpi - tpis][i]);
+        if (data) {
+            func(i, data, opaque);
+        }
+    }
+}
+
+void tcgplugin_gen_cpu_index(TCGv_i32 ret)
+{
+    tcg_gen_ld_i32(ret, tcgplugin_cpu_env,
+                   -ENV_OFFSET + offsetof(CPUState, cpu_index));
+}
+
+/* Counters use one cache line per vCPU, the slot of a vCPU is found
+ * at execution-time from its CPUState since a TB may be executed by
+ * any vCPU.  */
+#define TPI_CACHE_LINE_BITS 6
+QEMU_BUILD_BUG_ON(TPI_CACHE_LINE_SIZE != 1 << TPI_CACHE_LINE_BITS);
+
+struct TPICounter {
+    uint64_t *slots;
+};
+
+#define TPI_COUNTER_SLOT(counter, cpu_index) \
+    ((counter)->slots + ((cpu_index) << TPI_CACHE_LINE_BITS) / sizeof(uint64_t))
+
+TPICounter *tcgplugin_counter_new(void)
+{
+    TPICounter *counter = g_new0(TPICounter, 1);
+    size_t size = TPI_MAX_CPUS * TPI_CACHE_LINE_SIZE;
+
+    counter->slots = qemu_memalign(TPI_CACHE_LINE_SIZE, size);
+    memset(counter->slots, 0, size);
+
+    return counter;
+}
+
+/* Generate "slots[cpu_index].value += value", that is:
+ *
+ *     ld_i32     index, env, $cpu_index
+ *     shl_i32    index, index, $TPI_CACHE_LINE_BITS
+ *     and_i32    index, index, $slots_mask
+ *     ext_i32    slot, index
+ *     add        slot, slot, $slots
+ *     ld_i64     total, slot, $0
+ *     add_i64    total, total, $value
+ *     st_i64     total, slot, $0
+ *
+ * Return the parameter of the constant "value", for patching.  */
+static TCGArg *gen_counter_add(TPICounter *counter, uint64_t value)
+{
+    TCGv_i32 index = tcg_temp_new_i32();
+    TCGv_ptr slot = tcg_temp_new_ptr();
+    TCGv_ptr slots = tcg_const_ptr(counter->slots);
+    TCGv_i64 total = tcg_temp_new_i64();
+    TCGArg *value_arg;
+    TCGv_i64 value64;
+
+    /* cpu_index can grow beyond TPI_MAX_CPUS in user-mode (one vCPU
+     * per guest thread), wrap around rather than overflow: the
+     * increments of aliased vCPUs are then racy, not unsafe.  */
+    tcgplugin_gen_cpu_index(index);
+    tcg_gen_shli_i32(index, index, TPI_CACHE_LINE_BITS);
+    tcg_gen_andi_i32(index, index,
+                     (TPI_MAX_CPUS - 1) << TPI_CACHE_LINE_BITS);
+    tcg_gen_ext_i32_ptr(slot, index);
+    tcg_gen_add_ptr(slot, slot, slots);
+
+    value_arg = tcg_ctx.gen_opparam_ptr + 1;
+    value64 = tcg_const_i64(value);
+
+    tcg_gen_ld_i64(total, slot, 0);
+    tcg_gen_add_i64(total, total, value64);
+    tcg_gen_st_i64(total, slot, 0);
+
+    tcg_temp_free_i64(value64);
+    tcg_temp_free_i64(total);
+    tcg_temp_free_ptr(slots);
+    tcg_temp_free_ptr(slot);
+    tcg_temp_free_i32(index);
+
+    return value_arg;
+}
+
+void tcgplugin_gen_counter_add(TPICounter *counter, uint64_t value)
+{
+    gen_counter_add(counter, value);
+}
+
+void tcgplugin_gen_counter_add_icount(TPICounter *counter)
+{
+    /* Patched in tcg_plugin_after_gen_tb().  */
+    TCGArg *arg = gen_counter_add(counter, 0);
+    g_array_append_val(tb_icount_args, arg);
+}
+
+uint64_t tcgplugin_counter_read(const TPICounter *counter, uint32_t cpu_index)
+{
+    /* Same wrap around as gen_counter_add().  */
+    cpu_index &= TPI_MAX_CPUS - 1;
+    return atomic_read(TPI_COUNTER_SLOT(counter, cpu_index));
+}
+
+uint64_t tcgplugin_counter_sum(const TPICounter *counter)
+{
+    uint64_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < TPI_MAX_CPUS; i++) {
+        sum += atomic_read(TPI_COUNTER_SLOT(counter, i));
+    }
+
+    return sum;
+}
+
+void tcgplugin_gen_instr_hook(const TCGPluginInterface *tpi, uint32_t when,
+                              tpi_instr_hook_t func, const TPIInstrRegs *regs,
+                              uint64_t data)
+{
+    bool was_in_gen_tpi_helper = in_gen_tpi_helper;
+    TPIInstrHook *hook;
+
+    assert(!regs || regs->nb_regs <= TPI_INSTR_MAX_REGS);
+
+    hook = g_new0(TPIInstrHook, 1);
+    hook->tpi  = tpi;
+    hook->func = func;
+    hook->when = when;
+    hook->pc   = current_pc;
+    hook->data = data;
+    if (regs) {
+        hook->regs = *regs;
+    }
+
+    if (!tpi_recorded_instr_hooks) {
+        tpi_recorded_instr_hooks = g_ptr_array_new_with_free_func(g_free);
+    }
+    g_ptr_array_add(tpi_recorded_instr_hooks, hook);
+    g_ptr_array_add(instr_hooks, hook);
+
+    if (when & TPI_INSTR_BEFORE) {
+        in_gen_tpi_helper = true;
+        gen_helper_tcg_plugin_instr(&tcg_ctx, hook, TPI_INSTR_BEFORE);
+        in_gen_tpi_helper = was_in_gen_tpi_helper;
+    }
+}
+
+void tcgplugin_gen_instr_mem(TCGv addr, TCGMemOp memop, bool is_store)
+{
+    uint32_t when = is_store ? TPI_INSTR_MEM_ST : TPI_INSTR_MEM_LD;
+    TPIOpSlice slice;
+    unsigned int i;
+
+    if (in_gen_tpi_helper || !nb_tpis) {
+        return;
+    }
+
+    if (tpi_replay) {
+        tpi_replay_slice(&tcg_ctx);
+        return;
+    }
+
+    if (!instr_hooks_wanted(when)) {
+        return;
+    }
+
+    in_gen_tpi_helper = true;
+    tpi_record_begin(&tcg_ctx, &slice);
+
+    for (i = 0; i < instr_hooks->len; i++) {
+        TPIInstrHook *hook = g_ptr_array_index(instr_hooks, i);
+
+        if (hook->when & when) {
+            gen_helper_tcg_plugin_instr_mem(&tcg_ctx, hook, when, addr, memop);
+        }
+    }
+
+    tpi_record_end(&tcg_ctx, &slice);
+    in_gen_tpi_helper = false;
+}
+
+/* Call a hook registered by tcgplugin_gen_instr_hook().  */
+static inline void call_instr_hook(CPUArchState *env, const TPIInstrHook *hook,
+                                   uint32_t when, uint64_t address,
+                                   uint32_t memop)
+{
+    TPIInstrEvent event;
+    unsigned int i;
+
+    event.cpu_index = ENV_GET_CPU(env)->cpu_index;
+    event.when      = when;
+    event.pc        = hook->pc;
+    event.data      = hook->data;
+    event.address   = address;
+    event.memop     = memop;
+
+    for (i = 0; i < hook->regs.nb_regs; i++) {
+        const void *reg = (const uint8_t *)env + hook->regs.regs[i].offset;
+
+        if (hook->regs.regs[i].size == 8) {
+            event.regs[i] = *(const uint64_t *)reg;
+        }
+        else {
+            event.regs[i] = *(const uint32_t *)reg;
+        }
+    }
+
+    hook->func(hook->tpi, &event);
+}
+
+void tcgplugin_helper_instr(CPUArchState *env, void *hook, uint32_t when)
+{
+    call_instr_hook(env, hook, when, 0, 0);
+}
+
+void tcgplugin_helper_instr_mem(CPUArchState *env, void *hook, uint32_t when,
+                                target_ulong addr, uint32_t memop)
+{
+    call_instr_hook(env, hook, when, addr, memop);
+}
+
 #if !defined(CONFIG_USER_ONLY)
 const char *tcg_plugin_get_filename(void)
 {
@@ -639,8 +1615,48 @@ void tcgplugin_helper_post_qemu_ld_i32(CPUArchState *env, target_ulong addr, uin
 	tcgplugin_helper_post_qemu_ld_i64(env, addr, idx, val, memop);
 }
 
+/* Forward a monitored memory access to the plugins that subscribed to
+ * its kind/phase/size, if it lies in their address range.  */
+static inline void tcgplugin_notify_qemu_ldst(CPUArchState *env,
+                                              target_ulong addr, uint64_t val,
+                                              uint32_t memop, uint32_t flags)
+{
+    uint32_t mask = flags | TPI_MEM_SIZE(memop);
+    TCGPluginInterface *tpi;
+
+    FOREACH_TPI(tpi) {
+        if ((tpi->mem_subscription & mask) != mask
+            || addr < tpi->mem_low_addr || addr >= tpi->mem_high_addr) {
+            continue;
+        }
+
+        if (flags & TPI_MEM_POST) {
+            tpi->post_qemu_ldst(tpi, ENV_GET_CPU(env)->cpu_index, addr, val, memop, flags);
+        }
+        else {
+            tpi->pre_qemu_ldst(tpi, ENV_GET_CPU(env)->cpu_index, addr, val, memop, flags);
+        }
+    }
+}
+
 void tcgplugin_helper_post_qemu_ld_i64(CPUArchState *env, target_ulong addr, uint32_t idx, uint64_t val, uint32_t memop)
 {
+	tcgplugin_notify_qemu_ldst(env, addr, val, memop, TPI_MEM_LD | TPI_MEM_POST);
+}
+
+void tcgplugin_helper_pre_qemu_ld(CPUArchState *env, target_ulong addr, uint32_t idx, uint32_t memop)
+{
+	tcgplugin_notify_qemu_ldst(env, addr, 0, memop, TPI_MEM_LD | TPI_MEM_PRE);
+}
+
+void tcgplugin_helper_pre_qemu_st_i32(CPUArchState *env, target_ulong addr, uint32_t idx, uint32_t val, uint32_t memop)
+{
+	tcgplugin_helper_pre_qemu_st_i64(env, addr, idx, val, memop);
+}
+
+void tcgplugin_helper_pre_qemu_st_i64(CPUArchState *env, target_ulong addr, uint32_t idx, uint64_t val, uint32_t memop)
+{
+	tcgplugin_notify_qemu_ldst(env, addr, val, memop, TPI_MEM_ST | TPI_MEM_PRE);
 }
 
 void tcgplugin_helper_intercept_qemu_st_i32(CPUArchState *env, target_ulong addr, uint32_t idx, uint32_t val, uint32_t memop)
@@ -712,57 +1728,413 @@ void tcgplugin_helper_post_qemu_st_i32(CPUArchState *env, target_ulong addr, uin
 
 void tcgplugin_helper_post_qemu_st_i64(CPUArchState *env, target_ulong addr, uint32_t idx, uint64_t val, uint32_t memop)
 {
-//#ifdef TARGET_ARM
-//	printf("ST at 0x%0" PRIx32 "\n", (uint32_t) ((CPUARMState *) env)->regs[15]);
-//#endif
+	tcgplugin_notify_qemu_ldst(env, addr, val, memop, TPI_MEM_ST | TPI_MEM_POST);
+}
+
+/* Guest address ranges watched by the plugin, accesses to the pages
+ * they cover leave the inline TLB fast path, see TLB_WATCHED.  */
+#define TPI_MAX_WATCHED_RANGES 16
+static struct {
+    uint64_t low;
+    uint64_t high;
+} watched_ranges[TPI_MAX_WATCHED_RANGES];
+
+static bool tcgplugin_range_watched(uint64_t low, uint64_t high)
+{
+    unsigned int i;
+
+    for (i = 0; i < nb_watched_ranges; i++) {
+        if (low < watched_ranges[i].high && watched_ranges[i].low < high) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool tcgplugin_watch_memory(uint64_t low, uint64_t high)
+{
+#if defined(CONFIG_SOFTMMU)
+    CPUState *cpu;
+
+    if (low >= high || nb_watched_ranges == TPI_MAX_WATCHED_RANGES) {
+        return false;
+    }
+
+    watched_ranges[nb_watched_ranges].low = low;
+    watched_ranges[nb_watched_ranges].high = high;
+    nb_watched_ranges++;
+
+    /* Entries already in the TLB don't have TLB_WATCHED set.  */
+    CPU_FOREACH(cpu) {
+        tlb_flush(cpu, 1);
+    }
+    return true;
+#else
+    fprintf(stderr, "plugin: warning: memory can be watched in system mode only\n");
+    return false;
+#endif
+}
+
+bool tcgplugin_page_watched(target_ulong vaddr)
+{
+    uint64_t page = vaddr & TARGET_PAGE_MASK;
+
+    return nb_watched_ranges != 0
+        && tcgplugin_range_watched(page, page + TARGET_PAGE_SIZE);
+}
+
+/* Called from the softmmu slow path for accesses to watched pages, the
+ * first plugin that handles the access wins.  */
+bool tcgplugin_intercept_qemu_ld(CPUArchState *env, target_ulong addr, uint32_t memop, uint64_t *val)
+{
+    TCGPluginInterface *tpi;
+
+    if (!tcgplugin_range_watched(addr, (uint64_t)addr + (1 << (memop & MO_SIZE)))) {
+        return false;
+    }
+
+    FOREACH_TPI(tpi) {
+        if (tpi->intercept_qemu_ld
+            && tpi->intercept_qemu_ld(tpi, ENV_GET_CPU(env)->cpu_index, addr, memop, val)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool tcgplugin_intercept_qemu_st(CPUArchState *env, target_ulong addr, uint32_t memop, uint64_t val)
+{
+    TCGPluginInterface *tpi;
+
+    if (!tcgplugin_range_watched(addr, (uint64_t)addr + (1 << (memop & MO_SIZE)))) {
+        return false;
+    }
+
+    FOREACH_TPI(tpi) {
+        if (tpi->intercept_qemu_st
+            && tpi->intercept_qemu_st(tpi, ENV_GET_CPU(env)->cpu_index, addr, memop, val)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void tcgplugin_shutdown_request(int signal, pid_t pid)
 {
-	if (tpi.shutdown_request)  {
-		tpi.shutdown_request(&tpi, signal, pid);
+	TCGPluginInterface *tpi;
+
+	FOREACH_TPI(tpi) {
+		if (tpi->shutdown_request)  {
+			tpi->shutdown_request(tpi, signal, pid);
+		}
 	}
 }
 
 void tcgplugin_parse_cmdline(int argc, char ** argv)
 {
-	if (tpi.parse_cmdline)  {
-		tpi.parse_cmdline(&tpi, argc, argv);
+	TCGPluginInterface *tpi;
+
+	FOREACH_TPI(tpi) {
+		if (tpi->parse_cmdline)  {
+			tpi->parse_cmdline(tpi, argc, argv);
+		}
 	}
 }
 
 void tcgplugin_tb_alloc(TranslationBlock *tb)
 {
-	if (tpi.tb_alloc)  {
-		tpi.tb_alloc(&tpi, tb);
+	TCGPluginInterface *tpi;
+
+	tb->tcg_plugin_opaque = NULL;
+
+	FOREACH_TPI(tpi) {
+		if (tpi->tb_alloc)  {
+			tpi->tb_alloc(tpi, tb);
+		}
 	}
 }
 
 void tcgplugin_tb_free(TranslationBlock *tb)
 {
-	if (tpi.tb_free)  {
-		tpi.tb_free(&tpi, tb);
+	TCGPluginInterface *tpi;
+
+	FOREACH_TPI(tpi) {
+		if (tpi->tb_free)  {
+			tpi->tb_free(tpi, tb);
+		}
 	}
+
+	tpi_free_tb_cache(tb);
 }
 
 void tcgplugin_tb_flush(TCGContext *tcg_ctx, CPUArchState *env)
 {
-	if (tpi.tb_flush)  {
-		tpi.tb_flush(&tpi, tcg_ctx, env);
+	TCGPluginInterface *tpi;
+	int i, j;
+
+	FOREACH_TPI(tpi) {
+		if (tpi->tb_flush)  {
+			tpi->tb_flush(tpi, tcg_ctx, env);
+		}
+	}
+
+	/* The generated code referencing the chains of calls is dropped.  */
+	for (i = 0; i < tcg_ctx->tb_ctx.nb_regions; i++) {
+		TBRegion *r = &tcg_ctx->tb_ctx.regions[i];
+
+		for (j = r->first_tb; j < r->first_tb + r->nb_tbs; j++) {
+			tpi_free_tb_cache(&tcg_ctx->tb_ctx.tbs[j]);
+		}
 	}
 }
 
+/* Fork server, so that short runs (typically fuzzing) don't pay for
+ * the initialization of the machine and the warm-up of the translation
+ * cache each time.  The protocol is the one of AFL: the server writes
+ * 4 bytes on the status fd once ready, then for each 4-byte command
+ * read from the control fd it forks a child, and writes its PID and
+ * then its wait status on the status fd.  The children go on with the
+ * emulation, inheriting everything translated so far.  */
+#define TPI_FORK_SERVER_FD 198
+
+static bool fork_server_enabled;
+static bool fork_server_at_init;
+static uint64_t fork_server_pc;
+static int fork_server_fd = TPI_FORK_SERVER_FD;
+
+/* Also true in the children.  */
+static bool fork_server_started;
+
+#if defined(CONFIG_SOFTMMU)
+static bool fork_server_pending;
+static QEMUBH *fork_server_bh;
+static void fork_server_vm_state_change(void *opaque, int running, RunState state);
+#endif
+
+static void fork_server_init(void)
+{
+    const char *value = getenv("TPI_FORK_SERVER");
+
+    if (!value || !nb_tpis) {
+        return;
+    }
+
+    if (getenv("TPI_FORK_SERVER_FD")) {
+        fork_server_fd = atoi(getenv("TPI_FORK_SERVER_FD"));
+    }
+
+    if (*value == '\0' || strcmp(value, "init") == 0) {
+        fork_server_at_init = true;
+    }
+    else {
+        fork_server_pc = strtoull(value, NULL, 0);
+        if (!fork_server_pc) {
+            fprintf(stderr, "plugin: warning: can't parse TPI_FORK_SERVER "
+                    "(fork server disabled)\n");
+            return;
+        }
+    }
+
+    fork_server_enabled = true;
+
+#if defined(CONFIG_SOFTMMU)
+    qemu_add_vm_change_state_handler(fork_server_vm_state_change, NULL);
+#endif
+}
+
+/* Return true if a call to helper_tcg_plugin_fork_server() has to be
+ * generated at the beginning of "tb".  */
+static bool fork_server_wanted(const TranslationBlock *tb)
+{
+    if (!fork_server_enabled || fork_server_started) {
+        return false;
+    }
+
+#if defined(CONFIG_USER_ONLY)
+    /* There's no machine initialization in user-mode, the server is
+     * started before the first block.  */
+    if (fork_server_at_init) {
+        return true;
+    }
+#endif
+
+    return !fork_server_at_init && tb->pc == fork_server_pc;
+}
+
+/* Serve the requests until the control fd is closed.  Return true in
+ * the children, false if nobody listens to the status fd.  */
+static bool fork_server_run(void)
+{
+    int ctl_fd = fork_server_fd;
+    int st_fd = fork_server_fd + 1;
+    uint32_t word = 0;
+
+    fork_server_started = true;
+
+    if (write(st_fd, &word, sizeof(word)) != sizeof(word)) {
+        fprintf(stderr, "plugin: warning: fork server: can't write to fd %d "
+                "(running normally)\n", st_fd);
+        return false;
+    }
+
+    while (true) {
+        TCGPluginInterface *tpi;
+        int status;
+        pid_t pid;
+
+        if (read(ctl_fd, &word, sizeof(word)) != sizeof(word)) {
+            /* The controller has gone away.  */
+            _exit(0);
+        }
+
+        FOREACH_TPI(tpi) {
+            if (tpi->before_fork) {
+                tpi->before_fork(tpi);
+            }
+        }
+
+        /* Otherwise each child would flush the buffers of the parent.  */
+        fflush(NULL);
+
+        pid = fork();
+        if (pid < 0) {
+            perror("plugin: error: fork server: fork()");
+            _exit(1);
+        }
+
+        if (pid == 0) {
+            close(ctl_fd);
+            close(st_fd);
+
+            FOREACH_TPI(tpi) {
+                if (tpi->after_fork) {
+                    tpi->after_fork(tpi);
+                }
+            }
+            return true;
+        }
+
+        word = pid;
+        if (write(st_fd, &word, sizeof(word)) != sizeof(word)) {
+            _exit(1);
+        }
+
+        if (waitpid(pid, &status, 0) < 0) {
+            perror("plugin: error: fork server: waitpid()");
+            _exit(1);
+        }
+
+        word = status;
+        if (write(st_fd, &word, sizeof(word)) != sizeof(word)) {
+            _exit(1);
+        }
+    }
+}
+
+#if defined(CONFIG_SOFTMMU)
+static void fork_server_resume(void *opaque)
+{
+    qemu_bh_delete(fork_server_bh);
+    fork_server_bh = NULL;
+
+    vm_start();
+}
+
+/* In system-mode the server runs in the main thread, with the vCPUs
+ * stopped, so that the children only miss the TCG thread.  */
+static void fork_server_run_system(bool resume)
+{
+    if (fork_server_run()) {
+        qemu_tcg_restart_vcpu_thread();
+    }
+
+    if (resume) {
+        fork_server_bh = qemu_bh_new(fork_server_resume, NULL);
+        qemu_bh_schedule(fork_server_bh);
+    }
+}
+
+static void fork_server_vm_state_change(void *opaque, int running, RunState state)
+{
+    if (running || !fork_server_pending) {
+        return;
+    }
+
+    fork_server_pending = false;
+    fork_server_run_system(true);
+}
+#endif
+
+/* Called at the beginning of the block TPI_FORK_SERVER, "tb" is the
+ * block being executed.  */
+void helper_tcg_plugin_fork_server(void *tb)
+{
+    if (fork_server_started) {
+        return;
+    }
+
+#if defined(CONFIG_SOFTMMU)
+    {
+        CPUState *cpu = current_cpu;
+        CPUClass *cc = CPU_GET_CLASS(cpu);
+
+        /* Leave the block before it does anything, it is executed
+         * again by the children once the VM is resumed.  The PC isn't
+         * up to date when this block was reached through a direct
+         * jump, see cpu_tb_exec().  */
+        fork_server_pending = true;
+        fork_server_started = true;
+        vm_stop(RUN_STATE_PAUSED);
+
+        if (cc->synchronize_from_tb) {
+            cc->synchronize_from_tb(cpu, tb);
+        }
+        else {
+            cc->set_pc(cpu, ((TranslationBlock *)tb)->pc);
+        }
+        cpu->exception_index = EXCP_INTERRUPT;
+        cpu_loop_exit(cpu);
+    }
+#else
+    fork_server_run();
+#endif
+}
+
 static void tcgplugin_machine_init_done(Notifier *notifier, void *data)
 {
-	if (tpi.machine_init_done)  {
-		tpi.machine_init_done(&tpi);
+	TCGPluginInterface *tpi;
+
+	FOREACH_TPI(tpi) {
+		if (tpi->machine_init_done)  {
+			tpi->machine_init_done(tpi);
+		}
+	}
+
+#if defined(CONFIG_SOFTMMU)
+	if (fork_server_enabled && fork_server_at_init) {
+		fork_server_run_system(false);
 	}
+#endif
 }
 
 static void tcgplugin_exit(Notifier *notifier, void *data)
 {
-	if (tpi.exit)  {
-		tpi.exit(&tpi);
+	TCGPluginInterface *tpi;
+	bool locked = false;
+
+	FOREACH_TPI(tpi) {
+		locked |= tpi->pre_tb_helper_code && !tpi->cpu_data_size;
+	}
+
+	if (mutex_protected && locked)  {
+		fprintf(tpis[0].output, "plugin: info: helper mutex taken %u times, "
+				"contended %u times\n", helper_mutex_taken, helper_mutex_contended);
+	}
+
+	FOREACH_TPI(tpi) {
+		if (tpi->exit)  {
+			tpi->exit(tpi);
+		}
 	}
 }
 
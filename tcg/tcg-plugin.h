@@ -53,6 +53,9 @@
     void tcg_plugin_after_gen_tb(CPUArchState *env, TCGContext *s, TranslationBlock *tb);
     void tcg_plugin_after_gen_opc(TCGOpcode opname, uint16_t *opcode, TCGArg *opargs, uint8_t nb_args);
     void tcgplugin_tb_flush(TCGContext *tcg_ctx, CPUArchState *env);
+    bool tcgplugin_page_watched(target_ulong vaddr);
+    bool tcgplugin_intercept_qemu_ld(CPUArchState *env, target_ulong addr, uint32_t memop, uint64_t *val);
+    bool tcgplugin_intercept_qemu_st(CPUArchState *env, target_ulong addr, uint32_t memop, uint64_t val);
 #else
 #   define tcg_plugin_guest_arch_init(cpu_env)
 #   define tcg_plugin_register_helpers(tcg_ctx)
@@ -61,6 +64,7 @@
 #   define tcg_plugin_after_gen_tb(env, tb)
 #   define tcg_plugin_after_gen_opc(opname, tcg_opcode, tcg_opargs_, nb_args)
 #   define tcgplugin_tb_flush(tcg_ctx, env)
+#   define tcgplugin_page_watched(vaddr) false
 #endif /* !CONFIG_TCG_PLUGIN */
 
 /***********************************************************************
@@ -121,7 +125,49 @@ typedef void (* tpi_tb_alloc)(const TCGPluginInterface *tpi, TranslationBlock *t
 typedef void (* tpi_tb_free)(const TCGPluginInterface *tpi, TranslationBlock *tb);
 typedef void (* tpi_tb_flush)(const TCGPluginInterface *tpi, TCGContext *tcg_ctx, CPUArchState *env);
 
-#define TPI_VERSION 3
+/* Called by the fork server (TPI_FORK_SERVER) before each fork, and in
+ * the child after it.  The child has only the thread that forked: a
+ * plugin that runs threads of its own re-creates them there.  */
+typedef void (* tpi_before_fork_t)(const TCGPluginInterface *tpi);
+typedef void (* tpi_after_fork_t)(const TCGPluginInterface *tpi);
+
+/* The "flags" parameter holds the kind (TPI_MEM_LD or TPI_MEM_ST) and
+ * the phase (TPI_MEM_PRE or TPI_MEM_POST) of the access.  The "value"
+ * parameter is undefined for a load notified before the access.  */
+typedef void (* tpi_qemu_ldst_t)(const TCGPluginInterface *tpi,
+                                 uint32_t cpu_index, uint64_t address,
+                                 uint64_t value, uint32_t memop, uint32_t flags);
+
+/* Return true if the access was handled by the plugin, in which case
+ * the guest memory isn't accessed.  */
+typedef bool (* tpi_intercept_qemu_ld_t)(const TCGPluginInterface *tpi,
+                                         uint32_t cpu_index, uint64_t address,
+                                         uint32_t memop, uint64_t *value);
+typedef bool (* tpi_intercept_qemu_st_t)(const TCGPluginInterface *tpi,
+                                         uint32_t cpu_index, uint64_t address,
+                                         uint32_t memop, uint64_t value);
+
+/* Memory accesses a plugin subscribes to, see "mem_subscription".  */
+#define TPI_MEM_LD       0x0001
+#define TPI_MEM_ST       0x0002
+#define TPI_MEM_PRE      0x0004
+#define TPI_MEM_POST     0x0008
+#define TPI_MEM_SIZE_8   0x0010
+#define TPI_MEM_SIZE_16  0x0020
+#define TPI_MEM_SIZE_32  0x0040
+#define TPI_MEM_SIZE_64  0x0080
+
+#define TPI_MEM_SIZE_ALL (TPI_MEM_SIZE_8 | TPI_MEM_SIZE_16 \
+                          | TPI_MEM_SIZE_32 | TPI_MEM_SIZE_64)
+#define TPI_MEM_SIZE(memop) (TPI_MEM_SIZE_8 << ((memop) & MO_SIZE))
+
+/* Contracts of the callbacks called at execution-time regarding the
+ * guest registers held in the CPU state, see "pre_tb_helper_flags".  */
+#define TPI_CALL_NO_READ_GLOBALS  0x0001
+#define TPI_CALL_NO_WRITE_GLOBALS 0x0002
+#define TPI_CALL_NO_GLOBALS (TPI_CALL_NO_READ_GLOBALS | TPI_CALL_NO_WRITE_GLOBALS)
+
+#define TPI_VERSION 7
 struct TCGPluginInterface
 {
     /* Compatibility information.  */
@@ -160,6 +206,42 @@ struct TCGPluginInterface
     tpi_tb_alloc tb_alloc;
     tpi_tb_free tb_free;
     tpi_tb_flush tb_flush;
+    tpi_before_fork_t before_fork;
+    tpi_after_fork_t after_fork;
+
+    /* Memory accesses notified to pre_qemu_ldst/post_qemu_ldst: a
+     * mask of TPI_MEM_* values and a range [low, high[ of guest
+     * addresses.  Calls are only generated for the kinds, phases and
+     * sizes set in the mask, the address range is checked at
+     * execution-time.  */
+    uint32_t mem_subscription;
+    uint64_t mem_low_addr;
+    uint64_t mem_high_addr;
+    tpi_qemu_ldst_t pre_qemu_ldst;
+    tpi_qemu_ldst_t post_qemu_ldst;
+
+    /* Accesses to the guest address ranges registered with
+     * tcgplugin_watch_memory() are handed over to these callbacks (system
+     * mode only).  Other pages keep the inline TLB fast path.  */
+    tpi_intercept_qemu_ld_t intercept_qemu_ld;
+    tpi_intercept_qemu_st_t intercept_qemu_st;
+
+    /* Size of the per-vCPU data buffers, see tcgplugin_get_cpu_data().
+     * A plugin that sets it promises pre_tb_helper_code() only touches
+     * these buffers (or is thread-safe by other means), so that it is
+     * never serialized by TPI_MUTEX_PROTECTED.  */
+    size_t cpu_data_size;
+
+    /* What pre_tb_helper_code(), pre_qemu_ldst()/post_qemu_ldst() and
+     * intercept_qemu_ld()/intercept_qemu_st() promise not to do with
+     * the guest registers, a mask of TPI_CALL_* values.  TCG doesn't
+     * have to spill the registers into the CPU state before calling a
+     * callback that doesn't read them, nor to reload them after
+     * calling a callback that doesn't write them.  A callback that
+     * may raise a guest exception reads them.  */
+    uint32_t pre_tb_helper_flags;
+    uint32_t qemu_ldst_flags;
+    uint32_t intercept_flags;
 };
 
 #define TPI_INIT_VERSION(tpi) do {                                     \
@@ -178,12 +260,118 @@ struct TCGPluginInterface
         (tpi).sizeof_TranslationBlock = 0;                             \
     } while (0);
 
+/* Maximum number of plugins loaded at the same time.  */
+#define TPI_MAX_PLUGINS 8
+
 typedef void (* tpi_init_t)(TCGPluginInterface *tpi);
 void tpi_init(TCGPluginInterface *tpi);
 
 void tcgplugin_guest_arch_init(TCGv_ptr cpu_env);
 
+/* Per-vCPU data buffers, zeroed and cache-line aligned so that vCPUs
+ * running in parallel never share a line.  */
+#define TPI_MAX_CPUS 1024
+typedef void (* tpi_cpu_data_func_t)(uint32_t cpu_index, void *data, void *opaque);
+
+/* Return the buffer of "cpu_index" for the plugin "tpi", allocated on
+ * first use, or NULL if the plugin didn't set "cpu_data_size".  */
+void *tcgplugin_get_cpu_data(const TCGPluginInterface *tpi, uint32_t cpu_index);
+
+/* Call "func" for each buffer of the plugin "tpi" allocated so far.  */
+void tcgplugin_foreach_cpu_data(const TCGPluginInterface *tpi,
+                                tpi_cpu_data_func_t func, void *opaque);
+
+/* Generate the opcode loading the index of the vCPU that executes it,
+ * which isn't necessarily the one translating it.  */
+void tcgplugin_gen_cpu_index(TCGv_i32 ret);
+
+/* 64-bit counters incremented by inline TCG opcodes, without any call
+ * to a helper.  Each vCPU increments its own cache-line sized slot, so
+ * the increments need no atomic operations.  Beyond TPI_MAX_CPUS
+ * vCPUs (user-mode threads), the vCPUs share the slot of their index
+ * modulo TPI_MAX_CPUS and may lose increments of one another.  */
+typedef struct TPICounter TPICounter;
+
+TPICounter *tcgplugin_counter_new(void);
+
+/* Generate the opcodes adding "value" to the slot of the vCPU that
+ * executes them, at the current position of the translation.  */
+void tcgplugin_gen_counter_add(TPICounter *counter, uint64_t value);
+
+/* Same as above, the value being the number of guest instructions of
+ * the block being translated, patched once it is known.  */
+void tcgplugin_gen_counter_add_icount(TPICounter *counter);
+
+/* Value of the slot of "cpu_index" (modulo TPI_MAX_CPUS), and sum of
+ * all the slots.  A slot might be read while being incremented, the
+ * result is exact once the vCPUs are stopped, unless the slot is
+ * shared.  */
+uint64_t tcgplugin_counter_read(const TPICounter *counter, uint32_t cpu_index);
+uint64_t tcgplugin_counter_sum(const TPICounter *counter);
+
+/* When a hook registered with tcgplugin_gen_instr_hook() is called:
+ * before the instruction, once it is complete, and before each of its
+ * memory loads/stores.  */
+#define TPI_INSTR_BEFORE  0x0001
+#define TPI_INSTR_AFTER   0x0002
+#define TPI_INSTR_MEM_LD  0x0004
+#define TPI_INSTR_MEM_ST  0x0008
+
+/* Guest registers read from the CPU state each time the hook is
+ * called: offset in CPUArchState and size (4 or 8) of each of them.  */
+#define TPI_INSTR_MAX_REGS 4
+typedef struct TPIInstrRegs {
+    unsigned int nb_regs;
+    struct {
+        size_t offset;
+        unsigned int size;
+    } regs[TPI_INSTR_MAX_REGS];
+} TPIInstrRegs;
+
+typedef struct TPIInstrEvent {
+    uint32_t cpu_index;
+    uint32_t when;              /* A single TPI_INSTR_* value.  */
+    uint64_t pc;
+    uint64_t data;              /* As given to tcgplugin_gen_instr_hook().  */
+
+    /* Access that is about to be performed, for TPI_INSTR_MEM_* only.  */
+    uint64_t address;
+    uint32_t memop;
+
+    /* Values of the registers described by "regs", in the same order.  */
+    uint64_t regs[TPI_INSTR_MAX_REGS];
+} TPIInstrEvent;
+
+typedef void (* tpi_instr_hook_t)(const TCGPluginInterface *tpi,
+                                  const TPIInstrEvent *event);
+
+/* Call "hook" each time the guest instruction being decoded is
+ * executed, at the points given by "when", a mask of TPI_INSTR_*
+ * values.  This shall be called from decode_instr(), the instructions
+ * it isn't called for get no code at all.  "regs" may be NULL and is
+ * copied.  The hook may read the guest registers but must not modify
+ * them.  It isn't called after an instruction that raises a guest
+ * exception.  */
+void tcgplugin_gen_instr_hook(const TCGPluginInterface *tpi, uint32_t when,
+                              tpi_instr_hook_t hook, const TPIInstrRegs *regs,
+                              uint64_t data);
+
+/* Watch the guest virtual address range [low, high[, see
+ * intercept_qemu_ld/intercept_qemu_st.  Ranges are shared by all the
+ * plugins.  Return false if there are too many ranges already.  */
+bool tcgplugin_watch_memory(uint64_t low, uint64_t high);
+
 extern bool tcgplugin_intercept_qemu_ldst;
 extern bool tcgplugin_monitor_qemu_ldst;
+extern uint32_t tcgplugin_mem_subscription;
+
+/* Return true if a call to a monitoring helper has to be generated for
+ * a memory access of the given kind/phase ("what") and "memop".  */
+static inline bool tcgplugin_mem_subscribed(uint32_t what, TCGMemOp memop)
+{
+    uint32_t mask = what | TPI_MEM_SIZE(memop);
+    return tcgplugin_monitor_qemu_ldst
+        && (tcgplugin_mem_subscription & mask) == mask;
+}
 
 #endif /* TCG_PLUGIN_H */
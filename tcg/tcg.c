@@ -39,6 +39,9 @@
 #include "qemu-common.h"
 #include "qemu/host-utils.h"
 #include "qemu/timer.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 /* Note: the long term plan is to reduce the dependencies on the QEMU
    CPU definitions. Currently they are used for qemu_ld/st
@@ -246,6 +249,18 @@ static void tcg_out_label(TCGContext *s, int label_index, tcg_insn_unit *ptr)
     l->u.value_ptr = ptr;
 }
 
+/* Record that the code at "ptr" holds a pointer to the TB, rewritten when
+   the code is copied by the persistent translation cache.  */
+static __attribute__((unused)) void tcg_out_tb_reloc(TCGContext *s,
+                                                     tcg_insn_unit *ptr)
+{
+    if (s->nb_tb_relocs < TCG_MAX_TB_RELOCS) {
+        s->tb_relocs[s->nb_tb_relocs++] = tcg_ptr_byte_diff(ptr, s->code_buf);
+    } else {
+        s->code_gen_host_ptr = true;
+    }
+}
+
 int gen_new_label(void)
 {
     TCGContext *s = &tcg_ctx;
@@ -375,6 +390,9 @@ void tcg_context_init(TCGContext *s)
     tcg_target_init(s);
 }
 
+/* Size of the prologue and epilogue, once generated.  */
+static size_t tcg_prologue_size;
+
 void tcg_prologue_init(TCGContext *s)
 {
     /* init global prologue and epilogue */
@@ -383,6 +401,11 @@ void tcg_prologue_init(TCGContext *s)
     tcg_target_qemu_prologue(s);
     flush_icache_range((uintptr_t)s->code_buf, (uintptr_t)s->code_ptr);
 
+    tcg_prologue_size = tcg_current_code_size(s);
+    if (tcg_perf_enabled) {
+        tcg_perf_report_code(s->code_buf, tcg_prologue_size, "tcg-prologue");
+    }
+
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
         size_t size = tcg_current_code_size(s);
@@ -420,6 +443,9 @@ void tcg_func_start(TCGContext *s)
     s->gen_opc_ptr = s->gen_opc_buf;
     s->gen_opparam_ptr = s->gen_opparam_buf;
 
+    s->code_gen_host_ptr = false;
+    s->nb_tb_relocs = 0;
+
     s->be = tcg_malloc(sizeof(TCGBackendData));
 }
 
@@ -706,7 +732,11 @@ void tcg_gen_callN(TCGContext *s, void *func, TCGArg ret,
                    int nargs, TCGArg *args)
 {
     int i, real_args, nb_rets;
-    unsigned sizemask = 0, flags = 0;
+    /* Helpers that weren't registered, typically those of the TCG
+     * plugins, are called the conservative way.  */
+    TCGHelperInfo *info = g_hash_table_lookup(s->helpers, (gpointer)func);
+    unsigned sizemask = info ? info->sizemask : 0;
+    unsigned flags = info ? info->flags : 0;
     TCGArg *nparam = NULL;
     
     uint16_t *opcode = NULL;
@@ -923,6 +953,19 @@ void tcg_gen_shifti_i64(TCGv_i64 ret, TCGv_i64 arg1,
 }
 #endif
 
+/* Order a guest load or store with the previous accesses as much as the
+   guest requires and the host doesn't already guarantee.  */
+static inline void tcg_gen_req_mo(TCGBar type)
+{
+#ifdef TCG_GUEST_DEFAULT_MO
+    type &= TCG_GUEST_DEFAULT_MO;
+#endif
+    type &= ~TCG_TARGET_DEFAULT_MO;
+    if (type) {
+        tcg_gen_mb(type | TCG_BAR_SC);
+    }
+}
+
 static inline TCGMemOp tcg_canonicalize_memop(TCGMemOp op, bool is64, bool st)
 {
     switch (op & MO_SIZE) {
@@ -951,9 +994,15 @@ static inline TCGMemOp tcg_canonicalize_memop(TCGMemOp op, bool is64, bool st)
 void tcg_gen_qemu_ld_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 {
     TCGArg *opargs  = NULL;
+#ifdef CONFIG_TCG_PLUGIN
+    TCGv post_addr = addr;
+#endif
     memop = tcg_canonicalize_memop(memop, 0, 0);
+    tcg_gen_req_mo(TCG_MO_LD_LD | TCG_MO_ST_LD);
 
 #ifdef CONFIG_TCG_PLUGIN
+    tcgplugin_gen_instr_mem(addr, memop, false);
+
     if (tcgplugin_intercept_qemu_ldst)  {
     	TCGv_i32 tcg_idx = tcg_const_i32(idx);
     	TCGv_i32 tcg_memop = tcg_const_i32(memop);
@@ -966,6 +1015,22 @@ void tcg_gen_qemu_ld_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     }
 #endif /* CONFIG_TCG_PLUGIN */
 
+#ifdef CONFIG_TCG_PLUGIN
+    if (tcgplugin_mem_subscribed(TPI_MEM_LD | TPI_MEM_PRE, memop))  {
+        TCGv_i32 tcg_idx = tcg_const_i32(idx);
+        TCGv_i32 tcg_memop = tcg_const_i32(memop);
+        tcgplugin_gen_helper_pre_qemu_ld(&tcg_ctx, addr, tcg_idx, tcg_memop);
+        tcg_temp_free_i32(tcg_idx);
+        tcg_temp_free_i32(tcg_memop);
+    }
+
+    /* The loaded value may overwrite the address register.  */
+    if (tcgplugin_mem_subscribed(TPI_MEM_LD | TPI_MEM_POST, memop))  {
+        post_addr = tcg_temp_new();
+        tcg_gen_mov_tl(post_addr, addr);
+    }
+#endif /* CONFIG_TCG_PLUGIN */
+
     *tcg_ctx.gen_opc_ptr++ = INDEX_op_qemu_ld_i32;
     tcg_add_param_i32(val);
     tcg_add_param_tl(addr);
@@ -973,12 +1038,13 @@ void tcg_gen_qemu_ld_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     *tcg_ctx.gen_opparam_ptr++ = idx;
     
 #ifdef CONFIG_TCG_PLUGIN
-    if (tcgplugin_monitor_qemu_ldst)  {
-    	TCGv_i32 tcg_idx = tcg_const_i32(idx);
-		TCGv_i32 tcg_memop = tcg_const_i32(memop);
-		tcgplugin_gen_helper_post_qemu_ld_i32(&tcg_ctx, addr, tcg_idx, val, tcg_memop);
-		tcg_temp_free_i32(tcg_idx);
-		tcg_temp_free_i32(tcg_memop);
+    if (tcgplugin_mem_subscribed(TPI_MEM_LD | TPI_MEM_POST, memop))  {
+        TCGv_i32 tcg_idx = tcg_const_i32(idx);
+        TCGv_i32 tcg_memop = tcg_const_i32(memop);
+        tcgplugin_gen_helper_post_qemu_ld_i32(&tcg_ctx, post_addr, tcg_idx, val, tcg_memop);
+        tcg_temp_free_i32(tcg_idx);
+        tcg_temp_free_i32(tcg_memop);
+        tcg_temp_free(post_addr);
     }
 #endif /* CONFIG_TCG_PLUGIN */
 
@@ -989,8 +1055,11 @@ void tcg_gen_qemu_st_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 {
     TCGArg *opargs = NULL;
     memop = tcg_canonicalize_memop(memop, 0, 1);
+    tcg_gen_req_mo(TCG_MO_LD_ST | TCG_MO_ST_ST);
 
 #ifdef CONFIG_TCG_PLUGIN
+    tcgplugin_gen_instr_mem(addr, memop, true);
+
     if (tcgplugin_intercept_qemu_ldst)  {
     	TCGv_i32 tcg_idx = tcg_const_i32(idx);
     	TCGv_i32 tcg_memop = tcg_const_i32(memop);
@@ -1003,6 +1072,16 @@ void tcg_gen_qemu_st_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     }
 #endif /* CONFIG_TCG_PLUGIN */
 
+#ifdef CONFIG_TCG_PLUGIN
+    if (tcgplugin_mem_subscribed(TPI_MEM_ST | TPI_MEM_PRE, memop))  {
+        TCGv_i32 tcg_idx = tcg_const_i32(idx);
+        TCGv_i32 tcg_memop = tcg_const_i32(memop);
+        tcgplugin_gen_helper_pre_qemu_st_i32(&tcg_ctx, addr, tcg_idx, val, tcg_memop);
+        tcg_temp_free_i32(tcg_idx);
+        tcg_temp_free_i32(tcg_memop);
+    }
+#endif /* CONFIG_TCG_PLUGIN */
+
     *tcg_ctx.gen_opc_ptr++ = INDEX_op_qemu_st_i32;
         tcg_add_param_i32(val);
         tcg_add_param_tl(addr);
@@ -1010,12 +1089,12 @@ void tcg_gen_qemu_st_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
         *tcg_ctx.gen_opparam_ptr++ = idx;
 
 #ifdef CONFIG_TCG_PLUGIN
-    if (tcgplugin_monitor_qemu_ldst)  {
-    	TCGv_i32 tcg_idx = tcg_const_i32(idx);
-		TCGv_i32 tcg_memop = tcg_const_i32(memop);
-		tcgplugin_gen_helper_post_qemu_st_i32(&tcg_ctx, addr, tcg_idx, val, tcg_memop);
-		tcg_temp_free_i32(tcg_idx);
-		tcg_temp_free_i32(tcg_memop);
+    if (tcgplugin_mem_subscribed(TPI_MEM_ST | TPI_MEM_POST, memop))  {
+        TCGv_i32 tcg_idx = tcg_const_i32(idx);
+        TCGv_i32 tcg_memop = tcg_const_i32(memop);
+        tcgplugin_gen_helper_post_qemu_st_i32(&tcg_ctx, addr, tcg_idx, val, tcg_memop);
+        tcg_temp_free_i32(tcg_idx);
+        tcg_temp_free_i32(tcg_memop);
     }
 #endif /* CONFIG_TCG_PLUGIN */
     
@@ -1025,6 +1104,9 @@ void tcg_gen_qemu_st_i32(TCGv_i32 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 void tcg_gen_qemu_ld_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
 {
     TCGArg *opargs  = NULL;
+#ifdef CONFIG_TCG_PLUGIN
+    TCGv post_addr = addr;
+#endif
 
     memop = tcg_canonicalize_memop(memop, 1, 0);
 
@@ -1039,8 +1121,11 @@ void tcg_gen_qemu_ld_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
         return;
     }
 #endif
+    tcg_gen_req_mo(TCG_MO_LD_LD | TCG_MO_ST_LD);
 
 #ifdef CONFIG_TCG_PLUGIN
+    tcgplugin_gen_instr_mem(addr, memop, false);
+
     if (tcgplugin_intercept_qemu_ldst)  {
     	TCGv_i32 tcg_idx = tcg_const_i32(idx);
     	TCGv_i32 tcg_memop = tcg_const_i32(memop);
@@ -1053,6 +1138,22 @@ void tcg_gen_qemu_ld_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     }
 #endif /* CONFIG_TCG_PLUGIN */
 
+#ifdef CONFIG_TCG_PLUGIN
+    if (tcgplugin_mem_subscribed(TPI_MEM_LD | TPI_MEM_PRE, memop))  {
+        TCGv_i32 tcg_idx = tcg_const_i32(idx);
+        TCGv_i32 tcg_memop = tcg_const_i32(memop);
+        tcgplugin_gen_helper_pre_qemu_ld(&tcg_ctx, addr, tcg_idx, tcg_memop);
+        tcg_temp_free_i32(tcg_idx);
+        tcg_temp_free_i32(tcg_memop);
+    }
+
+    /* The loaded value may overwrite the address register.  */
+    if (tcgplugin_mem_subscribed(TPI_MEM_LD | TPI_MEM_POST, memop))  {
+        post_addr = tcg_temp_new();
+        tcg_gen_mov_tl(post_addr, addr);
+    }
+#endif /* CONFIG_TCG_PLUGIN */
+
     *tcg_ctx.gen_opc_ptr++ = INDEX_op_qemu_ld_i64;
     tcg_add_param_i64(val);
     tcg_add_param_tl(addr);
@@ -1060,12 +1161,13 @@ void tcg_gen_qemu_ld_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     *tcg_ctx.gen_opparam_ptr++ = idx;
 
 #ifdef CONFIG_TCG_PLUGIN
-    if (tcgplugin_monitor_qemu_ldst)  {
-    	TCGv_i32 tcg_idx = tcg_const_i32(idx);
-		TCGv_i32 tcg_memop = tcg_const_i32(memop);
-		tcgplugin_gen_helper_post_qemu_ld_i64(&tcg_ctx, addr, tcg_idx, val, tcg_memop);
-		tcg_temp_free_i32(tcg_idx);
-		tcg_temp_free_i32(tcg_memop);
+    if (tcgplugin_mem_subscribed(TPI_MEM_LD | TPI_MEM_POST, memop))  {
+        TCGv_i32 tcg_idx = tcg_const_i32(idx);
+        TCGv_i32 tcg_memop = tcg_const_i32(memop);
+        tcgplugin_gen_helper_post_qemu_ld_i64(&tcg_ctx, post_addr, tcg_idx, val, tcg_memop);
+        tcg_temp_free_i32(tcg_idx);
+        tcg_temp_free_i32(tcg_memop);
+        tcg_temp_free(post_addr);
     }
 #endif /* CONFIG_TCG_PLUGIN */
 
@@ -1084,8 +1186,11 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
         return;
     }
 #endif
+    tcg_gen_req_mo(TCG_MO_LD_ST | TCG_MO_ST_ST);
 
 #ifdef CONFIG_TCG_PLUGIN
+    tcgplugin_gen_instr_mem(addr, memop, true);
+
     if (tcgplugin_intercept_qemu_ldst)  {
     	TCGv_i32 tcg_idx = tcg_const_i32(idx);
     	TCGv_i32 tcg_memop = tcg_const_i32(memop);
@@ -1098,6 +1203,16 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     }
 #endif /* CONFIG_TCG_PLUGIN */
 
+#ifdef CONFIG_TCG_PLUGIN
+    if (tcgplugin_mem_subscribed(TPI_MEM_ST | TPI_MEM_PRE, memop))  {
+        TCGv_i32 tcg_idx = tcg_const_i32(idx);
+        TCGv_i32 tcg_memop = tcg_const_i32(memop);
+        tcgplugin_gen_helper_pre_qemu_st_i64(&tcg_ctx, addr, tcg_idx, val, tcg_memop);
+        tcg_temp_free_i32(tcg_idx);
+        tcg_temp_free_i32(tcg_memop);
+    }
+#endif /* CONFIG_TCG_PLUGIN */
+
     *tcg_ctx.gen_opc_ptr++ = INDEX_op_qemu_st_i64;
     tcg_add_param_i64(val);
     tcg_add_param_tl(addr);
@@ -1105,18 +1220,243 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     *tcg_ctx.gen_opparam_ptr++ = idx;
 
 #ifdef CONFIG_TCG_PLUGIN
-    if (tcgplugin_monitor_qemu_ldst)  {
-    	TCGv_i32 tcg_idx = tcg_const_i32(idx);
-		TCGv_i32 tcg_memop = tcg_const_i32(memop);
-		tcgplugin_gen_helper_post_qemu_st_i64(&tcg_ctx, addr, tcg_idx, val, tcg_memop);
-		tcg_temp_free_i32(tcg_idx);
-		tcg_temp_free_i32(tcg_memop);
+    if (tcgplugin_mem_subscribed(TPI_MEM_ST | TPI_MEM_POST, memop))  {
+        TCGv_i32 tcg_idx = tcg_const_i32(idx);
+        TCGv_i32 tcg_memop = tcg_const_i32(memop);
+        tcgplugin_gen_helper_post_qemu_st_i64(&tcg_ctx, addr, tcg_idx, val, tcg_memop);
+        tcg_temp_free_i32(tcg_idx);
+        tcg_temp_free_i32(tcg_memop);
     }
 #endif /* CONFIG_TCG_PLUGIN */
 
     TCG_PLUGIN_POST_GEN_OPC2(opargs);
 }
 
+void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env)
+{
+    if (TCG_TARGET_HAS_goto_ptr) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        TCGArg args[1] = { GET_TCGV_PTR(env) };
+
+        tcg_gen_callN(&tcg_ctx, (void *) HELPER(lookup_tb_ptr),
+                      GET_TCGV_PTR(ptr), 1, args);
+        tcg_gen_op1i(INDEX_op_goto_ptr, GET_TCGV_PTR(ptr));
+        tcg_temp_free_ptr(ptr);
+    } else {
+        tcg_gen_exit_tb(0);
+    }
+}
+
+static void tcg_gen_vec_op(TCGOpcode opc, TCGv_ptr base, intptr_t dofs,
+                           intptr_t aofs, TCGArg arg, TCGArg desc)
+{
+    *tcg_ctx.gen_opc_ptr++ = opc;
+    *tcg_ctx.gen_opparam_ptr++ = GET_TCGV_PTR(base);
+    *tcg_ctx.gen_opparam_ptr++ = dofs;
+    *tcg_ctx.gen_opparam_ptr++ = aofs;
+    *tcg_ctx.gen_opparam_ptr++ = arg;
+    *tcg_ctx.gen_opparam_ptr++ = desc;
+    TCG_PLUGIN_POST_GEN_OPC1(5);
+}
+
+/* Lane-wise add or sub on a 64-bit word: the top bits of the lanes are
+   computed apart, so that no carry crosses the lanes.  */
+static void tcg_gen_vec_addsub_i64(bool sub, unsigned vece, TCGv_i64 d,
+                                   TCGv_i64 a, TCGv_i64 b)
+{
+    static const uint64_t msb[3] = {
+        0x8080808080808080ull, 0x8000800080008000ull, 0x8000000080000000ull
+    };
+    TCGv_i64 t1, t2, t3;
+
+    if (vece == MO_64) {
+        if (sub) {
+            tcg_gen_sub_i64(d, a, b);
+        } else {
+            tcg_gen_add_i64(d, a, b);
+        }
+        return;
+    }
+
+    t1 = tcg_temp_new_i64();
+    t2 = tcg_temp_new_i64();
+    t3 = tcg_temp_new_i64();
+    tcg_gen_andi_i64(t2, b, ~msb[vece]);
+    if (sub) {
+        tcg_gen_ori_i64(t1, a, msb[vece]);
+        tcg_gen_sub_i64(t1, t1, t2);
+        tcg_gen_eqv_i64(t3, a, b);
+    } else {
+        tcg_gen_andi_i64(t1, a, ~msb[vece]);
+        tcg_gen_add_i64(t1, t1, t2);
+        tcg_gen_xor_i64(t3, a, b);
+    }
+    tcg_gen_andi_i64(t3, t3, msb[vece]);
+    tcg_gen_xor_i64(d, t1, t3);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+/* The vector operations of the hosts without TCG_TARGET_HAS_vec, one
+   64-bit word at a time, or in a helper for the comparisons.  */
+static void tcg_gen_vec_fallback(TCGOpcode opc, TCGv_ptr base, intptr_t dofs,
+                                 intptr_t aofs, intptr_t bofs,
+                                 unsigned oprsz, unsigned vece)
+{
+    TCGv_i64 a, b;
+    unsigned i;
+
+    if (opc == INDEX_op_cmpeq_vec || opc == INDEX_op_cmpgt_vec) {
+        TCGv_ptr d_ptr = tcg_temp_new_ptr();
+        TCGv_ptr a_ptr = tcg_temp_new_ptr();
+        TCGv_ptr b_ptr = tcg_temp_new_ptr();
+        TCGv_i32 desc = tcg_const_i32(VEC_DESC(oprsz, vece));
+
+        tcg_gen_addi_ptr(d_ptr, base, dofs);
+        tcg_gen_addi_ptr(a_ptr, base, aofs);
+        tcg_gen_addi_ptr(b_ptr, base, bofs);
+        if (opc == INDEX_op_cmpeq_vec) {
+            gen_helper_vec_cmpeq(d_ptr, a_ptr, b_ptr, desc);
+        } else {
+            gen_helper_vec_cmpgt(d_ptr, a_ptr, b_ptr, desc);
+        }
+        tcg_temp_free_ptr(d_ptr);
+        tcg_temp_free_ptr(a_ptr);
+        tcg_temp_free_ptr(b_ptr);
+        tcg_temp_free_i32(desc);
+        return;
+    }
+
+    a = tcg_temp_new_i64();
+    b = tcg_temp_new_i64();
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(a, base, aofs + i);
+        tcg_gen_ld_i64(b, base, bofs + i);
+        switch (opc) {
+        case INDEX_op_add_vec:
+            tcg_gen_vec_addsub_i64(false, vece, a, a, b);
+            break;
+        case INDEX_op_sub_vec:
+            tcg_gen_vec_addsub_i64(true, vece, a, a, b);
+            break;
+        case INDEX_op_and_vec:
+            tcg_gen_and_i64(a, a, b);
+            break;
+        case INDEX_op_or_vec:
+            tcg_gen_or_i64(a, a, b);
+            break;
+        case INDEX_op_xor_vec:
+            tcg_gen_xor_i64(a, a, b);
+            break;
+        case INDEX_op_andc_vec:
+            tcg_gen_andc_i64(a, a, b);
+            break;
+        default:
+            tcg_abort();
+        }
+        tcg_gen_st_i64(a, base, dofs + i);
+    }
+    tcg_temp_free_i64(a);
+    tcg_temp_free_i64(b);
+}
+
+static void tcg_gen_vec_binop(TCGOpcode opc, TCGv_ptr base, intptr_t dofs,
+                              intptr_t aofs, intptr_t bofs,
+                              unsigned oprsz, unsigned vece)
+{
+    tcg_debug_assert(oprsz == 8 || oprsz == 16);
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(opc, base, dofs, aofs, bofs, VEC_DESC(oprsz, vece));
+    } else {
+        tcg_gen_vec_fallback(opc, base, dofs, aofs, bofs, oprsz, vece);
+    }
+}
+
+void tcg_gen_vec_add(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                     intptr_t bofs, unsigned oprsz, unsigned vece)
+{
+    tcg_gen_vec_binop(INDEX_op_add_vec, base, dofs, aofs, bofs, oprsz, vece);
+}
+
+void tcg_gen_vec_sub(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                     intptr_t bofs, unsigned oprsz, unsigned vece)
+{
+    tcg_gen_vec_binop(INDEX_op_sub_vec, base, dofs, aofs, bofs, oprsz, vece);
+}
+
+void tcg_gen_vec_and(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                     intptr_t bofs, unsigned oprsz)
+{
+    tcg_gen_vec_binop(INDEX_op_and_vec, base, dofs, aofs, bofs, oprsz, MO_64);
+}
+
+void tcg_gen_vec_or(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                    intptr_t bofs, unsigned oprsz)
+{
+    tcg_gen_vec_binop(INDEX_op_or_vec, base, dofs, aofs, bofs, oprsz, MO_64);
+}
+
+void tcg_gen_vec_xor(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                     intptr_t bofs, unsigned oprsz)
+{
+    tcg_gen_vec_binop(INDEX_op_xor_vec, base, dofs, aofs, bofs, oprsz, MO_64);
+}
+
+void tcg_gen_vec_andc(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                      intptr_t bofs, unsigned oprsz)
+{
+    tcg_gen_vec_binop(INDEX_op_andc_vec, base, dofs, aofs, bofs, oprsz, MO_64);
+}
+
+void tcg_gen_vec_cmpeq(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                       intptr_t bofs, unsigned oprsz, unsigned vece)
+{
+    tcg_debug_assert(vece <= MO_32);
+    tcg_gen_vec_binop(INDEX_op_cmpeq_vec, base, dofs, aofs, bofs,
+                      oprsz, vece);
+}
+
+void tcg_gen_vec_cmpgt(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                       intptr_t bofs, unsigned oprsz, unsigned vece)
+{
+    tcg_debug_assert(vece <= MO_32);
+    tcg_gen_vec_binop(INDEX_op_cmpgt_vec, base, dofs, aofs, bofs,
+                      oprsz, vece);
+}
+
+/* Offset of the 32-bit element i of a vector, see VEC_DESC.  */
+#ifdef HOST_WORDS_BIGENDIAN
+# define VEC_ELT32_OFS(i)   (((i) ^ 1) * 4)
+#else
+# define VEC_ELT32_OFS(i)   ((i) * 4)
+#endif
+
+void tcg_gen_vec_shuf32(TCGv_ptr base, intptr_t dofs, intptr_t aofs,
+                        unsigned sel, unsigned oprsz)
+{
+    TCGv_i32 t[4];
+    unsigned i, n = oprsz / 4;
+
+    tcg_debug_assert(oprsz == 8 || oprsz == 16);
+    tcg_debug_assert(oprsz == 16 || (sel & 0xa) == 0);
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_shuf32_vec, base, dofs, aofs, sel & 0xff,
+                       VEC_DESC(oprsz, MO_32));
+        return;
+    }
+
+    /* Load all the elements first, in case dofs == aofs.  */
+    for (i = 0; i < n; i++) {
+        t[i] = tcg_temp_new_i32();
+        tcg_gen_ld_i32(t[i], base, aofs + VEC_ELT32_OFS((sel >> 2 * i) & 3));
+    }
+    for (i = 0; i < n; i++) {
+        tcg_gen_st_i32(t[i], base, dofs + VEC_ELT32_OFS(i));
+        tcg_temp_free_i32(t[i]);
+    }
+}
+
 static void tcg_reg_alloc_start(TCGContext *s)
 {
     int i;
@@ -1529,6 +1869,21 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *dead_temps,
     }
 }
 
+/* liveness analysis: conditional branch: the temps are dead, globals
+   and local temps should be in memory for the branch target, but the
+   globals used by the code that follows stay live in their registers. */
+static inline void tcg_la_cond_branch(TCGContext *s, uint8_t *dead_temps,
+                                      uint8_t *mem_temps)
+{
+    int i;
+
+    memset(dead_temps + s->nb_globals, 1, s->nb_temps - s->nb_globals);
+    memset(mem_temps, 1, s->nb_globals);
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        mem_temps[i] = s->temps[i].temp_local;
+    }
+}
+
 /* Liveness analysis : update the opc_dead_args array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -1766,7 +2121,9 @@ static void tcg_liveness_analysis(TCGContext *s)
                 }
 
                 /* if end of basic block, update */
-                if (def->flags & TCG_OPF_BB_END) {
+                if (def->flags & TCG_OPF_COND_BRANCH) {
+                    tcg_la_cond_branch(s, dead_temps, mem_temps);
+                } else if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s, dead_temps, mem_temps);
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
@@ -2049,8 +2406,11 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
 }
 
 /* at the end of a basic block, we assume all temporaries are dead and
-   all globals are stored at their canonical location. */
-static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
+   all globals are stored at their canonical location.  After a
+   conditional branch, the globals stay valid in their registers for the
+   code that follows. */
+static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs,
+                                 bool cond_branch)
 {
     TCGTemp *ts;
     int i;
@@ -2070,7 +2430,11 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
         }
     }
 
-    save_globals(s, allocated_regs);
+    if (cond_branch) {
+        sync_globals(s, allocated_regs);
+    } else {
+        save_globals(s, allocated_regs);
+    }
 }
 
 #define IS_DEAD_ARG(n) ((dead_args >> (n)) & 1)
@@ -2280,7 +2644,8 @@ static void tcg_reg_alloc_op(TCGContext *s,
     }
 
     if (def->flags & TCG_OPF_BB_END) {
-        tcg_reg_alloc_bb_end(s, allocated_regs);
+        tcg_reg_alloc_bb_end(s, allocated_regs,
+                             def->flags & TCG_OPF_COND_BRANCH);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
             /* XXX: permit generic clobber register list ? */ 
@@ -2617,7 +2982,7 @@ static inline int tcg_gen_code_common(TCGContext *s,
             temp_dead(s, args[0]);
             break;
         case INDEX_op_set_label:
-            tcg_reg_alloc_bb_end(s, s->reserved_regs);
+            tcg_reg_alloc_bb_end(s, s->reserved_regs, false);
             tcg_out_label(s, args[0], s->code_ptr);
             break;
         case INDEX_op_call:
@@ -2689,6 +3054,26 @@ int tcg_gen_code_search_pc(TCGContext *s, tcg_insn_unit *gen_code_buf,
     return tcg_gen_code_common(s, gen_code_buf, offset);
 }
 
+/* Shape of the hash table of the TBs, see tb_find_physical().  */
+static void dump_tb_hash_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    QHTStats stats;
+
+    if (!tcg_enabled()) {
+        return;
+    }
+
+    qht_statistics(&tcg_ctx.tb_ctx.htable, &stats);
+    cpu_fprintf(f, "TB hash buckets     %zu/%zu (%0.2f%% used)\n",
+                stats.used_head_buckets, stats.head_buckets,
+                stats.head_buckets ?
+                (double)stats.used_head_buckets / stats.head_buckets * 100.0
+                : 0);
+    cpu_fprintf(f, "TB hash entries     %zu\n", stats.entries);
+    cpu_fprintf(f, "TB hash chain       avg %0.2f max=%zu buckets\n",
+                stats.avg_chain, stats.max_chain);
+}
+
 #ifdef CONFIG_PROFILER
 void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
 {
@@ -2733,12 +3118,18 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
                 s->restore_count);
     cpu_fprintf(f, "  avg cycles        %0.1f\n",
                 s->restore_count ? (double)s->restore_time / s->restore_count : 0);
+    cpu_fprintf(f, "TB hash lookups     %" PRId64 "\n", s->tb_lookup_count);
+    cpu_fprintf(f, "  avg cycles        %0.1f\n",
+                s->tb_lookup_count ?
+                (double)s->tb_lookup_time / s->tb_lookup_count : 0);
+    dump_tb_hash_info(f, cpu_fprintf);
 
     dump_op_count();
 }
 #else
 void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
 {
+    dump_tb_hash_info(f, cpu_fprintf);
     cpu_fprintf(f, "[TCG profiler not compiled]\n");
 }
 #endif
@@ -3013,3 +3404,193 @@ void tcg_register_jit(void *buf, size_t buf_size)
 {
 }
 #endif /* ELF_HOST_MACHINE */
+
+/* Linux perf interface.
+
+   perf sees the translation buffer as one anonymous mapping.  With
+   -perfmap and -jitdump, tb_gen_code describes the host code of each
+   block to it, named after the guest symbol of the block:
+
+   - /tmp/perf-PID.map is the symbol map that perf reads for the anonymous
+     mappings of a process.  It has no notion of time: once tb_flush or
+     the eviction of a region reused the buffer, the same addresses have
+     several entries, and perf picks one of them.
+
+   - /tmp/jit-PID.dump is a jitdump file: "perf inject --jit" turns each
+     of its records into an ELF object, mapped from the time of the record
+     on, so that a sample goes to the block that held the code at that
+     time, across the flushes.  perf record must use the same clock, with
+     "-k mono".
+
+   An invalidated block keeps its code until its region of the buffer is
+   reused, and the records of the new blocks then take over: neither
+   format needs to unload it.  The records are written by tb_gen_code,
+   with tb_lock held.  */
+
+bool tcg_perf_enabled;
+
+#ifdef __linux__
+static FILE *perf_map_file;
+static FILE *jitdump_file;
+static uint64_t jitdump_code_index;
+
+/* Begin jitdump format.  THE FOLLOWING MUST MATCH
+   tools/perf/Documentation/jitdump-specification.txt in Linux.  */
+#define JITDUMP_MAGIC   0x4A695444
+#define JITDUMP_VERSION 1
+
+enum {
+    JIT_CODE_LOAD = 0,
+};
+
+typedef struct JitdumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitdumpHeader;
+
+typedef struct JitdumpRecord {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+} JitdumpRecord;
+
+/* Followed by the name of the code and the code itself.  */
+typedef struct JitdumpCodeLoad {
+    JitdumpRecord p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+} JitdumpCodeLoad;
+/* End jitdump format.  */
+
+/* The CLOCK_MONOTONIC of perf record -k mono.  */
+static uint64_t jitdump_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void jitdump_write(const void *buf, size_t size)
+{
+    if (jitdump_file && fwrite(buf, size, 1, jitdump_file) != 1) {
+        fprintf(stderr, "-jitdump: write error, stopping\n");
+        fclose(jitdump_file);
+        jitdump_file = NULL;
+    }
+}
+
+static void jitdump_init(void)
+{
+    char path[64];
+    JitdumpHeader header;
+    int fd;
+
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "-jitdump: cannot create %s: %s\n",
+                path, strerror(errno));
+        exit(1);
+    }
+    /* perf record finds the file through an executable mapping of it,
+       which must stay for the whole run.  */
+    if (mmap(NULL, getpagesize(), PROT_READ | PROT_EXEC, MAP_PRIVATE,
+             fd, 0) == MAP_FAILED) {
+        fprintf(stderr, "-jitdump: cannot map %s: %s\n",
+                path, strerror(errno));
+        exit(1);
+    }
+    jitdump_file = fdopen(fd, "w");
+
+    memset(&header, 0, sizeof(header));
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+#ifdef ELF_HOST_MACHINE
+    header.elf_mach = ELF_HOST_MACHINE;
+#endif
+    header.pid = getpid();
+    header.timestamp = jitdump_timestamp();
+    jitdump_write(&header, sizeof(header));
+}
+#endif /* __linux__ */
+
+void tcg_perf_init(bool perf_map, bool jitdump)
+{
+#ifdef __linux__
+    if (!tcg_enabled()) {
+        fprintf(stderr, "-perfmap and -jitdump need the TCG accelerator\n");
+        exit(1);
+    }
+    if (perf_map) {
+        char path[64];
+
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+        perf_map_file = fopen(path, "w");
+        if (!perf_map_file) {
+            fprintf(stderr, "-perfmap: cannot create %s: %s\n",
+                    path, strerror(errno));
+            exit(1);
+        }
+        /* linux-user leaves through exit_group, without flushing stdio.  */
+        setlinebuf(perf_map_file);
+    }
+    if (jitdump) {
+        jitdump_init();
+    }
+    tcg_perf_enabled = perf_map || jitdump;
+
+    /* The system emulator has generated the prologue already; the user
+       mode emulators generate it later, and tcg_prologue_init reports it
+       then.  */
+    if (tcg_prologue_size) {
+        tcg_perf_report_code(tcg_ctx.code_gen_prologue, tcg_prologue_size,
+                             "tcg-prologue");
+    }
+#else
+    fprintf(stderr, "-perfmap and -jitdump are only supported on Linux\n");
+    exit(1);
+#endif
+}
+
+void tcg_perf_report_code(const void *start, size_t size, const char *name)
+{
+#ifdef __linux__
+    if (perf_map_file) {
+        fprintf(perf_map_file, "%" PRIxPTR " %zx %s\n",
+                (uintptr_t)start, size, name);
+    }
+    if (jitdump_file) {
+        JitdumpCodeLoad load;
+        size_t name_size = strlen(name) + 1;
+
+        load.p.id = JIT_CODE_LOAD;
+        load.p.total_size = sizeof(load) + name_size + size;
+        load.p.timestamp = jitdump_timestamp();
+        load.pid = getpid();
+        load.tid = qemu_get_thread_id();
+        load.vma = (uintptr_t)start;
+        load.code_addr = (uintptr_t)start;
+        load.code_size = size;
+        load.code_index = jitdump_code_index++;
+        jitdump_write(&load, sizeof(load));
+        jitdump_write(name, name_size);
+        jitdump_write(start, size);
+        /* Whole records only, for the same reason as the perf map.  */
+        if (jitdump_file) {
+            fflush(jitdump_file);
+        }
+    }
+#endif
+}
@@ -29,6 +29,35 @@
 #include "qemu/bitops.h"
 #include "tcg-target.h"
 
+/* Set by the backends that index the softmmu TLB with env->tlb_mask
+   rather than with CPU_TLB_SIZE, so its size may change at run-time.  */
+#ifndef TCG_TARGET_DYNAMIC_TLB
+#define TCG_TARGET_DYNAMIC_TLB 0
+#endif
+
+/* Set by the backends that implement goto_ptr, the indirect jump to
+   the host code of another TB (see tcg_gen_lookup_and_goto_ptr).  */
+#ifndef TCG_TARGET_HAS_goto_ptr
+#define TCG_TARGET_HAS_goto_ptr 0
+#endif
+
+/* Set by the backends that implement mb, the host memory barrier needed
+   by -tcg-threads multi.  TCG_TARGET_DEFAULT_MO is the TCGBar ordering
+   that the host guarantees without barriers.  */
+#ifndef TCG_TARGET_HAS_mb
+#define TCG_TARGET_HAS_mb 0
+#endif
+#ifndef TCG_TARGET_DEFAULT_MO
+#define TCG_TARGET_DEFAULT_MO 0
+#endif
+
+/* Set by the backends that implement the vector operations (add_vec,
+   ...) with host vector instructions.  The others get a lowering to the
+   64-bit integer operations, or helpers.  */
+#ifndef TCG_TARGET_HAS_vec
+#define TCG_TARGET_HAS_vec 0
+#endif
+
 /* Default target word size to pointer size.  */
 #ifndef TCG_TARGET_REG_BITS
 # if UINTPTR_MAX == UINT32_MAX
@@ -187,6 +216,9 @@ typedef struct TCGPool {
 
 #define TCG_MAX_TEMPS 512
 
+/* pointers to the TB in its code, see TCGContext.tb_relocs */
+#define TCG_MAX_TB_RELOCS 8
+
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
 #define TCG_STATIC_CALL_ARGS_SIZE 128
@@ -272,6 +304,28 @@ typedef enum TCGMemOp {
     MO_SSIZE = MO_SIZE | MO_SIGN,
 } TCGMemOp;
 
+/* Argument of the mb op.  TCG_MO_X_Y orders the X accesses before the
+   barrier with the Y accesses after it.  The guests describe their
+   ordering of plain loads and stores with TCG_GUEST_DEFAULT_MO, in
+   cpu.h, which -tcg-threads multi requires.  */
+typedef enum {
+    TCG_MO_LD_LD  = 0x01,
+    TCG_MO_ST_LD  = 0x02,
+    TCG_MO_LD_ST  = 0x04,
+    TCG_MO_ST_ST  = 0x08,
+    TCG_MO_ALL    = 0x0F,
+
+    TCG_BAR_SC    = 0x30,   /* also sequentially consistent */
+} TCGBar;
+
+/* Last argument of the vector operations: the size of the vectors, 8 or
+   16 bytes, and the size of their elements, MO_8 to MO_64.  The 32-bit
+   elements that shuf32_vec numbers are the halves of the host-endian
+   64-bit words of the vector, low half first.  */
+#define VEC_DESC(oprsz, vece)   ((oprsz) << 2 | (vece))
+#define VEC_DESC_OPRSZ(desc)    ((desc) >> 2)
+#define VEC_DESC_VECE(desc)     ((desc) & 3)
+
 typedef tcg_target_ulong TCGArg;
 
 /* Define a type and accessor macros for variables.  Using a struct is
@@ -483,6 +537,15 @@ struct TCGContext {
     uint16_t *tb_next_offset;
     uint16_t *tb_jmp_offset; /* != NULL if USE_DIRECT_JUMP */
 
+    /* persistent translation cache, see translate-cache.c: the code must
+       still work once copied to another address, and the offsets of the
+       pointers to the TB it embeds are recorded */
+    bool code_gen_relocatable;
+    bool code_gen_host_ptr;     /* another host pointer is embedded, e.g.
+                                   by tcg_const_ptr: the code can't move */
+    int nb_tb_relocs;
+    uint16_t tb_relocs[TCG_MAX_TB_RELOCS];
+
     /* liveness analysis */
     uint16_t *op_dead_args; /* for each operation, each bit tells if the
                                corresponding argument is dead */
@@ -522,6 +585,8 @@ struct TCGContext {
     int64_t opt_time;
     int64_t restore_count;
     int64_t restore_time;
+    int64_t tb_lookup_count; /* tb_find_slow() lookups in tb_ctx.htable */
+    int64_t tb_lookup_time;
 #endif
 
 #ifdef CONFIG_DEBUG_TCG
@@ -544,6 +609,9 @@ struct TCGContext {
        extension that allows arithmetic on void*.  */
     int code_gen_max_blocks;
     void *code_gen_prologue;
+    /* the part of the prologue returning 0 to cpu_exec, goto_ptr jumps
+       there when the next TB isn't known */
+    void *code_gen_epilogue;
     void *code_gen_buffer;
     size_t code_gen_buffer_size;
     /* threshold to flush the translated code buffer */
@@ -558,6 +626,9 @@ struct TCGContext {
 
 extern TCGContext tcg_ctx;
 
+/* The vCPUs run in parallel host threads, see translate-all.c.  */
+extern bool parallel_cpus;
+
 /* pool based memory allocation */
 
 void *tcg_malloc_internal(TCGContext *s, int size);
@@ -661,6 +732,9 @@ enum {
     /* Instruction is optional and not implemented by the host, or insn
        is generic and should not be implemened by the host.  */
     TCG_OPF_NOT_PRESENT  = 0x10,
+    /* Instruction is a conditional branch: it ends a basic block, but
+       the code that follows is only reached from it.  */
+    TCG_OPF_COND_BRANCH  = 0x20,
 };
 
 typedef struct TCGOpDef {
@@ -702,7 +776,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V)))
+#define tcg_const_ptr(V) \
+    (tcg_ctx.code_gen_host_ptr = true, \
+     TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i32((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -713,7 +789,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I64(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V)))
+#define tcg_const_ptr(V) \
+    (tcg_ctx.code_gen_host_ptr = true, \
+     TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i64((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -840,6 +918,12 @@ static inline size_t tcg_current_code_size(TCGContext *s)
 
 void tcg_register_jit(void *buf, size_t buf_size);
 
+/* Set by -perfmap and -jitdump (tcg_perf_init), see tcg.c.  */
+extern bool tcg_perf_enabled;
+
+/* Describe to Linux perf the host code of a translated block.  */
+void tcg_perf_report_code(const void *start, size_t size, const char *name);
+
 /*
  * Memory helpers that will be used by TCG generated code.
  */
@@ -70,9 +70,9 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_st16_i32, { R, R } },
     { INDEX_op_st_i32, { R, R } },
 
-    { INDEX_op_add_i32, { R, RI, RI } },
-    { INDEX_op_sub_i32, { R, RI, RI } },
-    { INDEX_op_mul_i32, { R, RI, RI } },
+    { INDEX_op_add_i32, { R, R, RI } },
+    { INDEX_op_sub_i32, { R, R, RI } },
+    { INDEX_op_mul_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_div_i32
     { INDEX_op_div_i32, { R, R, R } },
     { INDEX_op_divu_i32, { R, R, R } },
@@ -82,32 +82,32 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_div2_i32, { R, R, "0", "1", R } },
     { INDEX_op_divu2_i32, { R, R, "0", "1", R } },
 #endif
-    /* TODO: Does R, RI, RI result in faster code than R, R, RI?
-       If both operands are constants, we can optimize. */
-    { INDEX_op_and_i32, { R, RI, RI } },
+    /* The instructions of tci.c have room for one constant: the last
+       input of the operations that accept one.  */
+    { INDEX_op_and_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_andc_i32
-    { INDEX_op_andc_i32, { R, RI, RI } },
+    { INDEX_op_andc_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_eqv_i32
-    { INDEX_op_eqv_i32, { R, RI, RI } },
+    { INDEX_op_eqv_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_nand_i32
-    { INDEX_op_nand_i32, { R, RI, RI } },
+    { INDEX_op_nand_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_nor_i32
-    { INDEX_op_nor_i32, { R, RI, RI } },
+    { INDEX_op_nor_i32, { R, R, RI } },
 #endif
-    { INDEX_op_or_i32, { R, RI, RI } },
+    { INDEX_op_or_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_orc_i32
-    { INDEX_op_orc_i32, { R, RI, RI } },
+    { INDEX_op_orc_i32, { R, R, RI } },
 #endif
-    { INDEX_op_xor_i32, { R, RI, RI } },
-    { INDEX_op_shl_i32, { R, RI, RI } },
-    { INDEX_op_shr_i32, { R, RI, RI } },
-    { INDEX_op_sar_i32, { R, RI, RI } },
+    { INDEX_op_xor_i32, { R, R, RI } },
+    { INDEX_op_shl_i32, { R, R, RI } },
+    { INDEX_op_shr_i32, { R, R, RI } },
+    { INDEX_op_sar_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_rot_i32
-    { INDEX_op_rotl_i32, { R, RI, RI } },
-    { INDEX_op_rotr_i32, { R, RI, RI } },
+    { INDEX_op_rotl_i32, { R, R, RI } },
+    { INDEX_op_rotr_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_deposit_i32
     { INDEX_op_deposit_i32, { R, "0", R } },
@@ -121,12 +121,11 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
 #endif /* TCG_TARGET_REG_BITS == 64 */
 
 #if TCG_TARGET_REG_BITS == 32
-    /* TODO: Support R, R, R, R, RI, RI? Will it be faster? */
     { INDEX_op_add2_i32, { R, R, R, R, R, R } },
     { INDEX_op_sub2_i32, { R, R, R, R, R, R } },
-    { INDEX_op_brcond2_i32, { R, R, RI, RI } },
+    { INDEX_op_brcond2_i32, { R, R, R, R } },
     { INDEX_op_mulu2_i32, { R, R, R, R } },
-    { INDEX_op_setcond2_i32, { R, R, R, RI, RI } },
+    { INDEX_op_setcond2_i32, { R, R, R, R, R } },
 #endif
 
 #if TCG_TARGET_HAS_not_i32
@@ -150,9 +149,9 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_st32_i64, { R, R } },
     { INDEX_op_st_i64, { R, R } },
 
-    { INDEX_op_add_i64, { R, RI, RI } },
-    { INDEX_op_sub_i64, { R, RI, RI } },
-    { INDEX_op_mul_i64, { R, RI, RI } },
+    { INDEX_op_add_i64, { R, R, RI } },
+    { INDEX_op_sub_i64, { R, R, RI } },
+    { INDEX_op_mul_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_div_i64
     { INDEX_op_div_i64, { R, R, R } },
     { INDEX_op_divu_i64, { R, R, R } },
@@ -162,30 +161,30 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_div2_i64, { R, R, "0", "1", R } },
     { INDEX_op_divu2_i64, { R, R, "0", "1", R } },
 #endif
-    { INDEX_op_and_i64, { R, RI, RI } },
+    { INDEX_op_and_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_andc_i64
-    { INDEX_op_andc_i64, { R, RI, RI } },
+    { INDEX_op_andc_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_eqv_i64
-    { INDEX_op_eqv_i64, { R, RI, RI } },
+    { INDEX_op_eqv_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_nand_i64
-    { INDEX_op_nand_i64, { R, RI, RI } },
+    { INDEX_op_nand_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_nor_i64
-    { INDEX_op_nor_i64, { R, RI, RI } },
+    { INDEX_op_nor_i64, { R, R, RI } },
 #endif
-    { INDEX_op_or_i64, { R, RI, RI } },
+    { INDEX_op_or_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_orc_i64
-    { INDEX_op_orc_i64, { R, RI, RI } },
+    { INDEX_op_orc_i64, { R, R, RI } },
 #endif
-    { INDEX_op_xor_i64, { R, RI, RI } },
-    { INDEX_op_shl_i64, { R, RI, RI } },
-    { INDEX_op_shr_i64, { R, RI, RI } },
-    { INDEX_op_sar_i64, { R, RI, RI } },
+    { INDEX_op_xor_i64, { R, R, RI } },
+    { INDEX_op_shl_i64, { R, R, RI } },
+    { INDEX_op_shr_i64, { R, R, RI } },
+    { INDEX_op_sar_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_rot_i64
-    { INDEX_op_rotl_i64, { R, RI, RI } },
-    { INDEX_op_rotr_i64, { R, RI, RI } },
+    { INDEX_op_rotl_i64, { R, R, RI } },
+    { INDEX_op_rotr_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_deposit_i64
     { INDEX_op_deposit_i64, { R, "0", R } },
@@ -397,283 +396,344 @@ void tci_disas(uint8_t opc)
 }
 #endif
 
-/* Write value (native size). */
-static void tcg_out_i(TCGContext *s, tcg_target_ulong v)
+/* Append an instruction of opcode "opc" to the code, with no operands
+   yet, after fusing the previous instruction with it if tci.c has an
+   instruction for the pair.  */
+static TCIInsn *tci_out_insn(TCGContext *s, TCIOpcode opc)
 {
-    if (TCG_TARGET_REG_BITS == 32) {
-        tcg_out32(s, v);
-    } else {
-        tcg_out64(s, v);
+    static const struct {
+        uint8_t first, second, fused;
+    } fusions[] = {
+        { TCI_ld32u, TCI_add_i32, TCI_ld_add_i32 },
+        { TCI_ld32u, TCI_addi_i32, TCI_ld_addi_i32 },
+        { TCI_setcond_i32, TCI_brcondi_i32, TCI_setcond_brcondi_i32 },
+        { TCI_setcondi_i32, TCI_brcondi_i32, TCI_setcondi_brcondi_i32 },
+#if TCG_TARGET_REG_BITS == 64
+        { TCI_ld64, TCI_add_i64, TCI_ld_add_i64 },
+        { TCI_ld64, TCI_addi_i64, TCI_ld_addi_i64 },
+        { TCI_setcond_i64, TCI_brcondi_i64, TCI_setcond_brcondi_i64 },
+        { TCI_setcondi_i64, TCI_brcondi_i64, TCI_setcondi_brcondi_i64 },
+#endif
+    };
+    TCIInsn *insn = (TCIInsn *)s->code_ptr;
+    int i;
+
+    /* The previous instruction always falls through to this one, which
+       stays a complete instruction for the branches to a label here.  */
+    if (tcg_current_code_size(s) >= sizeof(TCIInsn)) {
+        TCIInsn *prev = insn - 1;
+
+        for (i = 0; i < ARRAY_SIZE(fusions); i++) {
+            if (prev->opc == fusions[i].first && opc == fusions[i].second) {
+                prev->handler = tci_handlers[fusions[i].fused];
+                prev->opc = fusions[i].fused;
+                break;
+            }
+        }
     }
-}
 
-/* Write opcode. */
-static void tcg_out_op_t(TCGContext *s, TCGOpcode op)
-{
-    tcg_out8(s, op);
-    tcg_out8(s, 0);
+    memset(insn, 0, sizeof(*insn));
+    insn->handler = tci_handlers[opc];
+    insn->opc = opc;
+    s->code_ptr += sizeof(*insn);
+    return insn;
 }
 
-/* Write register. */
-static void tcg_out_r(TCGContext *s, TCGArg t0)
+/* Check a register operand. */
+static uint8_t tci_r(TCGArg t0)
 {
     assert(t0 < TCG_TARGET_NB_REGS);
-    tcg_out8(s, t0);
+    return t0;
 }
 
-/* Write register or constant (native size). */
-static void tcg_out_ri(TCGContext *s, int const_arg, TCGArg arg)
+/* Write label. */
+static void tci_out_label(TCGContext *s, TCIInsn *insn, TCGArg arg)
 {
-    if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out_i(s, arg);
+    TCGLabel *label = &s->labels[arg];
+    if (label->has_value) {
+        insn->target = label->u.value;
+        assert(label->u.value);
     } else {
-        tcg_out_r(s, arg);
+        tcg_out_reloc(s, (tcg_insn_unit *)&insn->target,
+                      sizeof(tcg_target_ulong), arg, 0);
     }
 }
 
-/* Write register or constant (32 bit). */
-static void tcg_out_ri32(TCGContext *s, int const_arg, TCGArg arg)
+/* Write an operation whose last input is a register or a constant: "opc"
+   is the instruction for a register, "opc" + 1 the one for a constant.  */
+static TCIInsn *tci_out_binop(TCGContext *s, TCIOpcode opc,
+                              const TCGArg *args, const int *const_args)
 {
-    if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out32(s, arg);
+    TCIInsn *insn = tci_out_insn(s, opc + (const_args[2] != 0));
+
+    insn->a[0] = tci_r(args[0]);
+    insn->a[1] = tci_r(args[1]);
+    if (const_args[2]) {
+        insn->i = args[2];
     } else {
-        tcg_out_r(s, arg);
+        insn->a[2] = tci_r(args[2]);
     }
+    return insn;
 }
 
-#if TCG_TARGET_REG_BITS == 64
-/* Write register or constant (64 bit). */
-static void tcg_out_ri64(TCGContext *s, int const_arg, TCGArg arg)
+/* Write an operation with registers only.  */
+static TCIInsn *tci_out_rrr(TCGContext *s, TCIOpcode opc,
+                            const TCGArg *args, int nb_regs)
 {
-    if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out64(s, arg);
-    } else {
-        tcg_out_r(s, arg);
+    TCIInsn *insn = tci_out_insn(s, opc);
+    int i;
+
+    for (i = 0; i < nb_regs; i++) {
+        insn->a[i] = tci_r(args[i]);
     }
+    return insn;
 }
-#endif
 
-/* Write label. */
-static void tci_out_label(TCGContext *s, TCGArg arg)
+/* Write a load or a store at "offset" from the register "base".  */
+static void tci_out_ldst(TCGContext *s, TCIOpcode opc, TCGReg val,
+                         TCGReg base, intptr_t offset)
 {
-    TCGLabel *label = &s->labels[arg];
-    if (label->has_value) {
-        tcg_out_i(s, label->u.value);
-        assert(label->u.value);
-    } else {
-        tcg_out_reloc(s, s->code_ptr, sizeof(tcg_target_ulong), arg, 0);
-        s->code_ptr += sizeof(tcg_target_ulong);
+    TCIInsn *insn = tci_out_insn(s, opc);
+
+    insn->a[0] = tci_r(val);
+    insn->a[1] = tci_r(base);
+    insn->i = offset;
+}
+
+/* Write a guest memory access: a[0] and a[1] hold the data, a[2] and a[3]
+   the address, a[4] the TCGMemOp, and i the MMU index.  */
+static void tci_out_qemu_ldst(TCGContext *s, TCIOpcode opc,
+                              const TCGArg *args, bool is_64)
+{
+    TCIInsn *insn = tci_out_insn(s, opc);
+
+    insn->a[0] = tci_r(*args++);
+    if (is_64 && TCG_TARGET_REG_BITS == 32) {
+        insn->a[1] = tci_r(*args++);
+    }
+    insn->a[2] = tci_r(*args++);
+    if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
+        insn->a[3] = tci_r(*args++);
     }
+    insn->a[4] = *args++;
+#ifdef CONFIG_SOFTMMU
+    insn->i = *args;
+#endif
 }
 
 static void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg1,
                        intptr_t arg2)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
     if (type == TCG_TYPE_I32) {
-        tcg_out_op_t(s, INDEX_op_ld_i32);
-        tcg_out_r(s, ret);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
+        tci_out_ldst(s, TCI_ld32u, ret, arg1, arg2);
     } else {
         assert(type == TCG_TYPE_I64);
 #if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_ld_i64);
-        tcg_out_r(s, ret);
-        tcg_out_r(s, arg1);
-        assert(arg2 == (int32_t)arg2);
-        tcg_out32(s, arg2);
+        tci_out_ldst(s, TCI_ld64, ret, arg1, arg2);
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static void tcg_out_mov(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
+    TCIInsn *insn = tci_out_insn(s, TCI_mov);
+
     assert(ret != arg);
-#if TCG_TARGET_REG_BITS == 32
-    tcg_out_op_t(s, INDEX_op_mov_i32);
-#else
-    tcg_out_op_t(s, INDEX_op_mov_i64);
-#endif
-    tcg_out_r(s, ret);
-    tcg_out_r(s, arg);
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    insn->a[0] = tci_r(ret);
+    insn->a[1] = tci_r(arg);
 }
 
 static void tcg_out_movi(TCGContext *s, TCGType type,
                          TCGReg t0, tcg_target_long arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-    uint32_t arg32 = arg;
-    if (type == TCG_TYPE_I32 || arg == arg32) {
-        tcg_out_op_t(s, INDEX_op_movi_i32);
-        tcg_out_r(s, t0);
-        tcg_out32(s, arg32);
+    TCIInsn *insn = tci_out_insn(s, TCI_movi);
+
+    insn->a[0] = tci_r(t0);
+    if (type == TCG_TYPE_I32) {
+        insn->i = (uint32_t)arg;
     } else {
         assert(type == TCG_TYPE_I64);
-#if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_movi_i64);
-        tcg_out_r(s, t0);
-        tcg_out64(s, arg);
-#else
-        TODO();
-#endif
+        insn->i = arg;
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static inline void tcg_out_call(TCGContext *s, tcg_insn_unit *arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-    tcg_out_op_t(s, INDEX_op_call);
-    tcg_out_ri(s, 1, (uintptr_t)arg);
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    TCIInsn *insn = tci_out_insn(s, TCI_call);
+
+    insn->i = (uintptr_t)arg;
 }
 
 static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
                        const int *const_args)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-
-    tcg_out_op_t(s, opc);
+    TCIInsn *insn;
 
     switch (opc) {
     case INDEX_op_exit_tb:
-        tcg_out64(s, args[0]);
+        insn = tci_out_insn(s, TCI_exit_tb);
+        insn->i = args[0];
         break;
     case INDEX_op_goto_tb:
-        if (s->tb_jmp_offset) {
-            /* Direct jump method. */
-            assert(args[0] < ARRAY_SIZE(s->tb_jmp_offset));
-            s->tb_jmp_offset[args[0]] = tcg_current_code_size(s);
-            tcg_out32(s, 0);
-        } else {
-            /* Indirect jump method. */
-            TODO();
-        }
+        /* Direct jump method: tb_set_jmp_target1 patches the target,
+           initially the next instruction. */
+        assert(s->tb_jmp_offset);
+        assert(args[0] < ARRAY_SIZE(s->tb_jmp_offset));
+        insn = tci_out_insn(s, TCI_goto_tb);
+        insn->target = (uintptr_t)(insn + 1);
+        s->tb_jmp_offset[args[0]] = tcg_ptr_byte_diff(&insn->target,
+                                                      s->code_buf);
         assert(args[0] < ARRAY_SIZE(s->tb_next_offset));
         s->tb_next_offset[args[0]] = tcg_current_code_size(s);
         break;
     case INDEX_op_br:
-        tci_out_label(s, args[0]);
+        insn = tci_out_insn(s, TCI_br);
+        tci_out_label(s, insn, args[0]);
         break;
     case INDEX_op_setcond_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        tcg_out8(s, args[3]);   /* condition */
+        insn = tci_out_binop(s, TCI_setcond_i32, args, const_args);
+        insn->a[3] = args[3];           /* condition */
         break;
 #if TCG_TARGET_REG_BITS == 32
     case INDEX_op_setcond2_i32:
         /* setcond2_i32 cond, t0, t1_low, t1_high, t2_low, t2_high */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_ri32(s, const_args[3], args[3]);
-        tcg_out_ri32(s, const_args[4], args[4]);
-        tcg_out8(s, args[5]);   /* condition */
+        insn = tci_out_rrr(s, TCI_setcond2_i32, args, 5);
+        insn->a[5] = args[5];           /* condition */
         break;
 #elif TCG_TARGET_REG_BITS == 64
     case INDEX_op_setcond_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
-        tcg_out8(s, args[3]);   /* condition */
+        insn = tci_out_binop(s, TCI_setcond_i64, args, const_args);
+        insn->a[3] = args[3];           /* condition */
         break;
 #endif
     case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8u_i64:
+        tci_out_ldst(s, TCI_ld8u, args[0], args[1], args[2]);
+        break;
     case INDEX_op_ld8s_i32:
+        tci_out_ldst(s, TCI_ld8s_i32, args[0], args[1], args[2]);
+        break;
     case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16u_i64:
+        tci_out_ldst(s, TCI_ld16u, args[0], args[1], args[2]);
+        break;
     case INDEX_op_ld16s_i32:
+        tci_out_ldst(s, TCI_ld16s_i32, args[0], args[1], args[2]);
+        break;
     case INDEX_op_ld_i32:
-    case INDEX_op_st8_i32:
-    case INDEX_op_st16_i32:
-    case INDEX_op_st_i32:
-    case INDEX_op_ld8u_i64:
-    case INDEX_op_ld8s_i64:
-    case INDEX_op_ld16u_i64:
-    case INDEX_op_ld16s_i64:
     case INDEX_op_ld32u_i64:
-    case INDEX_op_ld32s_i64:
-    case INDEX_op_ld_i64:
+        tci_out_ldst(s, TCI_ld32u, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st8_i32:
     case INDEX_op_st8_i64:
+        tci_out_ldst(s, TCI_st8, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st16_i32:
     case INDEX_op_st16_i64:
+        tci_out_ldst(s, TCI_st16, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st_i32:
     case INDEX_op_st32_i64:
-    case INDEX_op_st_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        assert(args[2] == (int32_t)args[2]);
-        tcg_out32(s, args[2]);
+        tci_out_ldst(s, TCI_st32, args[0], args[1], args[2]);
         break;
     case INDEX_op_add_i32:
+        tci_out_binop(s, TCI_add_i32, args, const_args);
+        break;
     case INDEX_op_sub_i32:
+        tci_out_binop(s, TCI_sub_i32, args, const_args);
+        break;
     case INDEX_op_mul_i32:
+        tci_out_binop(s, TCI_mul_i32, args, const_args);
+        break;
     case INDEX_op_and_i32:
-    case INDEX_op_andc_i32:     /* Optional (TCG_TARGET_HAS_andc_i32). */
-    case INDEX_op_eqv_i32:      /* Optional (TCG_TARGET_HAS_eqv_i32). */
-    case INDEX_op_nand_i32:     /* Optional (TCG_TARGET_HAS_nand_i32). */
-    case INDEX_op_nor_i32:      /* Optional (TCG_TARGET_HAS_nor_i32). */
+        tci_out_binop(s, TCI_and_i32, args, const_args);
+        break;
     case INDEX_op_or_i32:
-    case INDEX_op_orc_i32:      /* Optional (TCG_TARGET_HAS_orc_i32). */
+        tci_out_binop(s, TCI_or_i32, args, const_args);
+        break;
     case INDEX_op_xor_i32:
+        tci_out_binop(s, TCI_xor_i32, args, const_args);
+        break;
     case INDEX_op_shl_i32:
+        tci_out_binop(s, TCI_shl_i32, args, const_args);
+        break;
     case INDEX_op_shr_i32:
+        tci_out_binop(s, TCI_shr_i32, args, const_args);
+        break;
     case INDEX_op_sar_i32:
+        tci_out_binop(s, TCI_sar_i32, args, const_args);
+        break;
     case INDEX_op_rotl_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
+        tci_out_binop(s, TCI_rotl_i32, args, const_args);
+        break;
     case INDEX_op_rotr_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tci_out_binop(s, TCI_rotr_i32, args, const_args);
         break;
     case INDEX_op_deposit_i32:  /* Optional (TCG_TARGET_HAS_deposit_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
+        insn = tci_out_rrr(s, TCI_deposit_i32, args, 3);
         assert(args[3] <= UINT8_MAX);
-        tcg_out8(s, args[3]);
+        insn->a[3] = args[3];
         assert(args[4] <= UINT8_MAX);
-        tcg_out8(s, args[4]);
+        insn->a[4] = args[4];
         break;
 
 #if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld8s_i64:
+        tci_out_ldst(s, TCI_ld8s_i64, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_ld16s_i64:
+        tci_out_ldst(s, TCI_ld16s_i64, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_ld32s_i64:
+        tci_out_ldst(s, TCI_ld32s_i64, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_ld_i64:
+        tci_out_ldst(s, TCI_ld64, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st_i64:
+        tci_out_ldst(s, TCI_st64, args[0], args[1], args[2]);
+        break;
     case INDEX_op_add_i64:
+        tci_out_binop(s, TCI_add_i64, args, const_args);
+        break;
     case INDEX_op_sub_i64:
+        tci_out_binop(s, TCI_sub_i64, args, const_args);
+        break;
     case INDEX_op_mul_i64:
+        tci_out_binop(s, TCI_mul_i64, args, const_args);
+        break;
     case INDEX_op_and_i64:
-    case INDEX_op_andc_i64:     /* Optional (TCG_TARGET_HAS_andc_i64). */
-    case INDEX_op_eqv_i64:      /* Optional (TCG_TARGET_HAS_eqv_i64). */
-    case INDEX_op_nand_i64:     /* Optional (TCG_TARGET_HAS_nand_i64). */
-    case INDEX_op_nor_i64:      /* Optional (TCG_TARGET_HAS_nor_i64). */
+        tci_out_binop(s, TCI_and_i64, args, const_args);
+        break;
     case INDEX_op_or_i64:
-    case INDEX_op_orc_i64:      /* Optional (TCG_TARGET_HAS_orc_i64). */
+        tci_out_binop(s, TCI_or_i64, args, const_args);
+        break;
     case INDEX_op_xor_i64:
+        tci_out_binop(s, TCI_xor_i64, args, const_args);
+        break;
     case INDEX_op_shl_i64:
+        tci_out_binop(s, TCI_shl_i64, args, const_args);
+        break;
     case INDEX_op_shr_i64:
+        tci_out_binop(s, TCI_shr_i64, args, const_args);
+        break;
     case INDEX_op_sar_i64:
+        tci_out_binop(s, TCI_sar_i64, args, const_args);
+        break;
     case INDEX_op_rotl_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
+        tci_out_binop(s, TCI_rotl_i64, args, const_args);
+        break;
     case INDEX_op_rotr_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
+        tci_out_binop(s, TCI_rotr_i64, args, const_args);
         break;
     case INDEX_op_deposit_i64:  /* Optional (TCG_TARGET_HAS_deposit_i64). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
+        insn = tci_out_rrr(s, TCI_deposit_i64, args, 3);
         assert(args[3] <= UINT8_MAX);
-        tcg_out8(s, args[3]);
+        insn->a[3] = args[3];
         assert(args[4] <= UINT8_MAX);
-        tcg_out8(s, args[4]);
+        insn->a[4] = args[4];
         break;
     case INDEX_op_div_i64:      /* Optional (TCG_TARGET_HAS_div_i64). */
     case INDEX_op_divu_i64:     /* Optional (TCG_TARGET_HAS_div_i64). */
@@ -686,41 +746,85 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         TODO();
         break;
     case INDEX_op_brcond_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out8(s, args[2]);           /* condition */
-        tci_out_label(s, args[3]);
+        insn = tci_out_insn(s, TCI_brcond_i64 + (const_args[1] != 0));
+        insn->a[0] = tci_r(args[0]);
+        if (const_args[1]) {
+            insn->i = args[1];
+        } else {
+            insn->a[1] = tci_r(args[1]);
+        }
+        insn->a[2] = args[2];           /* condition */
+        tci_out_label(s, insn, args[3]);
         break;
     case INDEX_op_bswap16_i64:  /* Optional (TCG_TARGET_HAS_bswap16_i64). */
+        tci_out_rrr(s, TCI_bswap16, args, 2);
+        break;
     case INDEX_op_bswap32_i64:  /* Optional (TCG_TARGET_HAS_bswap32_i64). */
+        tci_out_rrr(s, TCI_bswap32, args, 2);
+        break;
     case INDEX_op_bswap64_i64:  /* Optional (TCG_TARGET_HAS_bswap64_i64). */
+        tci_out_rrr(s, TCI_bswap64, args, 2);
+        break;
     case INDEX_op_not_i64:      /* Optional (TCG_TARGET_HAS_not_i64). */
+        tci_out_rrr(s, TCI_not_i64, args, 2);
+        break;
     case INDEX_op_neg_i64:      /* Optional (TCG_TARGET_HAS_neg_i64). */
+        tci_out_rrr(s, TCI_neg_i64, args, 2);
+        break;
     case INDEX_op_ext8s_i64:    /* Optional (TCG_TARGET_HAS_ext8s_i64). */
+        tci_out_rrr(s, TCI_ext8s_i64, args, 2);
+        break;
     case INDEX_op_ext8u_i64:    /* Optional (TCG_TARGET_HAS_ext8u_i64). */
+        tci_out_rrr(s, TCI_ext8u, args, 2);
+        break;
     case INDEX_op_ext16s_i64:   /* Optional (TCG_TARGET_HAS_ext16s_i64). */
+        tci_out_rrr(s, TCI_ext16s_i64, args, 2);
+        break;
     case INDEX_op_ext16u_i64:   /* Optional (TCG_TARGET_HAS_ext16u_i64). */
+        tci_out_rrr(s, TCI_ext16u, args, 2);
+        break;
     case INDEX_op_ext32s_i64:   /* Optional (TCG_TARGET_HAS_ext32s_i64). */
+        tci_out_rrr(s, TCI_ext32s_i64, args, 2);
+        break;
     case INDEX_op_ext32u_i64:   /* Optional (TCG_TARGET_HAS_ext32u_i64). */
+        tci_out_rrr(s, TCI_ext32u_i64, args, 2);
+        break;
 #endif /* TCG_TARGET_REG_BITS == 64 */
     case INDEX_op_neg_i32:      /* Optional (TCG_TARGET_HAS_neg_i32). */
+        tci_out_rrr(s, TCI_neg_i32, args, 2);
+        break;
     case INDEX_op_not_i32:      /* Optional (TCG_TARGET_HAS_not_i32). */
+        tci_out_rrr(s, TCI_not_i32, args, 2);
+        break;
     case INDEX_op_ext8s_i32:    /* Optional (TCG_TARGET_HAS_ext8s_i32). */
+        tci_out_rrr(s, TCI_ext8s_i32, args, 2);
+        break;
     case INDEX_op_ext16s_i32:   /* Optional (TCG_TARGET_HAS_ext16s_i32). */
+        tci_out_rrr(s, TCI_ext16s_i32, args, 2);
+        break;
     case INDEX_op_ext8u_i32:    /* Optional (TCG_TARGET_HAS_ext8u_i32). */
+        tci_out_rrr(s, TCI_ext8u, args, 2);
+        break;
     case INDEX_op_ext16u_i32:   /* Optional (TCG_TARGET_HAS_ext16u_i32). */
+        tci_out_rrr(s, TCI_ext16u, args, 2);
+        break;
     case INDEX_op_bswap16_i32:  /* Optional (TCG_TARGET_HAS_bswap16_i32). */
+        tci_out_rrr(s, TCI_bswap16, args, 2);
+        break;
     case INDEX_op_bswap32_i32:  /* Optional (TCG_TARGET_HAS_bswap32_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
+        tci_out_rrr(s, TCI_bswap32, args, 2);
         break;
     case INDEX_op_div_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
+        tci_out_rrr(s, TCI_div_i32, args, 3);
+        break;
     case INDEX_op_divu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
+        tci_out_rrr(s, TCI_divu_i32, args, 3);
+        break;
     case INDEX_op_rem_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
+        tci_out_rrr(s, TCI_rem_i32, args, 3);
+        break;
     case INDEX_op_remu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tci_out_rrr(s, TCI_remu_i32, args, 3);
         break;
     case INDEX_op_div2_i32:     /* Optional (TCG_TARGET_HAS_div2_i32). */
     case INDEX_op_divu2_i32:    /* Optional (TCG_TARGET_HAS_div2_i32). */
@@ -728,84 +832,42 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         break;
 #if TCG_TARGET_REG_BITS == 32
     case INDEX_op_add2_i32:
+        tci_out_rrr(s, TCI_add2_i32, args, 6);
+        break;
     case INDEX_op_sub2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_r(s, args[3]);
-        tcg_out_r(s, args[4]);
-        tcg_out_r(s, args[5]);
+        tci_out_rrr(s, TCI_sub2_i32, args, 6);
         break;
     case INDEX_op_brcond2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        tcg_out_ri32(s, const_args[3], args[3]);
-        tcg_out8(s, args[4]);           /* condition */
-        tci_out_label(s, args[5]);
+        insn = tci_out_rrr(s, TCI_brcond2_i32, args, 4);
+        insn->a[4] = args[4];           /* condition */
+        tci_out_label(s, insn, args[5]);
         break;
     case INDEX_op_mulu2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_r(s, args[3]);
+        tci_out_rrr(s, TCI_mulu2_i32, args, 4);
         break;
 #endif
     case INDEX_op_brcond_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out8(s, args[2]);           /* condition */
-        tci_out_label(s, args[3]);
+        insn = tci_out_insn(s, TCI_brcond_i32 + (const_args[1] != 0));
+        insn->a[0] = tci_r(args[0]);
+        if (const_args[1]) {
+            insn->i = args[1];
+        } else {
+            insn->a[1] = tci_r(args[1]);
+        }
+        insn->a[2] = args[2];           /* condition */
+        tci_out_label(s, insn, args[3]);
         break;
     case INDEX_op_qemu_ld_i32:
-        tcg_out_r(s, *args++);
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-#ifdef CONFIG_SOFTMMU
-        tcg_out_i(s, *args);
-#endif
+        tci_out_qemu_ldst(s, TCI_qemu_ld_i32, args, false);
         break;
     case INDEX_op_qemu_ld_i64:
-        tcg_out_r(s, *args++);
-        if (TCG_TARGET_REG_BITS == 32) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-#ifdef CONFIG_SOFTMMU
-        tcg_out_i(s, *args);
-#endif
+        tci_out_qemu_ldst(s, TCI_qemu_ld_i64, args, true);
         break;
     case INDEX_op_qemu_st_i32:
-        tcg_out_r(s, *args++);
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-#ifdef CONFIG_SOFTMMU
-        tcg_out_i(s, *args);
-#endif
+        tci_out_qemu_ldst(s, TCI_qemu_st_i32, args, false);
         break;
     case INDEX_op_qemu_st_i64:
-        tcg_out_r(s, *args++);
-        if (TCG_TARGET_REG_BITS == 32) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-#ifdef CONFIG_SOFTMMU
-        tcg_out_i(s, *args);
-#endif
+        tci_out_qemu_ldst(s, TCI_qemu_st_i64, args, true);
         break;
     case INDEX_op_mov_i32:  /* Always emitted via tcg_out_mov.  */
     case INDEX_op_mov_i64:
@@ -815,30 +877,21 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     default:
         tcg_abort();
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg, TCGReg arg1,
                        intptr_t arg2)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
     if (type == TCG_TYPE_I32) {
-        tcg_out_op_t(s, INDEX_op_st_i32);
-        tcg_out_r(s, arg);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
+        tci_out_ldst(s, TCI_st32, arg, arg1, arg2);
     } else {
         assert(type == TCG_TYPE_I64);
 #if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_st_i64);
-        tcg_out_r(s, arg);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
+        tci_out_ldst(s, TCI_st64, arg, arg1, arg2);
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 /* Test if a constant matches the constraint. */
@@ -858,8 +911,11 @@ static void tcg_target_init(TCGContext *s)
     }
 #endif
 
-    /* The current code uses uint8_t for tcg operations. */
-    assert(ARRAY_SIZE(tcg_op_defs) <= UINT8_MAX);
+    /* TCIInsn uses uint8_t for the opcodes of the interpreter. */
+    QEMU_BUILD_BUG_ON(TCI_NB_OPS > UINT8_MAX);
+
+    /* Let the interpreter fill tci_handlers. */
+    tcg_qemu_tb_exec(NULL, NULL);
 
     /* Registers available for 32 bit operations. */
     tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0,
@@ -162,8 +162,6 @@ typedef enum {
     TCG_REG_R31,
 #endif
 #endif
-    /* Special value UINT8_MAX is used by TCI to encode constant values. */
-    TCG_CONST = UINT8_MAX
 } TCGReg;
 
 #define TCG_AREG0                       (TCG_TARGET_NB_REGS - 2)
@@ -173,6 +171,83 @@ typedef enum {
 #define TCG_TARGET_CALL_STACK_OFFSET    0
 #define TCG_TARGET_STACK_ALIGN          16
 
+/* The softmmu TLB is indexed with env->tlb_mask.  */
+#define TCG_TARGET_DYNAMIC_TLB 1
+
+/* The instructions of the interpreter.  Each TCG opcode maps to one of
+   them, and the operations whose last input may be a constant have two of
+   them: add_i32 adds two registers, addi_i32 a register and a constant.
+   The 32 bit operations zero-extend their result on 64 bit hosts.
+
+   The fused instructions execute their own operation, then the
+   instruction that follows them, with a single dispatch: the backend
+   turns a ld32u (resp. ld64) followed by an add into a ld_add, and a
+   setcond followed by a brcondi into a setcond_brcondi.  The second
+   instruction is left as it is, so that it can still be reached by a
+   branch.  */
+#define TCI_OPS_COMMON(X) \
+    X(exit_tb) X(goto_tb) X(br) X(call) \
+    X(mov) X(movi) \
+    X(ld8u) X(ld8s_i32) X(ld16u) X(ld16s_i32) X(ld32u) \
+    X(st8) X(st16) X(st32) \
+    X(add_i32) X(addi_i32) X(sub_i32) X(subi_i32) \
+    X(mul_i32) X(muli_i32) X(and_i32) X(andi_i32) \
+    X(or_i32) X(ori_i32) X(xor_i32) X(xori_i32) \
+    X(shl_i32) X(shli_i32) X(shr_i32) X(shri_i32) \
+    X(sar_i32) X(sari_i32) X(rotl_i32) X(rotli_i32) \
+    X(rotr_i32) X(rotri_i32) \
+    X(div_i32) X(divu_i32) X(rem_i32) X(remu_i32) \
+    X(deposit_i32) X(ext8s_i32) X(ext16s_i32) X(ext8u) X(ext16u) \
+    X(bswap16) X(bswap32) X(not_i32) X(neg_i32) \
+    X(setcond_i32) X(setcondi_i32) X(brcond_i32) X(brcondi_i32) \
+    X(qemu_ld_i32) X(qemu_ld_i64) X(qemu_st_i32) X(qemu_st_i64) \
+    X(ld_add_i32) X(ld_addi_i32) \
+    X(setcond_brcondi_i32) X(setcondi_brcondi_i32)
+
+#if TCG_TARGET_REG_BITS == 64
+#define TCI_OPS_HOST(X) \
+    X(ld8s_i64) X(ld16s_i64) X(ld32s_i64) X(ld64) X(st64) \
+    X(add_i64) X(addi_i64) X(sub_i64) X(subi_i64) \
+    X(mul_i64) X(muli_i64) X(and_i64) X(andi_i64) \
+    X(or_i64) X(ori_i64) X(xor_i64) X(xori_i64) \
+    X(shl_i64) X(shli_i64) X(shr_i64) X(shri_i64) \
+    X(sar_i64) X(sari_i64) X(rotl_i64) X(rotli_i64) \
+    X(rotr_i64) X(rotri_i64) \
+    X(deposit_i64) X(ext8s_i64) X(ext16s_i64) X(ext32s_i64) X(ext32u_i64) \
+    X(bswap64) X(not_i64) X(neg_i64) \
+    X(setcond_i64) X(setcondi_i64) X(brcond_i64) X(brcondi_i64) \
+    X(ld_add_i64) X(ld_addi_i64) \
+    X(setcond_brcondi_i64) X(setcondi_brcondi_i64)
+#else
+#define TCI_OPS_HOST(X) \
+    X(add2_i32) X(sub2_i32) X(mulu2_i32) X(brcond2_i32) X(setcond2_i32)
+#endif
+
+#define TCI_OPS(X) TCI_OPS_COMMON(X) TCI_OPS_HOST(X)
+
+typedef enum {
+#define TCI_OPC(name) TCI_##name,
+    TCI_OPS(TCI_OPC)
+#undef TCI_OPC
+    TCI_NB_OPS
+} TCIOpcode;
+
+/* An instruction of the interpreter, emitted by tcg-target.c and run by
+   tci.c.  All the instructions have the same size and are decoded by the
+   backend, so that the interpreter jumps from the handler of one to the
+   handler of the next (direct threading) and finds their operands at
+   fixed places.  */
+typedef struct TCIInsn {
+    const void *handler;        /* code of the interpreter for "opc" */
+    uint8_t opc;                /* TCIOpcode */
+    uint8_t a[7];               /* registers, then condition, memop, ... */
+    uintptr_t i;                /* constant, offset, helper, mmu_idx */
+    uintptr_t target;           /* TCIInsn of a branch, patched by goto_tb */
+} TCIInsn;
+
+/* The handler of each TCIOpcode, set by tcg_qemu_tb_exec(NULL, NULL).  */
+extern const void *const *tci_handlers;
+
 void tci_disas(uint8_t opc);
 
 uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr);
@@ -0,0 +1,74 @@
+/*
+ * Call-heavy guest workload, used to measure the cost of the indirect
+ * branches: returns, calls through function pointers and jump tables
+ * (see the "speed-indirect-branch" target).
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define NB_PASSES  2000
+
+typedef uint32_t (*op_fn)(uint32_t, uint32_t);
+
+static uint32_t op_add(uint32_t a, uint32_t b) { return a + b; }
+static uint32_t op_sub(uint32_t a, uint32_t b) { return a - b; }
+static uint32_t op_xor(uint32_t a, uint32_t b) { return a ^ b; }
+static uint32_t op_rol(uint32_t a, uint32_t b) { return (a << 5) | (a >> 27); }
+
+/* Volatile, so that the compiler keeps the calls indirect.  */
+static op_fn volatile ops[4] = { op_add, op_sub, op_xor, op_rol };
+
+/* One return per call, from many call sites.  */
+static uint32_t __attribute__((noinline)) fib(uint32_t n)
+{
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+/* A small interpreter, dispatching through a jump table.  */
+static uint32_t __attribute__((noinline)) interp(const uint8_t *code,
+                                                 int len, uint32_t acc)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        switch (code[i]) {
+        case 0: acc += 7; break;
+        case 1: acc *= 3; break;
+        case 2: acc ^= acc >> 7; break;
+        case 3: acc -= i; break;
+        case 4: acc = ops[acc & 3](acc, i); break;
+        case 5: acc |= 1; break;
+        case 6: acc = (acc << 1) | (acc >> 31); break;
+        default: acc = ~acc; break;
+        }
+    }
+    return acc;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t code[4096];
+    uint32_t sum = 0;
+    uint32_t seed = 1;
+    int pass, i;
+
+    for (i = 0; i < sizeof(code); i++) {
+        seed = seed * 1103515245 + 12345;
+        code[i] = (seed >> 16) & 7;
+    }
+
+    for (pass = 0; pass < NB_PASSES; pass++) {
+        sum += fib(20);
+        sum = interp(code, sizeof(code), sum);
+        for (i = 0; i < 1000; i++) {
+            sum = ops[i & 3](sum, i);
+        }
+    }
+
+    printf("callbench: %08x\n", sum);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Floating-point heavy guest workload, used to measure the host FPU fast
+ * path of softfloat (see the "speed-softfloat" target).  The results are
+ * printed bit for bit, to be compared with a native run.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define NB_BODIES  5
+#define NB_STEPS   2000000
+#define MAT_SIZE   64
+#define NB_MATMUL  40
+
+struct body {
+    double x, y, z, vx, vy, vz, mass;
+};
+
+/* The Sun and the outer planets: positions in AU, velocities in AU per
+   year and masses in units where G is 1.  */
+#define SOLAR_MASS      (4 * M_PI * M_PI)
+#define DAYS_PER_YEAR   365.24
+
+static struct body bodies[NB_BODIES] = {
+    { 0, 0, 0, 0, 0, 0, SOLAR_MASS },
+    { 4.84143144246472090e+00, -1.16032004402742839e+00,
+      -1.03622044471123109e-01, 1.66007664274403694e-03 * DAYS_PER_YEAR,
+      7.69901118419740425e-03 * DAYS_PER_YEAR,
+      -6.90460016972063023e-05 * DAYS_PER_YEAR,
+      9.54791938424326609e-04 * SOLAR_MASS },
+    { 8.34336671824457987e+00, 4.12479856412430479e+00,
+      -4.03523417114321381e-01, -2.76742510726862411e-03 * DAYS_PER_YEAR,
+      4.99852801234917238e-03 * DAYS_PER_YEAR,
+      2.30417297573763929e-05 * DAYS_PER_YEAR,
+      2.85885980666130812e-04 * SOLAR_MASS },
+    { 1.28943695621391310e+01, -1.51111514016986312e+01,
+      -2.23307578892655734e-01, 2.96460137564761618e-03 * DAYS_PER_YEAR,
+      2.37847173959480950e-03 * DAYS_PER_YEAR,
+      -2.96589568540237556e-05 * DAYS_PER_YEAR,
+      4.36624404335156298e-05 * SOLAR_MASS },
+    { 1.53796971148509165e+01, -2.59193146099879641e+01,
+      1.79258772950371181e-01, 2.68067772490389322e-03 * DAYS_PER_YEAR,
+      1.62824170038242295e-03 * DAYS_PER_YEAR,
+      -9.51592254519715870e-05 * DAYS_PER_YEAR,
+      5.15138902046611451e-05 * SOLAR_MASS },
+};
+
+static void advance(double dt)
+{
+    int i, j;
+
+    for (i = 0; i < NB_BODIES; i++) {
+        struct body *a = &bodies[i];
+
+        for (j = i + 1; j < NB_BODIES; j++) {
+            struct body *b = &bodies[j];
+            double dx = a->x - b->x, dy = a->y - b->y, dz = a->z - b->z;
+            double d2 = dx * dx + dy * dy + dz * dz;
+            double mag = dt / (d2 * sqrt(d2));
+
+            a->vx -= dx * b->mass * mag;
+            a->vy -= dy * b->mass * mag;
+            a->vz -= dz * b->mass * mag;
+            b->vx += dx * a->mass * mag;
+            b->vy += dy * a->mass * mag;
+            b->vz += dz * a->mass * mag;
+        }
+    }
+    for (i = 0; i < NB_BODIES; i++) {
+        bodies[i].x += dt * bodies[i].vx;
+        bodies[i].y += dt * bodies[i].vy;
+        bodies[i].z += dt * bodies[i].vz;
+    }
+}
+
+static float ma[MAT_SIZE][MAT_SIZE], mb[MAT_SIZE][MAT_SIZE];
+static float mc[MAT_SIZE][MAT_SIZE];
+
+static void matmul(void)
+{
+    int i, j, k;
+
+    for (i = 0; i < MAT_SIZE; i++) {
+        for (j = 0; j < MAT_SIZE; j++) {
+            float sum = 0;
+
+            for (k = 0; k < MAT_SIZE; k++) {
+                sum += ma[i][k] * mb[k][j];
+            }
+            mc[i][j] = sum / MAT_SIZE;
+        }
+    }
+    memcpy(ma, mc, sizeof(ma));
+}
+
+static uint64_t double_bits(double d)
+{
+    uint64_t u;
+
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static uint32_t float_bits(float f)
+{
+    uint32_t u;
+
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t fsum = 0;
+    int i, j;
+
+    for (i = 0; i < NB_STEPS; i++) {
+        advance(0.01);
+    }
+    for (i = 0; i < NB_BODIES; i++) {
+        printf("body %d: %016llx %016llx %016llx\n", i,
+               (unsigned long long)double_bits(bodies[i].x),
+               (unsigned long long)double_bits(bodies[i].y),
+               (unsigned long long)double_bits(bodies[i].z));
+    }
+
+    for (i = 0; i < MAT_SIZE; i++) {
+        for (j = 0; j < MAT_SIZE; j++) {
+            ma[i][j] = (float)(i + 1) / (j + 3);
+            mb[i][j] = sqrtf((float)(i * j + 1)) / MAT_SIZE;
+        }
+    }
+    for (i = 0; i < NB_MATMUL; i++) {
+        matmul();
+    }
+    for (i = 0; i < MAT_SIZE; i++) {
+        for (j = 0; j < MAT_SIZE; j++) {
+            fsum = fsum * 31 + float_bits(ma[i][j]);
+        }
+    }
+    printf("matrix: %08x\n", fsum);
+    return 0;
+}
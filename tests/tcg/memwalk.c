@@ -0,0 +1,46 @@
+/*
+ * Memory-heavy guest workload, used to measure the cost of
+ * load/store instrumentation (see the "speed-tcg-plugin-mem" target).
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define BUF_SIZE   (4 * 1024 * 1024)
+#define NB_PASSES  64
+
+int main(int argc, char **argv)
+{
+    uint32_t *buf = malloc(BUF_SIZE);
+    size_t nb_words = BUF_SIZE / sizeof(uint32_t);
+    uint32_t sum = 0;
+    size_t i;
+    int pass;
+
+    if (!buf) {
+        return 1;
+    }
+
+    for (i = 0; i < nb_words; i++) {
+        buf[i] = i;
+    }
+
+    for (pass = 0; pass < NB_PASSES; pass++) {
+        /* Sequential read-modify-write...  */
+        for (i = 0; i < nb_words; i++) {
+            buf[i] = buf[i] * 3 + pass;
+        }
+        /* ... then a page-crossing strided walk.  */
+        for (i = 0; i < nb_words; i += 1031) {
+            sum += buf[i] ^ ((uint8_t *)buf)[i];
+        }
+    }
+
+    printf("memwalk: %08x\n", sum);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * QHT tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "qemu/qht.h"
+
+#define N 5000
+
+static int values[N];
+
+static bool is_equal(const void *obj, const void *userp)
+{
+    return *(const int *)obj == *(const int *)userp;
+}
+
+static uint32_t hash_of(int i)
+{
+    return i * 2654435761u;
+}
+
+static void check(QHT *ht, int first, int last, int step, bool present)
+{
+    int i;
+
+    for (i = first; i < last; i += step) {
+        void *p = qht_lookup(ht, is_equal, &values[i], hash_of(i));
+
+        g_assert(p == (present ? &values[i] : NULL));
+    }
+}
+
+static void test_insert_remove(void)
+{
+    QHT ht;
+    QHTStats stats;
+    int i;
+
+    qht_init(&ht, 8, QHT_MODE_AUTO_RESIZE);
+
+    for (i = 0; i < N; i++) {
+        g_assert(qht_insert(&ht, &values[i], hash_of(i)));
+    }
+    g_assert(!qht_insert(&ht, &values[0], hash_of(0)));
+    check(&ht, 0, N, 1, true);
+
+    for (i = 0; i < N; i += 2) {
+        g_assert(qht_remove(&ht, &values[i], hash_of(i)));
+    }
+    g_assert(!qht_remove(&ht, &values[0], hash_of(0)));
+    check(&ht, 0, N, 2, false);
+    check(&ht, 1, N, 2, true);
+
+    qht_statistics(&ht, &stats);
+    g_assert_cmpint(stats.entries, ==, N / 2);
+    /* the table grew from 2 buckets */
+    g_assert_cmpint(stats.head_buckets, >, 2);
+
+    qht_reset(&ht);
+    check(&ht, 0, N, 1, false);
+    qht_statistics(&ht, &stats);
+    g_assert_cmpint(stats.entries, ==, 0);
+
+    qht_destroy(&ht);
+}
+
+/* All the entries in the same chain of buckets.  */
+static void test_collisions(void)
+{
+    QHT ht;
+    QHTStats stats;
+    int i;
+
+    qht_init(&ht, 16, 0);
+
+    for (i = 0; i < 100; i++) {
+        g_assert(qht_insert(&ht, &values[i], 42));
+    }
+    for (i = 0; i < 100; i += 3) {
+        g_assert(qht_remove(&ht, &values[i], 42));
+    }
+    for (i = 0; i < 100; i++) {
+        void *p = qht_lookup(&ht, is_equal, &values[i], 42);
+
+        g_assert(p == (i % 3 ? &values[i] : NULL));
+    }
+
+    qht_statistics(&ht, &stats);
+    g_assert_cmpint(stats.used_head_buckets, ==, 1);
+    g_assert_cmpint(stats.max_chain, >=, 66 / 4);
+
+    g_assert(qht_resize(&ht, 1024));
+    g_assert(!qht_resize(&ht, 1024));
+    for (i = 1; i < 100; i += 3) {
+        g_assert(qht_lookup(&ht, is_equal, &values[i], 42) == &values[i]);
+    }
+
+    qht_destroy(&ht);
+}
+
+static void count_entries(QHT *ht, void *p, uint32_t hash, void *userp)
+{
+    int *count = userp;
+
+    g_assert_cmpint(hash, ==, hash_of(*(int *)p));
+    (*count)++;
+}
+
+static void test_iter(void)
+{
+    QHT ht;
+    int count = 0;
+    int i;
+
+    qht_init(&ht, N, QHT_MODE_AUTO_RESIZE);
+    for (i = 0; i < N; i += 5) {
+        qht_insert(&ht, &values[i], hash_of(i));
+    }
+    qht_iter(&ht, count_entries, &count);
+    g_assert_cmpint(count, ==, N / 5);
+    qht_destroy(&ht);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < N; i++) {
+        values[i] = i;
+    }
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/qht/insert-remove", test_insert_remove);
+    g_test_add_func("/qht/collisions", test_collisions);
+    g_test_add_func("/qht/iter", test_iter);
+    return g_test_run();
+}
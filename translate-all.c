@@ -59,7 +59,13 @@
 #include "exec/cputlb.h"
 #include "translate-all.h"
 #include "qemu/timer.h"
+#include "qemu/tls.h"
 #include "tcg-plugin.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "qemu/main-loop.h"
+#include "sysemu/cpus.h"
+#include "exec/translate-cache.h"
+#endif
 
 //#define DEBUG_TB_INVALIDATE
 //#define DEBUG_FLUSH
@@ -129,6 +135,8 @@ TCGContext tcg_ctx;
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2);
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
+static void tb_phys_invalidate_1(TranslationBlock *tb,
+                                 tb_page_addr_t page_addr);
 
 void cpu_gen_init(void)
 {
@@ -262,13 +270,26 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
 bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
 {
     TranslationBlock *tb;
+    bool found = false;
+#if !defined(CONFIG_USER_ONLY)
+    /* the retranslation may fill the TLB, which needs the iothread
+       lock: it must be taken before tb_lock */
+    bool iothread_locked = qemu_tcg_lock_iothread();
+#endif
 
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (tb) {
         cpu_restore_state_from_tb(cpu, tb, retaddr);
-        return true;
+        found = true;
+    }
+    tb_unlock();
+#if !defined(CONFIG_USER_ONLY)
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
     }
-    return false;
+#endif
+    return found;
 }
 
 #ifdef _WIN32
@@ -683,6 +704,50 @@ static inline void code_gen_alloc(size_t tb_size)
             g_malloc(tcg_ctx.code_gen_max_blocks * sizeof(TranslationBlock));
 }
 
+/* Split the translation buffer and the TB array between the regions.
+   A region must have room for many TBs or it would be evicted too
+   often, so small buffers get fewer regions, down to a single one in
+   which case tb_flush() is used as before.  */
+static void tb_regions_init(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t headroom = TCG_MAX_OP_SIZE * OPC_BUF_SIZE;
+    size_t region_size;
+    int max_tbs;
+    int i, n;
+
+    n = TB_MAX_REGIONS;
+    while (n > 1 && tcg_ctx.code_gen_buffer_size / n < 4 * headroom) {
+        n /= 2;
+    }
+    region_size = (tcg_ctx.code_gen_buffer_size / n) & ~(CODE_GEN_ALIGN - 1);
+    max_tbs = tcg_ctx.code_gen_max_blocks / n;
+
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &ctx->regions[i];
+
+        r->code_start = tcg_ctx.code_gen_buffer + i * region_size;
+        r->code_end = r->code_start;
+        r->code_max = r->code_start + region_size - headroom;
+        r->first_tb = i * max_tbs;
+        r->nb_tbs = 0;
+        r->max_tbs = max_tbs;
+    }
+    /* The rounding leftovers go to the last region.  */
+    ctx->regions[n - 1].code_max = tcg_ctx.code_gen_buffer +
+        tcg_ctx.code_gen_buffer_max_size;
+    ctx->regions[n - 1].max_tbs = tcg_ctx.code_gen_max_blocks -
+        (n - 1) * max_tbs;
+
+    ctx->nb_regions = n;
+    ctx->current_region = 0;
+}
+
+#if !defined(CONFIG_USER_ONLY)
+/* See tb_lock().  */
+static QemuMutex tb_mutex;
+#endif
+
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
    (in bytes) allocated to the translation buffer. Zero means default
    size. */
@@ -690,7 +755,13 @@ void tcg_exec_init(unsigned long tb_size)
 {
     cpu_gen_init();
     code_gen_alloc(tb_size);
+    tb_regions_init();
+    qht_init(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE,
+             QHT_MODE_AUTO_RESIZE);
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+#if !defined(CONFIG_USER_ONLY)
+    qemu_mutex_init(&tb_mutex);
+#endif
     tcg_register_jit(tcg_ctx.code_gen_buffer, tcg_ctx.code_gen_buffer_size);
     page_init();
 #if !defined(CONFIG_USER_ONLY) || !defined(CONFIG_USE_GUEST_BASE)
@@ -705,20 +776,191 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* Set by -tcg-threads multi, before the vCPU threads are created: each
+   vCPU then runs in its own host thread, see docs/multi-thread-tcg.txt.  */
+bool parallel_cpus;
+
+/* Set by -tb-hot: a TB run this many times from cpu_exec is translated
+   again as a superblock, see tb_trace_branch().  Until then, it is
+   neither chained to nor reached by goto_ptr, so that all its runs and
+   exits are counted.  0 disables superblocks.  */
+unsigned int tb_hot_threshold;
+
+void tb_hot_init(unsigned int threshold)
+{
+    if (!tcg_enabled()) {
+        fprintf(stderr, "-tb-hot needs the TCG accelerator\n");
+        exit(1);
+    }
+    /* A superblock is left early by its side exits, after the whole of
+       its instructions was counted at its start.  */
+    if (use_icount) {
+        fprintf(stderr, "-tb-hot is not compatible with -icount\n");
+        exit(1);
+    }
+    /* The plugins expect the TBs that they see translated.  */
+    if (tcg_plugin_enabled()) {
+        fprintf(stderr, "-tb-hot is not supported with TCG plugins\n");
+        exit(1);
+    }
+#ifndef TARGET_HAS_SUPERBLOCKS
+    fprintf(stderr, "-tb-hot is not supported for this guest\n");
+    exit(1);
+#else
+    tb_hot_threshold = threshold;
+#endif
+}
+
+/* tb_lock protects the TBs, the writers of the physical hash table, the
+ * page descriptors and the translation buffer from the other vCPU
+ * threads.  It is recursive, so that the invalidation functions can take
+ * it whether or not their caller already holds it, and it is only taken
+ * when the vCPUs run in parallel: always in user mode, with
+ * -tcg-threads multi in system mode.
+ */
+static DEFINE_TLS(int, tb_lock_depth);
+
+void tb_lock(void)
+{
+    if (tls_var(tb_lock_depth)++ > 0) {
+        return;
+    }
+#if defined(CONFIG_USER_ONLY)
+    spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+#else
+    if (parallel_cpus) {
+        qemu_mutex_lock(&tb_mutex);
+    }
+#endif
+}
+
+void tb_unlock(void)
+{
+    assert(tls_var(tb_lock_depth) > 0);
+    if (--tls_var(tb_lock_depth) > 0) {
+        return;
+    }
+#if defined(CONFIG_USER_ONLY)
+    spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+#else
+    if (parallel_cpus) {
+        qemu_mutex_unlock(&tb_mutex);
+    }
+#endif
+}
+
+/* Release tb_lock if this thread holds it, after a longjmp to cpu_exec.  */
+void tb_lock_reset(void)
+{
+    if (tls_var(tb_lock_depth) > 0) {
+        tls_var(tb_lock_depth) = 1;
+        tb_unlock();
+    }
+}
+
+#if !defined(CONFIG_USER_ONLY)
+/* Makes the atomic sequences of the guests (x86 lock prefix, ARM store
+   exclusive) atomic when the vCPU threads run in parallel: the sequence
+   runs in an exclusive section, so that neither the sequences nor the
+   plain stores of the other vCPUs can interleave with it.  Called by
+   the helper at the start of the instruction, "retaddr" being the
+   return address of the helper: the instruction is executed again
+   once the exclusive section of another thread is over.  */
+static DEFINE_TLS(bool, have_atomic_lock);
+
+void tcg_atomic_lock(uintptr_t retaddr)
+{
+    CPUState *cpu = current_cpu;
+
+    if (!parallel_cpus) {
+        return;
+    }
+
+    if (!qemu_tcg_cpu_start_exclusive(cpu)) {
+        cpu_restore_state(cpu, retaddr);
+        cpu_loop_exit(cpu);
+    }
+    tls_var(have_atomic_lock) = true;
+}
+
+/* Also called after a longjmp to cpu_exec, the section may not be
+   held.  */
+void tcg_atomic_unlock(void)
+{
+    if (tls_var(have_atomic_lock)) {
+        tls_var(have_atomic_lock) = false;
+        qemu_tcg_cpu_end_exclusive(current_cpu);
+    }
+}
+#endif
+
+/* Drop all the TBs of region "i": they are unlinked from the physical
+   hash table, the page lists, the jump caches and the TBs jumping to
+   them, the TBs of the other regions are kept.  */
+static void tb_region_evict(int i)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &ctx->regions[i];
+    int j;
+
+    for (j = 0; j < r->nb_tbs; j++) {
+        TranslationBlock *tb = &ctx->tbs[r->first_tb + j];
+
+        tb_phys_invalidate_1(tb, -1);
+        tcgplugin_tb_free(tb);
+    }
+
+    ctx->nb_tbs -= r->nb_tbs;
+    ctx->tb_evict_count += r->nb_tbs;
+    ctx->tb_region_evict_count++;
+    ctx->tb_invalidated_flag = 1;
+
+    r->nb_tbs = 0;
+    r->code_end = r->code_start;
+}
+
+static inline bool tb_region_full(TBRegion *r)
+{
+    return r->nb_tbs >= r->max_tbs || tcg_ctx.code_gen_ptr >= r->code_max;
+}
+
+/* Move on to the next region of the translation buffer, evicting its
+   TBs (the oldest ones).  */
+static void tb_region_next(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+
+    ctx->regions[ctx->current_region].code_end = tcg_ctx.code_gen_ptr;
+    ctx->current_region = (ctx->current_region + 1) % ctx->nb_regions;
+    tb_region_evict(ctx->current_region);
+    tcg_ctx.code_gen_ptr = ctx->regions[ctx->current_region].code_start;
+}
+
+/* Allocate a new translation block. When the current region is full
+   move on to the next one, evicting its TBs.  With a single region, or
+   when the other vCPU threads may be running the code to evict, return
+   NULL and let the caller flush or evict (see tb_gen_code).  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &ctx->regions[ctx->current_region];
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks ||
-        (tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
-         tcg_ctx.code_gen_buffer_max_size) {
-        return NULL;
+    if (tb_region_full(r)) {
+        if (ctx->nb_regions == 1 || parallel_cpus) {
+            return NULL;
+        }
+        tb_region_next();
+        r = &ctx->regions[ctx->current_region];
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &ctx->tbs[r->first_tb + r->nb_tbs++];
+    ctx->nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
+    tb->exit_count[0] = 0;
+    tb->exit_count[1] = 0;
+    tb->trace = 0;
 
     tcgplugin_tb_alloc(tb);
 
@@ -727,15 +969,18 @@ static TranslationBlock *tb_alloc(target_ulong pc)
 
 void tb_free(TranslationBlock *tb)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &ctx->regions[ctx->current_region];
+
 	tcgplugin_tb_free(tb);
 
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == &ctx->tbs[r->first_tb + r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
-        tcg_ctx.tb_ctx.nb_tbs--;
+        r->nb_tbs--;
+        ctx->nb_tbs--;
     }
 }
 
@@ -781,11 +1026,11 @@ static void page_flush_tb(void)
     }
 }
 
-/* flush all the translation blocks */
-/* XXX: tb_flush is currently not thread safe */
-void tb_flush(CPUArchState *env1)
+/* flush all the translation blocks, no vCPU may be running their code */
+static void tb_do_flush(CPUArchState *env1)
 {
     CPUState *cpu = ENV_GET_CPU(env1);
+    int i;
 
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
@@ -802,12 +1047,19 @@ void tb_flush(CPUArchState *env1)
     tcgplugin_tb_flush(&tcg_ctx, env1);
 
     tcg_ctx.tb_ctx.nb_tbs = 0;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+        r->nb_tbs = 0;
+        r->code_end = r->code_start;
+    }
+    tcg_ctx.tb_ctx.current_region = 0;
 
     CPU_FOREACH(cpu) {
         memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
     }
 
-    memset(tcg_ctx.tb_ctx.tb_phys_hash, 0, sizeof(tcg_ctx.tb_ctx.tb_phys_hash));
+    qht_reset(&tcg_ctx.tb_ctx.htable);
     page_flush_tb();
 
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
@@ -816,61 +1068,120 @@ void tb_flush(CPUArchState *env1)
     tcg_ctx.tb_ctx.tb_flush_count++;
 }
 
-#ifdef DEBUG_TB_CHECK
+#if !defined(CONFIG_USER_ONLY)
+/* Work that a vCPU thread can only do once the other vCPUs are out of
+   the generated code, see tb_run_deferred_work().  */
+#define TB_WORK_ALLOC   1   /* the current region is full */
+#define TB_WORK_FLUSH   2   /* tb_flush() was called by a vCPU */
 
-static void tb_invalidate_check(target_ulong address)
+static int tb_deferred_work;
+
+/* Called by the vCPU threads out of cpu_exec, with the iothread lock
+   held, when the vCPUs run in parallel.  */
+void tb_run_deferred_work(CPUArchState *env)
 {
-    TranslationBlock *tb;
-    int i;
+    int work;
 
-    address &= TARGET_PAGE_MASK;
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tb_ctx.tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
-            if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
-                  address >= tb->pc + tb->size)) {
-                printf("ERROR invalidate: address=" TARGET_FMT_lx
-                       " PC=%08lx size=%04x\n",
-                       address, (long)tb->pc, tb->size);
-            }
+    if (!atomic_read(&tb_deferred_work)) {
+        return;
+    }
+
+    qemu_tcg_start_exclusive();
+    tb_lock();
+    work = atomic_xchg(&tb_deferred_work, 0);
+    if (work & TB_WORK_FLUSH) {
+        tb_do_flush(env);
+    } else if ((work & TB_WORK_ALLOC) &&
+               tb_region_full(&tcg_ctx.tb_ctx.regions[
+                                  tcg_ctx.tb_ctx.current_region])) {
+        /* another vCPU may have made room meanwhile */
+        if (tcg_ctx.tb_ctx.nb_regions == 1) {
+            tb_do_flush(env);
+        } else {
+            tb_region_next();
         }
     }
+    tb_unlock();
+    qemu_tcg_end_exclusive();
 }
+#endif
 
-/* verify that all the pages have correct rights for code */
-static void tb_page_check(void)
+/* flush all the translation blocks, return false if the flush is
+   deferred.
+
+   With -tcg-threads multi, a vCPU thread can't wait for the other vCPUs
+   to leave the generated code (see tb_run_deferred_work), so the flush
+   is only recorded: the current vCPU leaves cpu_exec at the end of its
+   current block and doesn't execute another one before the flush, done
+   in an exclusive section by the first vCPU thread out of cpu_exec.
+   Until then, the other vCPUs may still execute the blocks translated
+   before the call, and the buffer is not empty: a caller that relies on
+   either must check the return value.  Otherwise, and in the other
+   threads, the buffer is empty on return.  */
+bool tb_flush(CPUArchState *env1)
 {
-    TranslationBlock *tb;
-    int i, flags1, flags2;
-
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
-                tb = tb->phys_hash_next) {
-            flags1 = page_get_flags(tb->pc);
-            flags2 = page_get_flags(tb->pc + tb->size - 1);
-            if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
-                printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
-                       (long)tb->pc, tb->size, flags1, flags2);
-            }
+#if !defined(CONFIG_USER_ONLY)
+    if (parallel_cpus) {
+        if (current_cpu) {
+            atomic_or(&tb_deferred_work, TB_WORK_FLUSH);
+            cpu_exit(current_cpu);
+            return false;
         }
+        qemu_tcg_start_exclusive();
+        tb_lock();
+        tb_do_flush(env1);
+        tb_unlock();
+        qemu_tcg_end_exclusive();
+        return true;
     }
+#endif
+    tb_do_flush(env1);
+    return true;
 }
 
-#endif
+#ifdef DEBUG_TB_CHECK
 
-static inline void tb_hash_remove(TranslationBlock **ptb, TranslationBlock *tb)
+static void do_tb_invalidate_check(QHT *ht, void *p, uint32_t hash,
+                                   void *userp)
 {
-    TranslationBlock *tb1;
+    TranslationBlock *tb = p;
+    target_ulong address = *(target_ulong *)userp;
 
-    for (;;) {
-        tb1 = *ptb;
-        if (tb1 == tb) {
-            *ptb = tb1->phys_hash_next;
-            break;
-        }
-        ptb = &tb1->phys_hash_next;
+    if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
+          address >= tb->pc + tb->size)) {
+        printf("ERROR invalidate: address=" TARGET_FMT_lx
+               " PC=%08lx size=%04x\n",
+               address, (long)tb->pc, tb->size);
+    }
+}
+
+static void tb_invalidate_check(target_ulong address)
+{
+    address &= TARGET_PAGE_MASK;
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_invalidate_check, &address);
+}
+
+static void do_tb_page_check(QHT *ht, void *p, uint32_t hash, void *userp)
+{
+    TranslationBlock *tb = p;
+    int flags1, flags2;
+
+    flags1 = page_get_flags(tb->pc);
+    flags2 = page_get_flags(tb->pc + tb->size - 1);
+    if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
+        printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
+               (long)tb->pc, tb->size, flags1, flags2);
     }
 }
 
+/* verify that all the pages have correct rights for code */
+static void tb_page_check(void)
+{
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_page_check, NULL);
+}
+
+#endif
+
 static inline void tb_page_remove(TranslationBlock **ptb, TranslationBlock *tb)
 {
     TranslationBlock *tb1;
@@ -924,8 +1235,9 @@ static inline void tb_reset_jump(TranslationBlock *tb, int n)
     tb_set_jmp_target(tb, n, (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[n]));
 }
 
-/* invalidate one TB */
-void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+/* invalidate one TB, unless it already is */
+static void tb_phys_invalidate_1(TranslationBlock *tb,
+                                 tb_page_addr_t page_addr)
 {
     CPUState *cpu;
     PageDesc *p;
@@ -933,10 +1245,14 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     tb_page_addr_t phys_pc;
     TranslationBlock *tb1, *tb2;
 
-    /* remove the TB from the hash list */
+    if (tb->page_addr[0] == -1) {
+        return;
+    }
+
+    /* remove the TB from the hash table */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
-    tb_hash_remove(&tcg_ctx.tb_ctx.tb_phys_hash[h], tb);
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
+    qht_remove(&tcg_ctx.tb_ctx.htable, tb, h);
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -955,8 +1271,8 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
     CPU_FOREACH(cpu) {
-        if (cpu->tb_jmp_cache[h] == tb) {
-            cpu->tb_jmp_cache[h] = NULL;
+        if (atomic_read(&cpu->tb_jmp_cache[h]) == tb) {
+            atomic_set(&cpu->tb_jmp_cache[h], NULL);
         }
     }
 
@@ -979,6 +1295,13 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
     tb->jmp_first = (TranslationBlock *)((uintptr_t)tb | 2); /* fail safe */
 
+    /* so that evicting its region doesn't invalidate it again */
+    tb->page_addr[0] = -1;
+}
+
+void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+{
+    tb_phys_invalidate_1(tb, page_addr);
     tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
 }
 
@@ -1038,6 +1361,19 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
+/* Name the host code of "tb" after its guest function, for perf.  */
+static void tb_perf_report(TranslationBlock *tb, int code_size)
+{
+    const char *symbol = lookup_symbol(tb->pc);
+    char name[32];
+
+    if (!*symbol) {
+        snprintf(name, sizeof(name), "guest-0x" TARGET_FMT_lx, tb->pc);
+        symbol = name;
+    }
+    tcg_perf_report_code(tb->tc_ptr, code_size, symbol);
+}
+
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               int flags, int cflags)
@@ -1051,7 +1387,17 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     phys_pc = get_page_addr_code(env, pc);
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
+#if !defined(CONFIG_USER_ONLY)
+        if (parallel_cpus) {
+            /* The other vCPUs must leave the generated code before it
+               is evicted: do it from the vCPU thread, out of cpu_exec.  */
+            atomic_or(&tb_deferred_work, TB_WORK_ALLOC);
+            cpu->exception_index = EXCP_INTERRUPT;
+            cpu_loop_exit(cpu);
+        }
+#endif
+        /* flush must be done, immediately since the vCPUs don't run in
+           parallel here */
         tb_flush(env);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
@@ -1062,9 +1408,21 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+#if !defined(CONFIG_USER_ONLY)
+    if (!tb_cache_load(cpu, tb, phys_pc, &code_gen_size)) {
+        cpu_gen_code(env, tb, &code_gen_size);
+        tb_cache_save(cpu, tb, phys_pc, code_gen_size);
+    }
+#else
     cpu_gen_code(env, tb, &code_gen_size);
+#endif
+    if (tcg_perf_enabled) {
+        tb_perf_report(tb, code_gen_size);
+    }
     tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
             code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
+    tcg_ctx.tb_ctx.tb_gen_count++;
+    tcg_ctx.tb_ctx.tb_gen_target_size += tb->size;
 
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
@@ -1100,8 +1458,9 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end,
  * access: the virtual CPU will exit the current TB if code is modified inside
  * this TB.
  */
-void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
-                                   int is_cpu_write_access)
+static void tb_invalidate_phys_page_range__locked(tb_page_addr_t start,
+                                                  tb_page_addr_t end,
+                                                  int is_cpu_write_access)
 {
     TranslationBlock *tb, *tb_next, *saved_tb;
     CPUState *cpu = current_cpu;
@@ -1216,6 +1575,14 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
 #endif
 }
 
+void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
+                                   int is_cpu_write_access)
+{
+    tb_lock();
+    tb_invalidate_phys_page_range__locked(start, end, is_cpu_write_access);
+    tb_unlock();
+}
+
 /* len must be <= 8 and start must be a multiple of len */
 void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
 {
@@ -1231,9 +1598,10 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
                   (intptr_t)cpu_single_env->segs[R_CS].base);
     }
 #endif
+    tb_lock();
     p = page_find(start >> TARGET_PAGE_BITS);
     if (!p) {
-        return;
+        goto out;
     }
     if (p->code_bitmap) {
         offset = start & ~TARGET_PAGE_MASK;
@@ -1243,8 +1611,10 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
         }
     } else {
     do_invalidate:
-        tb_invalidate_phys_page_range(start, start + len, 1);
+        tb_invalidate_phys_page_range__locked(start, start + len, 1);
     }
+ out:
+    tb_unlock();
 }
 
 #if !defined(CONFIG_SOFTMMU)
@@ -1381,17 +1751,11 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
 {
-    unsigned int h;
-    TranslationBlock **ptb;
+    uint32_t h;
 
     /* Grab the mmap lock to stop another thread invalidating this TB
        before we are done.  */
     mmap_lock();
-    /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
-    ptb = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tb->phys_hash_next = *ptb;
-    *ptb = tb;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1413,30 +1777,48 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
         tb_reset_jump(tb, 1);
     }
 
+    /* add in the hash table last, lookups don't take the mmap lock */
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
+    qht_insert(&tcg_ctx.tb_ctx.htable, tb, h);
+
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
     mmap_unlock();
 }
 
+/* end of the generated code of region "i" */
+static void *tb_region_code_end(int i)
+{
+    if (i == tcg_ctx.tb_ctx.current_region) {
+        return tcg_ctx.code_gen_ptr;
+    }
+    return tcg_ctx.tb_ctx.regions[i].code_end;
+}
+
 /* find the TB 'tb' such that tb[0].tc_ptr <= tc_ptr <
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
+    TBRegion *r = NULL;
     int m_min, m_max, m;
     uintptr_t v;
     TranslationBlock *tb;
+    int i;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
-        return NULL;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        if (tc_ptr >= (uintptr_t)tcg_ctx.tb_ctx.regions[i].code_start &&
+            tc_ptr < (uintptr_t)tb_region_code_end(i)) {
+            r = &tcg_ctx.tb_ctx.regions[i];
+            break;
+        }
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    if (r == NULL || r->nb_tbs <= 0) {
         return NULL;
     }
     /* binary search (cf Knuth) */
-    m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_min = r->first_tb;
+    m_max = r->first_tb + r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
         tb = &tcg_ctx.tb_ctx.tbs[m];
@@ -1474,6 +1856,7 @@ void tb_check_watchpoint(CPUState *cpu)
 {
     TranslationBlock *tb;
 
+    tb_lock();
     tb = tb_find_pc(cpu->mem_io_pc);
     if (!tb) {
         cpu_abort(cpu, "check_watchpoint: could not find TB for pc=%p",
@@ -1481,6 +1864,7 @@ void tb_check_watchpoint(CPUState *cpu)
     }
     cpu_restore_state_from_tb(cpu, tb, cpu->mem_io_pc);
     tb_phys_invalidate(tb, -1);
+    tb_unlock();
 }
 
 #ifndef CONFIG_USER_ONLY
@@ -1594,8 +1978,10 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
 
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    ptrdiff_t code_size;
     TranslationBlock *tb;
 
     target_code_size = 0;
@@ -1603,55 +1989,60 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    code_size = 0;
+    for (i = 0; i < ctx->nb_regions; i++) {
+        TBRegion *r = &ctx->regions[i];
+
+        code_size += tb_region_code_end(i) - r->code_start;
+        for (j = r->first_tb; j < r->first_tb + r->nb_tbs; j++) {
+            tb = &ctx->tbs[j];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_buffer_max_size);
+                code_size, tcg_ctx.code_gen_buffer_max_size);
     cpu_fprintf(f, "TB count            %d/%d\n",
-            tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
+            ctx->nb_tbs, tcg_ctx.code_gen_max_blocks);
+    cpu_fprintf(f, "TB regions          %d (current %d)\n",
+                ctx->nb_regions, ctx->current_region);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
-            tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
-                    tcg_ctx.tb_ctx.nb_tbs : 0,
+            ctx->nb_tbs ? target_code_size / ctx->nb_tbs : 0,
             max_target_code_size);
     cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+            ctx->nb_tbs ? code_size / ctx->nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
-            tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
-                                    tcg_ctx.tb_ctx.nb_tbs : 0);
+            ctx->nb_tbs ? (cross_page * 100) / ctx->nb_tbs : 0);
     cpu_fprintf(f, "direct jump count   %d (%d%%) (2 jumps=%d %d%%)\n",
                 direct_jmp_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0,
+                ctx->nb_tbs ? (direct_jmp_count * 100) / ctx->nb_tbs : 0,
                 direct_jmp2_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0);
+                ctx->nb_tbs ? (direct_jmp2_count * 100) / ctx->nb_tbs : 0);
     cpu_fprintf(f, "\nStatistics:\n");
-    cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB flush count      %d\n", ctx->tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d (%" PRId64 " TBs)\n",
+                ctx->tb_region_evict_count, ctx->tb_evict_count);
+    cpu_fprintf(f, "TB translated       %" PRId64 " (%" PRId64
+                " target bytes)\n",
+                ctx->tb_gen_count, ctx->tb_gen_target_size);
     cpu_fprintf(f, "TB invalidate count %d\n",
-            tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+            ctx->tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    dump_tlb_info(f, cpu_fprintf, NULL);
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -0,0 +1,398 @@
+/*
+ * Persistent translation cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+/* With -tb-cache, the code generated for the TBs is saved to a file and
+ * copied back to the translation buffer by the next runs, instead of
+ * translating the same guest code again.
+ *
+ * 1. The file starts with a description of the configuration: the QEMU
+ *    binary, the address of its code and of the prologue, the CPU model,
+ *    icount... (tb_cache_header).  The generated code is only valid for
+ *    the same configuration, the file is replaced otherwise.
+ * 2. Each record holds the key of a TB, its guest code, its host code and
+ *    the offsets of the pointers to the TB in the host code.  A record is
+ *    only used if the guest code in memory is still the same, so that the
+ *    cache survives self-modifying code and changes of the guest image.
+ *    Once copied, the TB is linked to its page and invalidated by the
+ *    writes to it as usual.
+ * 3. For the code to work at another address, it is generated relocatable
+ *    (TCGContext.code_gen_relocatable): the backend only uses absolute
+ *    addresses for the helpers and the prologue, and records the pointers
+ *    to the TB.  The TBs holding other host pointers (tcg_const_ptr),
+ *    spanning two pages or translated for the debugger are not saved.
+ * 4. Several QEMU processes may share the file: it is mapped read-only at
+ *    startup, and the new records are appended at exit under an flock.
+ *    A file being replaced is renamed over, never truncated.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "config.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/ram_addr.h"
+#include "exec/translate-cache.h"
+#include "qemu/notify.h"
+#include "sysemu/sysemu.h"
+#include "tcg.h"
+
+#define TB_CACHE_MAGIC "QEMUTBC1"
+
+/* Append the new records to the file once they take this much memory.  */
+#define TB_CACHE_PENDING_MAX (1024 * 1024)
+
+typedef struct TBCacheRecord {
+    uint64_t phys_pc;
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint32_t cflags;
+    uint32_t icount;
+    uint16_t size;              /* of the guest code */
+    uint16_t code_size;         /* of the host code */
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    uint16_t nb_relocs;
+    uint16_t pad;
+    /* followed by the relocations, the guest code and the host code */
+} TBCacheRecord;
+
+typedef struct TBCacheReloc {
+    uint16_t offset;            /* of the pointer in the host code */
+    uint16_t addend;            /* to the address of the TB */
+} TBCacheReloc;
+
+static char *tb_cache_path;
+static GByteArray *tb_cache_header;
+/* the records of the mapped file, by TB key */
+static GHashTable *tb_cache_index;
+/* the records not appended to the file yet, protected by tb_lock */
+static GByteArray *tb_cache_pending;
+static Notifier tb_cache_exit_notifier;
+
+static inline const TBCacheReloc *tb_cache_relocs(const TBCacheRecord *r)
+{
+    return (const TBCacheReloc *)(r + 1);
+}
+
+static inline const uint8_t *tb_cache_guest_code(const TBCacheRecord *r)
+{
+    return (const uint8_t *)(tb_cache_relocs(r) + r->nb_relocs);
+}
+
+static inline const uint8_t *tb_cache_host_code(const TBCacheRecord *r)
+{
+    return tb_cache_guest_code(r) + r->size;
+}
+
+static inline size_t tb_cache_record_size(const TBCacheRecord *r)
+{
+    size_t size = sizeof(*r) + r->nb_relocs * sizeof(TBCacheReloc) +
+                  r->size + r->code_size;
+
+    return (size + 7) & ~(size_t)7;
+}
+
+static guint tb_cache_hash(gconstpointer p)
+{
+    const TBCacheRecord *r = p;
+
+    return tb_hash_func(r->phys_pc, r->pc, r->flags, r->cs_base);
+}
+
+static gboolean tb_cache_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheRecord *ra = a;
+    const TBCacheRecord *rb = b;
+
+    return ra->phys_pc == rb->phys_pc && ra->pc == rb->pc &&
+           ra->cs_base == rb->cs_base && ra->flags == rb->flags &&
+           ra->cflags == rb->cflags;
+}
+
+static bool tb_cache_record_valid(const TBCacheRecord *r)
+{
+    const TBCacheReloc *relocs = tb_cache_relocs(r);
+    int i;
+
+    if (r->size == 0 || r->size > TARGET_PAGE_SIZE ||
+        r->nb_relocs > TCG_MAX_TB_RELOCS) {
+        return false;
+    }
+    for (i = 0; i < 2; i++) {
+        if ((r->tb_next_offset[i] != 0xffff &&
+             r->tb_next_offset[i] > r->code_size) ||
+            (r->tb_jmp_offset[i] != 0xffff &&
+             r->tb_jmp_offset[i] + 4 > r->code_size)) {
+            return false;
+        }
+    }
+    for (i = 0; i < r->nb_relocs; i++) {
+        if (relocs[i].offset + sizeof(uint64_t) > r->code_size ||
+            relocs[i].addend > TB_EXIT_MASK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* TBs translated for the debugger differ, and must not be shared.  */
+static inline bool tb_cache_skip(CPUState *cpu)
+{
+    return cpu->singlestep_enabled || !QTAILQ_EMPTY(&cpu->breakpoints);
+}
+
+/* Map the file and index its records.  Return false if it must be
+   replaced: missing, generated for another configuration, or damaged by
+   a QEMU killed while appending to it.  */
+static bool tb_cache_map(void)
+{
+    struct stat st;
+    uint8_t *buf;
+    size_t pos, len;
+    int fd;
+
+    fd = qemu_open(tb_cache_path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < tb_cache_header->len) {
+        close(fd);
+        return false;
+    }
+    len = st.st_size;
+    buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        return false;
+    }
+    if (memcmp(buf, tb_cache_header->data, tb_cache_header->len)) {
+        munmap(buf, len);
+        return false;
+    }
+
+    for (pos = tb_cache_header->len; pos < len;) {
+        const TBCacheRecord *r = (const TBCacheRecord *)(buf + pos);
+
+        if (len - pos < sizeof(*r) || len - pos < tb_cache_record_size(r) ||
+            !tb_cache_record_valid(r)) {
+            g_hash_table_remove_all(tb_cache_index);
+            munmap(buf, len);
+            return false;
+        }
+        /* the last record of a TB wins */
+        g_hash_table_replace(tb_cache_index, (gpointer)r, (gpointer)r);
+        pos += tb_cache_record_size(r);
+    }
+    return true;
+}
+
+/* Replace the file with an empty one for this configuration.  The other
+   QEMU processes keep the one they mapped.  */
+static void tb_cache_create(void)
+{
+    char *tmp = g_strdup_printf("%s.XXXXXX", tb_cache_path);
+    int fd = g_mkstemp(tmp);
+
+    if (fd < 0 ||
+        qemu_write_full(fd, tb_cache_header->data, tb_cache_header->len) !=
+        tb_cache_header->len ||
+        rename(tmp, tb_cache_path) < 0) {
+        fprintf(stderr, "-tb-cache: can't create %s: %s\n", tb_cache_path,
+                strerror(errno));
+        exit(1);
+    }
+    close(fd);
+    g_free(tmp);
+}
+
+/* Append the pending records, unless another configuration replaced the
+   file meanwhile.  Called with tb_lock held.  */
+static void tb_cache_flush(void)
+{
+    uint8_t *header;
+    int fd;
+
+    if (!tb_cache_pending->len) {
+        return;
+    }
+
+    fd = qemu_open(tb_cache_path, O_RDWR | O_APPEND);
+    if (fd >= 0) {
+        header = g_malloc(tb_cache_header->len);
+        if (flock(fd, LOCK_EX) == 0 &&
+            pread(fd, header, tb_cache_header->len, 0) ==
+            tb_cache_header->len &&
+            !memcmp(header, tb_cache_header->data, tb_cache_header->len)) {
+            qemu_write_full(fd, tb_cache_pending->data,
+                            tb_cache_pending->len);
+        }
+        g_free(header);
+        close(fd);
+    }
+    g_byte_array_set_size(tb_cache_pending, 0);
+}
+
+static void tb_cache_exit(Notifier *n, void *data)
+{
+    tb_lock();
+    tb_cache_flush();
+    tb_unlock();
+}
+
+void tb_cache_init(const char *path, const char *config)
+{
+#ifdef TCG_TARGET_TB_CACHE
+    struct stat st;
+    char *desc;
+    uint32_t len[2];
+
+    /* The generated code calls the helpers of this very binary.  */
+    if (stat("/proc/self/exe", &st) < 0) {
+        fprintf(stderr, "-tb-cache: can't identify the QEMU binary: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+    desc = g_strdup_printf("%s %s %s dev=%ju ino=%ju size=%jd mtime=%jd "
+                           "text=%p prologue=%p icount=%d threads=%d "
+                           "singlestep=%d",
+                           QEMU_VERSION, TARGET_NAME, config,
+                           (uintmax_t)st.st_dev, (uintmax_t)st.st_ino,
+                           (intmax_t)st.st_size, (intmax_t)st.st_mtime,
+                           (void *)tcg_exec_init, tcg_ctx.code_gen_prologue,
+                           use_icount, parallel_cpus, singlestep);
+
+    len[0] = strlen(desc);
+    len[1] = 0;
+    tb_cache_header = g_byte_array_new();
+    g_byte_array_append(tb_cache_header, (const guint8 *)TB_CACHE_MAGIC, 8);
+    g_byte_array_append(tb_cache_header, (const guint8 *)len, sizeof(len));
+    g_byte_array_append(tb_cache_header, (const guint8 *)desc, len[0]);
+    g_byte_array_set_size(tb_cache_header, (tb_cache_header->len + 7) & ~7);
+    g_free(desc);
+
+    tb_cache_path = g_strdup(path);
+    tb_cache_index = g_hash_table_new(tb_cache_hash, tb_cache_equal);
+    tb_cache_pending = g_byte_array_new();
+    if (!tb_cache_map()) {
+        tb_cache_create();
+    }
+
+    tcg_ctx.code_gen_relocatable = true;
+    tb_cache_exit_notifier.notify = tb_cache_exit;
+    qemu_add_exit_notifier(&tb_cache_exit_notifier);
+#else
+    fprintf(stderr, "-tb-cache is not supported on this host\n");
+    exit(1);
+#endif
+}
+
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, int *code_size)
+{
+    TBCacheRecord key;
+    const TBCacheRecord *r;
+    const TBCacheReloc *relocs;
+    uint8_t *code = tb->tc_ptr;
+    int i;
+
+    if (!tb_cache_index || tb_cache_skip(cpu)) {
+        return false;
+    }
+
+    key.phys_pc = phys_pc;
+    key.pc = tb->pc;
+    key.cs_base = tb->cs_base;
+    key.flags = tb->flags;
+    key.cflags = tb->cflags;
+    r = g_hash_table_lookup(tb_cache_index, &key);
+    if (!r || (tb->pc & ~TARGET_PAGE_MASK) + r->size > TARGET_PAGE_SIZE ||
+        memcmp(qemu_get_ram_ptr(phys_pc), tb_cache_guest_code(r), r->size)) {
+        return false;
+    }
+
+    memcpy(code, tb_cache_host_code(r), r->code_size);
+    relocs = tb_cache_relocs(r);
+    for (i = 0; i < r->nb_relocs; i++) {
+        uint64_t ptr = (uintptr_t)tb + relocs[i].addend;
+
+        memcpy(code + relocs[i].offset, &ptr, sizeof(ptr));
+    }
+    flush_icache_range((uintptr_t)code, (uintptr_t)code + r->code_size);
+
+    tb->size = r->size;
+    tb->icount = r->icount;
+    tb->tb_next_offset[0] = r->tb_next_offset[0];
+    tb->tb_next_offset[1] = r->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    tb->tb_jmp_offset[0] = r->tb_jmp_offset[0];
+    tb->tb_jmp_offset[1] = r->tb_jmp_offset[1];
+#endif
+    *code_size = r->code_size;
+    return true;
+}
+
+void tb_cache_save(CPUState *cpu, TranslationBlock *tb,
+                   tb_page_addr_t phys_pc, int code_size)
+{
+    TCGContext *s = &tcg_ctx;
+    TBCacheRecord r;
+    TBCacheReloc relocs[TCG_MAX_TB_RELOCS];
+    int i;
+
+    /* The superblocks depend on the profile of the cold TBs
+       (tb_trace_branch): they are formed again by each run.  */
+    if (!s->code_gen_relocatable || s->code_gen_host_ptr ||
+        (tb->cflags & CF_SUPERBLOCK) ||
+        tb_cache_skip(cpu) || code_size > UINT16_MAX ||
+        (tb->pc & ~TARGET_PAGE_MASK) + tb->size > TARGET_PAGE_SIZE) {
+        return;
+    }
+    for (i = 0; i < s->nb_tb_relocs; i++) {
+        uint64_t ptr;
+
+        memcpy(&ptr, (uint8_t *)tb->tc_ptr + s->tb_relocs[i], sizeof(ptr));
+        if (ptr - (uintptr_t)tb > TB_EXIT_MASK) {
+            return;
+        }
+        relocs[i].offset = s->tb_relocs[i];
+        relocs[i].addend = ptr - (uintptr_t)tb;
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.phys_pc = phys_pc;
+    r.pc = tb->pc;
+    r.cs_base = tb->cs_base;
+    r.flags = tb->flags;
+    r.cflags = tb->cflags;
+    r.icount = tb->icount;
+    r.size = tb->size;
+    r.code_size = code_size;
+    r.tb_next_offset[0] = tb->tb_next_offset[0];
+    r.tb_next_offset[1] = tb->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    r.tb_jmp_offset[0] = tb->tb_jmp_offset[0];
+    r.tb_jmp_offset[1] = tb->tb_jmp_offset[1];
+#else
+    r.tb_jmp_offset[0] = 0xffff;
+    r.tb_jmp_offset[1] = 0xffff;
+#endif
+    r.nb_relocs = s->nb_tb_relocs;
+
+    g_byte_array_append(tb_cache_pending, (const guint8 *)&r, sizeof(r));
+    g_byte_array_append(tb_cache_pending, (const guint8 *)relocs,
+                        r.nb_relocs * sizeof(TBCacheReloc));
+    g_byte_array_append(tb_cache_pending, qemu_get_ram_ptr(phys_pc), r.size);
+    g_byte_array_append(tb_cache_pending, tb->tc_ptr, r.code_size);
+    g_byte_array_set_size(tb_cache_pending,
+                          (tb_cache_pending->len + 7) & ~7);
+
+    if (tb_cache_pending->len >= TB_CACHE_PENDING_MAX) {
+        tb_cache_flush();
+    }
+}
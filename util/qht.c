@@ -0,0 +1,406 @@
+/*
+ * QHT: resizable hash table with lock-free lookups
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include <assert.h>
+#include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qemu/seqlock.h"
+#include "qemu/qht.h"
+
+/* The entries of a chain of buckets are packed: the first NULL pointer
+ * ends the chain.  The seqlock of the head bucket covers the whole
+ * chain, it has no mutex since the writers hold QHT.lock.
+ */
+#define QHT_BUCKET_ENTRIES 4
+
+typedef struct QHTBucket QHTBucket;
+
+struct QHTBucket {
+    QemuSeqLock sequence;
+    uint32_t hashes[QHT_BUCKET_ENTRIES];
+    void *pointers[QHT_BUCKET_ENTRIES];
+    QHTBucket *next;
+};
+
+struct QHTMap {
+    QHTBucket *buckets;
+    size_t n_buckets;
+    /* chained buckets, allocated when a bucket overflows */
+    size_t n_added_buckets;
+    /* maps replaced by a resize, see qht.h */
+    QHTMap *retired;
+};
+
+/* Grow the table once the chained buckets are 1/8 of the buckets.  */
+static inline bool qht_map_needs_resize(const QHTMap *map)
+{
+    return map->n_added_buckets > map->n_buckets / 8;
+}
+
+static size_t qht_elems_to_buckets(size_t n_elems)
+{
+    size_t n = 1;
+
+    while (n * QHT_BUCKET_ENTRIES < n_elems) {
+        n <<= 1;
+    }
+    return n;
+}
+
+static inline QHTBucket *qht_map_to_bucket(QHTMap *map, uint32_t hash)
+{
+    return &map->buckets[hash & (map->n_buckets - 1)];
+}
+
+static QHTMap *qht_map_create(size_t n_buckets)
+{
+    QHTMap *map = g_new0(QHTMap, 1);
+    size_t i;
+
+    map->n_buckets = n_buckets;
+    map->buckets = g_new0(QHTBucket, n_buckets);
+    for (i = 0; i < n_buckets; i++) {
+        seqlock_init(&map->buckets[i].sequence, NULL);
+    }
+    return map;
+}
+
+static void qht_map_destroy(QHTMap *map)
+{
+    size_t i;
+
+    for (i = 0; i < map->n_buckets; i++) {
+        QHTBucket *b = map->buckets[i].next;
+
+        while (b) {
+            QHTBucket *next = b->next;
+
+            g_free(b);
+            b = next;
+        }
+    }
+    g_free(map->buckets);
+    g_free(map);
+}
+
+void qht_init(QHT *ht, size_t n_elems, unsigned int mode)
+{
+    ht->mode = mode;
+    qemu_mutex_init(&ht->lock);
+    ht->map = qht_map_create(qht_elems_to_buckets(n_elems));
+}
+
+void qht_destroy(QHT *ht)
+{
+    QHTMap *map = ht->map;
+
+    while (map) {
+        QHTMap *retired = map->retired;
+
+        qht_map_destroy(map);
+        map = retired;
+    }
+    ht->map = NULL;
+    qemu_mutex_destroy(&ht->lock);
+}
+
+static void *qht_do_lookup(QHTBucket *head, QHTLookupFunc func,
+                           const void *userp, uint32_t hash)
+{
+    QHTBucket *b = head;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            void *p = atomic_read(&b->pointers[i]);
+
+            if (p == NULL) {
+                return NULL;
+            }
+            if (atomic_read(&b->hashes[i]) == hash && func(p, userp)) {
+                return p;
+            }
+        }
+        b = atomic_read(&b->next);
+        smp_read_barrier_depends();
+    } while (b);
+
+    return NULL;
+}
+
+void *qht_lookup(QHT *ht, QHTLookupFunc func, const void *userp,
+                 uint32_t hash)
+{
+    QHTMap *map;
+    QHTBucket *b;
+    unsigned int version;
+    void *ret;
+
+    do {
+        map = atomic_read(&ht->map);
+        smp_read_barrier_depends();
+        b = qht_map_to_bucket(map, hash);
+
+        version = seqlock_read_begin(&b->sequence);
+        ret = qht_do_lookup(b, func, userp, hash);
+        /* also retry if a resize published a new map meanwhile */
+    } while (seqlock_read_retry(&b->sequence, version) ||
+             map != atomic_read(&ht->map));
+
+    return ret;
+}
+
+/* Called with ht->lock held, or on a map that isn't published yet.  */
+static bool qht_insert__locked(QHTMap *map, void *p, uint32_t hash)
+{
+    QHTBucket *head = qht_map_to_bucket(map, hash);
+    QHTBucket *b = head;
+    QHTBucket *prev = NULL;
+    QHTBucket *new = NULL;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i] == NULL) {
+                goto found;
+            }
+            if (b->pointers[i] == p) {
+                return false;
+            }
+        }
+        prev = b;
+        b = b->next;
+    } while (b);
+
+    /* The chain is full: fill a new bucket before linking it.  */
+    new = g_new0(QHTBucket, 1);
+    new->hashes[0] = hash;
+    new->pointers[0] = p;
+    map->n_added_buckets++;
+    smp_wmb();
+
+    seqlock_write_lock(&head->sequence);
+    atomic_set(&prev->next, new);
+    seqlock_write_unlock(&head->sequence);
+    return true;
+
+ found:
+    seqlock_write_lock(&head->sequence);
+    atomic_set(&b->hashes[i], hash);
+    atomic_set(&b->pointers[i], p);
+    seqlock_write_unlock(&head->sequence);
+    return true;
+}
+
+/* Move all the entries of the current map to a map of "n_buckets"
+   buckets, and publish it.  Called with ht->lock held.  */
+static void qht_do_resize(QHT *ht, size_t n_buckets)
+{
+    QHTMap *old = ht->map;
+    QHTMap *new = qht_map_create(n_buckets);
+    size_t i;
+    int j;
+
+    for (i = 0; i < old->n_buckets; i++) {
+        QHTBucket *b = &old->buckets[i];
+
+        do {
+            for (j = 0; j < QHT_BUCKET_ENTRIES && b->pointers[j]; j++) {
+                qht_insert__locked(new, b->pointers[j], b->hashes[j]);
+            }
+            b = b->next;
+        } while (b);
+    }
+
+    new->retired = old;
+    atomic_mb_set(&ht->map, new);
+}
+
+bool qht_insert(QHT *ht, void *p, uint32_t hash)
+{
+    QHTMap *map;
+    bool ret;
+
+    assert(p);
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    ret = qht_insert__locked(map, p, hash);
+    if (ret && (ht->mode & QHT_MODE_AUTO_RESIZE) &&
+        qht_map_needs_resize(map)) {
+        qht_do_resize(ht, map->n_buckets * 2);
+    }
+    qemu_mutex_unlock(&ht->lock);
+
+    return ret;
+}
+
+/* Fill the hole at b->pointers[pos] with the last entry of the chain,
+   so that the entries stay packed.  */
+static void qht_bucket_remove_entry(QHTBucket *b, int pos)
+{
+    QHTBucket *last_b = b;
+    int last_pos = pos;
+    QHTBucket *cur = b;
+    int i = pos + 1;
+
+    for (;;) {
+        if (i == QHT_BUCKET_ENTRIES) {
+            cur = cur->next;
+            i = 0;
+            if (cur == NULL) {
+                break;
+            }
+        }
+        if (cur->pointers[i] == NULL) {
+            break;
+        }
+        last_b = cur;
+        last_pos = i;
+        i++;
+    }
+
+    atomic_set(&b->hashes[pos], last_b->hashes[last_pos]);
+    atomic_set(&b->pointers[pos], last_b->pointers[last_pos]);
+    atomic_set(&last_b->pointers[last_pos], NULL);
+}
+
+bool qht_remove(QHT *ht, const void *p, uint32_t hash)
+{
+    QHTBucket *head;
+    QHTBucket *b;
+    int i;
+
+    qemu_mutex_lock(&ht->lock);
+    head = qht_map_to_bucket(ht->map, hash);
+    b = head;
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i] == NULL) {
+                goto out;
+            }
+            if (b->pointers[i] == p) {
+                assert(b->hashes[i] == hash);
+                seqlock_write_lock(&head->sequence);
+                qht_bucket_remove_entry(b, i);
+                seqlock_write_unlock(&head->sequence);
+                qemu_mutex_unlock(&ht->lock);
+                return true;
+            }
+        }
+        b = b->next;
+    } while (b);
+
+ out:
+    qemu_mutex_unlock(&ht->lock);
+    return false;
+}
+
+void qht_reset(QHT *ht)
+{
+    QHTMap *map;
+    size_t i;
+    int j;
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    for (i = 0; i < map->n_buckets; i++) {
+        QHTBucket *head = &map->buckets[i];
+        QHTBucket *b = head;
+
+        if (head->pointers[0] == NULL) {
+            continue;
+        }
+        /* The chained buckets are kept, lookups may be walking them.  */
+        seqlock_write_lock(&head->sequence);
+        do {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                atomic_set(&b->pointers[j], NULL);
+            }
+            b = b->next;
+        } while (b);
+        seqlock_write_unlock(&head->sequence);
+    }
+    qemu_mutex_unlock(&ht->lock);
+}
+
+bool qht_resize(QHT *ht, size_t n_elems)
+{
+    size_t n_buckets = qht_elems_to_buckets(n_elems);
+    bool ret = false;
+
+    qemu_mutex_lock(&ht->lock);
+    if (n_buckets != ht->map->n_buckets) {
+        qht_do_resize(ht, n_buckets);
+        ret = true;
+    }
+    qemu_mutex_unlock(&ht->lock);
+
+    return ret;
+}
+
+void qht_iter(QHT *ht, QHTIterFunc func, void *userp)
+{
+    QHTMap *map;
+    size_t i;
+    int j;
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    for (i = 0; i < map->n_buckets; i++) {
+        QHTBucket *b = &map->buckets[i];
+
+        do {
+            for (j = 0; j < QHT_BUCKET_ENTRIES && b->pointers[j]; j++) {
+                func(ht, b->pointers[j], b->hashes[j], userp);
+            }
+            b = b->next;
+        } while (b);
+    }
+    qemu_mutex_unlock(&ht->lock);
+}
+
+void qht_statistics(QHT *ht, QHTStats *stats)
+{
+    QHTMap *map;
+    size_t chains = 0;
+    size_t i;
+    int j;
+
+    memset(stats, 0, sizeof(*stats));
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    stats->head_buckets = map->n_buckets;
+    for (i = 0; i < map->n_buckets; i++) {
+        QHTBucket *b = &map->buckets[i];
+        size_t chain = 0;
+
+        if (b->pointers[0] == NULL) {
+            continue;
+        }
+        do {
+            chain++;
+            for (j = 0; j < QHT_BUCKET_ENTRIES && b->pointers[j]; j++) {
+                stats->entries++;
+            }
+            b = b->next;
+        } while (b && b->pointers[0]);
+
+        stats->used_head_buckets++;
+        chains += chain;
+        if (chain > stats->max_chain) {
+            stats->max_chain = chain;
+        }
+    }
+    qemu_mutex_unlock(&ht->lock);
+
+    if (stats->used_head_buckets) {
+        stats->avg_chain = (double)chains / stats->used_head_buckets;
+    }
+}
@@ -2912,6 +2912,10 @@ int main(int argc, char **argv, char **envp)
     int i;
     int snapshot, linux_boot;
     const char *icount_option = NULL;
+    const char *tcg_threads_option = NULL;
+    const char *tb_cache_path = NULL;
+    int tb_hot = 0;
+    bool perf_map = false, jitdump = false;
     const char *initrd_filename;
     const char *kernel_filename, *kernel_cmdline;
     const char *boot_order;
@@ -3833,9 +3837,35 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_tcg_threads:
+                tcg_threads_option = optarg;
+                break;
+            case QEMU_OPTION_tb_cache:
+                tb_cache_path = optarg;
+                break;
+            case QEMU_OPTION_tb_hot:
+                tb_hot = strtol(optarg, NULL, 0);
+                if (tb_hot <= 0) {
+                    fprintf(stderr, "-tb-hot: invalid threshold '%s'\n",
+                            optarg);
+                    exit(1);
+                }
+                break;
+            case QEMU_OPTION_perfmap:
+                perf_map = true;
+                break;
+            case QEMU_OPTION_jitdump:
+                jitdump = true;
+                break;
 #ifdef CONFIG_TCG_PLUGIN
             case QEMU_OPTION_tcg_plugin:
-                plugin_filename = optarg;
+                /* Several plugins can be loaded at the same time.  */
+                if (plugin_filename) {
+                    plugin_filename = g_strconcat(plugin_filename, ",",
+                                                  optarg, NULL);
+                } else {
+                    plugin_filename = optarg;
+                }
                 break;
 #endif /* CONFIG_TCG_PLUGIN */
             case QEMU_OPTION_icount:
@@ -4098,13 +4128,6 @@ int main(int argc, char **argv, char **envp)
         qemu_opts_set_defaults(qemu_find_opts("machine"),
                                machine_class->default_machine_opts, 0);
     }
-    
-#ifdef CONFIG_TCG_PLUGIN
-    plugin_filename = plugin_filename ?: getenv("TCG_PLUGIN");
-    if (plugin_filename) {
-        tcg_plugin_load(plugin_filename);
-    }
-#endif /* CONFIG_TCG_PLUGIN */
 
     qemu_opts_foreach(qemu_find_opts("device"), default_driver_check, NULL, 0);
     qemu_opts_foreach(qemu_find_opts("global"), default_driver_check, NULL, 0);
@@ -4334,6 +4357,33 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
     configure_icount(icount_option);
+    qemu_tcg_configure(tcg_threads_option);
+
+    if (tb_cache_path) {
+        char *config;
+
+        if (!tcg_enabled()) {
+            fprintf(stderr, "-tb-cache is only supported with TCG\n");
+            exit(1);
+        }
+#ifdef CONFIG_TCG_PLUGIN
+        /* The plugins instrument the code as they see it translated.  */
+        if (plugin_filename) {
+            fprintf(stderr, "-tb-cache is not supported with TCG plugins\n");
+            exit(1);
+        }
+#endif
+        config = g_strdup_printf("machine=%s cpu=%s", machine_class->name,
+                                 cpu_model ? cpu_model : "default");
+        tb_cache_init(tb_cache_path, config);
+        g_free(config);
+    }
+    if (tb_hot) {
+        tb_hot_init(tb_hot);
+    }
+    if (perf_map || jitdump) {
+        tcg_perf_init(perf_map, jitdump);
+    }
 
     /* clean up network at qemu process termination */
     atexit(&net_cleanup);